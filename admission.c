@@ -0,0 +1,236 @@
+#include "admission.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+static AdmissionAlgo algo = ADMISSION_OFF;
+static pthread_mutex_t adm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slot_free; // waits on CLOCK_MONOTONIC, set up by admission_init()
+static pthread_once_t slot_free_once = PTHREAD_ONCE_INIT;
+
+#define RTT_TOLERANCE 1.5 // gradient: window latency allowed over the baseline before shrinking
+#define AIMD_BACKOFF_RTT 2.0 // aimd: window latency over the baseline that counts as congestion
+
+static double limit = 32;
+static int max_limit = 256;
+static int limit_cap = 256; // --limiter-max; max_limit is this or the pool size, if smaller
+static long long queue_timeout_us = 20000;
+static int inflight;
+static int waiting;
+
+// Current window (under adm_lock)
+static long long window_start_us;
+static long long window_rtt_sum;
+static long long window_rtt_min;
+static int window_samples;
+static int window_saturated; // the limit was reached at some point
+static double base_rtt;      // best window latency, drifting up slowly, us
+
+static atomic_ullong admitted;
+static atomic_ullong shed_full;
+static atomic_ullong shed_timeout;
+
+// Deadlines and latencies must not jump with the wall clock
+static long long mono_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void slot_free_init(void)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&slot_free, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+int admission_parse(const char *name, AdmissionAlgo *out)
+{
+    if (strcmp(name, "off") == 0)
+        *out = ADMISSION_OFF;
+    else if (strcmp(name, "aimd") == 0)
+        *out = ADMISSION_AIMD;
+    else if (strcmp(name, "gradient") == 0)
+        *out = ADMISSION_GRADIENT;
+    else
+        return -1;
+    return 0;
+}
+
+const char *admission_name(AdmissionAlgo a)
+{
+    switch (a)
+    {
+    case ADMISSION_AIMD:
+        return "aimd";
+    case ADMISSION_GRADIENT:
+        return "gradient";
+    default:
+        return "off";
+    }
+}
+
+void admission_init(AdmissionAlgo a, int initial, int max, int queue_ms)
+{
+    pthread_once(&slot_free_once, slot_free_init);
+    pthread_mutex_lock(&adm_lock);
+    algo = a;
+    limit_cap = max;
+    max_limit = max > ADMISSION_MIN_LIMIT ? max : ADMISSION_MIN_LIMIT;
+    limit = initial < ADMISSION_MIN_LIMIT ? ADMISSION_MIN_LIMIT : initial > max_limit ? max_limit : initial;
+    queue_timeout_us = (long long)(queue_ms > 0 ? queue_ms : 1) * 1000;
+    inflight = waiting = 0;
+    window_start_us = mono_us();
+    window_rtt_sum = window_rtt_min = window_samples = window_saturated = 0;
+    base_rtt = 0;
+    pthread_mutex_unlock(&adm_lock);
+    atomic_store(&admitted, 0);
+    atomic_store(&shed_full, 0);
+    atomic_store(&shed_timeout, 0);
+}
+
+void admission_set_pool_size(int pool_max)
+{
+    pthread_mutex_lock(&adm_lock);
+    int max = limit_cap < pool_max ? limit_cap : pool_max;
+    max_limit = max > ADMISSION_MIN_LIMIT ? max : ADMISSION_MIN_LIMIT;
+    if (limit > max_limit)
+        limit = max_limit;
+    pthread_mutex_unlock(&adm_lock);
+}
+
+// Close the window and move the limit. Must hold adm_lock.
+static void adjust_locked(long long now)
+{
+    if (window_samples == 0)
+    {
+        window_start_us = now;
+        return;
+    }
+    double rtt = (double)window_rtt_sum / window_samples;
+    if (rtt < 1)
+        rtt = 1;
+    // The baseline is the uncongested DB time: the fastest request seen,
+    // drifting up slowly so it is re-learnt if the DB gets slower for good
+    double fastest = window_rtt_min < 1 ? 1 : window_rtt_min;
+    if (base_rtt == 0 || fastest < base_rtt)
+        base_rtt = fastest;
+    else
+        base_rtt += (fastest - base_rtt) * 0.01;
+
+    double next = limit;
+    if (algo == ADMISSION_AIMD)
+    {
+        if (rtt > AIMD_BACKOFF_RTT * base_rtt)
+            next = limit * 0.9;
+        else if (window_saturated)
+            next = limit + 1;
+    }
+    else
+    {
+        double gradient = RTT_TOLERANCE * base_rtt / rtt;
+        if (gradient > 1.0)
+            gradient = 1.0;
+        if (gradient < 0.5)
+            gradient = 0.5;
+        double target = limit * gradient + sqrt(limit);
+        // Only grow when the current limit is actually being used
+        if (target > limit && !window_saturated)
+            target = limit;
+        next = limit * 0.8 + target * 0.2;
+    }
+
+    if (next < ADMISSION_MIN_LIMIT)
+        next = ADMISSION_MIN_LIMIT;
+    if (next > max_limit)
+        next = max_limit;
+    // A higher limit lets queued requests in now
+    if ((int)next > (int)limit)
+        pthread_cond_broadcast(&slot_free);
+    limit = next;
+
+    window_start_us = now;
+    window_rtt_sum = window_rtt_min = window_samples = 0;
+    window_saturated = inflight >= (int)limit;
+}
+
+long long admission_enter(void)
+{
+    if (algo == ADMISSION_OFF)
+        return 0;
+
+    pthread_mutex_lock(&adm_lock);
+    long long now = mono_us();
+    if (inflight >= (int)limit)
+    {
+        window_saturated = 1;
+        if (waiting >= (int)limit)
+        {
+            pthread_mutex_unlock(&adm_lock);
+            atomic_fetch_add_explicit(&shed_full, 1, memory_order_relaxed);
+            return -1;
+        }
+
+        long long deadline = now + queue_timeout_us;
+        struct timespec until = {deadline / 1000000, (deadline % 1000000) * 1000};
+        waiting++;
+        while (inflight >= (int)limit && mono_us() < deadline)
+            pthread_cond_timedwait(&slot_free, &adm_lock, &until);
+        waiting--;
+        if (inflight >= (int)limit)
+        {
+            pthread_mutex_unlock(&adm_lock);
+            atomic_fetch_add_explicit(&shed_timeout, 1, memory_order_relaxed);
+            return -1;
+        }
+        now = mono_us();
+    }
+    inflight++;
+    pthread_mutex_unlock(&adm_lock);
+    atomic_fetch_add_explicit(&admitted, 1, memory_order_relaxed);
+    return now;
+}
+
+void admission_exit(long long token)
+{
+    if (token <= 0)
+        return;
+
+    long long now = mono_us();
+    pthread_mutex_lock(&adm_lock);
+    inflight--;
+    long long rtt = now - token;
+    window_rtt_sum += rtt;
+    if (window_samples == 0 || rtt < window_rtt_min)
+        window_rtt_min = rtt;
+    window_samples++;
+    if (now - window_start_us >= ADMISSION_WINDOW_MS * 1000LL)
+        adjust_locked(now);
+    if (waiting)
+        pthread_cond_signal(&slot_free);
+    pthread_mutex_unlock(&adm_lock);
+}
+
+void admission_render_metrics(MetricsBuf *b)
+{
+    if (algo == ADMISSION_OFF)
+        return;
+    pthread_mutex_lock(&adm_lock);
+    int lim = (int)limit, in = inflight, q = waiting;
+    pthread_mutex_unlock(&adm_lock);
+    mbuf_printf(b, "# TYPE leaderboard_admission_limit gauge\nleaderboard_admission_limit %d\n"
+                   "# TYPE leaderboard_admission_inflight gauge\nleaderboard_admission_inflight %d\n"
+                   "# TYPE leaderboard_admission_queued gauge\nleaderboard_admission_queued %d\n"
+                   "# TYPE leaderboard_admission_admitted_total counter\nleaderboard_admission_admitted_total %llu\n"
+                   "# TYPE leaderboard_admission_shed_total counter\n"
+                   "leaderboard_admission_shed_total{reason=\"queue_full\"} %llu\n"
+                   "leaderboard_admission_shed_total{reason=\"deadline\"} %llu\n",
+                lim, in, q, (unsigned long long)atomic_load(&admitted), (unsigned long long)atomic_load(&shed_full),
+                (unsigned long long)atomic_load(&shed_timeout));
+}
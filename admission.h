@@ -0,0 +1,54 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include "metrics.h"
+
+// Adaptive concurrency limit in front of the DB path (modes 0, 2, 3).
+//
+// At most `limit` requests hold a DB slot at once. A request that finds
+// the limit reached waits up to the queue deadline (and only while fewer
+// than `limit` others are waiting); otherwise it is shed and the handler
+// answers 503 with Retry-After. Requests answered from the caches never
+// pass through here.
+//
+// The limit follows the DB time of admitted requests, averaged per window
+// of ADMISSION_WINDOW_MS and compared with a baseline (the fastest request
+// seen, drifting up slowly):
+//   aimd      +1 while the limit is reached; x0.9 when a window takes more
+//             than twice the baseline
+//   gradient  limit * clamp(1.5 * baseline / window latency, 0.5, 1)
+//             + sqrt(limit) of headroom, smoothed (after Netflix's
+//             concurrency-limits Gradient)
+
+typedef enum
+{
+    ADMISSION_OFF,
+    ADMISSION_AIMD,
+    ADMISSION_GRADIENT,
+} AdmissionAlgo;
+
+#define ADMISSION_WINDOW_MS 100
+#define ADMISSION_MIN_LIMIT 2
+#define ADMISSION_RETRY_AFTER "1" // seconds
+
+// Returns 0 and sets *out for off|aimd|gradient
+int admission_parse(const char *name, AdmissionAlgo *out);
+const char *admission_name(AdmissionAlgo algo);
+
+// initial and max bound the limit; queue_ms is the per-request deadline
+void admission_init(AdmissionAlgo algo, int initial, int max_limit, int queue_ms);
+
+// The deadline only covers the wait for a slot and admitted requests wait
+// for a pool connection without one, so the limit never goes above the
+// pool size. Call after admission_init() and whenever pool_max changes.
+void admission_set_pool_size(int pool_max);
+
+// Take a DB slot. Returns a token for admission_exit(), or -1 if the
+// request was shed. Free (returns 0) when the limiter is off.
+long long admission_enter(void);
+void admission_exit(long long token);
+
+// Limit, queue and shed counters for GET /metrics
+void admission_render_metrics(MetricsBuf *b);
+
+#endif // ADMISSION_H
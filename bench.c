@@ -0,0 +1,393 @@
+/*
+Microbenchmarks
+Times the in-memory building blocks on their own, without HTTP, curl or
+Postgres: the LRU cache (cache_update / cache_get_score), the Top-N cache
+(topn_update / topn_get_top) and the leaderboard JSON builder.
+
+Build and run:
+make bench                          (writes bench.json)
+
+Usage:
+./microbench [--threads 1,2,4,8] [--sizes 1000,100000] [--keys N]
+             [--dists uniform,zipfian] [--skew THETA] [--ms N]
+             [--filter NAME] [--out PATH]
+
+Every case runs for --ms milliseconds (default 500) on each thread count.
+Results are printed as a table on stderr and as JSON on stdout (or --out),
+one object per case:
+  ns_per_op      wall time per operation on one thread (elapsed * threads / ops)
+  ops_per_sec    total operations per second over all threads
+  allocs_per_op  malloc/calloc/realloc calls per operation (counted with
+                 the linker's --wrap, so only calls from these objects)
+
+Key streams are generated before timing starts; zipfian makes id 1 the
+hottest, as in loadgen.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "cache.h"
+#include "topn.h"
+#include "json.h"
+#include "metrics.h"
+#include "workload.h"
+
+#define MAX_THREADS 64
+#define MAX_LIST 16
+#define OPS_PER_CHECK 256
+
+// ---------- Allocation counting ----------
+
+static __thread unsigned long long allocs;
+
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t n);
+
+void *__wrap_malloc(size_t n)
+{
+    allocs++;
+    return __real_malloc(n);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    allocs++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t n)
+{
+    allocs++;
+    return __real_realloc(p, n);
+}
+
+// ---------- Key streams ----------
+
+static const char *dist_names[] = {"uniform", "zipfian"};
+
+static WorkloadOpts opts = {.keys = 100000, .theta = 0.99};
+
+// ---------- Cases ----------
+
+typedef struct
+{
+    int keys[KEY_STREAM];
+    int scores[KEY_STREAM];
+    unsigned long long ops, allocs, hits;
+} Worker;
+
+typedef void (*BenchFn)(Worker *w, unsigned pos);
+
+static int json_count; // players per json_leaderboard call
+static int topn_limit; // players per topn_get_top call
+static Player json_players[TOP_N_SIZE];
+
+static void op_cache_update(Worker *w, unsigned pos)
+{
+    cache_update(w->keys[pos], w->scores[pos]);
+}
+
+static void op_cache_get(Worker *w, unsigned pos)
+{
+    w->hits += cache_get_score(w->keys[pos]) >= 0;
+}
+
+static void op_topn_update(Worker *w, unsigned pos)
+{
+    topn_update(w->keys[pos], w->scores[pos]);
+}
+
+static void op_topn_get(Worker *w, unsigned pos)
+{
+    Player out[TOP_N_SIZE];
+    w->hits += topn_get_top(out, topn_limit, TOPN_ALL) > 0;
+}
+
+static void op_json(Worker *w, unsigned pos)
+{
+    char buf[8192];
+    w->hits += json_leaderboard(buf, sizeof(buf), json_players, json_count) > 0;
+}
+
+// ---------- Thread pool ----------
+
+static Worker *workers;
+static int pool_threads;
+static WorkloadPool pool;
+static BenchFn current_fn;
+static int active_threads;
+
+static void worker_run(void *arg, int index)
+{
+    Worker *w = arg;
+    if (index >= active_threads)
+        return;
+    BenchFn fn = current_fn;
+    unsigned pos = workload_stream_start(index);
+    unsigned long long ops = 0, a0 = allocs;
+    while (!workload_pool_stopping(&pool))
+    {
+        for (int i = 0; i < OPS_PER_CHECK; i++)
+            fn(w, pos++ & (KEY_STREAM - 1));
+        ops += OPS_PER_CHECK;
+    }
+    w->ops = ops;
+    w->allocs = allocs - a0;
+}
+
+typedef struct
+{
+    const char *name;
+    BenchFn fn;
+    int threads;
+    const char *dist; // NULL when keys do not matter
+    int cache_size;   // 0 when the cache is not involved
+    int param;        // players per call for topn_get_top / json, 0 otherwise
+    unsigned long long ops, allocs, hits;
+    double ns_per_op, ops_per_sec, allocs_per_op, hit_ratio;
+} Result;
+
+static Result results[4096];
+static int nresults;
+static int run_ms = 500;
+static const char *filter;
+
+static void run_case(const char *name, BenchFn fn, int threads, int dist, int cache_size, int param)
+{
+    if (filter && !strstr(name, filter))
+        return;
+    if (nresults == (int)(sizeof(results) / sizeof(results[0])))
+        return;
+
+    for (int i = 0; i < pool_threads; i++)
+        workers[i].ops = workers[i].allocs = workers[i].hits = 0;
+    current_fn = fn;
+    active_threads = threads;
+    long long elapsed = workload_pool_round(&pool, run_ms);
+
+    Result *r = &results[nresults++];
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+    r->fn = fn;
+    r->threads = threads;
+    r->dist = dist >= 0 ? dist_names[dist] : NULL;
+    r->cache_size = cache_size;
+    r->param = param;
+    for (int i = 0; i < threads; i++)
+    {
+        r->ops += workers[i].ops;
+        r->allocs += workers[i].allocs;
+        r->hits += workers[i].hits;
+    }
+    r->ns_per_op = r->ops ? (double)elapsed * threads / r->ops : 0;
+    r->ops_per_sec = r->ops / (elapsed / 1e9);
+    r->allocs_per_op = r->ops ? (double)r->allocs / r->ops : 0;
+    r->hit_ratio = r->ops ? (double)r->hits / r->ops : 0;
+
+    fprintf(stderr, "%-16s threads=%-3d %-8s size=%-7d param=%-4d %10.1f ns/op %14.0f ops/s %6.3f allocs/op\n",
+            name, threads, r->dist ? r->dist : "-", cache_size, param, r->ns_per_op, r->ops_per_sec,
+            r->allocs_per_op);
+}
+
+static void fill_streams(const Zipf *z, KeyDist dist)
+{
+    for (int i = 0; i < pool_threads; i++)
+    {
+        workload_make_keys(workers[i].keys, KEY_STREAM, dist, z, 0x9E3779B97F4A7C15ull * (i + 1) + dist);
+        uint64_t s = 0xD1B54A32D192ED03ull * (i + 1);
+        for (int k = 0; k < KEY_STREAM; k++)
+            workers[i].scores[k] = (int)(rng_next(&s) % 1000000);
+    }
+}
+
+// Start each cache case full, so updates evict and lookups can hit
+static void prefill_cache(int size)
+{
+    cache_clear();
+    cache_capacity = size;
+    for (int id = 1; id <= size && id <= opts.keys; id++)
+        cache_update(id, id);
+}
+
+static void write_json(FILE *f)
+{
+    workload_json_begin(f, &opts);
+    fprintf(f, "  \"run_ms\": %d,\n  \"results\": [\n", run_ms);
+    for (int i = 0; i < nresults; i++)
+    {
+        const Result *r = &results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"threads\": %d, ", r->name, r->threads);
+        if (r->dist)
+            fprintf(f, "\"dist\": \"%s\", ", r->dist);
+        if (r->cache_size)
+            fprintf(f, "\"cache_size\": %d, ", r->cache_size);
+        if (r->param)
+            fprintf(f, "\"players\": %d, ", r->param);
+        fprintf(f, "\"ops\": %llu, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, \"allocs_per_op\": %.4f",
+                r->ops, r->ns_per_op, r->ops_per_sec, r->allocs_per_op);
+        if (r->fn == op_cache_get)
+            fprintf(f, ", \"hit_ratio\": %.4f", r->hit_ratio);
+        fprintf(f, "}%s\n", i == nresults - 1 ? "" : ",");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+// "1,2,4" -> list; returns count, or -1 if malformed
+static int parse_list(const char *s, int *out, int max)
+{
+    int n = 0;
+    while (*s)
+    {
+        char *end;
+        long v = strtol(s, &end, 10);
+        if (end == s || v <= 0 || n == max || (*end && *end != ','))
+            return -1;
+        out[n++] = (int)v;
+        s = *end ? end + 1 : end;
+    }
+    return n;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [--threads 1,2,4,8] [--sizes 1000,100000] [--keys N] [--dists uniform,zipfian]\n"
+            "          [--skew THETA] [--ms N] [--filter NAME] [--out PATH]\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    int threads[MAX_LIST] = {1, 2, 4, 8};
+    int nthreads = 4;
+    int sizes[MAX_LIST] = {1000, 100000};
+    int nsizes = 2;
+    KeyDist dists[2] = {KEYS_UNIFORM, KEYS_ZIPFIAN};
+    int ndists = 2;
+
+    static const struct option long_opts[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"sizes", required_argument, NULL, 's'},
+        {"dists", required_argument, NULL, 'd'},
+        {"ms", required_argument, NULL, 'm'},
+        {"filter", required_argument, NULL, 'f'},
+        WORKLOAD_LONG_OPTS,
+        {NULL, 0, NULL, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1)
+    {
+        if (workload_parse_opt(&opts, opt, optarg))
+            continue;
+        switch (opt)
+        {
+        case 't':
+            nthreads = parse_list(optarg, threads, MAX_LIST);
+            break;
+        case 's':
+            nsizes = parse_list(optarg, sizes, MAX_LIST);
+            break;
+        case 'd':
+            ndists = 0;
+            if (strstr(optarg, "uniform"))
+                dists[ndists++] = KEYS_UNIFORM;
+            if (strstr(optarg, "zipfian"))
+                dists[ndists++] = KEYS_ZIPFIAN;
+            break;
+        case 'm':
+            run_ms = atoi(optarg);
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (nthreads <= 0 || nsizes <= 0 || ndists == 0 || !workload_opts_valid(&opts) || run_ms <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    for (int i = 0; i < nthreads; i++)
+    {
+        if (threads[i] > pool_threads)
+            pool_threads = threads[i];
+    }
+    if (pool_threads > MAX_THREADS)
+    {
+        fprintf(stderr, "At most %d threads\n", MAX_THREADS);
+        return 1;
+    }
+
+    workers = calloc(pool_threads, sizeof(Worker));
+    if (!workers)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    if (workload_pool_start(&pool, pool_threads, workers, sizeof(Worker), worker_run, metrics_thread_init) != 0)
+    {
+        fprintf(stderr, "Cannot start %d threads\n", pool_threads);
+        return 1;
+    }
+
+    Zipf zipf;
+    zipf_init(&zipf, opts.keys, opts.theta);
+    for (int di = 0; di < ndists; di++)
+    {
+        KeyDist dist = dists[di];
+        fill_streams(&zipf, dist);
+        for (int si = 0; si < nsizes; si++)
+        {
+            for (int ti = 0; ti < nthreads; ti++)
+            {
+                prefill_cache(sizes[si]);
+                run_case("cache_update", op_cache_update, threads[ti], dist, sizes[si], 0);
+                prefill_cache(sizes[si]);
+                run_case("cache_get_score", op_cache_get, threads[ti], dist, sizes[si], 0);
+            }
+        }
+        for (int ti = 0; ti < nthreads; ti++)
+        {
+            topn_clear();
+            run_case("topn_update", op_topn_update, threads[ti], dist, 0, 0);
+        }
+    }
+    cache_clear();
+
+    // Reads see a full Top-N; keys do not matter
+    topn_clear();
+    for (int i = 1; i <= TOP_N_SIZE * 2; i++)
+        topn_update(i, i);
+    static const int limits[] = {10, TOP_N_SIZE};
+    for (int li = 0; li < 2; li++)
+    {
+        topn_limit = limits[li];
+        for (int ti = 0; ti < nthreads; ti++)
+            run_case("topn_get_top", op_topn_get, threads[ti], -1, 0, topn_limit);
+    }
+
+    json_count = topn_get_top(json_players, TOP_N_SIZE, TOPN_ALL);
+    for (int li = 0; li < 2; li++)
+    {
+        json_count = limits[li];
+        run_case("json_leaderboard", op_json, 1, -1, 0, json_count);
+    }
+
+    workload_pool_stop(&pool);
+
+    FILE *f = workload_out_open(&opts);
+    if (!f)
+        return 1;
+    write_json(f);
+    workload_out_close(f, &opts);
+    free(workers);
+    return 0;
+}
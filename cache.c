@@ -0,0 +1,237 @@
+#include "cache.h"
+
+#include <stdlib.h>
+#include "metrics.h"
+#include "trace.h"
+
+pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+LRUNode *lru_head = NULL;
+int cache_count = 0;
+int cache_capacity = MAX_CACHE_SIZE;
+
+static LRUNode *tail = NULL;
+static LRUNode *cache_map = NULL;
+
+static void lru_remove(LRUNode *node)
+{
+    if (!node)
+        return;
+
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        lru_head = node->next;
+
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        tail = node->prev;
+}
+
+static void lru_push_front(LRUNode *node)
+{
+    node->next = lru_head;
+    node->prev = NULL;
+    if (lru_head)
+        lru_head->prev = node;
+    lru_head = node;
+    if (tail == NULL)
+        tail = node;
+}
+
+LRUNode *cache_find_locked(int id)
+{
+    LRUNode *node = NULL;
+    HASH_FIND_INT(cache_map, &id, node);
+    return node;
+}
+
+void cache_update_locked(int id, int score)
+{
+    LRUNode *node = NULL;
+    HASH_FIND_INT(cache_map, &id, node);
+
+    if (node)
+    {
+        node->score = score;
+        lru_remove(node);
+        lru_push_front(node);
+        return;
+    }
+
+    // Normally evicts one entry; after a shrink, cache_set_capacity() drains
+    // the surplus so a single insert never evicts more than a couple
+    for (int evicted = 0; cache_count >= cache_capacity && tail && evicted < 2; evicted++)
+    {
+        LRUNode *old_tail = tail;
+        HASH_DEL(cache_map, old_tail);
+        lru_remove(old_tail);
+        free(old_tail);
+        cache_count--;
+        metrics_count(METRIC_CACHE_EVICTIONS, 1);
+    }
+
+    node = (LRUNode *)malloc(sizeof(LRUNode));
+    if (!node)
+        return;
+    node->id = id;
+    node->score = score;
+    node->prev = node->next = NULL;
+
+    lru_push_front(node);
+    HASH_ADD_INT(cache_map, id, node);
+    cache_count++;
+    metrics_gauge_set(METRIC_CACHE_ENTRIES, cache_count);
+}
+
+void cache_update(int id, int score)
+{
+    uint64_t t0 = trace_start();
+    pthread_mutex_lock(&cache_lock);
+    trace_end(TRACE_CACHE_LOCK_WAIT, t0);
+
+    uint64_t t1 = trace_start();
+    cache_update_locked(id, score);
+    trace_end(TRACE_CACHE_OP, t1);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void cache_update_batch(const Player *recs, int n)
+{
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < n; i++)
+        cache_update_locked(recs[i].id, recs[i].score);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+int cache_get_score(int id)
+{
+    uint64_t t0 = trace_start();
+    pthread_mutex_lock(&cache_lock);
+    trace_end(TRACE_CACHE_LOCK_WAIT, t0);
+
+    uint64_t t1 = trace_start();
+    LRUNode *node = NULL;
+    HASH_FIND_INT(cache_map, &id, node);
+
+    if (node)
+    {
+        int score = node->score;
+        lru_remove(node);
+        lru_push_front(node);
+        trace_end(TRACE_CACHE_OP, t1);
+        pthread_mutex_unlock(&cache_lock);
+        metrics_count(METRIC_CACHE_HITS, 1);
+        return score;
+    }
+
+    trace_end(TRACE_CACHE_OP, t1);
+    pthread_mutex_unlock(&cache_lock);
+    metrics_count(METRIC_CACHE_MISSES, 1);
+    return -1;
+}
+
+int cache_get_scores(const int *ids, int n, int *scores)
+{
+    uint64_t t0 = trace_start();
+    pthread_mutex_lock(&cache_lock);
+    trace_end(TRACE_CACHE_LOCK_WAIT, t0);
+
+    uint64_t t1 = trace_start();
+    int hits = 0;
+    for (int i = 0; i < n; i++)
+    {
+        LRUNode *node = NULL;
+        HASH_FIND_INT(cache_map, &ids[i], node);
+        if (node)
+        {
+            scores[i] = node->score;
+            lru_remove(node);
+            lru_push_front(node);
+            hits++;
+        }
+        else
+        {
+            scores[i] = -1;
+        }
+    }
+    trace_end(TRACE_CACHE_OP, t1);
+    pthread_mutex_unlock(&cache_lock);
+
+    metrics_count(METRIC_CACHE_HITS, hits);
+    metrics_count(METRIC_CACHE_MISSES, n - hits);
+    return hits;
+}
+
+int cache_invalidate(const int *ids, int n)
+{
+    pthread_mutex_lock(&cache_lock);
+    int removed = 0;
+    for (int i = 0; i < n; i++)
+    {
+        LRUNode *node = NULL;
+        HASH_FIND_INT(cache_map, &ids[i], node);
+        if (node)
+        {
+            HASH_DEL(cache_map, node);
+            lru_remove(node);
+            free(node);
+            cache_count--;
+            removed++;
+        }
+    }
+    if (removed)
+        metrics_gauge_set(METRIC_CACHE_ENTRIES, cache_count);
+    pthread_mutex_unlock(&cache_lock);
+    return removed;
+}
+
+void cache_clear(void)
+{
+    pthread_mutex_lock(&cache_lock);
+    LRUNode *node, *next;
+    HASH_ITER(hh, cache_map, node, next)
+    {
+        HASH_DEL(cache_map, node);
+        free(node);
+    }
+    lru_head = tail = NULL;
+    cache_count = 0;
+    metrics_gauge_set(METRIC_CACHE_ENTRIES, 0);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+int cache_set_capacity(int capacity)
+{
+    int evicted = 0;
+    pthread_mutex_lock(&cache_lock);
+    cache_capacity = capacity;
+    while (cache_count > cache_capacity && tail)
+    {
+        // Unlink one chunk under the lock, free it outside
+        LRUNode *chunk = NULL;
+        for (int i = 0; i < CACHE_EVICT_CHUNK && cache_count > cache_capacity && tail; i++)
+        {
+            LRUNode *old_tail = tail;
+            HASH_DEL(cache_map, old_tail);
+            lru_remove(old_tail);
+            old_tail->next = chunk;
+            chunk = old_tail;
+            cache_count--;
+            evicted++;
+        }
+        metrics_gauge_set(METRIC_CACHE_ENTRIES, cache_count);
+        pthread_mutex_unlock(&cache_lock);
+
+        while (chunk)
+        {
+            LRUNode *next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+        pthread_mutex_lock(&cache_lock);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    metrics_count(METRIC_CACHE_EVICTIONS, evicted);
+    return evicted;
+}
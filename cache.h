@@ -0,0 +1,66 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include "uthash.h"
+
+// LRU score cache.
+//
+// A uthash map from player id to node, threaded on a doubly linked
+// recency list (head = most recently used). Everything is protected by
+// cache_lock; the *_locked functions expect the caller to hold it so
+// several steps can share one critical section.
+
+#define MAX_CACHE_SIZE 1000 // default capacity
+#define CACHE_EVICT_CHUNK 256 // entries evicted per cache_lock hold when shrinking
+
+typedef struct
+{
+    int id;
+    int score;
+} Player;
+
+typedef struct LRUNode
+{
+    int id;
+    int score;
+    struct LRUNode *prev, *next;
+    UT_hash_handle hh;
+} LRUNode;
+
+extern pthread_mutex_t cache_lock;
+extern LRUNode *lru_head; // most recently used
+extern int cache_count;
+extern int cache_capacity; // entries kept before the tail is evicted; see cache_set_capacity()
+
+// Insert or refresh an entry (must hold cache_lock)
+void cache_update_locked(int id, int score);
+
+// Entry for id without touching its recency, or NULL (must hold cache_lock)
+LRUNode *cache_find_locked(int id);
+
+void cache_update(int id, int score);
+
+// Apply a batch of updates under a single cache_lock acquisition
+void cache_update_batch(const Player *recs, int n);
+
+// Score of id (moving it to the front), or -1 on a miss
+int cache_get_score(int id);
+
+// Look up many players under one cache_lock acquisition; scores[i] is -1
+// on a miss. Returns the number of hits.
+int cache_get_scores(const int *ids, int n, int *scores);
+
+// Drop the given players under one cache_lock acquisition; returns how
+// many were cached
+int cache_invalidate(const int *ids, int n);
+
+// Drop every entry
+void cache_clear(void);
+
+// Change the capacity while running. Shrinking evicts from the tail in
+// chunks of CACHE_EVICT_CHUNK, releasing cache_lock in between so lookups
+// keep going. Returns the number of entries evicted.
+int cache_set_capacity(int capacity);
+
+#endif // CACHE_H
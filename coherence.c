@@ -0,0 +1,401 @@
+#include "coherence.h"
+
+#include <postgresql/libpq-fe.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "db.h"
+#include "topn.h"
+#include "uthash.h"
+
+#define LISTEN_RETRY_MS 1000
+
+typedef struct
+{
+    int id;
+    int score;
+    UT_hash_handle hh;
+} PendingUpdate;
+
+static unsigned int instance_id;
+static int apply_topn;
+static int flush_interval_ms = 10;
+
+// Publisher: latest score per player since the last flush
+static PendingUpdate *pending;
+static int pending_count;
+static int pending_overflow; // too many players this interval: send a reset
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stop_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int running;
+static pthread_t flusher;
+
+static atomic_ullong published;    // writes queued
+static atomic_ullong coalesced;    // writes superseded before their flush
+static atomic_ullong notifies;     // NOTIFY payloads sent
+static atomic_ullong send_errors;
+static atomic_ullong received;     // remote changes received
+static atomic_ullong invalidated;  // of which were cached in the LRU
+static atomic_ullong resets;       // full cache resets (remote overflow or lost connection)
+
+// Must hold pending_lock
+static void publish_locked(int id, int score)
+{
+    PendingUpdate *u = NULL;
+    HASH_FIND_INT(pending, &id, u);
+    if (u)
+    {
+        u->score = score;
+        atomic_fetch_add_explicit(&coalesced, 1, memory_order_relaxed);
+        return;
+    }
+    if (pending_count >= COHERENCE_MAX_PENDING)
+    {
+        pending_overflow = 1;
+        return;
+    }
+    u = malloc(sizeof(*u));
+    if (!u)
+    {
+        pending_overflow = 1;
+        return;
+    }
+    u->id = id;
+    u->score = score;
+    HASH_ADD_INT(pending, id, u);
+    pending_count++;
+}
+
+void coherence_publish(int id, int score)
+{
+    if (!running)
+        return;
+    pthread_mutex_lock(&pending_lock);
+    publish_locked(id, score);
+    pthread_mutex_unlock(&pending_lock);
+    atomic_fetch_add_explicit(&published, 1, memory_order_relaxed);
+}
+
+void coherence_publish_batch(const Player *recs, int n)
+{
+    if (!running || n <= 0)
+        return;
+    pthread_mutex_lock(&pending_lock);
+    for (int i = 0; i < n; i++)
+        publish_locked(recs[i].id, recs[i].score);
+    pthread_mutex_unlock(&pending_lock);
+    atomic_fetch_add_explicit(&published, n, memory_order_relaxed);
+}
+
+// Encode the detached queue as a text[] literal of payloads and send them
+// all with one statement. Returns the number of payloads, -1 on error.
+static int send_batch(PGconn *c, PendingUpdate *batch, int overflow)
+{
+    // Worst case per entry: "-2147483648=-2147483648," (24 bytes)
+    size_t cap = (size_t)HASH_COUNT(batch) * 24 + COHERENCE_PAYLOAD_MAX + 64;
+    char *arr = malloc(cap);
+    if (!arr)
+        return -1;
+
+    char prefix[16];
+    int plen = snprintf(prefix, sizeof(prefix), "%08x:", instance_id);
+    size_t pos = 0;
+    int payloads = 0;
+    arr[pos++] = '{';
+    if (overflow)
+    {
+        pos += snprintf(arr + pos, cap - pos, "\"%s*\"", prefix);
+        payloads = 1;
+    }
+    else
+    {
+        size_t start = 0; // offset of the current payload's first entry
+        PendingUpdate *u, *tmp;
+        HASH_ITER(hh, batch, u, tmp)
+        {
+            char entry[32];
+            int elen = snprintf(entry, sizeof(entry), "%d=%d", u->id, u->score);
+            if (payloads == 0 || pos - start + elen + 1 > (size_t)(COHERENCE_PAYLOAD_MAX - plen))
+            {
+                if (payloads > 0)
+                    pos += snprintf(arr + pos, cap - pos, "\",");
+                pos += snprintf(arr + pos, cap - pos, "\"%s", prefix);
+                start = pos;
+                payloads++;
+            }
+            else
+            {
+                arr[pos++] = ',';
+            }
+            memcpy(arr + pos, entry, elen);
+            pos += elen;
+        }
+        if (payloads > 0)
+            arr[pos++] = '"';
+    }
+    arr[pos++] = '}';
+    arr[pos] = '\0';
+
+    if (payloads == 0)
+    {
+        free(arr);
+        return 0;
+    }
+
+    const char *params[1] = {arr};
+    PGresult *res = PQexecParams(c, "SELECT pg_notify('" COHERENCE_CHANNEL "', p) FROM unnest($1::text[]) AS p;",
+                                 1, NULL, params, NULL, NULL, 0);
+    free(arr);
+    int ok = res && PQresultStatus(res) == PGRES_TUPLES_OK;
+    if (!ok)
+        fprintf(stderr, "coherence: NOTIFY failed: %s\n", PQerrorMessage(c));
+    if (res)
+        PQclear(res);
+    return ok ? payloads : -1;
+}
+
+static void *flush_loop(void *arg)
+{
+    PGconn *c = arg;
+    pthread_mutex_lock(&pending_lock);
+    for (;;)
+    {
+        if (running)
+        {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += (long)flush_interval_ms * 1000000L;
+            until.tv_sec += until.tv_nsec / 1000000000L;
+            until.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&stop_cond, &pending_lock, &until);
+        }
+
+        PendingUpdate *batch = pending;
+        int overflow = pending_overflow;
+        pending = NULL;
+        pending_count = 0;
+        pending_overflow = 0;
+        int stop = !running;
+        pthread_mutex_unlock(&pending_lock);
+
+        if (batch || overflow)
+        {
+            if (PQstatus(c) != CONNECTION_OK)
+                PQreset(c);
+            int n = send_batch(c, batch, overflow);
+            if (n > 0)
+            {
+                atomic_fetch_add(&notifies, n);
+            }
+            else if (n < 0)
+            {
+                // These changes are lost to the other servers: make the
+                // next flush tell them to reset instead
+                atomic_fetch_add(&send_errors, 1);
+                pthread_mutex_lock(&pending_lock);
+                pending_overflow = 1;
+                pthread_mutex_unlock(&pending_lock);
+            }
+        }
+        PendingUpdate *u, *tmp;
+        HASH_ITER(hh, batch, u, tmp)
+        {
+            HASH_DEL(batch, u);
+            free(u);
+        }
+
+        if (stop)
+            break;
+        pthread_mutex_lock(&pending_lock);
+    }
+    PQfinish(c);
+    return NULL;
+}
+
+// ---------- Listener ----------
+
+// Changes from another server may be lost (overflowed or missed while
+// disconnected): drop the LRU and rebuild Top-N from the DB
+static void reset_caches(void)
+{
+    cache_clear();
+    if (apply_topn)
+    {
+        Player temp[TOPN_MAX_SIZE];
+        for (int w = 0; w < TOPN_WINDOW_COUNT; w++)
+        {
+            int count = db_get_top(temp, topn_depth, w);
+            topn_load_window(w, temp, count);
+        }
+    }
+    atomic_fetch_add(&resets, 1);
+}
+
+static void apply_payload(const char *payload)
+{
+    char *end;
+    unsigned long from = strtoul(payload, &end, 16);
+    if (*end != ':')
+        return;
+    if (from == instance_id)
+        return;
+    const char *p = end + 1;
+    if (*p == '*')
+    {
+        reset_caches();
+        return;
+    }
+
+    // One payload holds at most COHERENCE_PAYLOAD_MAX / 4 entries ("1=1,")
+    static Player recs[COHERENCE_PAYLOAD_MAX / 4];
+    static int ids[COHERENCE_PAYLOAD_MAX / 4];
+    int n = 0;
+    while (*p && n < COHERENCE_PAYLOAD_MAX / 4)
+    {
+        long id = strtol(p, &end, 10);
+        if (*end != '=')
+            break;
+        long score = strtol(end + 1, &end, 10);
+        recs[n].id = (int)id;
+        recs[n].score = (int)score;
+        ids[n] = (int)id;
+        n++;
+        if (*end != ',')
+            break;
+        p = end + 1;
+    }
+
+    atomic_fetch_add(&received, n);
+    atomic_fetch_add(&invalidated, cache_invalidate(ids, n));
+    if (apply_topn)
+        topn_update_batch(recs, n);
+}
+
+static PGconn *listen_connect(void)
+{
+    PGconn *c = db_connect();
+    if (!c)
+        return NULL;
+    PGresult *res = PQexec(c, "LISTEN " COHERENCE_CHANNEL ";");
+    int ok = res && PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok)
+        fprintf(stderr, "coherence: LISTEN failed: %s\n", PQerrorMessage(c));
+    if (res)
+        PQclear(res);
+    if (!ok)
+    {
+        PQfinish(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void *listen_loop(void *arg)
+{
+    PGconn *c = arg;
+    for (;;)
+    {
+        while (!c)
+        {
+            usleep(LISTEN_RETRY_MS * 1000);
+            c = listen_connect();
+            if (c)
+                reset_caches();
+        }
+
+        struct pollfd pfd = {.fd = PQsocket(c), .events = POLLIN};
+        if (poll(&pfd, 1, 1000) < 0 && errno != EINTR)
+            perror("coherence poll");
+
+        if (!PQconsumeInput(c) || PQstatus(c) != CONNECTION_OK)
+        {
+            fprintf(stderr, "coherence: lost listen connection: %s\n", PQerrorMessage(c));
+            PQfinish(c);
+            c = NULL;
+            continue;
+        }
+        PGnotify *n;
+        while ((n = PQnotifies(c)) != NULL)
+        {
+            apply_payload(n->extra);
+            PQfreemem(n);
+        }
+    }
+    return NULL;
+}
+
+int coherence_start(int flush_ms, int topn)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    instance_id = (unsigned int)(ts.tv_nsec ^ (ts.tv_sec << 20) ^ ((long)getpid() << 8));
+    if (instance_id == 0)
+        instance_id = 1;
+    apply_topn = topn;
+    if (flush_ms > 0)
+        flush_interval_ms = flush_ms;
+
+    PGconn *pub = db_connect();
+    PGconn *sub = pub ? listen_connect() : NULL;
+    if (!sub)
+    {
+        if (pub)
+            PQfinish(pub);
+        return -1;
+    }
+
+    running = 1;
+    pthread_t t;
+    if (pthread_create(&flusher, NULL, flush_loop, pub) != 0)
+    {
+        running = 0;
+        PQfinish(pub);
+        PQfinish(sub);
+        return -1;
+    }
+    if (pthread_create(&t, NULL, listen_loop, sub) != 0)
+    {
+        coherence_shutdown();
+        PQfinish(sub);
+        return -1;
+    }
+    pthread_detach(t);
+    return 0;
+}
+
+void coherence_shutdown(void)
+{
+    pthread_mutex_lock(&pending_lock);
+    if (!running)
+    {
+        pthread_mutex_unlock(&pending_lock);
+        return;
+    }
+    running = 0;
+    pthread_cond_signal(&stop_cond);
+    pthread_mutex_unlock(&pending_lock);
+    pthread_join(flusher, NULL);
+}
+
+void coherence_render_metrics(MetricsBuf *b)
+{
+    if (!instance_id)
+        return;
+    mbuf_printf(b, "# TYPE leaderboard_coherence_published_total counter\nleaderboard_coherence_published_total %llu\n"
+                   "# TYPE leaderboard_coherence_coalesced_total counter\nleaderboard_coherence_coalesced_total %llu\n"
+                   "# TYPE leaderboard_coherence_notifies_total counter\nleaderboard_coherence_notifies_total %llu\n"
+                   "# TYPE leaderboard_coherence_send_errors_total counter\nleaderboard_coherence_send_errors_total %llu\n"
+                   "# TYPE leaderboard_coherence_received_total counter\nleaderboard_coherence_received_total %llu\n"
+                   "# TYPE leaderboard_coherence_invalidated_total counter\nleaderboard_coherence_invalidated_total %llu\n"
+                   "# TYPE leaderboard_coherence_resets_total counter\nleaderboard_coherence_resets_total %llu\n",
+                (unsigned long long)atomic_load(&published), (unsigned long long)atomic_load(&coalesced),
+                (unsigned long long)atomic_load(&notifies), (unsigned long long)atomic_load(&send_errors),
+                (unsigned long long)atomic_load(&received), (unsigned long long)atomic_load(&invalidated),
+                (unsigned long long)atomic_load(&resets));
+}
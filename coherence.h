@@ -0,0 +1,41 @@
+#ifndef COHERENCE_H
+#define COHERENCE_H
+
+#include "cache.h"
+#include "metrics.h"
+
+// Cache coherence between servers sharing one database (modes 2/3).
+//
+// Every committed write is queued for publication. The queue keeps only
+// the latest score per player (coalescing), and a flusher sends it every
+// flush interval as a few NOTIFY payloads in one round trip. Each server
+// LISTENs on a dedicated connection and, for other servers' changes,
+// drops the player from its LRU (the next read goes to the DB) and
+// applies the new score to its Top-N windows.
+//
+// Payload: "<instance>:<id>=<score>,<id>=<score>,..." or "<instance>:*"
+// when more than COHERENCE_MAX_PENDING players changed in one interval;
+// receivers then clear the LRU and reload Top-N from the DB, as they do
+// after losing the listen connection.
+//
+// Two servers writing the same player within one interval may leave a
+// Top-N entry with the older score until its next update.
+
+#define COHERENCE_CHANNEL "leaderboard_changes"
+#define COHERENCE_PAYLOAD_MAX 7900 // NOTIFY payloads must stay under 8000 bytes
+#define COHERENCE_MAX_PENDING 4096 // distinct players per interval before sending a reset
+
+// Start the publisher and listener; apply_topn is set in mode 3
+int coherence_start(int flush_ms, int apply_topn);
+
+// Send what is queued and stop publishing
+void coherence_shutdown(void);
+
+// Queue committed writes; no-ops unless coherence_start() succeeded
+void coherence_publish(int id, int score);
+void coherence_publish_batch(const Player *recs, int n);
+
+// Coherence counters for GET /metrics
+void coherence_render_metrics(MetricsBuf *b);
+
+#endif // COHERENCE_H
@@ -0,0 +1,131 @@
+#include "config.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char *trim(char *s)
+{
+    while (isspace((unsigned char)*s))
+        s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    return s;
+}
+
+// Path given by --config, or NULL
+static const char *find_config_path(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--") == 0)
+            break;
+        if (strncmp(argv[i], "--config=", 9) == 0)
+            return argv[i] + 9;
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+            return argv[i + 1];
+    }
+    return NULL;
+}
+
+int config_apply_file(int *argc, char ***argv)
+{
+    const char *path = find_config_path(*argc, *argv);
+    if (!path)
+        return 0;
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        return -1;
+    }
+
+    // The new argv lives until exit, like the original
+    int cap = *argc + 16, n = 0;
+    char **out = malloc(sizeof(char *) * cap);
+    if (!out)
+    {
+        fclose(f);
+        return -1;
+    }
+    out[n++] = (*argv)[0];
+
+    char line[CONFIG_LINE_MAX];
+    int lineno = 0, rc = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        lineno++;
+        // '#' starts a comment at the start of the line or after whitespace,
+        // so values such as conninfo passwords may contain it
+        for (char *p = line; *p; p++)
+        {
+            if (*p == '#' && (p == line || isspace((unsigned char)p[-1])))
+            {
+                *p = '\0';
+                break;
+            }
+        }
+        char *key = trim(line);
+        if (*key == '\0')
+            continue;
+
+        char *value = NULL;
+        char *eq = strchr(key, '=');
+        if (eq)
+        {
+            *eq = '\0';
+            value = trim(eq + 1);
+            key = trim(key);
+        }
+        if (*key == '\0' || strspn(key, "abcdefghijklmnopqrstuvwxyz0123456789-") != strlen(key) ||
+            strcmp(key, "config") == 0)
+        {
+            fprintf(stderr, "%s:%d: invalid setting\n", path, lineno);
+            rc = -1;
+            break;
+        }
+
+        if (n + *argc + 1 > cap)
+        {
+            cap *= 2;
+            char **p = realloc(out, sizeof(char *) * cap);
+            if (!p)
+            {
+                rc = -1;
+                break;
+            }
+            out = p;
+        }
+        size_t len = strlen(key) + (value ? strlen(value) + 1 : 0) + 3;
+        char *opt = malloc(len);
+        if (!opt)
+        {
+            rc = -1;
+            break;
+        }
+        if (value)
+            snprintf(opt, len, "--%s=%s", key, value);
+        else
+            snprintf(opt, len, "--%s", key);
+        out[n++] = opt;
+    }
+    fclose(f);
+
+    if (rc != 0)
+    {
+        for (int i = 1; i < n; i++)
+            free(out[i]);
+        free(out);
+        return -1;
+    }
+
+    for (int i = 1; i < *argc; i++)
+        out[n++] = (*argv)[i];
+    out[n] = NULL;
+    *argc = n;
+    *argv = out;
+    return 0;
+}
@@ -1,15 +1,30 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-// PostgreSQL connection
+// Compile-time defaults. Each can be overridden on the command line or in
+// a --config file (see config_apply_file); the LRU, Top-N and pool sizes
+// default to MAX_CACHE_SIZE (cache.h), TOP_N_SIZE (topn.h) and
+// POOL_MIN_SIZE/POOL_SIZE (db.h).
+
+// PostgreSQL connection (--conninfo)
 #define PG_CONNINFO "host=127.0.0.1 port=5432 dbname=leaderboard_db user=leaderboard_user password=leaderboard_pw"
 
 // server config
-#define DEFAULT_PORT 8080
-#define THREAD_POOL_SIZE 8
-#define DEFAULT_TOP_N 10
+#define DEFAULT_PORT 8080      // --port or the first positional argument
+#define THREAD_POOL_SIZE 10    // libmicrohttpd worker threads (--http-threads)
+#define DEFAULT_TOP_N 10       // /leaderboard without top=
 
 // cache limits
 #define SKIPLIST_MAX_LEVEL 16
 
+#define CONFIG_LINE_MAX 1024
+
+// If argv contains --config PATH (or --config=PATH), read PATH and insert
+// its settings as options right after argv[0], so that options given on
+// the command line, which come later, override them. Each line is
+// "key = value" or a bare "key" for flags, where key is a long option
+// name without the dashes; '#' starts a comment. Returns 0 (argc/argv
+// replaced only if a file was read), -1 on error.
+int config_apply_file(int *argc, char ***argv);
+
 #endif // CONFIG_H
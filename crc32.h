@@ -0,0 +1,10 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli), table driven. Start with crc = 0.
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif // CRC32_H
@@ -0,0 +1,930 @@
+#include "db.h"
+
+#include <postgresql/libpq-fe.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "metrics.h"
+#include "trace.h"
+#include "coherence.h"
+#include "config.h"
+
+// ---------- Connection Pool ----------
+//
+// pool_init() opens pool_min connections in parallel. An acquire that has
+// waited grow_wait_us without finding an idle connection asks for one
+// more (up to pool_max), opened on a helper thread while it keeps
+// waiting. The maintenance thread closes connections idle for longer than
+// idle_timeout_us (down to pool_min), health-checks idle ones, and
+// reconnects broken ones, so none of that happens on the request path.
+
+typedef enum
+{
+    SLOT_EMPTY,
+    SLOT_CONNECTING,
+    SLOT_IDLE,
+    SLOT_BUSY,
+    SLOT_BROKEN,   // returned with a failed connection; the maintainer resets it
+    SLOT_CHECKING, // held by the maintainer
+} SlotState;
+
+typedef struct
+{
+    PGconn *conn;
+    SlotState state;
+    long long idle_since; // us
+    long long checked_at; // last use or health check, us
+} PoolSlot;
+
+static PoolSlot slots[POOL_SLOTS];
+static int pool_open; // slots that are not SLOT_EMPTY
+static int pool_min = POOL_MIN_SIZE;
+static int pool_max = POOL_SIZE;
+static long long grow_wait_us = 2000;
+static long long idle_timeout_us = 60000000;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wait;  // both wait on CLOCK_MONOTONIC, see pool_clock_init()
+static pthread_cond_t maint_wake;
+static pthread_once_t pool_clock_once = PTHREAD_ONCE_INIT;
+static int maint_running;
+static int pool_closing;
+static pthread_t maint_thread;
+static const char *conninfo = PG_CONNINFO;
+
+// Monotonic, so grow and idle deadlines do not jump with the wall clock
+static long long clock_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void pool_clock_init(void)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool_wait, &attr);
+    pthread_cond_init(&maint_wake, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static PGconn *create_new_connection()
+{
+    PGconn *c = PQconnectdb(conninfo);
+
+    if (!c)
+    {
+        fprintf(stderr, "PQconnectdb returned NULL\n");
+        return NULL;
+    }
+
+    if (PQstatus(c) != CONNECTION_OK)
+    {
+        fprintf(stderr, "Connection failed: %s\n", PQerrorMessage(c));
+        PQfinish(c);
+        return NULL;
+    }
+    return c;
+}
+
+// Statements prepared on every pooled connection
+static int pool_prepare(PGconn *c)
+{
+    PGresult *res = PQprepare(c, "get_scores",
+                              "SELECT player_id, score FROM leaderboard WHERE player_id = ANY($1::int[]);", 1, NULL);
+    int ok = res && PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok)
+        fprintf(stderr, "pool_prepare: %s\n", PQerrorMessage(c));
+    if (res)
+        PQclear(res);
+    return ok ? 0 : -1;
+}
+
+// Must hold pool_lock
+static void pool_publish_size_locked(void)
+{
+    int connected = 0;
+    for (int i = 0; i < POOL_SLOTS; i++)
+    {
+        if (slots[i].state != SLOT_EMPTY && slots[i].state != SLOT_CONNECTING)
+            connected++;
+    }
+    metrics_gauge_set(METRIC_POOL_SIZE, connected);
+}
+
+// Claim an empty slot for a new connection; -1 at pool_max. Must hold pool_lock.
+static int pool_reserve_locked(void)
+{
+    if (pool_closing || pool_open >= pool_max)
+        return -1;
+    for (int i = 0; i < POOL_SLOTS; i++)
+    {
+        if (slots[i].state == SLOT_EMPTY)
+        {
+            slots[i].state = SLOT_CONNECTING;
+            pool_open++;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Connect a reserved slot (outside pool_lock); returns 0 on success
+static int pool_open_slot(int i)
+{
+    PGconn *c = create_new_connection();
+    if (c && pool_prepare(c) != 0)
+    {
+        PQfinish(c);
+        c = NULL;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    if (c && pool_closing)
+    {
+        PQfinish(c);
+        c = NULL;
+    }
+    if (c)
+    {
+        slots[i].conn = c;
+        slots[i].state = SLOT_IDLE;
+        slots[i].idle_since = slots[i].checked_at = clock_us();
+        metrics_count(METRIC_POOL_CONNECTS, 1);
+    }
+    else
+    {
+        slots[i].state = SLOT_EMPTY;
+        pool_open--;
+    }
+    pool_publish_size_locked();
+    pthread_cond_broadcast(&pool_wait);
+    pthread_mutex_unlock(&pool_lock);
+    return c ? 0 : -1;
+}
+
+static void *pool_open_worker(void *arg)
+{
+    pool_open_slot((int)(intptr_t)arg);
+    return NULL;
+}
+
+// Open a reserved slot in the background. Must hold pool_lock.
+static void pool_grow_locked(int i)
+{
+    pthread_t t;
+    if (pthread_create(&t, NULL, pool_open_worker, (void *)(intptr_t)i) != 0)
+    {
+        slots[i].state = SLOT_EMPTY;
+        pool_open--;
+        return;
+    }
+    pthread_detach(t);
+}
+
+// Verify an idle or broken connection, resetting it if needed; NULL (and
+// the connection closed) if it cannot be brought back
+static PGconn *pool_check(PGconn *c)
+{
+    if (PQstatus(c) == CONNECTION_OK)
+    {
+        PGresult *res = PQexec(c, "SELECT 1;");
+        int ok = res && PQresultStatus(res) == PGRES_TUPLES_OK;
+        if (res)
+            PQclear(res);
+        if (ok)
+            return c;
+    }
+    PQreset(c);
+    if (PQstatus(c) != CONNECTION_OK || pool_prepare(c) != 0)
+    {
+        fprintf(stderr, "Warning: dropping pooled connection: %s\n", PQerrorMessage(c));
+        PQfinish(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void *pool_maintain(void *arg)
+{
+    pthread_mutex_lock(&pool_lock);
+    while (maint_running)
+    {
+        for (int i = 0; i < POOL_SLOTS && maint_running; i++)
+        {
+            PoolSlot *s = &slots[i];
+            long long now = clock_us();
+            int close_it = 0, check = s->state == SLOT_BROKEN;
+            if (s->state == SLOT_IDLE)
+            {
+                if (pool_open > pool_max || (pool_open > pool_min && now - s->idle_since > idle_timeout_us))
+                    close_it = 1;
+                else if (now - s->checked_at > POOL_HEALTH_CHECK_US)
+                    check = 1;
+            }
+            if (!close_it && !check)
+                continue;
+
+            PGconn *c = s->conn;
+            s->state = SLOT_CHECKING;
+            pthread_mutex_unlock(&pool_lock);
+            if (close_it)
+            {
+                PQfinish(c);
+                c = NULL;
+            }
+            else
+            {
+                c = pool_check(c);
+            }
+            pthread_mutex_lock(&pool_lock);
+
+            if (c)
+            {
+                s->state = SLOT_IDLE;
+                s->idle_since = s->checked_at = clock_us();
+                pthread_cond_signal(&pool_wait);
+            }
+            else
+            {
+                s->conn = NULL;
+                s->state = SLOT_EMPTY;
+                pool_open--;
+                metrics_count(METRIC_POOL_CLOSES, 1);
+            }
+            pool_publish_size_locked();
+        }
+
+        // Back up to the minimum after failures (or a raised minimum)
+        while (pool_open < pool_min)
+        {
+            int i = pool_reserve_locked();
+            if (i < 0)
+                break;
+            pool_grow_locked(i);
+        }
+
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_sec += POOL_MAINTAIN_INTERVAL_S;
+        pthread_cond_timedwait(&maint_wake, &pool_lock, &until);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+void pool_configure(int min, int max, int grow_wait_ms, int idle_timeout_s)
+{
+    pthread_once(&pool_clock_once, pool_clock_init);
+    pthread_mutex_lock(&pool_lock);
+    if (max > 0)
+        pool_max = max < POOL_SLOTS ? max : POOL_SLOTS;
+    if (min >= 0)
+        pool_min = min;
+    if (pool_min > pool_max)
+        pool_min = pool_max;
+    if (grow_wait_ms >= 0)
+        grow_wait_us = (long long)grow_wait_ms * 1000;
+    if (idle_timeout_s > 0)
+        idle_timeout_us = (long long)idle_timeout_s * 1000000;
+    pthread_cond_signal(&maint_wake);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void db_set_conninfo(const char *info)
+{
+    conninfo = info;
+}
+
+void pool_get_bounds(int *min, int *max)
+{
+    pthread_mutex_lock(&pool_lock);
+    *min = pool_min;
+    *max = pool_max;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void pool_init()
+{
+    pthread_once(&pool_clock_once, pool_clock_init);
+    long long start = clock_us();
+    int want = pool_min > 0 ? pool_min : 1;
+    pthread_t tids[POOL_SLOTS];
+    int idx[POOL_SLOTS];
+    int n = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_closing = 0;
+    while (n < want && (idx[n] = pool_reserve_locked()) >= 0)
+        n++;
+    pthread_mutex_unlock(&pool_lock);
+
+    int started = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (pthread_create(&tids[i], NULL, pool_open_worker, (void *)(intptr_t)idx[i]) == 0)
+            idx[started++] = i;
+        else
+            pool_open_slot(idx[i]);
+    }
+    for (int i = 0; i < started; i++)
+        pthread_join(tids[idx[i]], NULL);
+
+    pthread_mutex_lock(&pool_lock);
+    int connected = pool_open;
+    pthread_mutex_unlock(&pool_lock);
+    if (connected == 0)
+    {
+        fprintf(stderr, "Failed to initialize DB pool: no connection could be opened\n");
+        exit(1);
+    }
+    if (connected < want)
+        fprintf(stderr, "Warning: DB pool opened %d of %d connections, retrying in the background\n", connected,
+                want);
+    printf("DB pool: %d connections in %lld ms (min %d, max %d)\n", connected, (clock_us() - start) / 1000, pool_min,
+           pool_max);
+
+    maint_running = 1;
+    if (pthread_create(&maint_thread, NULL, pool_maintain, NULL) != 0)
+    {
+        maint_running = 0;
+        fprintf(stderr, "Warning: pool maintenance thread not started\n");
+    }
+}
+
+PGconn *pool_get_connection()
+{
+    long long start = clock_us();
+    uint64_t t0 = trace_start();
+    int waited = 0, grew = 0;
+
+    pthread_mutex_lock(&pool_lock);
+
+    while (1)
+    {
+        for (int i = 0; i < POOL_SLOTS; i++)
+        {
+            if (slots[i].state == SLOT_IDLE)
+            {
+                slots[i].state = SLOT_BUSY;
+                PGconn *c = slots[i].conn;
+                pthread_mutex_unlock(&pool_lock);
+
+                metrics_gauge_add(METRIC_POOL_IN_USE, 1);
+                metrics_count(METRIC_POOL_ACQUIRES, 1);
+                if (waited)
+                    metrics_count(METRIC_POOL_WAITS, 1);
+                metrics_record(METRIC_LAT_POOL_WAIT, clock_us() - start);
+                trace_end(TRACE_POOL_WAIT, t0);
+                return c;
+            }
+        }
+        waited = 1;
+
+        // Waited long enough: add a connection, unless at pool_max
+        long long grow_at = start + grow_wait_us;
+        if (!grew && clock_us() >= grow_at)
+        {
+            grew = 1;
+            int i = pool_reserve_locked();
+            if (i >= 0)
+                pool_grow_locked(i);
+        }
+        if (grew)
+        {
+            pthread_cond_wait(&pool_wait, &pool_lock);
+        }
+        else
+        {
+            struct timespec until = {grow_at / 1000000, (grow_at % 1000000) * 1000};
+            pthread_cond_timedwait(&pool_wait, &pool_lock, &until);
+        }
+    }
+}
+
+void pool_release_connection(PGconn *c)
+{
+    // Only the cheap local status check here; reconnecting is the maintainer's job
+    int broken = PQstatus(c) != CONNECTION_OK;
+    pthread_mutex_lock(&pool_lock);
+
+    for (int i = 0; i < POOL_SLOTS; i++)
+    {
+        if (slots[i].conn == c && slots[i].state == SLOT_BUSY)
+        {
+            if (broken)
+            {
+                slots[i].state = SLOT_BROKEN;
+                pthread_cond_signal(&maint_wake);
+            }
+            else
+            {
+                slots[i].state = SLOT_IDLE;
+                slots[i].idle_since = slots[i].checked_at = clock_us();
+            }
+            break;
+        }
+    }
+
+    pthread_cond_signal(&pool_wait);
+    pthread_mutex_unlock(&pool_lock);
+    metrics_gauge_add(METRIC_POOL_IN_USE, -1);
+}
+
+void pool_close()
+{
+    pthread_mutex_lock(&pool_lock);
+    pool_closing = 1;
+    int joined = maint_running;
+    maint_running = 0;
+    pthread_cond_signal(&maint_wake);
+    pthread_mutex_unlock(&pool_lock);
+    if (joined)
+        pthread_join(maint_thread, NULL);
+
+    pthread_mutex_lock(&pool_lock);
+    for (int i = 0; i < POOL_SLOTS; i++)
+    {
+        if (slots[i].conn && slots[i].state != SLOT_CHECKING && slots[i].state != SLOT_CONNECTING)
+        {
+            PQfinish(slots[i].conn);
+            slots[i].conn = NULL;
+            slots[i].state = SLOT_EMPTY;
+            pool_open--;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+PGconn *db_connect()
+{
+    PGconn *c = create_new_connection();
+    if (c)
+        printf("Connected to DB %s as %s on %s:%s\n", PQdb(c), PQuser(c), PQhost(c), PQport(c));
+    return c;
+}
+
+// PQexec with the round trip attributed to the db_exec trace stage
+static PGresult *db_exec(PGconn *c, const char *q)
+{
+    uint64_t t0 = trace_start();
+    PGresult *res = PQexec(c, q);
+    trace_end(TRACE_DB_EXEC, t0);
+    return res;
+}
+
+void db_update(int id, int score)
+{
+    PGconn *c = pool_get_connection();
+    if (!c)
+    {
+        fprintf(stderr, "db_update: no connection available\n");
+        return;
+    }
+
+    char q[256];
+    snprintf(q, sizeof(q),
+             "INSERT INTO leaderboard (player_id, score, last_updated) "
+             "VALUES (%d, %d, now()) "
+             "ON CONFLICT (player_id) DO UPDATE SET score = EXCLUDED.score, last_updated = now();",
+             id, score);
+
+    PGresult *res = db_exec(c, q);
+    if (!res)
+    {
+        fprintf(stderr, "db_update: PQexec returned NULL\n");
+    }
+    else
+    {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK)
+        {
+            fprintf(stderr, "db_update: query failed: %s\n", PQerrorMessage(c));
+        }
+        else
+        {
+            coherence_publish(id, score);
+        }
+        PQclear(res);
+    }
+
+    pool_release_connection(c);
+}
+
+// Upsert a batch in one statement; duplicate ids keep the last record of the batch
+void db_update_batch(const Player *recs, int n)
+{
+    if (n <= 0)
+        return;
+
+    PGconn *c = pool_get_connection();
+    if (!c)
+    {
+        fprintf(stderr, "db_update_batch: no connection available\n");
+        return;
+    }
+
+    // Postgres array literals: "{1,2,3}"
+    size_t cap = (size_t)n * 12 + 3;
+    char *ids = malloc(cap);
+    char *scores = malloc(cap);
+    if (!ids || !scores)
+    {
+        free(ids);
+        free(scores);
+        pool_release_connection(c);
+        return;
+    }
+    size_t ip = 0, sp = 0;
+    ids[ip++] = '{';
+    scores[sp++] = '{';
+    for (int i = 0; i < n; i++)
+    {
+        ip += snprintf(ids + ip, cap - ip, "%s%d", i ? "," : "", recs[i].id);
+        sp += snprintf(scores + sp, cap - sp, "%s%d", i ? "," : "", recs[i].score);
+    }
+    ids[ip++] = '}';
+    ids[ip] = '\0';
+    scores[sp++] = '}';
+    scores[sp] = '\0';
+
+    const char *params[2] = {ids, scores};
+    uint64_t t0 = trace_start();
+    PGresult *res = PQexecParams(c,
+                                 "INSERT INTO leaderboard (player_id, score, last_updated) "
+                                 "SELECT DISTINCT ON (u.id) u.id, u.score, now() "
+                                 "FROM unnest($1::int[], $2::int[]) WITH ORDINALITY AS u(id, score, ord) "
+                                 "ORDER BY u.id, u.ord DESC "
+                                 "ON CONFLICT (player_id) DO UPDATE SET score = EXCLUDED.score, last_updated = now();",
+                                 2, NULL, params, NULL, NULL, 0);
+    trace_end(TRACE_DB_EXEC, t0);
+    if (!res)
+    {
+        fprintf(stderr, "db_update_batch: PQexecParams returned NULL\n");
+    }
+    else
+    {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK)
+        {
+            fprintf(stderr, "db_update_batch: query failed: %s\n", PQerrorMessage(c));
+        }
+        else
+        {
+            coherence_publish_batch(recs, n);
+        }
+        PQclear(res);
+    }
+
+    free(ids);
+    free(scores);
+    pool_release_connection(c);
+}
+
+// Rows considered by each window, in the same (timestamp without time
+// zone) domain as last_updated
+static const char *topn_window_sql[TOPN_WINDOW_COUNT] = {
+    [TOPN_ALL] = "",
+    [TOPN_DAY] = "WHERE last_updated >= date_trunc('day', now()::timestamp) ",
+    [TOPN_WEEK] = "WHERE last_updated >= date_trunc('week', now()::timestamp) ",
+};
+
+// Conditional write for op=max|incr|cas. Returns 1 and the stored score
+// if the row changed, 0 if the condition did not hold, DB_OUT_OF_RANGE if
+// an incr would overflow the column, -1 on other errors.
+int db_update_op(int id, UpdateOp op, int value, int expect, int *out)
+{
+    PGconn *c = pool_get_connection();
+    if (!c)
+    {
+        fprintf(stderr, "db_update_op: no connection available\n");
+        return -1;
+    }
+
+    char q[320];
+    switch (op)
+    {
+    case UPDATE_MAX:
+        snprintf(q, sizeof(q),
+                 "INSERT INTO leaderboard (player_id, score, last_updated) VALUES (%d, %d, now()) "
+                 "ON CONFLICT (player_id) DO UPDATE SET score = EXCLUDED.score, last_updated = now() "
+                 "WHERE leaderboard.score < EXCLUDED.score RETURNING score;",
+                 id, value);
+        break;
+    case UPDATE_INCR:
+        snprintf(q, sizeof(q),
+                 "INSERT INTO leaderboard (player_id, score, last_updated) VALUES (%d, %d, now()) "
+                 "ON CONFLICT (player_id) DO UPDATE SET score = leaderboard.score + EXCLUDED.score, "
+                 "last_updated = now() RETURNING score;",
+                 id, value);
+        break;
+    case UPDATE_CAS:
+        snprintf(q, sizeof(q),
+                 "UPDATE leaderboard SET score = %d, last_updated = now() "
+                 "WHERE player_id = %d AND score = %d RETURNING score;",
+                 value, id, expect);
+        break;
+    default:
+        snprintf(q, sizeof(q),
+                 "INSERT INTO leaderboard (player_id, score, last_updated) VALUES (%d, %d, now()) "
+                 "ON CONFLICT (player_id) DO UPDATE SET score = EXCLUDED.score, last_updated = now() "
+                 "RETURNING score;",
+                 id, value);
+        break;
+    }
+
+    PGresult *res = db_exec(c, q);
+    int rc = -1;
+    if (!res)
+    {
+        fprintf(stderr, "db_update_op: PQexec returned NULL\n");
+    }
+    else
+    {
+        if (PQresultStatus(res) != PGRES_TUPLES_OK)
+        {
+            // 22003 numeric_value_out_of_range: the incr overflowed the column
+            const char *state = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+            if (state && strcmp(state, "22003") == 0)
+                rc = DB_OUT_OF_RANGE;
+            else
+                fprintf(stderr, "db_update_op: query failed: %s\n", PQerrorMessage(c));
+        }
+        else if (PQntuples(res) == 1)
+        {
+            *out = atoi(PQgetvalue(res, 0, 0));
+            rc = 1;
+            coherence_publish(id, *out);
+        }
+        else
+        {
+            rc = 0;
+        }
+        PQclear(res);
+    }
+
+    pool_release_connection(c);
+    return rc;
+}
+
+int db_get_top(Player *arr, int limit, TopNWindow w)
+{
+    PGconn *c = pool_get_connection();
+    if (!c)
+    {
+        fprintf(stderr, "db_get_top: no connection available\n");
+        return 0;
+    }
+
+    char q[256];
+    snprintf(q, sizeof(q), "SELECT player_id, score FROM leaderboard %sORDER BY score DESC LIMIT %d;",
+             topn_window_sql[w], limit);
+
+    PGresult *res = db_exec(c, q);
+    if (!res)
+    {
+        fprintf(stderr, "db_get_top: PQexec returned NULL\n");
+        pool_release_connection(c);
+        return 0;
+    }
+
+    if (PQresultStatus(res) != PGRES_TUPLES_OK)
+    {
+        fprintf(stderr, "db_get_top: query failed: %s\n", PQerrorMessage(c));
+        PQclear(res);
+        pool_release_connection(c);
+        return 0;
+    }
+
+    int rows = PQntuples(res);
+    for (int i = 0; i < rows; i++)
+    {
+        arr[i].id = atoi(PQgetvalue(res, i, 0));
+        arr[i].score = atoi(PQgetvalue(res, i, 1));
+    }
+    PQclear(res);
+    pool_release_connection(c);
+    return rows;
+}
+
+// Fetch many scores with one prepared ANY($1) query. out[i] is set for
+// every id found; returns the number of rows, -1 on error.
+int db_get_scores(const int *ids, int n, Player *out)
+{
+    PGconn *c = pool_get_connection();
+    if (!c)
+    {
+        fprintf(stderr, "db_get_scores: no connection available\n");
+        return -1;
+    }
+
+    // int[] literal: "{1,2,3}"
+    char *arr = malloc((size_t)n * 12 + 3);
+    if (!arr)
+    {
+        pool_release_connection(c);
+        return -1;
+    }
+    size_t pos = 0;
+    arr[pos++] = '{';
+    for (int i = 0; i < n; i++)
+        pos += sprintf(arr + pos, i ? ",%d" : "%d", ids[i]);
+    arr[pos++] = '}';
+    arr[pos] = '\0';
+
+    const char *params[1] = {arr};
+    uint64_t t0 = trace_start();
+    PGresult *res = PQexecPrepared(c, "get_scores", 1, params, NULL, NULL, 0);
+    trace_end(TRACE_DB_EXEC, t0);
+    const char *state = res ? PQresultErrorField(res, PG_DIAG_SQLSTATE) : NULL;
+    if (state && strcmp(state, "26000") == 0) // invalid_sql_statement_name
+    {
+        // The session lost its statements (reset outside pool_check, or a
+        // pooler in front of Postgres); prepare again and retry once
+        PQclear(res);
+        res = NULL;
+        if (pool_prepare(c) == 0)
+            res = PQexecPrepared(c, "get_scores", 1, params, NULL, NULL, 0);
+    }
+    free(arr);
+
+    int rows = -1;
+    if (!res)
+    {
+        fprintf(stderr, "db_get_scores: PQexecPrepared returned NULL\n");
+    }
+    else
+    {
+        if (PQresultStatus(res) != PGRES_TUPLES_OK)
+        {
+            fprintf(stderr, "db_get_scores: query failed: %s\n", PQerrorMessage(c));
+        }
+        else
+        {
+            rows = PQntuples(res);
+            for (int i = 0; i < rows && i < n; i++)
+            {
+                out[i].id = atoi(PQgetvalue(res, i, 0));
+                out[i].score = atoi(PQgetvalue(res, i, 1));
+            }
+            if (rows > n)
+                rows = n;
+        }
+        PQclear(res);
+    }
+
+    pool_release_connection(c);
+    return rows;
+}
+
+int db_get_score(int id)
+{
+    PGconn *c = pool_get_connection();
+    if (!c)
+    {
+        fprintf(stderr, "db_get_score: no connection available\n");
+        return -1;
+    }
+
+    char q[128];
+    snprintf(q, sizeof(q),
+             "SELECT score FROM leaderboard WHERE player_id=%d;", id);
+
+    PGresult *res = db_exec(c, q);
+    if (!res)
+    {
+        fprintf(stderr, "db_get_score: PQexec returned NULL\n");
+        pool_release_connection(c);
+        return -1;
+    }
+
+    if (PQresultStatus(res) != PGRES_TUPLES_OK)
+    {
+        if (PQntuples(res) == 0)
+        {
+            PQclear(res);
+            pool_release_connection(c);
+            return -1;
+        }
+        else
+        {
+            fprintf(stderr, "db_get_score: query failed: %s\n", PQerrorMessage(c));
+            PQclear(res);
+            pool_release_connection(c);
+            return -1;
+        }
+    }
+
+    int rows = PQntuples(res);
+    if (rows == 0)
+    {
+        PQclear(res);
+        pool_release_connection(c);
+        return -1;
+    }
+
+    int score = atoi(PQgetvalue(res, 0, 0));
+    PQclear(res);
+    pool_release_connection(c);
+    return score;
+}
+
+// Run a single-value bigint query; returns -1 on error
+long long db_query_bigint(const char *fn, const char *q)
+{
+    PGconn *c = pool_get_connection();
+    if (!c)
+    {
+        fprintf(stderr, "%s: no connection available\n", fn);
+        return -1;
+    }
+
+    PGresult *res = db_exec(c, q);
+    long long v = -1;
+    if (res && PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1 && !PQgetisnull(res, 0, 0))
+        v = atoll(PQgetvalue(res, 0, 0));
+    else if (res && PQresultStatus(res) != PGRES_TUPLES_OK)
+        fprintf(stderr, "%s: query failed: %s\n", fn, PQerrorMessage(c));
+    if (res)
+        PQclear(res);
+    pool_release_connection(c);
+    return v;
+}
+
+int db_time_zone(char *out, size_t len)
+{
+    PGconn *c = pool_get_connection();
+    if (!c)
+    {
+        fprintf(stderr, "db_time_zone: no connection available\n");
+        return -1;
+    }
+
+    PGresult *res = db_exec(c, "SHOW TimeZone;");
+    int rc = -1;
+    if (res && PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1)
+    {
+        snprintf(out, len, "%s", PQgetvalue(res, 0, 0));
+        rc = 0;
+    }
+    else
+        fprintf(stderr, "db_time_zone: query failed: %s\n", PQerrorMessage(c));
+    if (res)
+        PQclear(res);
+    pool_release_connection(c);
+    return rc;
+}
+
+// DB clock in microseconds, in the same (timestamp without time zone)
+// domain as last_updated. Rows written after this have last_updated > it.
+long long db_watermark()
+{
+    return db_query_bigint("db_watermark", "SELECT (extract(epoch FROM now()::timestamp) * 1000000)::bigint;");
+}
+
+// Newest last_updated in the table, same units as db_watermark(); 0 if empty
+long long db_high_water_mark()
+{
+    return db_query_bigint("db_high_water_mark",
+                           "SELECT COALESCE((extract(epoch FROM max(last_updated)) * 1000000)::bigint, 0) FROM leaderboard;");
+}
+
+// Rows updated after watermark, oldest first; returns count, or -1 on error
+int db_get_changed_since(long long watermark, Player *arr, int limit)
+{
+    PGconn *c = pool_get_connection();
+    if (!c)
+    {
+        fprintf(stderr, "db_get_changed_since: no connection available\n");
+        return -1;
+    }
+
+    char q[256];
+    snprintf(q, sizeof(q),
+             "SELECT player_id, score FROM leaderboard "
+             "WHERE last_updated > timestamp 'epoch' + %lld * interval '1 microsecond' "
+             "ORDER BY last_updated LIMIT %d;",
+             watermark, limit);
+
+    PGresult *res = db_exec(c, q);
+    if (!res || PQresultStatus(res) != PGRES_TUPLES_OK)
+    {
+        fprintf(stderr, "db_get_changed_since: query failed: %s\n", PQerrorMessage(c));
+        if (res)
+            PQclear(res);
+        pool_release_connection(c);
+        return -1;
+    }
+
+    int rows = PQntuples(res);
+    for (int i = 0; i < rows; i++)
+    {
+        arr[i].id = atoi(PQgetvalue(res, i, 0));
+        arr[i].score = atoi(PQgetvalue(res, i, 1));
+    }
+    PQclear(res);
+    pool_release_connection(c);
+    return rows;
+}
@@ -0,0 +1,97 @@
+#ifndef DB_H
+#define DB_H
+
+#include <stddef.h>
+#include "cache.h"
+#include "topn.h"
+
+// Storage layer behind modes 0, 2 and 3.
+//
+// db.c implements it on PostgreSQL through a pool that grows from
+// POOL_MIN_SIZE to POOL_SIZE connections on demand; db_stub.c is an in-memory stand-in with the same interface
+// (used by the in-process harness).
+
+#define POOL_SIZE 64     // default maximum
+#define POOL_MIN_SIZE 4  // default minimum, opened in parallel at startup
+#define POOL_SLOTS 256   // hard cap on the maximum
+#define POOL_HEALTH_CHECK_US 10000000LL // idle connections are checked this often
+#define POOL_MAINTAIN_INTERVAL_S 1
+
+// /update_score?op=
+typedef enum
+{
+    UPDATE_SET,  // overwrite (default)
+    UPDATE_MAX,  // keep the best score
+    UPDATE_INCR, // add to the current score (missing players start at 0)
+    UPDATE_CAS,  // set only if the current score equals expect=
+} UpdateOp;
+
+// Pool bounds, the acquire wait (ms) after which the pool grows and the
+// idle time (s) after which connections above the minimum are closed.
+// Negative (0 for max and idle) keeps the current value. May be called
+// before pool_init() or while running.
+void pool_configure(int min, int max, int grow_wait_ms, int idle_timeout_s);
+void pool_get_bounds(int *min, int *max);
+
+void pool_init(void);
+void pool_close(void);
+
+// Raw pooled connections and ad-hoc queries for bulk work (preload);
+// db.c only
+struct pg_conn *pool_get_connection(void);
+void pool_release_connection(struct pg_conn *c);
+
+// A dedicated connection outside the pool, e.g. for LISTEN; db.c only
+struct pg_conn *db_connect(void);
+
+// libpq connection string for the pool and db_connect() (default
+// PG_CONNINFO in config.h); set before pool_init(). db.c only
+void db_set_conninfo(const char *conninfo);
+
+// Run a single-value bigint query; returns -1 on error. fn names the
+// caller in error messages.
+long long db_query_bigint(const char *fn, const char *q);
+
+void db_update(int id, int score);
+
+// Upsert a batch in one statement; duplicate ids keep the last record of the batch
+void db_update_batch(const Player *recs, int n);
+
+// db_update_op: the new score does not fit in the score column
+#define DB_OUT_OF_RANGE -2
+
+// Conditional write for op=max|incr|cas. Returns 1 and the stored score
+// if the row changed, 0 if the condition did not hold, DB_OUT_OF_RANGE if
+// an incr would overflow the column, -1 on other errors.
+int db_update_op(int id, UpdateOp op, int value, int expect, int *out);
+
+// Best `limit` players of window w, highest first; returns count
+int db_get_top(Player *arr, int limit, TopNWindow w);
+
+// Scores of the given ids in one round trip; returns rows found, -1 on error
+int db_get_scores(const int *ids, int n, Player *out);
+
+// Returns -1 if the player has no score
+int db_get_score(int id);
+
+// The sessions' TimeZone setting, which date_trunc() and last_updated
+// follow; 0 on success
+int db_time_zone(char *out, size_t len);
+
+// DB clock in microseconds, in the same domain as last_updated
+long long db_watermark(void);
+
+// Newest last_updated in the table, same units as db_watermark(); 0 if empty
+long long db_high_water_mark(void);
+
+// Rows updated after watermark, oldest first; returns count, or -1 on error
+int db_get_changed_since(long long watermark, Player *arr, int limit);
+
+// db_stub.c only: fixed delay added to every call, how many calls may be
+// in that delay at once (0 = unlimited; the rest queue, like on the pool),
+// and dropping all rows
+void db_stub_set_latency(int us);
+void db_stub_set_capacity(int n);
+void db_stub_clear(void);
+
+#endif // DB_H
@@ -0,0 +1,302 @@
+#include "db.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "uthash.h"
+#include "metrics.h"
+#include "trace.h"
+
+// In-memory stand-in for db.c: one uthash table of rows under a mutex,
+// with an optional fixed delay per call in place of the network round
+// trip. Window queries compare last_updated against local midnight and
+// Monday, as date_trunc() does on the server.
+
+typedef struct
+{
+    int id;
+    int score;
+    time_t last_updated;
+    UT_hash_handle hh;
+} StubRow;
+
+static StubRow *rows;
+static pthread_mutex_t rows_lock = PTHREAD_MUTEX_INITIALIZER;
+static int latency_us;
+static int capacity; // 0 = unlimited
+static int busy;
+static pthread_mutex_t slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slot_free = PTHREAD_COND_INITIALIZER;
+
+void db_stub_set_latency(int us)
+{
+    latency_us = us > 0 ? us : 0;
+}
+
+void db_stub_set_capacity(int n)
+{
+    pthread_mutex_lock(&slots_lock);
+    capacity = n > 0 ? n : 0;
+    pthread_cond_broadcast(&slot_free);
+    pthread_mutex_unlock(&slots_lock);
+}
+
+void db_stub_clear()
+{
+    pthread_mutex_lock(&rows_lock);
+    StubRow *r, *tmp;
+    HASH_ITER(hh, rows, r, tmp)
+    {
+        HASH_DEL(rows, r);
+        free(r);
+    }
+    pthread_mutex_unlock(&rows_lock);
+}
+
+// Stands in for the query round trip; the delay is not taken under rows_lock.
+// With a capacity, callers beyond it wait for a slot first, so the stub
+// saturates like a real pool instead of scaling with the caller count.
+static void stub_round_trip()
+{
+    uint64_t t0 = trace_start();
+    if (latency_us)
+    {
+        pthread_mutex_lock(&slots_lock);
+        while (capacity && busy >= capacity)
+            pthread_cond_wait(&slot_free, &slots_lock);
+        busy++;
+        pthread_mutex_unlock(&slots_lock);
+
+        struct timespec ts = {latency_us / 1000000, (long)(latency_us % 1000000) * 1000};
+        nanosleep(&ts, NULL);
+
+        pthread_mutex_lock(&slots_lock);
+        busy--;
+        pthread_cond_signal(&slot_free);
+        pthread_mutex_unlock(&slots_lock);
+    }
+    trace_end(TRACE_DB_EXEC, t0);
+}
+
+// Must hold rows_lock; NULL on allocation failure
+static StubRow *row_upsert_locked(int id)
+{
+    StubRow *r;
+    HASH_FIND_INT(rows, &id, r);
+    if (!r)
+    {
+        r = malloc(sizeof(StubRow));
+        if (!r)
+            return NULL;
+        r->id = id;
+        r->score = 0;
+        HASH_ADD_INT(rows, id, r);
+    }
+    r->last_updated = time(NULL);
+    return r;
+}
+
+static int stub_pool_min = POOL_MIN_SIZE, stub_pool_max = POOL_SIZE;
+
+void pool_configure(int min, int max, int grow_wait_ms, int idle_timeout_s)
+{
+    if (max > 0)
+        stub_pool_max = max < POOL_SLOTS ? max : POOL_SLOTS;
+    if (min >= 0)
+        stub_pool_min = min;
+    if (stub_pool_min > stub_pool_max)
+        stub_pool_min = stub_pool_max;
+}
+
+void pool_get_bounds(int *min, int *max)
+{
+    *min = stub_pool_min;
+    *max = stub_pool_max;
+}
+
+void pool_init()
+{
+    metrics_gauge_set(METRIC_POOL_SIZE, stub_pool_max);
+}
+
+void pool_close()
+{
+    db_stub_clear();
+}
+
+void db_update(int id, int score)
+{
+    stub_round_trip();
+    pthread_mutex_lock(&rows_lock);
+    StubRow *r = row_upsert_locked(id);
+    if (r)
+        r->score = score;
+    pthread_mutex_unlock(&rows_lock);
+}
+
+void db_update_batch(const Player *recs, int n)
+{
+    if (n <= 0)
+        return;
+    stub_round_trip();
+    pthread_mutex_lock(&rows_lock);
+    for (int i = 0; i < n; i++)
+    {
+        StubRow *r = row_upsert_locked(recs[i].id);
+        if (r)
+            r->score = recs[i].score;
+    }
+    pthread_mutex_unlock(&rows_lock);
+}
+
+int db_update_op(int id, UpdateOp op, int value, int expect, int *out)
+{
+    stub_round_trip();
+    pthread_mutex_lock(&rows_lock);
+    StubRow *r;
+    HASH_FIND_INT(rows, &id, r);
+
+    int rc = 1;
+    int score = value;
+    switch (op)
+    {
+    case UPDATE_MAX:
+        if (r && r->score >= value)
+            rc = 0;
+        break;
+    case UPDATE_INCR:
+        if (r && __builtin_add_overflow(r->score, value, &score))
+            rc = DB_OUT_OF_RANGE;
+        break;
+    case UPDATE_CAS:
+        if (!r || r->score != expect)
+            rc = 0;
+        break;
+    default:
+        break;
+    }
+
+    if (rc == 1)
+    {
+        r = row_upsert_locked(id);
+        if (r)
+        {
+            r->score = score;
+            *out = score;
+        }
+        else
+        {
+            rc = -1;
+        }
+    }
+    pthread_mutex_unlock(&rows_lock);
+    return rc;
+}
+
+// Start of the day/week window containing `now`
+static time_t window_start(TopNWindow w, time_t now)
+{
+    struct tm tm;
+    localtime_r(&now, &tm);
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    if (w == TOPN_WEEK)
+        tm.tm_mday -= (tm.tm_wday + 6) % 7; // back to Monday
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+int db_get_top(Player *arr, int limit, TopNWindow w)
+{
+    if (limit <= 0)
+        return 0;
+    stub_round_trip();
+    time_t since = w == TOPN_ALL ? 0 : window_start(w, time(NULL));
+
+    // One pass keeping the best `limit` rows sorted, highest first
+    int count = 0;
+    pthread_mutex_lock(&rows_lock);
+    for (StubRow *r = rows; r; r = r->hh.next)
+    {
+        if (r->last_updated < since)
+            continue;
+        if (count == limit && r->score <= arr[count - 1].score)
+            continue;
+        int pos = count < limit ? count++ : limit - 1;
+        while (pos > 0 && arr[pos - 1].score < r->score)
+        {
+            arr[pos] = arr[pos - 1];
+            pos--;
+        }
+        arr[pos].id = r->id;
+        arr[pos].score = r->score;
+    }
+    pthread_mutex_unlock(&rows_lock);
+    return count;
+}
+
+int db_get_scores(const int *ids, int n, Player *out)
+{
+    stub_round_trip();
+    int found = 0;
+    pthread_mutex_lock(&rows_lock);
+    for (int i = 0; i < n; i++)
+    {
+        StubRow *r;
+        HASH_FIND_INT(rows, &ids[i], r);
+        if (r)
+        {
+            out[found].id = r->id;
+            out[found].score = r->score;
+            found++;
+        }
+    }
+    pthread_mutex_unlock(&rows_lock);
+    return found;
+}
+
+int db_get_score(int id)
+{
+    stub_round_trip();
+    pthread_mutex_lock(&rows_lock);
+    StubRow *r;
+    HASH_FIND_INT(rows, &id, r);
+    int score = r ? r->score : -1;
+    pthread_mutex_unlock(&rows_lock);
+    return score;
+}
+
+long long db_watermark()
+{
+    return (long long)time(NULL) * 1000000;
+}
+
+long long db_high_water_mark()
+{
+    long long hwm = 0;
+    pthread_mutex_lock(&rows_lock);
+    for (StubRow *r = rows; r; r = r->hh.next)
+    {
+        if ((long long)r->last_updated * 1000000 > hwm)
+            hwm = (long long)r->last_updated * 1000000;
+    }
+    pthread_mutex_unlock(&rows_lock);
+    return hwm;
+}
+
+// Changed rows are not ordered by time here; callers only use the set
+int db_get_changed_since(long long watermark, Player *arr, int limit)
+{
+    int count = 0;
+    pthread_mutex_lock(&rows_lock);
+    for (StubRow *r = rows; r && count < limit; r = r->hh.next)
+    {
+        if ((long long)r->last_updated * 1000000 > watermark)
+        {
+            arr[count].id = r->id;
+            arr[count].score = r->score;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&rows_lock);
+    return count;
+}
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Goodput under overload, with and without the admission limiter.
+#
+# Runs the in-process harness against a saturating stub DB for each
+# thread count and limiter, and prints one CSV row per run:
+#   threads,limiter,goodput_rps,shed
+# Goodput counts 2xx answers within SLO_MS; shed counts 503s.
+#
+# Usage: ./goodput_curve.sh [thread counts...]      (default: 4 8 16 32 64)
+#
+# Environment:
+#   MODE=0          server mode (the limiter only guards 0, 2 and 3)
+#   LIMITERS="off aimd gradient"
+#   DB_LATENCY=1000 stub DB time per call, us
+#   DB_CAPACITY=8   stub DB calls in flight at once
+#   SLO_MS=10       goodput deadline
+#   DEADLINE_MS=3   limiter queue deadline
+#   SECONDS_PER_RUN=3
+#   MIX=update=50,get=50
+
+MODE=${MODE:-0}
+LIMITERS=${LIMITERS:-off aimd gradient}
+DB_LATENCY=${DB_LATENCY:-1000}
+DB_CAPACITY=${DB_CAPACITY:-8}
+SLO_MS=${SLO_MS:-10}
+DEADLINE_MS=${DEADLINE_MS:-3}
+SECONDS_PER_RUN=${SECONDS_PER_RUN:-3}
+MIX=${MIX:-update=50,get=50}
+COUNTS=${*:-4 8 16 32 64}
+
+echo "threads,limiter,goodput_rps,shed"
+for n in $COUNTS; do
+    for l in $LIMITERS; do
+        ./harness --modes "$MODE" --threads "$n" --seconds "$SECONDS_PER_RUN" --mix "$MIX" \
+            --db-latency "$DB_LATENCY" --db-capacity "$DB_CAPACITY" --slo-ms "$SLO_MS" \
+            --queue-deadline-ms "$DEADLINE_MS" --limiter "$l" 2>&1 >/dev/null |
+            sed -n "s/^mode [0-9] goodput *\([0-9]*\) req\/s, shed \([0-9]*\).*/$n,$l,\1,\2/p"
+    done
+done
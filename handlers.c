@@ -0,0 +1,1035 @@
+#include "handlers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include "topn.h"
+#include "json.h"
+#include "db.h"
+#include "reqlog.h"
+#include "trace.h"
+#include "wal.h"
+#include "repl.h"
+#include "admission.h"
+#include "config.h"
+
+#define MAX_MULTI_GET 1000 // ids per /get_scores request
+
+int mode = 0; // 0=DB-only, 1=Caches-only, 2=LRU+DB, 3=All
+int wal_enabled = 0;
+int read_only = 0;
+const char *admin_token = NULL;
+
+long long now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// ---------- Durable Update Section ----------
+//
+// Mode 1 with --wal-dir: see the Snapshot & Durability section of server.c.
+
+// Apply an update to both caches and append it to the WAL while holding
+// cache_lock, so WAL order matches the order the caches saw. Returns the LSN.
+// Callers reserve the WAL slot first so a full buffer never stalls other
+// cache_lock holders.
+static uint64_t durable_update_locked(int id, int score)
+{
+    cache_update_locked(id, score);
+    pthread_mutex_lock(&topn_lock);
+    topn_update_locked(id, score);
+    pthread_mutex_unlock(&topn_lock);
+    return wal_append(id, score);
+}
+
+int durable_update(int id, int score)
+{
+    wal_reserve(1);
+    pthread_mutex_lock(&cache_lock);
+    uint64_t lsn = durable_update_locked(id, score);
+    pthread_mutex_unlock(&cache_lock);
+    return wal_wait(lsn);
+}
+
+int durable_update_batch(const Player *recs, int n)
+{
+    uint64_t lsn = 0;
+    for (int i = 0; i < n; i += WAL_BUFFER_RECORDS)
+    {
+        int chunk = n - i < WAL_BUFFER_RECORDS ? n - i : WAL_BUFFER_RECORDS;
+        wal_reserve(chunk);
+        pthread_mutex_lock(&cache_lock);
+        for (int k = i; k < i + chunk; k++)
+            lsn = durable_update_locked(recs[k].id, recs[k].score);
+        pthread_mutex_unlock(&cache_lock);
+    }
+    return n > 0 ? wal_wait(lsn) : 0;
+}
+
+// ---------- Conditional Update Section ----------
+//
+// op=max|incr|cas are decided against the cached score first: when the
+// LRU knows the player and the op would not change it, nothing is written
+// anywhere. Otherwise the DB gets a matching conditional statement, which
+// stays correct even if the cache was stale.
+
+typedef enum
+{
+    UPDATE_APPLIED,
+    UPDATE_UNCHANGED, // valid op that changed nothing (max not better, incr 0, ...)
+    UPDATE_CONFLICT,  // cas: current score != expect
+    UPDATE_OVERFLOW,  // incr: the new score would not fit in an int
+    UPDATE_FAILED,
+    UPDATE_SHED, // the DB path was over its concurrency limit
+} UpdateOutcome;
+
+// Evaluate op against a known current score (have=0: player has no score)
+static UpdateOutcome update_op_eval(UpdateOp op, int have, int cur, int value, int expect, int *out)
+{
+    int sum;
+    switch (op)
+    {
+    case UPDATE_MAX:
+        if (have && cur >= value)
+            return UPDATE_UNCHANGED;
+        *out = value;
+        return UPDATE_APPLIED;
+    case UPDATE_INCR:
+        if (have && value == 0)
+            return UPDATE_UNCHANGED;
+        if (__builtin_add_overflow(have ? cur : 0, value, &sum))
+            return UPDATE_OVERFLOW; // *out keeps the current score
+        *out = sum;
+        return UPDATE_APPLIED;
+    case UPDATE_CAS:
+        if (!have || cur != expect)
+            return UPDATE_CONFLICT;
+        if (cur == value)
+            return UPDATE_UNCHANGED;
+        *out = value;
+        return UPDATE_APPLIED;
+    default:
+        *out = value;
+        return UPDATE_APPLIED;
+    }
+}
+
+// Look up and, if the op changes it, update the cached score in one
+// cache_lock section. Returns -1 on a cache miss (outcome undecided).
+static int cache_apply_op(int id, UpdateOp op, int value, int expect, int *score, UpdateOutcome *outcome)
+{
+    uint64_t t0 = trace_start();
+    pthread_mutex_lock(&cache_lock);
+    trace_end(TRACE_CACHE_LOCK_WAIT, t0);
+
+    uint64_t t1 = trace_start();
+    LRUNode *node = cache_find_locked(id);
+    if (!node)
+    {
+        trace_end(TRACE_CACHE_OP, t1);
+        pthread_mutex_unlock(&cache_lock);
+        metrics_count(METRIC_CACHE_MISSES, 1);
+        return -1;
+    }
+
+    *score = node->score;
+    *outcome = update_op_eval(op, 1, node->score, value, expect, score);
+    if (*outcome == UPDATE_APPLIED)
+        cache_update_locked(id, *score);
+    trace_end(TRACE_CACHE_OP, t1);
+    pthread_mutex_unlock(&cache_lock);
+    metrics_count(METRIC_CACHE_HITS, 1);
+    return 0;
+}
+
+// Mode 1: the caches are the only copy, so a miss means "no score yet"
+static UpdateOutcome update_conditional_cache_only(int id, UpdateOp op, int value, int expect, int *score)
+{
+    if (wal_enabled)
+        wal_reserve(1);
+    pthread_mutex_lock(&cache_lock);
+    LRUNode *node = cache_find_locked(id);
+    *score = node ? node->score : -1;
+    UpdateOutcome o = update_op_eval(op, node != NULL, *score, value, expect, score);
+    if (o == UPDATE_APPLIED)
+    {
+        if (wal_enabled)
+        {
+            uint64_t lsn = durable_update_locked(id, *score);
+            pthread_mutex_unlock(&cache_lock);
+            return wal_wait(lsn) == 0 ? o : UPDATE_FAILED;
+        }
+        cache_update_locked(id, *score);
+        pthread_mutex_lock(&topn_lock);
+        topn_update_locked(id, *score);
+        pthread_mutex_unlock(&topn_lock);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (wal_enabled)
+        wal_unreserve(1);
+    return o;
+}
+
+// Apply op=max|incr|cas in the current mode. *score is the player's score
+// afterwards (-1 if unknown); *flags gets the REQLOG_WROTE_* bits.
+static UpdateOutcome update_conditional(int id, UpdateOp op, int value, int expect, int *score, int *flags)
+{
+    *flags = 0;
+    *score = -1;
+
+    if (mode == 1)
+    {
+        UpdateOutcome o = update_conditional_cache_only(id, op, value, expect, score);
+        if (o == UPDATE_APPLIED)
+            *flags = REQLOG_WROTE_LRU | REQLOG_WROTE_TOPN;
+        else if (o == UPDATE_UNCHANGED || o == UPDATE_CONFLICT)
+            metrics_count(METRIC_WRITES_AVOIDED, 1);
+        return o;
+    }
+
+    // Admitted before touching the LRU, so a shed request changes nothing
+    long long admitted = admission_enter();
+    if (admitted < 0)
+        return UPDATE_SHED;
+
+    int cached = 0;
+    int cache_score = 0;
+    if (mode == 2 || mode == 3)
+    {
+        UpdateOutcome o;
+        if (cache_apply_op(id, op, value, expect, &cache_score, &o) == 0)
+        {
+            if (o != UPDATE_APPLIED)
+            {
+                admission_exit(admitted);
+                *score = cache_score;
+                if (o == UPDATE_UNCHANGED || o == UPDATE_CONFLICT)
+                    metrics_count(METRIC_WRITES_AVOIDED, 1);
+                return o;
+            }
+            cached = 1;
+            *flags |= REQLOG_WROTE_LRU;
+        }
+    }
+
+    int db_score = 0;
+    int rc = db_update_op(id, op, value, expect, &db_score);
+    if (rc < 0)
+    {
+        admission_exit(admitted);
+        // The LRU already holds the new score but it was never stored
+        if (cached)
+            cache_invalidate(&id, 1);
+        return rc == DB_OUT_OF_RANGE ? UPDATE_OVERFLOW : UPDATE_FAILED;
+    }
+    *flags |= REQLOG_WROTE_DB;
+
+    if (rc == 0)
+    {
+        // The condition failed in the DB although the cache said otherwise
+        // (or nothing was cached): re-read the real score so the cache
+        // stops answering from a stale value
+        db_score = db_get_score(id);
+        admission_exit(admitted);
+        *score = db_score;
+        if (cached && db_score >= 0)
+            cache_update(id, db_score);
+        else if (cached)
+            cache_invalidate(&id, 1);
+        return op == UPDATE_CAS ? UPDATE_CONFLICT : UPDATE_UNCHANGED;
+    }
+
+    admission_exit(admitted);
+    *score = db_score;
+    if (mode == 2 || mode == 3)
+    {
+        if (!cached || db_score != cache_score)
+            cache_update(id, db_score);
+        *flags |= REQLOG_WROTE_LRU;
+    }
+    if (mode == 3)
+    {
+        topn_update(id, db_score);
+        *flags |= REQLOG_WROTE_TOPN;
+    }
+    return UPDATE_APPLIED;
+}
+
+// ---------- HTTP Handlers ----------
+
+static enum MHD_Result route_request(struct MHD_Connection *conn_http, const char *url, const char *method);
+
+static void (*metrics_hook)(MetricsBuf *b);
+
+void handlers_set_metrics_hook(void (*fn)(MetricsBuf *b))
+{
+    metrics_hook = fn;
+}
+
+// Record request latency and queue a log record (followed by args, for
+// replay); formatting and I/O happen on the reqlog drain thread
+static void record_request_args(int type, int cache_hit, int flags, long long start, long long end, int id, int score,
+                                const int *args, int nargs)
+{
+    static const MetricHist hist_for_type[] = {
+        [REQLOG_LEADERBOARD] = METRIC_LAT_LEADERBOARD,
+        [REQLOG_UPDATE] = METRIC_LAT_UPDATE_SCORE,
+        [REQLOG_GET] = METRIC_LAT_GET_SCORE,
+        [REQLOG_MULTIGET] = METRIC_LAT_GET_SCORES,
+    };
+    metrics_record(hist_for_type[type], end - start);
+
+    if (!reqlog_sampled())
+        return;
+
+    ReqLogRecord rec;
+    rec.ts_us = (uint64_t)start;
+    rec.latency_us = (uint32_t)(end - start);
+    rec.id = id;
+    rec.score = score;
+    rec.type = (uint8_t)type;
+    rec.mode = (uint8_t)mode;
+    rec.cache_hit = (uint8_t)cache_hit;
+    rec.flags = (uint8_t)flags;
+    reqlog_write_args(&rec, (const int32_t *)args, nargs);
+}
+
+static void record_request(int type, int cache_hit, int flags, long long start, long long end, int id, int score)
+{
+    record_request_args(type, cache_hit, flags, start, end, id, score, NULL, 0);
+}
+
+// Request body collected across MHD upload callbacks (POST /get_scores)
+typedef struct
+{
+    char *data;
+    size_t len;
+} RequestBody;
+
+#define MAX_REQUEST_BODY (64 * 1024)
+
+static enum MHD_Result handle_get_scores(struct MHD_Connection *conn_http, const char *body);
+
+// 503 for DB-bound work the admission limiter turned away
+static enum MHD_Result reply_shed(struct MHD_Connection *conn_http)
+{
+    const char *err = "{\"error\":\"overloaded\"}";
+    struct MHD_Response *res = MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
+    MHD_add_response_header(res, "Retry-After", ADMISSION_RETRY_AFTER);
+    int ret = MHD_queue_response(conn_http, MHD_HTTP_SERVICE_UNAVAILABLE, res);
+    MHD_destroy_response(res);
+    return ret;
+}
+
+enum MHD_Result handle_request(void *cls, struct MHD_Connection *conn_http,
+                               const char *url, const char *method,
+                               const char *ver, const char *upload_data,
+                               size_t *upload_data_size, void **con_cls)
+{
+    if (strcmp(method, "POST") == 0 && strcmp(url, "/get_scores") == 0)
+    {
+        RequestBody *body = *con_cls;
+        if (!body)
+        {
+            body = calloc(1, sizeof(RequestBody));
+            if (!body)
+                return MHD_NO;
+            *con_cls = body;
+            return MHD_YES;
+        }
+        if (*upload_data_size)
+        {
+            if (body->len + *upload_data_size > MAX_REQUEST_BODY)
+                return MHD_NO;
+            char *p = realloc(body->data, body->len + *upload_data_size + 1);
+            if (!p)
+                return MHD_NO;
+            memcpy(p + body->len, upload_data, *upload_data_size);
+            body->data = p;
+            body->len += *upload_data_size;
+            body->data[body->len] = '\0';
+            *upload_data_size = 0;
+            return MHD_YES;
+        }
+
+        trace_begin("get_scores");
+        enum MHD_Result ret = handle_get_scores(conn_http, body->data ? body->data : "");
+        trace_finish();
+        return ret;
+    }
+
+    trace_begin(strncmp(url, "/leaderboard", 12) == 0     ? "leaderboard"
+                : strncmp(url, "/update_score", 13) == 0 ? "update_score"
+                : strncmp(url, "/get_scores", 11) == 0   ? "get_scores"
+                : strncmp(url, "/get_score", 10) == 0    ? "get_score"
+                                                         : "other");
+    enum MHD_Result ret = route_request(conn_http, url, method);
+    trace_finish();
+    return ret;
+}
+
+void request_completed(void *cls, struct MHD_Connection *conn_http, void **con_cls,
+                       enum MHD_RequestTerminationCode toe)
+{
+    RequestBody *body = *con_cls;
+    if (body)
+    {
+        free(body->data);
+        free(body);
+        *con_cls = NULL;
+    }
+}
+
+// Parse a non-negative integer argument; returns 1 if present, -1 if malformed
+static int admin_arg(struct MHD_Connection *conn_http, const char *name, int *out)
+{
+    const char *q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, name);
+    if (!q)
+        return 0;
+    char *end;
+    long v = strtol(q, &end, 10);
+    if (end == q || *end || v < 0 || v > 1000000000)
+        return -1;
+    *out = (int)v;
+    return 1;
+}
+
+// With --admin-token the X-Admin-Token header must match it; otherwise
+// only clients on the loopback interface may use /admin/config
+static int admin_allowed(struct MHD_Connection *conn_http)
+{
+    if (admin_token)
+    {
+        const char *t = MHD_lookup_connection_value(conn_http, MHD_HEADER_KIND, "X-Admin-Token");
+        size_t len = strlen(admin_token);
+        if (!t || strlen(t) != len)
+            return 0;
+        // Compare every byte so the time taken does not reveal the prefix
+        unsigned char diff = 0;
+        for (size_t i = 0; i < len; i++)
+            diff |= (unsigned char)t[i] ^ (unsigned char)admin_token[i];
+        return diff == 0;
+    }
+
+    const union MHD_ConnectionInfo *ci = MHD_get_connection_info(conn_http, MHD_CONNECTION_INFO_CLIENT_ADDRESS);
+    const struct sockaddr *sa = ci ? ci->client_addr : NULL;
+    if (!sa)
+        return 0;
+    if (sa->sa_family == AF_INET)
+        return (ntohl(((const struct sockaddr_in *)sa)->sin_addr.s_addr) >> 24) == 127;
+    if (sa->sa_family == AF_INET6)
+    {
+        const struct in6_addr *a = &((const struct sockaddr_in6 *)sa)->sin6_addr;
+        return IN6_IS_ADDR_LOOPBACK(a) || (IN6_IS_ADDR_V4MAPPED(a) && a->s6_addr[12] == 127);
+    }
+    return 0;
+}
+
+// GET /admin/config shows the resizable settings; POST with any of
+// cache_size=, topn_size=, pool_min=, pool_max= changes them. Shrinking
+// the LRU evicts in chunks (see cache_set_capacity); growing Top-N in
+// mode 3 refills the new ranks from the DB.
+static enum MHD_Result handle_admin_config(struct MHD_Connection *conn_http, int apply)
+{
+    static pthread_mutex_t admin_lock = PTHREAD_MUTEX_INITIALIZER;
+    int cache_size = -1, topn_size = -1, pmin = -1, pmax = -1, evicted = 0;
+    const char *err = NULL;
+
+    pthread_mutex_lock(&admin_lock);
+    int cur_min, cur_max;
+    pool_get_bounds(&cur_min, &cur_max);
+    if (apply)
+    {
+        int has_cache = admin_arg(conn_http, "cache_size", &cache_size);
+        int has_topn = admin_arg(conn_http, "topn_size", &topn_size);
+        int has_min = admin_arg(conn_http, "pool_min", &pmin);
+        int has_max = admin_arg(conn_http, "pool_max", &pmax);
+        int new_min = has_min > 0 ? pmin : cur_min, new_max = has_max > 0 ? pmax : cur_max;
+
+        if (has_cache < 0 || has_topn < 0 || has_min < 0 || has_max < 0)
+            err = "{\"error\":\"invalid value\"}";
+        else if (has_cache > 0 && cache_size < 1)
+            err = "{\"error\":\"cache_size must be at least 1\"}";
+        else if (has_topn > 0 && (topn_size < 1 || topn_size > TOPN_MAX_SIZE))
+            err = "{\"error\":\"topn_size out of range\"}";
+        else if ((has_min > 0 || has_max > 0) && mode == 1)
+            err = "{\"error\":\"no DB pool in mode 1\"}";
+        else if (new_max < 1 || new_max > POOL_SLOTS || new_min > new_max)
+            err = "{\"error\":\"pool bounds must satisfy pool_min <= pool_max <= 256\"}";
+
+        if (!err)
+        {
+            if (has_cache > 0)
+                evicted = cache_set_capacity(cache_size);
+            if (has_topn > 0)
+            {
+                int grew = topn_size > topn_get_depth();
+                topn_set_depth(topn_size);
+                if (grew && mode == 3)
+                {
+                    Player temp[TOPN_MAX_SIZE];
+                    for (int w = 0; w < TOPN_WINDOW_COUNT; w++)
+                    {
+                        int count = db_get_top(temp, topn_size, w);
+                        topn_merge_window(w, temp, count);
+                    }
+                }
+            }
+            if (has_min > 0 || has_max > 0)
+                pool_configure(new_min, new_max, -1, 0);
+            pool_get_bounds(&cur_min, &cur_max);
+            if (has_max > 0)
+                admission_set_pool_size(cur_max);
+        }
+    }
+    pthread_mutex_unlock(&admin_lock);
+
+    if (err)
+    {
+        struct MHD_Response *res = MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
+        int ret = MHD_queue_response(conn_http, MHD_HTTP_BAD_REQUEST, res);
+        MHD_destroy_response(res);
+        return ret;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    int capacity = cache_capacity, entries = cache_count;
+    pthread_mutex_unlock(&cache_lock);
+    char json[256];
+    snprintf(json, sizeof(json),
+             "{\"cache_size\":%d,\"cache_entries\":%d,\"evicted\":%d,\"topn_size\":%d,\"pool_min\":%d,"
+             "\"pool_max\":%d}",
+             capacity, entries, evicted, topn_get_depth(), cur_min, cur_max);
+    struct MHD_Response *res = MHD_create_response_from_buffer(strlen(json), strdup(json), MHD_RESPMEM_MUST_FREE);
+    MHD_add_response_header(res, "Content-Type", "application/json");
+    int ret = MHD_queue_response(conn_http, MHD_HTTP_OK, res);
+    MHD_destroy_response(res);
+    return ret;
+}
+
+// Parse ids from "1,2,3", "[1, 2, 3]" or {"ids":[1,2,3]}: every integer
+// in the text is taken. Returns the count, or -1 if there are too many.
+static int parse_id_list(const char *s, int *ids, int max)
+{
+    int n = 0;
+    while (*s)
+    {
+        if ((*s >= '0' && *s <= '9') || (*s == '-' && s[1] >= '0' && s[1] <= '9'))
+        {
+            char *end;
+            long v = strtol(s, &end, 10);
+            if (n == max)
+                return -1;
+            ids[n++] = (int)v;
+            s = end;
+        }
+        else
+        {
+            s++;
+        }
+    }
+    return n;
+}
+
+// GET /get_scores?ids=1,2,3 or POST /get_scores with the ids in the body.
+// Hits are resolved in one cache pass; all misses go to the DB in one
+// query and are added to the cache.
+static enum MHD_Result handle_get_scores(struct MHD_Connection *conn_http, const char *body)
+{
+    long long start = now_us();
+
+    int *ids = malloc(sizeof(int) * MAX_MULTI_GET);
+    int *scores = malloc(sizeof(int) * MAX_MULTI_GET);
+    char *hit = malloc(MAX_MULTI_GET);
+    int n = ids && scores && hit ? parse_id_list(body, ids, MAX_MULTI_GET) : -1;
+    if (n <= 0)
+    {
+        free(ids);
+        free(scores);
+        free(hit);
+        const char *err = n < 0 ? "{\"error\":\"too many ids\"}" : "{\"error\":\"missing ids\"}";
+        struct MHD_Response *res = MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
+        int ret = MHD_queue_response(conn_http, MHD_HTTP_BAD_REQUEST, res);
+        MHD_destroy_response(res);
+        return ret;
+    }
+
+    int hits = 0;
+    if (mode == 0)
+    {
+        for (int i = 0; i < n; i++)
+            scores[i] = -1;
+    }
+    else
+    {
+        hits = cache_get_scores(ids, n, scores);
+    }
+    for (int i = 0; i < n; i++)
+        hit[i] = scores[i] >= 0;
+
+    long long admitted = 0;
+    if ((mode == 0 || mode == 2 || mode == 3) && hits < n && (admitted = admission_enter()) < 0)
+    {
+        free(ids);
+        free(scores);
+        free(hit);
+        return reply_shed(conn_http);
+    }
+    if ((mode == 0 || mode == 2 || mode == 3) && hits < n)
+    {
+        int *missing = malloc(sizeof(int) * (n - hits));
+        Player *found = malloc(sizeof(Player) * (n - hits));
+        int nmiss = 0;
+        for (int i = 0; missing && i < n; i++)
+        {
+            if (scores[i] < 0)
+                missing[nmiss++] = ids[i];
+        }
+
+        int rows = (missing && found) ? db_get_scores(missing, nmiss, found) : -1;
+        admission_exit(admitted);
+        if (rows < 0)
+        {
+            // The misses are unknown, not absent: -1 would read as "no score"
+            free(missing);
+            free(found);
+            free(ids);
+            free(scores);
+            free(hit);
+            const char *err = "{\"error\":\"database unavailable\"}";
+            struct MHD_Response *res = MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
+            int ret = MHD_queue_response(conn_http, MHD_HTTP_SERVICE_UNAVAILABLE, res);
+            MHD_destroy_response(res);
+            return ret;
+        }
+        if (rows > 0)
+        {
+            // Small n: match rows back to the requested ids directly
+            for (int r = 0; r < rows; r++)
+            {
+                for (int i = 0; i < n; i++)
+                {
+                    if (ids[i] == found[r].id && scores[i] < 0)
+                        scores[i] = found[r].score;
+                }
+            }
+            if (mode != 0)
+                cache_update_batch(found, rows);
+        }
+        free(missing);
+        free(found);
+    }
+
+    long long end = now_us();
+    record_request_args(REQLOG_MULTIGET, hits == n, 0, start, end, n, hits, ids, n);
+
+    uint64_t tj = trace_start();
+    MetricsBuf b = {0};
+    mbuf_printf(&b, "{\"scores\":[");
+    for (int i = 0; i < n; i++)
+    {
+        mbuf_printf(&b, "%s{\"id\":%d,\"score\":%d,\"cache_hit\":%d}", i ? "," : "", ids[i], scores[i], hit[i]);
+    }
+    mbuf_printf(&b, "],\"hits\":%d,\"misses\":%d}", hits, n - hits);
+    trace_end(TRACE_JSON, tj);
+    free(ids);
+    free(scores);
+    free(hit);
+
+    if (!b.data)
+        return MHD_NO;
+    struct MHD_Response *res = MHD_create_response_from_buffer(b.len, b.data, MHD_RESPMEM_MUST_FREE);
+    MHD_add_response_header(res, "Content-Type", "application/json");
+    int ret = MHD_queue_response(conn_http, MHD_HTTP_OK, res);
+    MHD_destroy_response(res);
+    return ret;
+}
+
+// POST /update_score with op=max|incr|cas
+static enum MHD_Result handle_conditional_update(struct MHD_Connection *conn_http, long long start, int id, int value,
+                                                 const char *op_q)
+{
+    const char *expect_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "expect");
+    UpdateOp op = UPDATE_SET;
+    if (strcmp(op_q, "max") == 0)
+        op = UPDATE_MAX;
+    else if (strcmp(op_q, "incr") == 0)
+        op = UPDATE_INCR;
+    else if (strcmp(op_q, "cas") == 0 && expect_q)
+        op = UPDATE_CAS;
+
+    if (op == UPDATE_SET)
+    {
+        const char *err = "Invalid op (expected set, max, incr, or cas with expect=)";
+        struct MHD_Response *res = MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
+        int ret = MHD_queue_response(conn_http, MHD_HTTP_BAD_REQUEST, res);
+        MHD_destroy_response(res);
+        return ret;
+    }
+    int expect = expect_q ? atoi(expect_q) : 0;
+
+    int score, flags;
+    UpdateOutcome o = update_conditional(id, op, value, expect, &score, &flags);
+    if (o == UPDATE_SHED)
+        return reply_shed(conn_http);
+    if (o == UPDATE_APPLIED)
+        repl_publish(id, score);
+
+    long long end = now_us();
+    record_request_args(REQLOG_UPDATE, 0, flags | (op << REQLOG_OP_SHIFT), start, end, id, value, &expect,
+                        op == UPDATE_CAS);
+
+    char json[128];
+    unsigned int code = MHD_HTTP_OK;
+    if (o == UPDATE_FAILED)
+    {
+        code = MHD_HTTP_INTERNAL_SERVER_ERROR;
+        snprintf(json, sizeof(json), "{\"status\":\"error\"}");
+    }
+    else if (o == UPDATE_OVERFLOW)
+    {
+        code = MHD_HTTP_CONFLICT;
+        snprintf(json, sizeof(json), "{\"status\":\"error\",\"error\":\"score out of range\",\"score\":%d}", score);
+    }
+    else if (o == UPDATE_CONFLICT)
+    {
+        code = MHD_HTTP_CONFLICT;
+        snprintf(json, sizeof(json), "{\"status\":\"conflict\",\"score\":%d}", score);
+    }
+    else
+    {
+        snprintf(json, sizeof(json), "{\"status\":\"ok\",\"applied\":%s,\"score\":%d}",
+                 o == UPDATE_APPLIED ? "true" : "false", score);
+    }
+
+    struct MHD_Response *res = MHD_create_response_from_buffer(strlen(json), strdup(json), MHD_RESPMEM_MUST_FREE);
+    MHD_add_response_header(res, "Content-Type", "application/json");
+    int ret = MHD_queue_response(conn_http, code, res);
+    MHD_destroy_response(res);
+    return ret;
+}
+
+static enum MHD_Result route_request(struct MHD_Connection *conn_http, const char *url, const char *method)
+{
+    if (strcmp(method, "GET") == 0 && strncmp(url, "/leaderboard", 12) == 0)
+    {
+        long long start = now_us();
+
+        const char *top_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "top");
+        int top = top_q ? atoi(top_q) : DEFAULT_TOP_N;
+        int depth = topn_get_depth();
+        if (top < 0)
+            top = 0;
+        if (top > depth)
+            top = depth;
+
+        const char *window_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "window");
+        TopNWindow window = TOPN_ALL;
+        if (window_q && strcmp(window_q, "day") == 0)
+            window = TOPN_DAY;
+        else if (window_q && strcmp(window_q, "week") == 0)
+            window = TOPN_WEEK;
+        else if (window_q && strcmp(window_q, "all") != 0)
+        {
+            const char *err = "Invalid window (expected day, week or all)";
+            struct MHD_Response *res = MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
+            int ret = MHD_queue_response(conn_http, MHD_HTTP_BAD_REQUEST, res);
+            MHD_destroy_response(res);
+            return ret;
+        }
+
+        Player top_players[TOPN_MAX_SIZE];
+        int count = 0;
+        int cache_hit = 0;
+
+        long long admitted = 0;
+        if ((mode == 0 || mode == 2) && (admitted = admission_enter()) < 0)
+            return reply_shed(conn_http);
+
+        if (mode == 0)
+        {
+            // DB-only
+            count = db_get_top(top_players, top, window);
+            cache_hit = 0;
+        }
+        else if (mode == 1)
+        {
+            // Caches-only: use Top-N cache
+            count = topn_get_top(top_players, top, window);
+            cache_hit = 1;
+        }
+        else if (mode == 2)
+        {
+            // LRU Cache + DB: use DB for leaderboard (LRU doesn't guarantee top-N)
+            count = db_get_top(top_players, top, window);
+            cache_hit = 0;
+        }
+        else if (mode == 3)
+        {
+            // All: use Top-N cache
+            count = topn_get_top(top_players, top, window);
+            cache_hit = 1;
+        }
+        admission_exit(admitted);
+
+        long long end = now_us();
+        record_request(REQLOG_LEADERBOARD, cache_hit, window, start, end, top, 0);
+
+        uint64_t tj = trace_start();
+        size_t cap = JSON_LEADERBOARD_MAX(count);
+        char *json = malloc(cap);
+        int len = json ? json_leaderboard(json, cap, top_players, count) : -1;
+        trace_end(TRACE_JSON, tj);
+        if (len < 0)
+        {
+            free(json);
+            const char *err = "{\"error\":\"could not build response\"}";
+            struct MHD_Response *res = MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
+            int ret = MHD_queue_response(conn_http, MHD_HTTP_INTERNAL_SERVER_ERROR, res);
+            MHD_destroy_response(res);
+            return ret;
+        }
+
+        struct MHD_Response *res = MHD_create_response_from_buffer(len, json, MHD_RESPMEM_MUST_FREE);
+        MHD_add_response_header(res, "Content-Type", "application/json");
+        int ret = MHD_queue_response(conn_http, MHD_HTTP_OK, res);
+        MHD_destroy_response(res);
+        return ret;
+    }
+
+    if (strcmp(method, "POST") == 0 && strncmp(url, "/update_score", 13) == 0)
+    {
+        long long start = now_us();
+
+        const char *id_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "player_id");
+        const char *score_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "score");
+        if (!id_q || !score_q)
+        {
+            const char *err = "Missing parameters";
+            struct MHD_Response *res = MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
+            int ret = MHD_queue_response(conn_http, MHD_HTTP_BAD_REQUEST, res);
+            MHD_destroy_response(res);
+            return ret;
+        }
+
+        int id = atoi(id_q);
+        int score = atoi(score_q);
+
+        if (read_only)
+        {
+            const char *err = "{\"error\":\"read-only replica\"}";
+            struct MHD_Response *res = MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
+            int ret = MHD_queue_response(conn_http, MHD_HTTP_FORBIDDEN, res);
+            MHD_destroy_response(res);
+            return ret;
+        }
+
+        const char *op_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "op");
+        if (op_q && strcmp(op_q, "set") != 0)
+            return handle_conditional_update(conn_http, start, id, score, op_q);
+
+        long long admitted = 0;
+        if (mode != 1 && (admitted = admission_enter()) < 0)
+            return reply_shed(conn_http);
+
+        int wrote_lru = 0, wrote_topn = 0, wrote_db = 0;
+
+        if (mode == 0)
+        {
+            // DB-only
+            db_update(id, score);
+            wrote_db = 1;
+        }
+        else if (mode == 1)
+        {
+            // Caches-only: update both LRU and Top-N caches (and the WAL if enabled)
+            if (wal_enabled)
+            {
+                if (durable_update(id, score) != 0)
+                {
+                    const char *err = "{\"error\":\"write-ahead log failed\"}";
+                    struct MHD_Response *res =
+                        MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
+                    int ret = MHD_queue_response(conn_http, MHD_HTTP_INTERNAL_SERVER_ERROR, res);
+                    MHD_destroy_response(res);
+                    return ret;
+                }
+            }
+            else
+            {
+                cache_update(id, score);
+                topn_update(id, score);
+            }
+            wrote_lru = 1;
+            wrote_topn = 1;
+        }
+        else if (mode == 2)
+        {
+            // LRU Cache + DB: update LRU and DB
+            cache_update(id, score);
+            db_update(id, score);
+            wrote_lru = 1;
+            wrote_db = 1;
+        }
+        else if (mode == 3)
+        {
+            // All: update LRU, Top-N, and DB
+            cache_update(id, score);
+            topn_update(id, score);
+            db_update(id, score);
+            wrote_lru = 1;
+            wrote_topn = 1;
+            wrote_db = 1;
+        }
+        admission_exit(admitted);
+        repl_publish(id, score);
+
+        long long end = now_us();
+        record_request(REQLOG_UPDATE, 0,
+                    (wrote_lru ? REQLOG_WROTE_LRU : 0) | (wrote_topn ? REQLOG_WROTE_TOPN : 0) | (wrote_db ? REQLOG_WROTE_DB : 0),
+                    start, end, id, score);
+
+        const char *ok = "{\"status\":\"ok\"}";
+        struct MHD_Response *res = MHD_create_response_from_buffer(strlen(ok), (void *)ok, MHD_RESPMEM_PERSISTENT);
+        int ret = MHD_queue_response(conn_http, MHD_HTTP_OK, res);
+        MHD_destroy_response(res);
+        return ret;
+    }
+
+    if (strcmp(method, "GET") == 0 && strcmp(url, "/get_scores") == 0)
+    {
+        const char *ids_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "ids");
+        return handle_get_scores(conn_http, ids_q ? ids_q : "");
+    }
+
+    if (strcmp(method, "GET") == 0 && strncmp(url, "/get_score", 10) == 0)
+    {
+        long long start = now_us();
+
+        const char *id_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "player_id");
+        if (!id_q)
+        {
+            const char *err = "{\"error\":\"missing player_id\"}";
+            struct MHD_Response *res = MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
+            int ret = MHD_queue_response(conn_http, MHD_HTTP_BAD_REQUEST, res);
+            MHD_destroy_response(res);
+            return ret;
+        }
+
+        int id = atoi(id_q);
+        int score = -1;
+        int cache_hit = 0;
+
+        long long admitted = 0;
+        if (mode == 0)
+        {
+            // DB-only
+            if ((admitted = admission_enter()) < 0)
+                return reply_shed(conn_http);
+            score = db_get_score(id);
+            admission_exit(admitted);
+            cache_hit = 0;
+        }
+        else if (mode == 1)
+        {
+            // Caches-only: try LRU cache
+            score = cache_get_score(id);
+            cache_hit = (score >= 0) ? 1 : 0;
+        }
+        else if (mode == 2)
+        {
+            // LRU Cache + DB: try LRU first, fallback to DB
+            score = cache_get_score(id);
+            if (score >= 0)
+            {
+                cache_hit = 1;
+            }
+            else
+            {
+                if ((admitted = admission_enter()) < 0)
+                    return reply_shed(conn_http);
+                score = db_get_score(id);
+                admission_exit(admitted);
+                cache_hit = 0;
+            }
+        }
+        else if (mode == 3)
+        {
+            // All: try LRU first, fallback to DB
+            score = cache_get_score(id);
+            if (score >= 0)
+            {
+                cache_hit = 1;
+            }
+            else
+            {
+                if ((admitted = admission_enter()) < 0)
+                    return reply_shed(conn_http);
+                score = db_get_score(id);
+                admission_exit(admitted);
+                cache_hit = 0;
+            }
+        }
+
+        long long end = now_us();
+        record_request(REQLOG_GET, cache_hit, 0, start, end, id, score);
+
+        uint64_t tj = trace_start();
+        char json[128];
+        snprintf(json, sizeof(json), "{\"id\":%d,\"score\":%d,\"cache_hit\":%d}", id, score, cache_hit);
+        trace_end(TRACE_JSON, tj);
+
+        struct MHD_Response *res = MHD_create_response_from_buffer(strlen(json), strdup(json), MHD_RESPMEM_MUST_FREE);
+        MHD_add_response_header(res, "Content-Type", "application/json");
+        int ret = MHD_queue_response(conn_http, MHD_HTTP_OK, res);
+        MHD_destroy_response(res);
+        return ret;
+    }
+
+    if (strcmp(url, "/admin/config") == 0 && (strcmp(method, "GET") == 0 || strcmp(method, "POST") == 0))
+    {
+        if (!admin_allowed(conn_http))
+        {
+            const char *err = "{\"error\":\"forbidden\"}";
+            struct MHD_Response *res = MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
+            int ret = MHD_queue_response(conn_http, MHD_HTTP_FORBIDDEN, res);
+            MHD_destroy_response(res);
+            return ret;
+        }
+        return handle_admin_config(conn_http, strcmp(method, "POST") == 0);
+    }
+
+    if (strcmp(method, "GET") == 0 && strcmp(url, "/metrics") == 0)
+    {
+        MetricsBuf b = {0};
+        metrics_render(&b);
+        trace_render(&b);
+        mbuf_printf(&b, "# HELP leaderboard_reqlog_dropped_total Request log records dropped on full rings\n"
+                        "# TYPE leaderboard_reqlog_dropped_total counter\n"
+                        "leaderboard_reqlog_dropped_total %llu\n",
+                    reqlog_dropped());
+        admission_render_metrics(&b);
+        if (metrics_hook)
+            metrics_hook(&b);
+        if (!b.data)
+            return MHD_NO;
+        struct MHD_Response *res = MHD_create_response_from_buffer(b.len, b.data, MHD_RESPMEM_MUST_FREE);
+        MHD_add_response_header(res, "Content-Type", "text/plain; version=0.0.4");
+        int ret = MHD_queue_response(conn_http, MHD_HTTP_OK, res);
+        MHD_destroy_response(res);
+        return ret;
+    }
+
+    const char *nf = "Not Found";
+    struct MHD_Response *res = MHD_create_response_from_buffer(strlen(nf), (void *)nf, MHD_RESPMEM_PERSISTENT);
+    int ret = MHD_queue_response(conn_http, MHD_HTTP_NOT_FOUND, res);
+    MHD_destroy_response(res);
+    return ret;
+}
+
@@ -0,0 +1,36 @@
+#ifndef HANDLERS_H
+#define HANDLERS_H
+
+#include <stddef.h>
+#include <microhttpd.h>
+#include "cache.h"
+#include "metrics.h"
+
+// Request handling: routing, the per-mode endpoint logic and the
+// durable (WAL) update path. server.c wires these into libmicrohttpd;
+// harness.c calls handle_request() directly without sockets.
+
+extern int mode;        // 0=DB-only, 1=Caches-only, 2=LRU+DB, 3=All
+extern int wal_enabled; // mode 1: updates also go to the WAL
+extern int read_only;   // replica: POST /update_score is refused with 403
+extern const char *admin_token; // /admin/config needs X-Admin-Token; NULL: loopback clients only
+
+long long now_us(void);
+
+// Update both caches and the WAL, waiting as the durability level requires.
+// Returns -1 if the WAL could not store the update (see wal_wait()).
+int durable_update(int id, int score);
+int durable_update_batch(const Player *recs, int n);
+
+// libmicrohttpd access handler and completion callback
+enum MHD_Result handle_request(void *cls, struct MHD_Connection *conn_http,
+                               const char *url, const char *method,
+                               const char *ver, const char *upload_data,
+                               size_t *upload_data_size, void **con_cls);
+void request_completed(void *cls, struct MHD_Connection *conn_http, void **con_cls,
+                       enum MHD_RequestTerminationCode toe);
+
+// Extra text appended to GET /metrics (e.g. UDP ingest counters)
+void handlers_set_metrics_hook(void (*fn)(MetricsBuf *b));
+
+#endif // HANDLERS_H
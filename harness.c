@@ -0,0 +1,660 @@
+/*
+In-process harness
+Drives handle_request() directly from many threads, with no sockets,
+libmicrohttpd or Postgres in the way: the MHD shim below provides the
+few MHD_* calls the handlers make, and db_stub.c stands in for the DB.
+What is left is the handler itself (routing, caches, Top-N, JSON,
+metrics), so throughput and latency can be compared across modes
+without network or database noise.
+
+Build and run:
+make harness
+
+Usage:
+./harness [--modes 0,1,2,3] [--threads N] [--seconds N] [--requests N]
+          [--mix update=W,get=W,leaderboard=W,multiget=W] [--keys N]
+          [--dist uniform|zipfian] [--skew THETA] [--preload N]
+          [--db-latency US] [--db-capacity N] [--limiter off|aimd|gradient]
+          [--queue-deadline-ms N] [--slo-ms N] [--backoff-ms N]
+          [--wal-dir DIR] [--durability none|batched|sync] [--out PATH]
+
+Each mode starts from empty caches and storage, then the first --preload
+ids (default all --keys) are written through POST /update_score so every
+store the mode uses is filled the way live traffic fills it. Requests are
+then issued for --seconds (default 3) or --requests per thread. Only the
+handle_request() call is timed; request construction is not.
+
+--db-latency adds a fixed delay to every stub DB call (default 0), e.g.
+to see how much of a mode's cost is the DB path. --db-capacity lets only
+that many calls be in the delay at once, so the stub DB saturates.
+
+--wal-dir makes mode 1 log every update to a write-ahead log in DIR
+(appended after whatever log is already there) with --durability
+none|batched|sync (default batched), as ./server --wal-dir does.
+
+--limiter puts the admission limiter (admission.h) in front of the DB
+path; requests it sheds count as "shed", not errors, and the worker then
+pauses --backoff-ms (default 10) as a client honouring Retry-After would.
+Goodput is the rate of 2xx answers that took at most --slo-ms (every 2xx
+if 0), e.g.
+
+  ./harness --modes 0 --threads 64 --db-latency 1000 --db-capacity 8 --slo-ms 5 --limiter gradient
+
+goodput_curve.sh sweeps thread counts with and without the limiter.
+
+Results are printed as a table on stderr and as JSON on stdout (or --out),
+one object per mode and endpoint; latencies are in microseconds.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "handlers.h"
+#include "cache.h"
+#include "topn.h"
+#include "db.h"
+#include "hdr.h"
+#include "metrics.h"
+#include "trace.h"
+#include "admission.h"
+#include "workload.h"
+#include "wal.h"
+
+#define MAX_THREADS 64
+#define MAX_ARGS 4
+#define MULTIGET_IDS 10
+#define LEADERBOARD_TOP "10"
+
+// ---------- MHD shim ----------
+//
+// Just enough of libmicrohttpd for the handlers: query arguments come
+// from the request built below, and the queued status and body length are
+// kept on the connection. Memory modes follow the library's rules.
+
+struct MHD_Connection
+{
+    const char *keys[MAX_ARGS];
+    const char *values[MAX_ARGS];
+    int nargs;
+    unsigned int status;
+    size_t body_len;
+};
+
+struct MHD_Response
+{
+    void *data;
+    size_t len;
+    int owned;
+};
+
+const char *MHD_lookup_connection_value(struct MHD_Connection *conn, enum MHD_ValueKind kind, const char *key)
+{
+    if (kind != MHD_GET_ARGUMENT_KIND)
+        return NULL;
+    for (int i = 0; i < conn->nargs; i++)
+    {
+        if (strcmp(conn->keys[i], key) == 0)
+            return conn->values[i];
+    }
+    return NULL;
+}
+
+// Requests come from loopback, so /admin/config is allowed without a token
+const union MHD_ConnectionInfo *MHD_get_connection_info(struct MHD_Connection *conn,
+                                                        enum MHD_ConnectionInfoType info_type, ...)
+{
+    static struct sockaddr_in addr = {.sin_family = AF_INET};
+    static union MHD_ConnectionInfo info = {.client_addr = (struct sockaddr *)&addr};
+    if (info_type != MHD_CONNECTION_INFO_CLIENT_ADDRESS)
+        return NULL;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return &info;
+}
+
+struct MHD_Response *MHD_create_response_from_buffer(size_t size, void *buffer, enum MHD_ResponseMemoryMode mode)
+{
+    struct MHD_Response *r = malloc(sizeof(*r));
+    if (!r)
+        return NULL;
+    r->data = buffer;
+    r->len = size;
+    r->owned = mode != MHD_RESPMEM_PERSISTENT;
+    if (mode == MHD_RESPMEM_MUST_COPY)
+    {
+        r->data = malloc(size ? size : 1);
+        if (!r->data)
+        {
+            free(r);
+            return NULL;
+        }
+        memcpy(r->data, buffer, size);
+    }
+    return r;
+}
+
+enum MHD_Result MHD_add_response_header(struct MHD_Response *r, const char *header, const char *content)
+{
+    return r ? MHD_YES : MHD_NO;
+}
+
+enum MHD_Result MHD_queue_response(struct MHD_Connection *conn, unsigned int status_code, struct MHD_Response *r)
+{
+    if (!r)
+        return MHD_NO;
+    conn->status = status_code;
+    conn->body_len = r->len;
+    return MHD_YES;
+}
+
+void MHD_destroy_response(struct MHD_Response *r)
+{
+    if (!r)
+        return;
+    if (r->owned)
+        free(r->data);
+    free(r);
+}
+
+// ---------- Workload ----------
+
+enum
+{
+    EP_UPDATE,
+    EP_GET,
+    EP_LEADERBOARD,
+    EP_MULTIGET,
+    EP_COUNT
+};
+
+static const char *ep_names[EP_COUNT] = {"update_score", "get_score", "leaderboard", "get_scores"};
+
+static WorkloadOpts opts = {.keys = 100000, .theta = 0.99};
+static KeyDist dist = KEYS_ZIPFIAN;
+static int mix[EP_COUNT] = {50, 40, 5, 5};
+static int mix_total = 100;
+
+// update=W,get=W,leaderboard=W,multiget=W; unnamed endpoints get weight 0
+static int parse_mix(const char *spec)
+{
+    static const char *names[EP_COUNT] = {"update", "get", "leaderboard", "multiget"};
+    int w[EP_COUNT] = {0};
+    const char *p = spec;
+    while (*p)
+    {
+        int ep;
+        for (ep = 0; ep < EP_COUNT; ep++)
+        {
+            size_t n = strlen(names[ep]);
+            if (strncmp(p, names[ep], n) == 0 && p[n] == '=')
+                break;
+        }
+        if (ep == EP_COUNT)
+            return -1;
+        char *end;
+        long v = strtol(p + strlen(names[ep]) + 1, &end, 10);
+        if (v < 0 || (*end && *end != ','))
+            return -1;
+        w[ep] = (int)v;
+        p = *end ? end + 1 : end;
+    }
+    mix_total = 0;
+    for (int ep = 0; ep < EP_COUNT; ep++)
+    {
+        mix[ep] = w[ep];
+        mix_total += w[ep];
+    }
+    return mix_total > 0 ? 0 : -1;
+}
+
+// One request as handle_request() sees it
+typedef struct
+{
+    int ep;
+    const char *url;
+    const char *method;
+    char id[16];
+    char score[16];
+    char ids[MULTIGET_IDS * 12];
+    struct MHD_Connection conn;
+} Request;
+
+static void build_request(Request *r, int ep, const int *stream, unsigned pos, uint64_t *rng)
+{
+    struct MHD_Connection *c = &r->conn;
+    memset(c, 0, sizeof(*c));
+    r->ep = ep;
+    r->method = "GET";
+    switch (ep)
+    {
+    case EP_UPDATE:
+        r->url = "/update_score";
+        r->method = "POST";
+        snprintf(r->id, sizeof(r->id), "%d", stream[pos & (KEY_STREAM - 1)]);
+        snprintf(r->score, sizeof(r->score), "%d", (int)(rng_next(rng) % 1000000));
+        c->keys[0] = "player_id";
+        c->values[0] = r->id;
+        c->keys[1] = "score";
+        c->values[1] = r->score;
+        c->nargs = 2;
+        break;
+    case EP_GET:
+        r->url = "/get_score";
+        snprintf(r->id, sizeof(r->id), "%d", stream[pos & (KEY_STREAM - 1)]);
+        c->keys[0] = "player_id";
+        c->values[0] = r->id;
+        c->nargs = 1;
+        break;
+    case EP_LEADERBOARD:
+        r->url = "/leaderboard";
+        c->keys[0] = "top";
+        c->values[0] = LEADERBOARD_TOP;
+        c->nargs = 1;
+        break;
+    default:
+    {
+        r->url = "/get_scores";
+        size_t n = 0;
+        for (int i = 0; i < MULTIGET_IDS; i++)
+            n += snprintf(r->ids + n, sizeof(r->ids) - n, "%s%d", i ? "," : "",
+                          stream[(pos + i) & (KEY_STREAM - 1)]);
+        c->keys[0] = "ids";
+        c->values[0] = r->ids;
+        c->nargs = 1;
+        break;
+    }
+    }
+}
+
+static long long mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Returns the status the handler answered with, 0 if it refused the request
+static unsigned int issue(Request *r)
+{
+    void *con_cls = NULL;
+    size_t upload = 0;
+    enum MHD_Result ret = handle_request(NULL, &r->conn, r->url, r->method, "HTTP/1.1", NULL, &upload, &con_cls);
+    request_completed(NULL, &r->conn, &con_cls, MHD_REQUEST_TERMINATED_COMPLETED_OK);
+    return ret == MHD_YES ? r->conn.status : 0;
+}
+
+// ---------- Thread pool ----------
+
+typedef struct
+{
+    int keys[KEY_STREAM];
+    HdrHistogram hist[EP_COUNT]; // handler latency, ns
+    unsigned long long errors[EP_COUNT];
+    unsigned long long shed[EP_COUNT]; // 503 from the admission limiter
+    unsigned long long good[EP_COUNT]; // 2xx within the SLO
+    uint64_t rng;
+} Worker;
+
+static Worker *workers;
+static WorkloadPool pool;
+static int nthreads = 4;
+static long long requests_per_thread; // 0 = run for run_seconds
+static int run_seconds = 3;
+static long long slo_ns; // 0 = every 2xx counts as goodput
+static int backoff_ms = 10; // pause after a 503, standing in for Retry-After
+
+static void worker_run(void *arg, int index)
+{
+    Worker *w = arg;
+    unsigned pos = workload_stream_start(index);
+    Request r;
+    for (long long n = 0; requests_per_thread ? n < requests_per_thread : !workload_pool_stopping(&pool); n++)
+    {
+        int pick = (int)(rng_next(&w->rng) % mix_total);
+        int ep = 0;
+        while (pick >= mix[ep])
+            pick -= mix[ep++];
+        build_request(&r, ep, w->keys, pos, &w->rng);
+        pos += ep == EP_MULTIGET ? MULTIGET_IDS : 1;
+
+        long long t0 = mono_ns();
+        unsigned int status = issue(&r);
+        long long took = mono_ns() - t0;
+        hdr_record(&w->hist[ep], (uint64_t)took);
+        if (status == MHD_HTTP_SERVICE_UNAVAILABLE)
+        {
+            w->shed[ep]++;
+            struct timespec d = {backoff_ms / 1000, (backoff_ms % 1000) * 1000000L};
+            nanosleep(&d, NULL);
+        }
+        else if (status < 200 || status >= 300)
+            w->errors[ep]++;
+        else if (!slo_ns || took <= slo_ns)
+            w->good[ep]++;
+    }
+}
+
+// ---------- Runs ----------
+
+typedef struct
+{
+    int mode;
+    int ep;
+    unsigned long long requests, errors, shed;
+    double rps, goodput_rps, mean_us, p50_us, p90_us, p99_us, p999_us, max_us;
+} Result;
+
+static Result results[4 * EP_COUNT];
+static int nresults;
+static int preload = -1; // -1 = keys
+static int db_latency_us;
+static int db_capacity;
+static AdmissionAlgo limiter = ADMISSION_OFF;
+static int queue_deadline_ms = 20;
+static const char *wal_dir; // mode 1 logs updates here when set
+static WalDurability durability = WAL_DURABILITY_BATCHED;
+
+// Empty every store, then write the first `preload` ids through the handlers
+static void reset_mode(int m)
+{
+    mode = m;
+    metrics_init(m);
+    cache_clear();
+    topn_clear();
+    db_stub_clear();
+    db_stub_set_latency(0);
+    admission_init(ADMISSION_OFF, POOL_SIZE / 2, POOL_SIZE, queue_deadline_ms);
+
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    Request r;
+    int stream[KEY_STREAM];
+    for (int base = 0; base < preload; base += KEY_STREAM)
+    {
+        int n = preload - base < KEY_STREAM ? preload - base : KEY_STREAM;
+        for (int i = 0; i < n; i++)
+            stream[i] = base + i + 1;
+        for (int i = 0; i < n; i++)
+        {
+            build_request(&r, EP_UPDATE, stream, (unsigned)i, &rng);
+            issue(&r);
+        }
+    }
+    db_stub_set_latency(db_latency_us);
+    db_stub_set_capacity(db_capacity);
+    admission_init(limiter, POOL_SIZE / 2, POOL_SIZE, queue_deadline_ms);
+}
+
+static void run_mode(int m)
+{
+    reset_mode(m);
+    for (int i = 0; i < nthreads; i++)
+    {
+        memset(workers[i].hist, 0, sizeof(workers[i].hist));
+        memset(workers[i].errors, 0, sizeof(workers[i].errors));
+        memset(workers[i].shed, 0, sizeof(workers[i].shed));
+        memset(workers[i].good, 0, sizeof(workers[i].good));
+    }
+    double elapsed_s = workload_pool_round(&pool, requests_per_thread ? 0 : run_seconds * 1000) / 1e9;
+
+    unsigned long long total = 0, total_shed = 0, total_good = 0;
+    for (int ep = 0; ep < EP_COUNT; ep++)
+    {
+        HdrSnapshot s;
+        hdr_snapshot_clear(&s);
+        unsigned long long errors = 0, shed = 0, good = 0;
+        for (int i = 0; i < nthreads; i++)
+        {
+            hdr_snapshot_add(&s, &workers[i].hist[ep]);
+            errors += workers[i].errors[ep];
+            shed += workers[i].shed[ep];
+            good += workers[i].good[ep];
+        }
+        if (s.total == 0)
+            continue;
+        total += s.total;
+        total_shed += shed;
+        total_good += good;
+
+        Result *r = &results[nresults++];
+        r->mode = m;
+        r->ep = ep;
+        r->requests = s.total;
+        r->errors = errors;
+        r->shed = shed;
+        r->rps = s.total / elapsed_s;
+        r->goodput_rps = good / elapsed_s;
+        r->mean_us = hdr_mean(&s) / 1000.0;
+        r->p50_us = hdr_percentile(&s, 50) / 1000.0;
+        r->p90_us = hdr_percentile(&s, 90) / 1000.0;
+        r->p99_us = hdr_percentile(&s, 99) / 1000.0;
+        r->p999_us = hdr_percentile(&s, 99.9) / 1000.0;
+        r->max_us = s.max / 1000.0;
+        fprintf(stderr, "mode %d %-13s %10llu req %12.0f req/s %9.2f mean %9.2f p50 %9.2f p99 %9.2f p99.9 us%s\n",
+                m, ep_names[ep], r->requests, r->rps, r->mean_us, r->p50_us, r->p99_us, r->p999_us,
+                errors ? " (errors)" : "");
+    }
+    fprintf(stderr, "mode %d total         %10llu req %12.0f req/s over %d threads\n", m, total, total / elapsed_s,
+            nthreads);
+    fprintf(stderr, "mode %d goodput       %12.0f req/s, shed %llu (limiter %s)\n\n", m, total_good / elapsed_s,
+            total_shed, admission_name(limiter));
+}
+
+static void write_json(FILE *f)
+{
+    workload_json_begin(f, &opts);
+    fprintf(f, "  \"threads\": %d,\n"
+               "  \"dist\": \"%s\",\n  \"preload\": %d,\n  \"db_latency_us\": %d,\n"
+               "  \"db_capacity\": %d,\n  \"limiter\": \"%s\",\n  \"queue_deadline_ms\": %d,\n  \"slo_ms\": %.3f,\n"
+               "  \"mix\": {\"update\": %d, \"get\": %d, \"leaderboard\": %d, \"multiget\": %d},\n  \"results\": [\n",
+            nthreads, dist == KEYS_ZIPFIAN ? "zipfian" : "uniform", preload, db_latency_us, db_capacity, admission_name(limiter), queue_deadline_ms, slo_ns / 1e6, mix[EP_UPDATE], mix[EP_GET], mix[EP_LEADERBOARD], mix[EP_MULTIGET]);
+    for (int i = 0; i < nresults; i++)
+    {
+        const Result *r = &results[i];
+        fprintf(f, "    {\"mode\": %d, \"endpoint\": \"%s\", \"requests\": %llu, \"errors\": %llu, \"shed\": %llu, "
+                   "\"rps\": %.0f, \"goodput_rps\": %.0f, \"mean_us\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, "
+                   "\"p999_us\": %.3f, \"max_us\": %.3f}%s\n",
+                r->mode, ep_names[r->ep], r->requests, r->errors, r->shed, r->rps, r->goodput_rps, r->mean_us, r->p50_us, r->p90_us,
+                r->p99_us, r->p999_us, r->max_us, i == nresults - 1 ? "" : ",");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [--modes 0,1,2,3] [--threads N] [--seconds N] [--requests N]\n"
+            "          [--mix update=W,get=W,leaderboard=W,multiget=W] [--keys N]\n"
+            "          [--dist uniform|zipfian] [--skew THETA] [--preload N] [--db-latency US]\n"
+            "          [--db-capacity N] [--limiter off|aimd|gradient] [--queue-deadline-ms N] [--slo-ms N]\n"
+            "          [--backoff-ms N] [--wal-dir DIR] [--durability none|batched|sync] [--out PATH]\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    int modes[4] = {0, 1, 2, 3};
+    int nmodes = 4;
+
+    static const struct option long_opts[] = {
+        {"modes", required_argument, NULL, 'M'},
+        {"threads", required_argument, NULL, 't'},
+        {"seconds", required_argument, NULL, 's'},
+        {"requests", required_argument, NULL, 'n'},
+        {"mix", required_argument, NULL, 'm'},
+        {"dist", required_argument, NULL, 'd'},
+        {"preload", required_argument, NULL, 'p'},
+        {"db-latency", required_argument, NULL, 'L'},
+        {"db-capacity", required_argument, NULL, 'C'},
+        {"limiter", required_argument, NULL, 'A'},
+        {"queue-deadline-ms", required_argument, NULL, 'D'},
+        {"slo-ms", required_argument, NULL, 'S'},
+        {"backoff-ms", required_argument, NULL, 'B'},
+        {"wal-dir", required_argument, NULL, 'W'},
+        {"durability", required_argument, NULL, 'Y'},
+        WORKLOAD_LONG_OPTS,
+        {NULL, 0, NULL, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1)
+    {
+        if (workload_parse_opt(&opts, opt, optarg))
+            continue;
+        switch (opt)
+        {
+        case 'M':
+        {
+            nmodes = 0;
+            const char *p = optarg;
+            while (*p)
+            {
+                if (*p < '0' || *p > '3' || nmodes == 4 || (p[1] && p[1] != ','))
+                {
+                    fprintf(stderr, "Bad --modes (expected e.g. 0,1,2,3): %s\n", optarg);
+                    return 1;
+                }
+                modes[nmodes++] = *p - '0';
+                p += p[1] ? 2 : 1;
+            }
+            break;
+        }
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 's':
+            run_seconds = atoi(optarg);
+            break;
+        case 'n':
+            requests_per_thread = atoll(optarg);
+            break;
+        case 'm':
+            if (parse_mix(optarg) != 0)
+            {
+                fprintf(stderr, "Bad --mix (expected e.g. update=50,get=40,leaderboard=5,multiget=5): %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd':
+            if (strcmp(optarg, "uniform") == 0)
+                dist = KEYS_UNIFORM;
+            else if (strcmp(optarg, "zipfian") == 0)
+                dist = KEYS_ZIPFIAN;
+            else
+            {
+                fprintf(stderr, "Unknown distribution: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            preload = atoi(optarg);
+            break;
+        case 'L':
+            db_latency_us = atoi(optarg);
+            break;
+        case 'C':
+            db_capacity = atoi(optarg);
+            break;
+        case 'A':
+            if (admission_parse(optarg, &limiter) != 0)
+            {
+                fprintf(stderr, "Unknown limiter: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'D':
+            queue_deadline_ms = atoi(optarg);
+            break;
+        case 'S':
+            slo_ns = (long long)(atof(optarg) * 1e6);
+            break;
+        case 'B':
+            backoff_ms = atoi(optarg);
+            break;
+        case 'W':
+            wal_dir = optarg;
+            break;
+        case 'Y':
+        {
+            int ok;
+            durability = wal_parse_durability(optarg, &ok);
+            if (!ok)
+            {
+                fprintf(stderr, "Unknown durability: %s\n", optarg);
+                return 1;
+            }
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (nmodes == 0 || nthreads <= 0 || run_seconds <= 0 || requests_per_thread < 0 || !workload_opts_valid(&opts) ||
+        db_latency_us < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (nthreads > MAX_THREADS)
+    {
+        fprintf(stderr, "At most %d threads\n", MAX_THREADS);
+        return 1;
+    }
+    if (preload < 0 || preload > opts.keys)
+        preload = (int)opts.keys;
+
+    trace_init(0, NULL);
+    pool_init();
+    if (wal_dir)
+    {
+        // Only mode 1 writes to it, as in the server
+        WalScan scan;
+        uint64_t next = wal_scan(wal_dir, 1, &scan) == 0 ? scan.last_lsn + 1 : 1;
+        wal_scan_free(&scan);
+        if (wal_trim_tail(wal_dir, next - 1, next) != 0 || wal_open(wal_dir, durability, 5, next) != 0)
+        {
+            fprintf(stderr, "Cannot open the WAL in %s\n", wal_dir);
+            return 1;
+        }
+        wal_enabled = 1;
+        fprintf(stderr, "Mode 1 logs to %s (durability=%s)\n\n", wal_dir, wal_durability_name(durability));
+    }
+
+    workers = calloc(nthreads, sizeof(Worker));
+    if (!workers)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    Zipf zipf;
+    zipf_init(&zipf, opts.keys, opts.theta);
+    for (int i = 0; i < nthreads; i++)
+    {
+        workers[i].rng = 0xD1B54A32D192ED03ull * (i + 1);
+        workload_make_keys(workers[i].keys, KEY_STREAM, dist, &zipf, 0x9E3779B97F4A7C15ull * (i + 1));
+    }
+    if (workload_pool_start(&pool, nthreads, workers, sizeof(Worker), worker_run, metrics_thread_init) != 0)
+    {
+        fprintf(stderr, "Cannot start %d threads\n", nthreads);
+        return 1;
+    }
+
+    for (int i = 0; i < nmodes; i++)
+        run_mode(modes[i]);
+
+    workload_pool_stop(&pool);
+    if (wal_dir)
+        wal_close();
+    pool_close();
+
+    FILE *f = workload_out_open(&opts);
+    if (!f)
+        return 1;
+    write_json(f);
+    workload_out_close(f, &opts);
+    free(workers);
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "hdr.h"
+
+#include <string.h>
+
+int hdr_bucket_index(uint64_t value)
+{
+    if (value < (1u << HDR_SUB_BITS))
+        return (int)value;
+
+    int h = 63 - __builtin_clzll(value);
+    if (h >= HDR_MAX_BITS)
+        return HDR_BUCKETS - 1;
+
+    int shift = h - HDR_SUB_BITS + 1;
+    return (1 << HDR_SUB_BITS) + (h - HDR_SUB_BITS) * HDR_HALF + (int)((value >> shift) - HDR_HALF);
+}
+
+uint64_t hdr_bucket_upper(int index)
+{
+    if (index < (1 << HDR_SUB_BITS))
+        return (uint64_t)index;
+
+    int rel = index - (1 << HDR_SUB_BITS);
+    int h = rel / HDR_HALF + HDR_SUB_BITS;
+    int shift = h - HDR_SUB_BITS + 1;
+    uint64_t sub = (uint64_t)(rel % HDR_HALF + HDR_HALF);
+    return ((sub + 1) << shift) - 1;
+}
+
+void hdr_record(HdrHistogram *h, uint64_t value)
+{
+    atomic_fetch_add_explicit(&h->counts[hdr_bucket_index(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, value, memory_order_relaxed);
+
+    unsigned long long cur = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (value > cur &&
+           !atomic_compare_exchange_weak_explicit(&h->max, &cur, value, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+void hdr_snapshot_clear(HdrSnapshot *s)
+{
+    memset(s, 0, sizeof(*s));
+}
+
+void hdr_snapshot_add(HdrSnapshot *s, const HdrHistogram *h)
+{
+    for (int i = 0; i < HDR_BUCKETS; i++)
+        s->counts[i] += atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+    s->total += atomic_load_explicit(&h->total, memory_order_relaxed);
+    s->sum += atomic_load_explicit(&h->sum, memory_order_relaxed);
+    uint64_t m = atomic_load_explicit(&h->max, memory_order_relaxed);
+    if (m > s->max)
+        s->max = m;
+}
+
+void hdr_snapshot_take(HdrSnapshot *s, HdrHistogram *h)
+{
+    for (int i = 0; i < HDR_BUCKETS; i++)
+        s->counts[i] += atomic_exchange_explicit(&h->counts[i], 0, memory_order_relaxed);
+    s->total += atomic_exchange_explicit(&h->total, 0, memory_order_relaxed);
+    s->sum += atomic_exchange_explicit(&h->sum, 0, memory_order_relaxed);
+    uint64_t m = atomic_exchange_explicit(&h->max, 0, memory_order_relaxed);
+    if (m > s->max)
+        s->max = m;
+}
+
+void hdr_snapshot_merge(HdrSnapshot *dst, const HdrSnapshot *src)
+{
+    for (int i = 0; i < HDR_BUCKETS; i++)
+        dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+uint64_t hdr_percentile(const HdrSnapshot *s, double p)
+{
+    // Bucket totals and the running total are read at slightly different
+    // moments, so work from the bucket counts themselves.
+    uint64_t total = 0;
+    for (int i = 0; i < HDR_BUCKETS; i++)
+        total += s->counts[i];
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > total)
+        rank = total;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HDR_BUCKETS; i++)
+    {
+        seen += s->counts[i];
+        if (seen >= rank)
+        {
+            uint64_t v = hdr_bucket_upper(i);
+            return (s->max && v > s->max) ? s->max : v;
+        }
+    }
+    return s->max;
+}
+
+double hdr_mean(const HdrSnapshot *s)
+{
+    return s->total ? (double)s->sum / (double)s->total : 0.0;
+}
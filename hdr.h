@@ -0,0 +1,55 @@
+#ifndef HDR_H
+#define HDR_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Log-linear (HDR-style) histogram.
+//
+// Values below 2^HDR_SUB_BITS are counted exactly; above that every
+// power-of-two range is split into 2^(HDR_SUB_BITS-1) equal buckets, so
+// the relative error stays below 1/2^(HDR_SUB_BITS-1) (~1.6%) up to
+// 2^HDR_MAX_BITS. Larger values land in the last bucket.
+//
+// Recording is a relaxed atomic add, so a histogram owned by one thread
+// can be read (snapshotted) by another without locks.
+
+#define HDR_SUB_BITS 7
+#define HDR_MAX_BITS 40
+#define HDR_HALF (1 << (HDR_SUB_BITS - 1))
+#define HDR_BUCKETS ((1 << HDR_SUB_BITS) + (HDR_MAX_BITS - HDR_SUB_BITS) * HDR_HALF)
+
+typedef struct
+{
+    atomic_ullong counts[HDR_BUCKETS];
+    atomic_ullong total;
+    atomic_ullong sum;
+    atomic_ullong max;
+} HdrHistogram;
+
+// Plain (non-atomic) copy used for merging and percentile queries
+typedef struct
+{
+    uint64_t counts[HDR_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+} HdrSnapshot;
+
+void hdr_record(HdrHistogram *h, uint64_t value);
+
+void hdr_snapshot_clear(HdrSnapshot *s);
+// Add the current contents of h to s
+void hdr_snapshot_add(HdrSnapshot *s, const HdrHistogram *h);
+// Add the contents of h to s and reset h (for per-interval series)
+void hdr_snapshot_take(HdrSnapshot *s, HdrHistogram *h);
+void hdr_snapshot_merge(HdrSnapshot *dst, const HdrSnapshot *src);
+
+// Value at percentile p (0..100); returns the upper bound of its bucket
+uint64_t hdr_percentile(const HdrSnapshot *s, double p);
+double hdr_mean(const HdrSnapshot *s);
+
+int hdr_bucket_index(uint64_t value);
+uint64_t hdr_bucket_upper(int index);
+
+#endif // HDR_H
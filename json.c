@@ -0,0 +1,24 @@
+#include "json.h"
+
+#include <stdio.h>
+
+int json_leaderboard(char *buf, size_t len, const Player *players, int count)
+{
+    size_t pos = 0;
+    int n = snprintf(buf, len, "{\"leaderboard\":[");
+    if (n < 0 || (size_t)n >= len)
+        return -1;
+    pos = n;
+    for (int i = 0; i < count; i++)
+    {
+        n = snprintf(buf + pos, len - pos, "{\"id\":%d,\"score\":%d}%s", players[i].id, players[i].score,
+                     (i == count - 1) ? "" : ",");
+        if (n < 0 || (size_t)n >= len - pos)
+            return -1;
+        pos += n;
+    }
+    n = snprintf(buf + pos, len - pos, "]}");
+    if (n < 0 || (size_t)n >= len - pos)
+        return -1;
+    return (int)(pos + n);
+}
@@ -0,0 +1,19 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+#include "cache.h"
+
+// Response bodies.
+//
+// Writers return the length written (excluding the NUL), or -1 if the
+// body does not fit in len bytes.
+
+// Buffer size that always fits json_leaderboard() for count players:
+// "{\"leaderboard\":[" + "]}" and at most 39 bytes per entry
+#define JSON_LEADERBOARD_MAX(count) (32 + (size_t)(count) * 40)
+
+// {"leaderboard":[{"id":1,"score":2},...]}
+int json_leaderboard(char *buf, size_t len, const Player *players, int count);
+
+#endif // JSON_H
@@ -6,10 +6,60 @@ Modes:
 2 = Mixed (default)
 
 Compile:
-gcc -O2 -Wall loadgen.c -o loadgen -lcurl -lpthread
+gcc -O2 -Wall loadgen.c hdr.c workload.c -o loadgen -lcurl -lpthread -lm
 
 Usage:
+./loadgen [options] <server_url> <threads> <requests_per_thread> <mode>
 ./loadgen http://127.0.0.1:8080 4 100 2
+./loadgen --ramp 5 --warmup 10 --duration 60 --csv run.csv http://127.0.0.1:8080 4 0 2
+
+Options:
+--rate <req/s>                  open loop: start iterations at this total rate
+                                instead of back to back (closed loop)
+--arrival poisson|uniform       inter-arrival distribution for --rate (default poisson)
+--hist-file <path>              write the full latency histograms as CSV
+--csv <path>                    write a per-second, per-endpoint time series as CSV
+--json <path>                   the same series as JSON lines
+--ramp <s>                      raise the load linearly over s seconds (open loop:
+                                the rate; closed loop: threads start staggered)
+--warmup <s>                    then run s seconds at full load before measuring
+--duration <s>                  measure for s seconds, then stop; <requests_per_thread>
+                                still caps each thread, 0 = no cap
+--server-pid <pid>              sample the server's CPU time, context switches, RSS
+                                and I/O from /proc every second
+--pg-pids <pid,pid,...>         the same for Postgres backends (summed), e.g.
+                                $(pgrep -d, -f 'postgres: .*leaderboard')
+--keys <n>                      player id space 1..n (default 100000)
+--dist uniform|zipfian|hotspot|latest
+                                how player ids are picked (default uniform)
+--skew <theta>                  zipfian/latest skew, 0 < theta < 1 (default 0.99)
+--hot-fraction <f>              hotspot: fraction of ids that are hot (default 0.2)
+--hot-prob <p>                  hotspot: probability of picking a hot id (default 0.8)
+--mix update=W,get=W,leaderboard=W
+                                weighted operation mix; replaces <mode>'s fixed mix
+--connections <n>               per thread: drive n keep-alive connections with
+                                curl_multi instead of one blocking handle
+--max-inflight <n>              per thread: outstanding requests (default: --connections)
+--replay <file>                 replay a binary request log (./server --log binary)
+                                instead of generating requests; takes only
+                                <server_url> <threads>
+--speed <x>|max                 replay at x times the recorded pace (default 1),
+                                or back to back with max
+
+Replay sends each key's requests from one thread (chosen by hashing the
+player id), in recorded order, so per-key ordering survives; leaderboard
+and multi-get requests are spread round-robin. Cas updates and multi-gets
+are replayed with the expect= and ids logged after them; logs too old to
+have those skip them. The log is mmap()ed, so reading it costs no syscalls
+during playback.
+
+Requests completed during the ramp and warm-up appear in the per-second
+series (phase column) but not in the summary, which covers only the
+measurement window.
+
+In open-loop and timed replay modes, latency is measured from each iteration's intended start
+time, so time spent queued behind a slow response is counted (coordinated
+omission correction).
 */
 
 #include <stdio.h>
@@ -19,6 +69,17 @@ Usage:
 #include <curl/curl.h>
 #include <sys/time.h>
 #include <time.h>
+#include <math.h>
+#include <getopt.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hdr.h"
+#include "reqlog.h"
+#include "workload.h"
 
 typedef struct
 {
@@ -58,32 +119,207 @@ double cpu_usage_percent(CpuStats a, CpuStats b)
     return (100.0 * (totald - idled) / totald);
 }
 
+// ---------- Process sampling ----------
+//
+// read_cpu() is system-wide, and the load generator's own I/O says nothing
+// about the server. With --server-pid / --pg-pids, loadgen samples those
+// processes from /proc every interval: CPU time, context switches, RSS and
+// storage I/O.
+
 typedef struct
 {
-    unsigned long long read_bytes;
-    unsigned long long write_bytes;
-} IoStats;
+    int ok;    // /proc/<pid>/stat and status were readable
+    int io_ok; // /proc/<pid>/io needs the same user (or root)
+    unsigned long long utime, stime; // clock ticks
+    unsigned long long vcsw, ivcsw;
+    unsigned long long rss_kb;
+    unsigned long long read_bytes, write_bytes;
+} ProcSample;
 
-IoStats read_io()
+static int proc_read(int pid, ProcSample *s)
 {
-    IoStats io = {0};
-    FILE *f = fopen("/proc/self/io", "r");
+    char path[64], line[512];
+    memset(s, 0, sizeof(*s));
+
+    // Fields after the command name, which may itself contain spaces or ')'
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
     if (!f)
-        return io;
+        return -1;
+    char *rp = fgets(line, sizeof(line), f) ? strrchr(line, ')') : NULL;
+    fclose(f);
+    if (!rp || sscanf(rp + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &s->utime, &s->stime) != 2)
+        return -1;
 
-    char key[64];
-    while (fscanf(f, "%63s %llu", key, &io.read_bytes) != EOF)
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if (!(f = fopen(path, "r")))
+        return -1;
+    while (fgets(line, sizeof(line), f))
     {
-        if (strcmp(key, "read_bytes:") == 0)
-            fscanf(f, "%llu", &io.read_bytes);
-        if (strcmp(key, "write_bytes:") == 0)
-            fscanf(f, "%llu", &io.write_bytes);
+        if (sscanf(line, "VmRSS: %llu", &s->rss_kb) == 1 ||
+            sscanf(line, "voluntary_ctxt_switches: %llu", &s->vcsw) == 1 ||
+            sscanf(line, "nonvoluntary_ctxt_switches: %llu", &s->ivcsw) == 1)
+            continue;
     }
-
     fclose(f);
-    return io;
+
+    // One "key: value" pair per line
+    snprintf(path, sizeof(path), "/proc/%d/io", pid);
+    if ((f = fopen(path, "r")))
+    {
+        int found = 0;
+        while (fgets(line, sizeof(line), f))
+        {
+            found += sscanf(line, "read_bytes: %llu", &s->read_bytes) == 1;
+            found += sscanf(line, "write_bytes: %llu", &s->write_bytes) == 1;
+        }
+        fclose(f);
+        s->io_ok = found == 2;
+    }
+
+    s->ok = 1;
+    return 0;
 }
 
+typedef struct
+{
+    int pid;
+    ProcSample last;
+    ProcSample start; // at the start of the measurement window
+} ProcTrack;
+
+// Summed over a group's processes; rss_kb is the current total
+typedef struct
+{
+    double cpu_s;
+    unsigned long long vcsw, ivcsw;
+    unsigned long long rss_kb;
+    unsigned long long read_bytes, write_bytes;
+    int alive, io_ok;
+} ProcDelta;
+
+enum
+{
+    PROC_SERVER,
+    PROC_PG,
+    PROC_GROUPS
+};
+
+typedef struct
+{
+    const char *name;  // column prefix: "server", "pg"
+    const char *label; // for the summary
+    ProcTrack *procs;
+    int n;
+    unsigned long long peak_rss_kb; // during measurement
+} ProcGroup;
+
+static void proc_delta_add(ProcDelta *d, const ProcSample *a, const ProcSample *b)
+{
+    d->cpu_s += (double)((b->utime + b->stime) - (a->utime + a->stime)) / sysconf(_SC_CLK_TCK);
+    d->vcsw += b->vcsw - a->vcsw;
+    d->ivcsw += b->ivcsw - a->ivcsw;
+    d->read_bytes += b->read_bytes - a->read_bytes;
+    d->write_bytes += b->write_bytes - a->write_bytes;
+    d->io_ok = d->io_ok && a->io_ok && b->io_ok;
+}
+
+// Sample every process and return the change since the previous sample.
+// A process that exits (or restarts under a new pid) stops contributing.
+static void proc_group_sample(ProcGroup *g, ProcDelta *d, int measured)
+{
+    memset(d, 0, sizeof(*d));
+    d->io_ok = 1;
+    for (int i = 0; i < g->n; i++)
+    {
+        ProcSample now;
+        ProcTrack *t = &g->procs[i];
+        if (proc_read(t->pid, &now) != 0)
+        {
+            t->last.ok = 0;
+            continue;
+        }
+        if (t->last.ok)
+            proc_delta_add(d, &t->last, &now);
+        if (!t->start.ok)
+            t->start = now; // appeared after the window started
+        t->last = now;
+        d->rss_kb += now.rss_kb;
+        d->alive++;
+    }
+    if (!d->alive)
+        d->io_ok = 0;
+    if (measured && d->rss_kb > g->peak_rss_kb)
+        g->peak_rss_kb = d->rss_kb;
+}
+
+static void proc_group_mark_start(ProcGroup *g)
+{
+    g->peak_rss_kb = 0;
+    for (int i = 0; i < g->n; i++)
+        g->procs[i].start = g->procs[i].last;
+}
+
+// Change over the measurement window
+static void proc_group_total(const ProcGroup *g, ProcDelta *d)
+{
+    memset(d, 0, sizeof(*d));
+    d->io_ok = 1;
+    for (int i = 0; i < g->n; i++)
+    {
+        const ProcTrack *t = &g->procs[i];
+        if (!t->start.ok || !t->last.ok)
+            continue;
+        proc_delta_add(d, &t->start, &t->last);
+        d->rss_kb += t->last.rss_kb;
+        d->alive++;
+    }
+    if (!d->alive)
+        d->io_ok = 0;
+}
+
+// Comma-separated pids
+static int proc_group_init(ProcGroup *g, const char *list)
+{
+    g->n = 0;
+    g->procs = calloc(strlen(list) / 2 + 1, sizeof(ProcTrack));
+    if (!g->procs)
+        return -1;
+    const char *p = list;
+    while (*p)
+    {
+        char *end;
+        long pid = strtol(p, &end, 10);
+        if (end == p || pid <= 0 || (*end && *end != ','))
+            return -1;
+        g->procs[g->n++].pid = (int)pid;
+        p = *end ? end + 1 : end;
+    }
+    return g->n > 0 ? 0 : -1;
+}
+
+enum
+{
+    ARRIVAL_POISSON,
+    ARRIVAL_UNIFORM,
+};
+
+enum
+{
+    EP_UPDATE,
+    EP_LEADERBOARD,
+    EP_GET_SCORE,
+    EP_GET_SCORES, // replay only
+    EP_COUNT
+};
+
+static const char *ep_names[EP_COUNT] = {
+    [EP_UPDATE] = "update_score",
+    [EP_LEADERBOARD] = "leaderboard",
+    [EP_GET_SCORE] = "get_score",
+    [EP_GET_SCORES] = "get_scores",
+};
+
 typedef struct
 {
     const char *base_url;
@@ -93,6 +329,22 @@ typedef struct
 1 = leaderboard only
 2 = mixed update+leaderboard
 3 = get_score only*/
+    double rate; // iterations/sec for this thread, 0 = closed loop
+    int arrival;
+    int connections;  // multi engine: keep-alive connections per thread, 0 = one blocking handle
+    int max_inflight; // multi engine: outstanding requests per thread
+    uint64_t rng; // per-thread PRNG state
+    int open_loop; // latency from the intended start rather than the send time
+    long long start_ns; // closed-loop ramp: when this thread starts sending
+    int replaying; // --replay: send only this thread's share of the trace
+    const uint32_t *replay; // trace record indices for this thread, in time order (NULL if none)
+    size_t replay_count;
+
+    // results; hist and errors are read by the reporter while the thread runs
+    HdrHistogram *hist; // per endpoint, us from intended start (open loop) or send time
+    atomic_ullong errors[EP_COUNT];
+    unsigned long long sent, late;
+    double svc_sum_ms, svc_max_ms; // from actual send time
 } ThreadArgs;
 
 double now_ms()
@@ -102,124 +354,1340 @@ double now_ms()
     return t.tv_sec * 1000.0 + t.tv_usec / 1000.0;
 }
 
-void *worker(void *arg)
+static long long mono_ns(void)
 {
-    ThreadArgs *ta = (ThreadArgs *)arg;
-    CURL *curl = curl_easy_init();
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-    if (!curl)
-        pthread_exit(NULL);
+static void sleep_until_ns(long long t)
+{
+    struct timespec ts = {t / 1000000000LL, t % 1000000000LL};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+// ---------- Run phases ----------
+//
+// The run is ramp -> warm-up -> measurement. Results are recorded the whole
+// time, but only the measurement window reaches the summary.
+
+static double ramp_s, warmup_s, duration_s;
+static long long run_start_ns;
+static long long measure_start_ns;
+static long long run_end_ns; // 0 = run until every thread has sent its requests
+
+static inline int measuring(long long t)
+{
+    return t >= measure_start_ns;
+}
+
+static int more_iterations(const ThreadArgs *ta, int done)
+{
+    if (ta->requests > 0 && done >= ta->requests)
+        return 0;
+    return !run_end_ns || mono_ns() < run_end_ns;
+}
+
+// Share of the target load at time t: rises linearly during the ramp
+static double ramp_factor(long long t)
+{
+    double f = ramp_s > 0 ? (t - run_start_ns) / (ramp_s * 1e9) : 1.0;
+    if (f > 1.0)
+        return 1.0;
+    return f < 0.01 ? 0.01 : f; // keep the first gap finite
+}
+
+static const char *phase_name(long long t)
+{
+    if (measuring(t))
+        return "measure";
+    return t <= run_start_ns + (long long)(ramp_s * 1e9) ? "ramp" : "warmup";
+}
 
+// ---------- Workload ----------
+
+enum
+{
+    DIST_UNIFORM,
+    DIST_ZIPFIAN, // rank 0 (id 1) is the hottest
+    DIST_HOTSPOT,
+    DIST_LATEST, // reads favour the ids most recently updated
+};
+
+typedef struct
+{
+    int dist;
+    long long keys;
+    double theta;
+    double hot_fraction, hot_prob;
+    int mix[EP_COUNT]; // weights; all 0 = use <mode>
+    int mix_total;
+
+    Zipf zipf; // zipfian and latest
+
+    atomic_llong latest; // DIST_LATEST: ids handed out to updates so far
+} Workload;
+
+static Workload wl = {
+    .dist = DIST_UNIFORM,
+    .keys = 100000,
+    .theta = 0.99,
+    .hot_fraction = 0.2,
+    .hot_prob = 0.8,
+};
+
+static uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Player id in [1, n]; `update` matters only for DIST_LATEST
+static int pick_key(ThreadArgs *ta, long long n, int update)
+{
+    switch (wl.dist)
+    {
+    case DIST_ZIPFIAN:
+        return (int)(zipf_rank(&wl.zipf, &ta->rng) % n) + 1;
+    case DIST_HOTSPOT:
+    {
+        long long hot = (long long)(n * wl.hot_fraction);
+        if (hot < 1)
+            hot = 1;
+        if (hot >= n || rng_double(&ta->rng) < wl.hot_prob)
+            return (int)(rng_next(&ta->rng) % hot) + 1;
+        return (int)(hot + rng_next(&ta->rng) % (n - hot)) + 1;
+    }
+    case DIST_LATEST:
+    {
+        if (update)
+            return (int)(atomic_fetch_add(&wl.latest, 1) % n) + 1;
+        long long newest = atomic_load(&wl.latest) - 1;
+        long long k = newest - zipf_rank(&wl.zipf, &ta->rng);
+        return (int)(((k % n) + n) % n) + 1;
+    }
+    default:
+        return (int)(rng_next(&ta->rng) % n) + 1;
+    }
+}
+
+// Parse "update=70,get=25,leaderboard=5"
+static int parse_mix(const char *spec)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        char *eq = strchr(tok, '=');
+        if (!eq)
+            return -1;
+        *eq = '\0';
+        int w = atoi(eq + 1);
+        if (w < 0)
+            return -1;
+        if (strcmp(tok, "update") == 0)
+            wl.mix[EP_UPDATE] = w;
+        else if (strcmp(tok, "get") == 0)
+            wl.mix[EP_GET_SCORE] = w;
+        else if (strcmp(tok, "leaderboard") == 0)
+            wl.mix[EP_LEADERBOARD] = w;
+        else
+            return -1;
+    }
+    wl.mix_total = 0;
+    for (int ep = 0; ep < EP_COUNT; ep++)
+        wl.mix_total += wl.mix[ep];
+    return wl.mix_total > 0 ? 0 : -1;
+}
+
+// Endpoints to hit in one iteration; returns how many
+static int next_ops(ThreadArgs *ta, int *ops)
+{
+    if (wl.mix_total > 0)
+    {
+        int r = (int)(rng_next(&ta->rng) % wl.mix_total);
+        for (int ep = 0; ep < EP_COUNT; ep++)
+        {
+            if (r < wl.mix[ep])
+            {
+                ops[0] = ep;
+                return 1;
+            }
+            r -= wl.mix[ep];
+        }
+    }
+
+    switch (ta->mode)
+    {
+    case 0:
+        ops[0] = EP_UPDATE;
+        return 1;
+    case 1:
+        ops[0] = EP_LEADERBOARD;
+        return 1;
+    case 3:
+        ops[0] = EP_GET_SCORE;
+        return 1;
+    default:
+        // MIXED (update then get)
+        ops[0] = EP_UPDATE;
+        ops[1] = EP_LEADERBOARD;
+        return 2;
+    }
+}
+
+// Response bodies are not needed; discarding them keeps stdout out of the latency
+static size_t discard_body(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    return size * nmemb;
+}
+
+// Nanoseconds until the next iteration after the one at time t should start
+static long long next_gap_ns(ThreadArgs *ta, long long t)
+{
+    double mean = 1e9 / (ta->rate * ramp_factor(t));
+    if (ta->arrival == ARRIVAL_UNIFORM)
+        return (long long)mean;
+    return (long long)(-log(rng_double(&ta->rng)) * mean);
+}
+
+static void point_handle(CURL *curl, const char *url, int post);
+
+// Point a handle at one request to endpoint ep
+static void setup_request(ThreadArgs *ta, CURL *curl, int ep)
+{
     char url[256];
-    for (int i = 0; i < ta->requests; i++)
+    if (ep == EP_UPDATE)
+    {
+        int pid = pick_key(ta, wl.keys, 1);
+        int score = (int)(rng_next(&ta->rng) % 50000);
+        snprintf(url, sizeof(url), "%s/update_score?player_id=%d&score=%d",
+                 ta->base_url, pid, score);
+    }
+    else if (ep == EP_GET_SCORE)
+    {
+        // Plain mode 3 keeps its old habit of reading the first tenth of the ids
+        long long n = (wl.mix_total == 0 && wl.keys >= 10) ? wl.keys / 10 : wl.keys;
+        snprintf(url, sizeof(url), "%s/get_score?player_id=%d",
+                 ta->base_url, pick_key(ta, n, 0));
+    }
+    else
+    {
+        snprintf(url, sizeof(url), "%s/leaderboard?top=10", ta->base_url);
+    }
+    point_handle(curl, url, ep == EP_UPDATE);
+}
+
+static void point_handle(CURL *curl, const char *url, int post)
+{
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    if (post)
+    {
+        // Empty body; without POSTFIELDS libcurl would read the body from stdin
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 0L);
+    }
+    else
+    {
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    }
+}
+
+static void record_result(ThreadArgs *ta, CURL *curl, int ep, CURLcode rc, long long intended_ns,
+                          long long sent, long long done)
+{
+    long status = 0;
+    if (rc == CURLE_OK)
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    if (rc != CURLE_OK || status >= 400)
+        atomic_fetch_add_explicit(&ta->errors[ep], 1, memory_order_relaxed);
+
+    // Closed loop has no schedule: measure each request from its own send
+    long long ref = ta->open_loop ? intended_ns : sent;
+    hdr_record(&ta->hist[ep], (uint64_t)(done - ref) / 1000);
+    if (!measuring(done))
+        return;
+    double svc = (done - sent) / 1e6;
+    ta->sent++;
+    ta->svc_sum_ms += svc;
+    if (svc > ta->svc_max_ms)
+        ta->svc_max_ms = svc;
+}
+
+// Wait for the next iteration's start time (open loop) and return it
+static long long next_iteration(ThreadArgs *ta, long long intended, int wait)
+{
+    if (ta->rate <= 0)
+        return mono_ns();
+
+    // Open loop: the schedule does not wait for slow responses
+    intended += next_gap_ns(ta, intended);
+    if (!wait)
+        return intended;
+    long long now = mono_ns();
+    if (now < intended)
+        sleep_until_ns(intended);
+    else if (now - intended > 1000000 && measuring(intended))
+        ta->late++;
+    return intended;
+}
+
+// One blocking easy handle per thread
+static void run_easy(ThreadArgs *ta)
+{
+    CURL *curl = curl_easy_init();
+    if (!curl)
+        return;
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_body);
+
+    long long intended = mono_ns();
+    for (int i = 0; more_iterations(ta, i); i++)
+    {
+        intended = next_iteration(ta, intended, 1);
+
+        int ops[2];
+        int nops = next_ops(ta, ops);
+        for (int k = 0; k < nops; k++)
+        {
+            setup_request(ta, curl, ops[k]);
+            long long sent = mono_ns();
+            CURLcode rc = curl_easy_perform(curl);
+            // Only the first op is on the schedule; the second one is issued
+            // when the first returns, so its wait for the first is not its latency
+            record_result(ta, curl, ops[k], rc, k == 0 ? intended : sent, sent, mono_ns());
+        }
+    }
+
+    curl_easy_cleanup(curl);
+}
+
+// ---------- Multi engine ----------
+//
+// With --connections, each thread drives that many keep-alive connections
+// through one curl_multi handle, with up to --max-inflight requests
+// outstanding. The requests of an iteration are sent concurrently. In open
+// loop, requests that find no free slot wait in line, and that wait counts
+// toward their latency.
+
+typedef struct
+{
+    CURL *easy;
+    int ep;
+    long long intended, sent;
+} MultiSlot;
+
+static void run_multi(ThreadArgs *ta)
+{
+    int nslots = ta->max_inflight;
+    CURLM *multi = curl_multi_init();
+    MultiSlot *slots = calloc(nslots, sizeof(MultiSlot));
+    MultiSlot **idle = calloc(nslots, sizeof(MultiSlot *));
+    if (!multi || !slots || !idle)
+    {
+        fprintf(stderr, "multi engine: out of memory\n");
+        goto out;
+    }
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)ta->connections);
+    curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long)ta->connections);
+
+    int nidle = 0;
+    for (int i = 0; i < nslots; i++)
+    {
+        slots[i].easy = curl_easy_init();
+        if (!slots[i].easy)
+            continue;
+        curl_easy_setopt(slots[i].easy, CURLOPT_WRITEFUNCTION, discard_body);
+        curl_easy_setopt(slots[i].easy, CURLOPT_PRIVATE, &slots[i]);
+        idle[nidle++] = &slots[i];
+    }
+
+    int iter = 0;
+    int ops[2], nops = 0, opi = 0; // requests of the current iteration not yet sent
+    long long intended = 0;
+    long long next_due = next_iteration(ta, mono_ns(), 0);
+    int inflight = 0;
+
+    int more = 1;
+    while (inflight > 0 || opi < nops || more)
+    {
+        long long now = mono_ns();
+
+        // Start whatever is due, as far as free slots allow
+        while (nidle > 0)
+        {
+            if (opi == nops)
+            {
+                if (!(more = more_iterations(ta, iter)))
+                    break;
+                if (ta->rate > 0 && next_due > now)
+                    break;
+                intended = ta->rate > 0 ? next_due : now;
+                next_due = next_iteration(ta, intended, 0);
+                iter++;
+                nops = next_ops(ta, ops);
+                opi = 0;
+            }
+
+            MultiSlot *sl = idle[--nidle];
+            sl->ep = ops[opi++];
+            sl->intended = intended;
+            if (ta->rate > 0 && now - intended > 1000000 && opi == 1 && measuring(intended))
+                ta->late++;
+            setup_request(ta, sl->easy, sl->ep);
+            sl->sent = mono_ns();
+            curl_multi_add_handle(multi, sl->easy);
+            inflight++;
+        }
+
+        int running;
+        curl_multi_perform(multi, &running);
+
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(multi, &left)))
+        {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            MultiSlot *sl;
+            CURL *easy = msg->easy_handle;
+            CURLcode rc = msg->data.result;
+            curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&sl);
+            record_result(ta, easy, sl->ep, rc, sl->intended, sl->sent, mono_ns());
+            curl_multi_remove_handle(multi, easy);
+            idle[nidle++] = sl;
+            inflight--;
+        }
+
+        // Sleep until a response arrives or the next iteration is due,
+        // unless a freed slot can be used right away
+        now = mono_ns();
+        more = more && more_iterations(ta, iter);
+        int pending = opi < nops || more;
+        if (nidle > 0 && pending && (opi < nops || ta->rate <= 0 || next_due <= now))
+            continue;
+        int timeout_ms = 100;
+        if (ta->rate > 0 && nidle > 0 && pending)
+        {
+            long long due = (next_due - now + 999999) / 1000000; // round up: don't spin
+            timeout_ms = due < 100 ? (int)due : 100;
+        }
+        if (inflight > 0 || timeout_ms > 0)
+            curl_multi_poll(multi, NULL, 0, timeout_ms, NULL);
+    }
+
+out:
+    for (int i = 0; slots && i < nslots; i++)
+    {
+        if (slots[i].easy)
+            curl_easy_cleanup(slots[i].easy);
+    }
+    free(slots);
+    free(idle);
+    if (multi)
+        curl_multi_cleanup(multi);
+}
+
+// ---------- Trace replay ----------
+
+typedef struct
+{
+    const ReqLogRecord *recs;
+    size_t count;
+    uint64_t t0_us; // earliest request start
+    void *map;
+    size_t map_len;
+} Trace;
+
+static Trace trace;
+static double replay_speed = 1.0; // 0 = as fast as possible
+
+static int trace_open(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("replay: open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ReqLogHeader))
+    {
+        fprintf(stderr, "%s: not a request log\n", path);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("replay: mmap");
+        return -1;
+    }
+
+    const ReqLogHeader *h = map;
+    if (memcmp(h->magic, REQLOG_MAGIC, sizeof(REQLOG_MAGIC)) != 0 || h->record_size != sizeof(ReqLogRecord))
     {
-        int pid = rand() % 100000 + 1;
-        int score = rand() % 50000;
+        fprintf(stderr, "%s: not a request log (or record size %u, expected %zu)\n", path, h->record_size,
+                sizeof(ReqLogRecord));
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    trace.map = map;
+    trace.map_len = st.st_size;
+    trace.recs = (const ReqLogRecord *)((const char *)map + sizeof(ReqLogHeader));
+    trace.count = (st.st_size - sizeof(ReqLogHeader)) / sizeof(ReqLogRecord);
+    trace.t0_us = trace.count ? trace.recs[0].ts_us : 0;
+    for (size_t i = 1; i < trace.count; i++)
+        if (trace.recs[i].ts_us < trace.t0_us)
+            trace.t0_us = trace.recs[i].ts_us;
+    return 0;
+}
+
+// The server drains per-thread rings in batches, so the file is only
+// roughly in time order; each thread's share is sorted by start time
+static int trace_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    uint64_t tx = trace.recs[x].ts_us, ty = trace.recs[y].ts_us;
+    if (tx != ty)
+        return tx < ty ? -1 : 1;
+    return x < y ? -1 : (x > y);
+}
+
+static int cas_record(const ReqLogRecord *r)
+{
+    return ((r->flags & REQLOG_OP_MASK) >> REQLOG_OP_SHIFT) == REQLOG_OP_CAS;
+}
+
+// Number of REQLOG_ARGS records following record i
+static size_t trace_args(size_t i)
+{
+    size_t n = 0;
+    while (i + 1 + n < trace.count && trace.recs[i + 1 + n].type == REQLOG_ARGS)
+        n++;
+    return n;
+}
 
-        if (ta->mode == 0)
+// Give every record a thread; returns the number of records skipped (cas
+// updates and multi-gets from logs that did not keep their arguments)
+static size_t trace_partition(ThreadArgs *args, int threads)
+{
+    size_t *n = calloc(threads, sizeof(size_t));
+    uint32_t **idx = calloc(threads, sizeof(uint32_t *));
+    size_t skipped = 0, rr = 0;
+    if (!n || !idx)
+        goto oom;
+
+    // Two passes over the mapping: count, then fill
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (size_t i = 0; i < trace.count; i++)
         {
-            // UPDATE only
-            snprintf(url, sizeof(url), "%s/update_score?player_id=%d&score=%d",
-                     ta->base_url, pid, score);
-            curl_easy_setopt(curl, CURLOPT_URL, url);
-            curl_easy_setopt(curl, CURLOPT_POST, 1L);
-            curl_easy_perform(curl);
+            const ReqLogRecord *r = &trace.recs[i];
+            int t;
+            if (r->type == REQLOG_ARGS)
+                continue; // read along with the record before them
+            if ((r->type == REQLOG_UPDATE && (!cas_record(r) || trace_args(i))) || r->type == REQLOG_GET)
+                t = (int)((((uint64_t)(uint32_t)r->id * 0x9E3779B97F4A7C15ull) >> 32) % threads);
+            else if (r->type == REQLOG_LEADERBOARD || (r->type == REQLOG_MULTIGET && trace_args(i)))
+                t = (int)(rr++ % threads);
+            else
+            {
+                if (pass == 0)
+                    skipped++;
+                continue;
+            }
+            if (pass == 0)
+                n[t]++;
+            else
+                idx[t][args[t].replay_count++] = (uint32_t)i;
         }
-        else if (ta->mode == 1)
+        if (pass == 0)
         {
-            // GET only
-            snprintf(url, sizeof(url), "%s/leaderboard?top=10",
-                     ta->base_url);
-            curl_easy_setopt(curl, CURLOPT_URL, url);
-            curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
-            curl_easy_perform(curl);
+            for (int t = 0; t < threads; t++)
+                if (n[t] && !(idx[t] = malloc(n[t] * sizeof(uint32_t))))
+                    goto oom;
+            rr = 0;
         }
-        else if (ta->mode == 3)
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        qsort(idx[t], args[t].replay_count, sizeof(uint32_t), trace_cmp);
+        args[t].replay = idx[t];
+    }
+    free(n);
+    free(idx);
+    return skipped;
+
+oom:
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+}
+
+// Point a handle at a recorded request (trace record i); returns its endpoint
+static int setup_replay_request(ThreadArgs *ta, CURL *curl, size_t i)
+{
+    static __thread char body[REQLOG_MAX_ARGS * 12];
+    const ReqLogRecord *r = &trace.recs[i];
+    const ReqLogRecord *args = &trace.recs[i + 1];
+    char url[256];
+    if (r->type == REQLOG_UPDATE)
+    {
+        static const char *ops[] = {NULL, "max", "incr", "cas"};
+        const char *op = ops[(r->flags & REQLOG_OP_MASK) >> REQLOG_OP_SHIFT];
+        int len = snprintf(url, sizeof(url), "%s/update_score?player_id=%d&score=%d%s%s", ta->base_url, r->id,
+                           r->score, op ? "&op=" : "", op ? op : "");
+        if (cas_record(r))
+            snprintf(url + len, sizeof(url) - len, "&expect=%d", args->id);
+        point_handle(curl, url, 1);
+        return EP_UPDATE;
+    }
+    if (r->type == REQLOG_MULTIGET)
+    {
+        // The ids go in a POST body: up to REQLOG_MAX_ARGS would not fit a URL
+        size_t len = 0;
+        size_t nargs = trace_args(i);
+        for (size_t k = 0; k < nargs; k++)
         {
-            int pid = rand() % 10000 + 1;
+            len += snprintf(body + len, sizeof(body) - len, "%s%d", len ? "," : "", args[k].id);
+            if (args[k].flags > 1)
+                len += snprintf(body + len, sizeof(body) - len, ",%d", args[k].score);
+        }
+        snprintf(url, sizeof(url), "%s/get_scores", ta->base_url);
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)len);
+        return EP_GET_SCORES;
+    }
+    if (r->type == REQLOG_GET)
+    {
+        snprintf(url, sizeof(url), "%s/get_score?player_id=%d", ta->base_url, r->id);
+        point_handle(curl, url, 0);
+        return EP_GET_SCORE;
+    }
 
-            snprintf(url, sizeof(url), "%s/get_score?player_id=%d",
-                     ta->base_url, pid);
+    // Logs written before the depth was recorded have id 0
+    static const char *windows[] = {"all", "day", "week", "all"};
+    int window = r->flags & 0x3;
+    snprintf(url, sizeof(url), "%s/leaderboard?top=%d%s%s", ta->base_url, r->id > 0 ? r->id : 10,
+             window ? "&window=" : "", window ? windows[window] : "");
+    point_handle(curl, url, 0);
+    return EP_LEADERBOARD;
+}
 
-            curl_easy_setopt(curl, CURLOPT_URL, url);
-            curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
-            curl_easy_perform(curl);
+// One blocking handle per thread keeps each key's requests in order
+static void run_replay(ThreadArgs *ta)
+{
+    if (ta->replay_count == 0)
+        return;
+    CURL *curl = curl_easy_init();
+    if (!curl)
+        return;
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_body);
+
+    for (size_t i = 0; i < ta->replay_count; i++)
+    {
+        const ReqLogRecord *r = &trace.recs[ta->replay[i]];
+        long long intended;
+        if (run_end_ns && mono_ns() >= run_end_ns)
+            break;
+        if (replay_speed > 0)
+        {
+            intended = run_start_ns + (long long)((r->ts_us - trace.t0_us) * 1000.0 / replay_speed);
+            long long now = mono_ns();
+            if (now < intended)
+                sleep_until_ns(intended);
+            else if (now - intended > 1000000 && measuring(intended))
+                ta->late++;
         }
         else
         {
-            // MIXED (update then get)
-            snprintf(url, sizeof(url), "%s/update_score?player_id=%d&score=%d",
-                     ta->base_url, pid, score);
-            curl_easy_setopt(curl, CURLOPT_URL, url);
-            curl_easy_setopt(curl, CURLOPT_POST, 1L);
-            curl_easy_perform(curl);
-
-            snprintf(url, sizeof(url), "%s/leaderboard?top=10", ta->base_url);
-            curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
-            curl_easy_setopt(curl, CURLOPT_URL, url);
-            curl_easy_perform(curl);
+            intended = mono_ns();
         }
+
+        int ep = setup_replay_request(ta, curl, ta->replay[i]);
+        long long sent = mono_ns();
+        CURLcode rc = curl_easy_perform(curl);
+        record_result(ta, curl, ep, rc, intended, sent, mono_ns());
     }
 
     curl_easy_cleanup(curl);
+}
+
+void *worker(void *arg)
+{
+    ThreadArgs *ta = (ThreadArgs *)arg;
+    if (ta->start_ns)
+        sleep_until_ns(ta->start_ns);
+    if (ta->replaying)
+        run_replay(ta);
+    else if (ta->connections > 0)
+        run_multi(ta);
+    else
+        run_easy(ta);
     pthread_exit(NULL);
 }
 
+// ---------- Latency reporting ----------
+//
+// Worker threads record into their own histograms. The reporter drains
+// them (hdr_snapshot_take) once per second, and at the start of the
+// measurement window, and optionally writes each interval as CSV or JSON
+// rows. Only intervals inside the measurement window are added to the
+// run totals.
+
+typedef struct
+{
+    ThreadArgs *args;
+    int threads;
+    FILE *csv;
+    FILE *json;
+    HdrSnapshot *total;    // [EP_COUNT], measurement window
+    HdrSnapshot *interval; // [EP_COUNT + 1] scratch, the last one for "all"
+    unsigned long long errors[EP_COUNT];
+    ProcGroup procs[PROC_GROUPS]; // n = 0 when not sampled
+    atomic_int stop;
+    long long last_ns; // end of the previous interval
+    CpuStats cpu_start; // at the start of the measurement window
+} Reporter;
+
+// Process columns of the "all" row; empty when a group is not sampled
+static void series_procs(Reporter *r, const ProcDelta *pd, double interval_s)
+{
+    for (int g = 0; g < PROC_GROUPS; g++)
+    {
+        const ProcDelta *d = pd ? &pd[g] : NULL;
+        if (r->csv)
+        {
+            if (d && d->alive)
+            {
+                fprintf(r->csv, ",%.1f,%llu,%llu,%llu", interval_s > 0 ? 100.0 * d->cpu_s / interval_s : 0.0,
+                        d->vcsw, d->ivcsw, d->rss_kb);
+                if (d->io_ok)
+                    fprintf(r->csv, ",%llu,%llu", d->read_bytes, d->write_bytes);
+                else
+                    fprintf(r->csv, ",,");
+            }
+            else
+            {
+                fprintf(r->csv, ",,,,,,");
+            }
+        }
+        if (r->json && d && d->alive)
+        {
+            fprintf(r->json, ",\"%s\":{\"cpu_pct\":%.1f,\"vcsw\":%llu,\"ivcsw\":%llu,\"rss_kb\":%llu", r->procs[g].name,
+                    interval_s > 0 ? 100.0 * d->cpu_s / interval_s : 0.0, d->vcsw, d->ivcsw, d->rss_kb);
+            if (d->io_ok)
+                fprintf(r->json, ",\"read_bytes\":%llu,\"write_bytes\":%llu}", d->read_bytes, d->write_bytes);
+            else
+                fprintf(r->json, ",\"read_bytes\":null,\"write_bytes\":null}");
+        }
+    }
+}
+
+static void series_row(Reporter *r, double t_s, const char *phase, const char *name, const HdrSnapshot *iv,
+                       unsigned long long errs, double interval_s, const ProcDelta *pd)
+{
+    double rps = interval_s > 0 ? iv->total / interval_s : 0;
+    double p50 = hdr_percentile(iv, 50) / 1000.0, p90 = hdr_percentile(iv, 90) / 1000.0;
+    double p99 = hdr_percentile(iv, 99) / 1000.0, p999 = hdr_percentile(iv, 99.9) / 1000.0;
+    if (r->csv)
+    {
+        fprintf(r->csv, "%.3f,%s,%s,%llu,%.2f,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f", t_s, phase, name,
+                (unsigned long long)iv->total, rps, errs, hdr_mean(iv) / 1000.0, p50, p90, p99, p999,
+                iv->max / 1000.0);
+    }
+    if (r->json)
+    {
+        fprintf(r->json,
+                "{\"time_s\":%.3f,\"phase\":\"%s\",\"endpoint\":\"%s\",\"count\":%llu,\"rps\":%.2f,"
+                "\"errors\":%llu,\"mean_ms\":%.3f,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,"
+                "\"p999_ms\":%.3f,\"max_ms\":%.3f",
+                t_s, phase, name, (unsigned long long)iv->total, rps, errs, hdr_mean(iv) / 1000.0, p50, p90, p99,
+                p999, iv->max / 1000.0);
+    }
+    series_procs(r, pd, interval_s);
+    if (r->csv)
+        fputc('\n', r->csv);
+    if (r->json)
+        fputs("}\n", r->json);
+}
+
+// Drain everything recorded up to now, an interval that ends at at_ns
+static void reporter_collect(Reporter *r, long long at_ns)
+{
+    // An interval belongs to the phase of its last instant; ticks land on
+    // the measurement boundary, so no interval straddles it
+    const char *phase = phase_name(at_ns - 1);
+    int measured = measuring(at_ns - 1);
+    double t_s = (at_ns - run_start_ns) / 1e9;
+    double interval_s = (at_ns - r->last_ns) / 1e9;
+    r->last_ns = at_ns;
+
+    HdrSnapshot *all = &r->interval[EP_COUNT];
+    hdr_snapshot_clear(all);
+    unsigned long long all_errs = 0;
+    for (int ep = 0; ep < EP_COUNT; ep++)
+    {
+        HdrSnapshot *iv = &r->interval[ep];
+        hdr_snapshot_clear(iv);
+        unsigned long long errs = 0;
+        for (int i = 0; i < r->threads; i++)
+        {
+            hdr_snapshot_take(iv, &r->args[i].hist[ep]);
+            errs += atomic_exchange_explicit(&r->args[i].errors[ep], 0, memory_order_relaxed);
+        }
+        if (measured)
+        {
+            hdr_snapshot_merge(&r->total[ep], iv);
+            r->errors[ep] += errs;
+        }
+        hdr_snapshot_merge(all, iv);
+        all_errs += errs;
+
+        if (iv->total || errs)
+            series_row(r, t_s, phase, ep_names[ep], iv, errs, interval_s, NULL);
+    }
+
+    ProcDelta pd[PROC_GROUPS];
+    for (int g = 0; g < PROC_GROUPS; g++)
+    {
+        memset(&pd[g], 0, sizeof(pd[g]));
+        if (r->procs[g].n)
+            proc_group_sample(&r->procs[g], &pd[g], measured);
+    }
+    // Written even when idle, so stalls show up as zero-throughput rows
+    series_row(r, t_s, phase, "all", all, all_errs, interval_s, pd);
+    if (r->csv)
+        fflush(r->csv);
+    if (r->json)
+        fflush(r->json);
+}
+
+static void *reporter_loop(void *arg)
+{
+    Reporter *r = arg;
+    long long next = run_start_ns;
+    while (!atomic_load(&r->stop))
+    {
+        long long prev = next;
+        next += 1000000000LL;
+        if (prev < measure_start_ns && next > measure_start_ns)
+            next = measure_start_ns;
+        sleep_until_ns(next);
+        if (atomic_load(&r->stop))
+            break;
+        if (next == measure_start_ns)
+            r->cpu_start = read_cpu();
+        reporter_collect(r, next);
+        if (next == measure_start_ns)
+        {
+            for (int g = 0; g < PROC_GROUPS; g++)
+                proc_group_mark_start(&r->procs[g]);
+        }
+    }
+    return NULL;
+}
+
+static void print_latency_row(const char *name, const HdrSnapshot *s, unsigned long long errors)
+{
+    printf("%-14s %10llu %8llu %9.3f %9.3f %9.3f %9.3f %9.3f\n", name, (unsigned long long)s->total, errors,
+           hdr_percentile(s, 50) / 1000.0, hdr_percentile(s, 90) / 1000.0, hdr_percentile(s, 99) / 1000.0,
+           hdr_percentile(s, 99.9) / 1000.0, s->max / 1000.0);
+}
+
+static int write_hist_file(const char *path, const HdrSnapshot *total)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        perror("fopen hist file");
+        return -1;
+    }
+    fprintf(f, "endpoint,upper_us,count,cumulative\n");
+    for (int ep = 0; ep < EP_COUNT; ep++)
+    {
+        const HdrSnapshot *s = &total[ep];
+        uint64_t seen = 0;
+        for (int b = 0; b < HDR_BUCKETS; b++)
+        {
+            if (!s->counts[b])
+                continue;
+            seen += s->counts[b];
+            fprintf(f, "%s,%llu,%llu,%.6f\n", ep_names[ep], (unsigned long long)hdr_bucket_upper(b),
+                    (unsigned long long)s->counts[b], (double)seen / s->total);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [--rate REQ_PER_SEC] [--arrival poisson|uniform]\n"
+           "          [--hist-file PATH] [--csv PATH] [--json PATH]\n"
+           "          [--ramp SEC] [--warmup SEC] [--duration SEC]\n"
+           "          [--server-pid PID] [--pg-pids PID,PID,...]\n"
+           "          [--keys N] [--dist uniform|zipfian|hotspot|latest] [--skew THETA]\n"
+           "          [--hot-fraction F] [--hot-prob P] [--mix update=W,get=W,leaderboard=W]\n"
+           "          [--connections N] [--max-inflight N]\n"
+           "          <server_url> <threads> <requests_per_thread> <mode>\n"
+           "       %s --replay FILE [--speed X|max] [--warmup SEC] [--duration SEC]\n"
+           "          [--hist-file PATH] [--csv PATH] [--json PATH]\n"
+           "          <server_url> <threads>\n",
+           prog, prog);
+    printf("mode: 0=update only, 1=get only, 2=mixed, 3=get_score only\n");
+}
+
 int main(int argc, char **argv)
 {
-    if (argc < 5)
+    double rate = 0;
+    int arrival = ARRIVAL_POISSON;
+    const char *hist_path = NULL;
+    const char *csv_path = NULL;
+    const char *json_path = NULL;
+    const char *server_pid = NULL;
+    const char *pg_pids = NULL;
+    int connections = 0;
+    int max_inflight = 0;
+    const char *replay_path = NULL;
+
+    static const struct option long_opts[] = {
+        {"rate", required_argument, NULL, 'r'},
+        {"arrival", required_argument, NULL, 'a'},
+        {"hist-file", required_argument, NULL, 'H'},
+        {"csv", required_argument, NULL, 'c'},
+        {"json", required_argument, NULL, 'J'},
+        {"ramp", required_argument, NULL, 'u'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"duration", required_argument, NULL, 'D'},
+        {"server-pid", required_argument, NULL, 'P'},
+        {"pg-pids", required_argument, NULL, 'G'},
+        {"keys", required_argument, NULL, 'k'},
+        {"dist", required_argument, NULL, 'd'},
+        {"skew", required_argument, NULL, 's'},
+        {"hot-fraction", required_argument, NULL, 'f'},
+        {"hot-prob", required_argument, NULL, 'p'},
+        {"mix", required_argument, NULL, 'm'},
+        {"connections", required_argument, NULL, 'C'},
+        {"max-inflight", required_argument, NULL, 'I'},
+        {"replay", required_argument, NULL, 'R'},
+        {"speed", required_argument, NULL, 'S'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'a':
+            if (strcmp(optarg, "poisson") == 0)
+                arrival = ARRIVAL_POISSON;
+            else if (strcmp(optarg, "uniform") == 0)
+                arrival = ARRIVAL_UNIFORM;
+            else
+            {
+                fprintf(stderr, "Unknown arrival distribution: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'H':
+            hist_path = optarg;
+            break;
+        case 'c':
+            csv_path = optarg;
+            break;
+        case 'J':
+            json_path = optarg;
+            break;
+        case 'u':
+            ramp_s = atof(optarg);
+            break;
+        case 'w':
+            warmup_s = atof(optarg);
+            break;
+        case 'D':
+            duration_s = atof(optarg);
+            break;
+        case 'P':
+            server_pid = optarg;
+            break;
+        case 'G':
+            pg_pids = optarg;
+            break;
+        case 'k':
+            wl.keys = atoll(optarg);
+            break;
+        case 'd':
+            if (strcmp(optarg, "uniform") == 0)
+                wl.dist = DIST_UNIFORM;
+            else if (strcmp(optarg, "zipfian") == 0)
+                wl.dist = DIST_ZIPFIAN;
+            else if (strcmp(optarg, "hotspot") == 0)
+                wl.dist = DIST_HOTSPOT;
+            else if (strcmp(optarg, "latest") == 0)
+                wl.dist = DIST_LATEST;
+            else
+            {
+                fprintf(stderr, "Unknown key distribution: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            wl.theta = atof(optarg);
+            break;
+        case 'f':
+            wl.hot_fraction = atof(optarg);
+            break;
+        case 'p':
+            wl.hot_prob = atof(optarg);
+            break;
+        case 'C':
+            connections = atoi(optarg);
+            break;
+        case 'I':
+            max_inflight = atoi(optarg);
+            break;
+        case 'R':
+            replay_path = optarg;
+            break;
+        case 'S':
+            replay_speed = strcmp(optarg, "max") == 0 ? 0 : atof(optarg);
+            if (replay_speed <= 0 && strcmp(optarg, "max") != 0)
+            {
+                fprintf(stderr, "Bad --speed (expected a positive factor or max): %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'm':
+            if (parse_mix(optarg) != 0)
+            {
+                fprintf(stderr, "Bad --mix (expected e.g. update=70,get=25,leaderboard=5): %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (argc - optind < (replay_path ? 2 : 4))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *url = argv[optind];
+    int threads = atoi(argv[optind + 1]);
+    int reqs = replay_path ? 0 : atoi(argv[optind + 2]);
+    int mode = replay_path ? 0 : atoi(argv[optind + 3]);
+    if (threads < 1)
+    {
+        fprintf(stderr, "Need at least one thread\n");
+        return 1;
+    }
+    if (ramp_s < 0 || warmup_s < 0 || duration_s < 0)
+    {
+        fprintf(stderr, "--ramp, --warmup and --duration must not be negative\n");
+        return 1;
+    }
+    if (!replay_path && reqs <= 0 && duration_s <= 0)
+    {
+        fprintf(stderr, "<requests_per_thread> may only be 0 with --duration\n");
+        return 1;
+    }
+    if (replay_path && ramp_s > 0)
+    {
+        fprintf(stderr, "--ramp does not apply to --replay (the trace sets the pace)\n");
+        return 1;
+    }
+    if (replay_path && (rate > 0 || connections > 0 || max_inflight > 0))
     {
-        printf("Usage: %s <server_url> <threads> <requests_per_thread> <mode>\n", argv[0]);
-        printf("mode: 0=update only, 1=get only, 2=mixed\n");
+        fprintf(stderr, "--replay keeps the recorded schedule and one connection per thread; "
+                        "use --speed and <threads> instead of --rate/--connections\n");
         return 1;
     }
+    if (replay_path && trace_open(replay_path) != 0)
+        return 1;
 
-    const char *url = argv[1];
-    int threads = atoi(argv[2]);
-    int reqs = atoi(argv[3]);
-    int mode = atoi(argv[4]);
+    if (wl.keys < 1 || wl.theta <= 0 || wl.theta >= 1 || wl.hot_fraction <= 0 || wl.hot_fraction > 1 ||
+        wl.hot_prob < 0 || wl.hot_prob > 1)
+    {
+        fprintf(stderr, "Need --keys >= 1, 0 < --skew < 1, 0 < --hot-fraction <= 1, 0 <= --hot-prob <= 1\n");
+        return 1;
+    }
+    if (wl.dist == DIST_ZIPFIAN || wl.dist == DIST_LATEST)
+        zipf_init(&wl.zipf, wl.keys, wl.theta);
+    if (wl.dist == DIST_LATEST)
+        atomic_store(&wl.latest, 1);
 
-    srand(time(NULL));
+    if (max_inflight > 0 && connections <= 0)
+        connections = max_inflight;
+    if (connections > 0 && max_inflight <= 0)
+        max_inflight = connections;
+    if (connections < 0 || max_inflight < 0)
+    {
+        fprintf(stderr, "--connections and --max-inflight must be positive\n");
+        return 1;
+    }
+
+    uint64_t seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
     curl_global_init(CURL_GLOBAL_ALL);
 
     pthread_t tids[threads];
-    ThreadArgs args = {url, reqs, mode};
+    ThreadArgs args[threads];
+    for (int i = 0; i < threads; i++)
+    {
+        memset(&args[i], 0, sizeof(args[i]));
+        args[i].base_url = url;
+        args[i].requests = reqs;
+        args[i].mode = mode;
+        args[i].rate = rate / threads;
+        args[i].arrival = arrival;
+        args[i].connections = connections;
+        args[i].max_inflight = max_inflight;
+        args[i].rng = splitmix64(&seed) | 1; // xorshift state must not be 0
+        args[i].open_loop = replay_path ? replay_speed > 0 : rate > 0;
+        args[i].replaying = replay_path != NULL;
+        args[i].hist = calloc(EP_COUNT, sizeof(HdrHistogram));
+        if (!args[i].hist)
+        {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
+
+    size_t replay_skipped = replay_path ? trace_partition(args, threads) : 0;
+
+    Reporter rep = {.args = args, .threads = threads};
+    rep.total = calloc(EP_COUNT, sizeof(HdrSnapshot));
+    rep.interval = malloc((EP_COUNT + 1) * sizeof(HdrSnapshot));
+    if (!rep.total || !rep.interval)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    rep.procs[PROC_SERVER].name = "server";
+    rep.procs[PROC_SERVER].label = "Server";
+    rep.procs[PROC_PG].name = "pg";
+    rep.procs[PROC_PG].label = "Postgres";
+    if ((server_pid && proc_group_init(&rep.procs[PROC_SERVER], server_pid) != 0) ||
+        (pg_pids && proc_group_init(&rep.procs[PROC_PG], pg_pids) != 0))
+    {
+        fprintf(stderr, "Bad --server-pid/--pg-pids (expected comma-separated pids)\n");
+        return 1;
+    }
+    for (int g = 0; g < PROC_GROUPS; g++)
+    {
+        ProcGroup *pg = &rep.procs[g];
+        for (int i = 0; i < pg->n; i++)
+        {
+            ProcSample probe;
+            if (proc_read(pg->procs[i].pid, &probe) != 0)
+                fprintf(stderr, "Warning: cannot read /proc/%d\n", pg->procs[i].pid);
+            else if (!probe.io_ok)
+                fprintf(stderr, "Warning: /proc/%d/io is not readable; I/O bytes will be missing\n",
+                        pg->procs[i].pid);
+        }
+    }
+    if (csv_path)
+    {
+        rep.csv = fopen(csv_path, "w");
+        if (!rep.csv)
+        {
+            perror("fopen csv");
+            return 1;
+        }
+        fprintf(rep.csv, "time_s,phase,endpoint,count,rps,errors,mean_ms,p50_ms,p90_ms,p99_ms,p999_ms,max_ms");
+        for (int g = 0; g < PROC_GROUPS; g++)
+        {
+            const char *n = rep.procs[g].name;
+            fprintf(rep.csv, ",%s_cpu_pct,%s_vcsw,%s_ivcsw,%s_rss_kb,%s_read_bytes,%s_write_bytes", n, n, n, n, n, n);
+        }
+        fputc('\n', rep.csv);
+    }
+    if (json_path)
+    {
+        rep.json = fopen(json_path, "w");
+        if (!rep.json)
+        {
+            perror("fopen json");
+            return 1;
+        }
+    }
 
-    CpuStats c1 = read_cpu();
-    IoStats io1 = read_io();
+    run_start_ns = mono_ns();
+    measure_start_ns = run_start_ns + (long long)((ramp_s + warmup_s) * 1e9);
+    run_end_ns = duration_s > 0 ? measure_start_ns + (long long)(duration_s * 1e9) : 0;
+    rep.last_ns = run_start_ns;
+    rep.cpu_start = read_cpu(); // replaced at the start of measurement if there is a ramp or warm-up
+    for (int g = 0; g < PROC_GROUPS; g++)
+    {
+        ProcDelta unused;
+        proc_group_sample(&rep.procs[g], &unused, 0);
+        proc_group_mark_start(&rep.procs[g]);
+    }
+    if (ramp_s > 0 && rate <= 0)
+    {
+        for (int i = 0; i < threads; i++)
+            args[i].start_ns = run_start_ns + (long long)(ramp_s * 1e9 * i / threads);
+    }
 
-    double start = now_ms();
+    pthread_t reporter;
+    int reporter_started = pthread_create(&reporter, NULL, reporter_loop, &rep) == 0;
 
     /* run loadgen test */
     for (int i = 0; i < threads; i++)
-        pthread_create(&tids[i], NULL, worker, &args);
+        pthread_create(&tids[i], NULL, worker, &args[i]);
 
     for (int i = 0; i < threads; i++)
         pthread_join(tids[i], NULL);
 
-    double end = now_ms();
+    long long end_ns = mono_ns();
+
+    atomic_store(&rep.stop, 1);
+    if (reporter_started)
+        pthread_join(reporter, NULL);
+    reporter_collect(&rep, end_ns);
+    if (rep.csv)
+        fclose(rep.csv);
+    if (rep.json)
+        fclose(rep.json);
 
     CpuStats c2 = read_cpu();
-    IoStats io2 = read_io();
 
-    double cpu_percent = cpu_usage_percent(c1, c2);
-    unsigned long long read_delta = io2.read_bytes - io1.read_bytes;
-    unsigned long long write_delta = io2.write_bytes - io1.write_bytes;
+    double cpu_percent = cpu_usage_percent(rep.cpu_start, c2);
+    double elapsed = end_ns > measure_start_ns ? (end_ns - measure_start_ns) / 1e9 : 0;
 
-    double total;
-    if (mode == 2)
-        total = threads * reqs * 2; // mixed
-    else
-        total = threads * reqs; // others
+    double total = 0; // requests actually sent (a --mix iteration is one request)
+    for (int i = 0; i < threads; i++)
+        total += args[i].sent;
 
+    static const char *dist_names[] = {"uniform", "zipfian", "hotspot", "latest"};
     printf("\n=== Load Test Summary ===\n");
-    printf("Mode: %d\n", mode);
-    printf("Threads: %d, Requests/thread: %d\n", threads, reqs);
+    if (replay_path)
+    {
+        printf("Replay: %s, %zu records (%zu cas/multi-get without arguments skipped)\n", replay_path, trace.count, replay_skipped);
+        if (replay_speed > 0)
+            printf("Speed: %gx recorded pace\n", replay_speed);
+        else
+            printf("Speed: max (back to back)\n");
+        printf("Threads: %d\n", threads);
+    }
+    else
+    {
+        if (wl.mix_total > 0)
+            printf("Mix: update=%d get=%d leaderboard=%d\n", wl.mix[EP_UPDATE], wl.mix[EP_GET_SCORE],
+                   wl.mix[EP_LEADERBOARD]);
+        else
+            printf("Mode: %d\n", mode);
+        printf("Keys: %lld, distribution: %s\n", wl.keys, dist_names[wl.dist]);
+        if (reqs > 0)
+            printf("Threads: %d, Requests/thread: %d\n", threads, reqs);
+        else
+            printf("Threads: %d\n", threads);
+    }
+    if (connections > 0)
+        printf("Engine: curl_multi, %d connections and up to %d in flight per thread\n", connections, max_inflight);
+    if (ramp_s > 0 || warmup_s > 0)
+        printf("Phases: ramp %.1f sec, warm-up %.1f sec (not measured)\n", ramp_s, warmup_s);
+    if (elapsed == 0)
+        printf("The run ended before the measurement window started; nothing was measured\n");
     printf("Total HTTP requests: %.0f\n", total);
-    printf("Elapsed: %.2f sec\n", (end - start) / 1000.0);
-    printf("Throughput: %.2f req/sec\n", total / ((end - start) / 1000.0));
+    printf("Elapsed: %.2f sec\n", elapsed);
+    printf("Throughput: %.2f req/sec\n", elapsed > 0 ? total / elapsed : 0.0);
     printf("CPU Utilization: %.2f %%\n", cpu_percent);
+    for (int g = 0; g < PROC_GROUPS; g++)
+    {
+        const ProcGroup *pg = &rep.procs[g];
+        if (!pg->n)
+            continue;
+        ProcDelta d;
+        proc_group_total(pg, &d);
+        if (pg->n == 1)
+            printf("%s (pid %d):", pg->label, pg->procs[0].pid);
+        else
+            printf("%s (%d of %d pids):", pg->label, d.alive, pg->n);
+        if (!d.alive)
+        {
+            printf(" not running\n");
+            continue;
+        }
+        printf(" CPU %.1f %% of one core, context switches %llu voluntary / %llu involuntary,"
+               " RSS %.1f MB (peak %.1f MB)",
+               elapsed > 0 ? 100.0 * d.cpu_s / elapsed : 0.0, d.vcsw, d.ivcsw, d.rss_kb / 1024.0,
+               pg->peak_rss_kb / 1024.0);
+        if (d.io_ok)
+            printf(", I/O read %.1f MB / written %.1f MB\n", d.read_bytes / 1048576.0, d.write_bytes / 1048576.0);
+        else
+            printf(", I/O n/a\n");
+    }
+
+    unsigned long long sent = 0, errors = 0, late = 0;
+    double svc_sum = 0, svc_max = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        sent += args[i].sent;
+        late += args[i].late;
+        svc_sum += args[i].svc_sum_ms;
+        if (args[i].svc_max_ms > svc_max)
+            svc_max = args[i].svc_max_ms;
+    }
+    for (int ep = 0; ep < EP_COUNT; ep++)
+        errors += rep.errors[ep];
+    printf("Errors: %llu\n", errors);
+    if (rate > 0)
+    {
+        printf("Offered rate: %.2f iterations/sec (%s arrivals)\n", rate,
+               arrival == ARRIVAL_POISSON ? "poisson" : "uniform");
+        printf("Service time (from send): mean %.3f ms, max %.3f ms\n",
+               sent ? svc_sum / sent : 0.0, svc_max);
+        printf("Iterations started >1 ms behind schedule: %llu\n", late);
+    }
+    else if (replay_path && replay_speed > 0)
+    {
+        printf("Service time (from send): mean %.3f ms, max %.3f ms\n",
+               sent ? svc_sum / sent : 0.0, svc_max);
+        printf("Requests sent >1 ms behind the recorded schedule: %llu\n", late);
+    }
+
+    printf("\nLatency (ms%s)\n", args[0].open_loop ? ", from intended start" : "");
+    printf("%-14s %10s %8s %9s %9s %9s %9s %9s\n", "endpoint", "count", "errors", "p50", "p90", "p99", "p99.9", "max");
+    HdrSnapshot *all = calloc(1, sizeof(HdrSnapshot));
+    for (int ep = 0; ep < EP_COUNT; ep++)
+    {
+        if (!rep.total[ep].total && !rep.errors[ep])
+            continue;
+        print_latency_row(ep_names[ep], &rep.total[ep], rep.errors[ep]);
+        if (all)
+            hdr_snapshot_merge(all, &rep.total[ep]);
+    }
+    if (all)
+        print_latency_row("all", all, errors);
+    free(all);
+
+    if (hist_path && write_hist_file(hist_path, rep.total) == 0)
+        printf("Histogram written to %s\n", hist_path);
+    if (csv_path)
+        printf("Per-second series written to %s\n", csv_path);
+    if (json_path)
+        printf("Per-second series written to %s\n", json_path);
 
+    if (trace.map)
+        munmap(trace.map, trace.map_len);
     curl_global_cleanup();
     return 0;
 }
@@ -0,0 +1,94 @@
+/*
+Request Log Decoder
+Turns a binary request log (./server --log binary --log-file FILE) back into
+the text lines the analyze*.py scripts parse.
+
+Compile:
+gcc -O2 -Wall logdecode.c reqlog.c -o logdecode -pthread
+
+Usage:
+./logdecode <logfile> [--ts | --jsonl]
+--ts     prefixes each line with the request start time in microseconds
+--jsonl  prints one JSON object per record instead (every field, for
+         scripts that want the raw trace: endpoint, id, score, timestamp)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reqlog.h"
+
+static void print_json(const ReqLogRecord *r)
+{
+    static const char *types[] = {
+        [REQLOG_LEADERBOARD] = "leaderboard",
+        [REQLOG_UPDATE] = "update_score",
+        [REQLOG_GET] = "get_score",
+        [REQLOG_MULTIGET] = "get_scores",
+        [REQLOG_ARGS] = "args",
+    };
+    const char *type = r->type < sizeof(types) / sizeof(types[0]) && types[r->type] ? types[r->type] : "unknown";
+    printf("{\"ts_us\":%llu,\"endpoint\":\"%s\",\"id\":%d,\"score\":%d,\"latency_us\":%u,"
+           "\"mode\":%u,\"cache_hit\":%u,\"flags\":%u}\n",
+           (unsigned long long)r->ts_us, type, r->id, r->score, r->latency_us, r->mode, r->cache_hit, r->flags);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <logfile> [--ts | --jsonl]\n", argv[0]);
+        return 1;
+    }
+
+    int with_ts = (argc > 2 && strcmp(argv[2], "--ts") == 0);
+    int jsonl = (argc > 2 && strcmp(argv[2], "--jsonl") == 0);
+
+    FILE *f = fopen(argv[1], "rb");
+    if (!f)
+    {
+        perror("fopen");
+        return 1;
+    }
+
+    ReqLogHeader h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, REQLOG_MAGIC, sizeof(REQLOG_MAGIC)) != 0)
+    {
+        fprintf(stderr, "%s: not a request log\n", argv[1]);
+        fclose(f);
+        return 1;
+    }
+    if (h.record_size != sizeof(ReqLogRecord))
+    {
+        fprintf(stderr, "%s: record size %u, expected %zu\n", argv[1], h.record_size, sizeof(ReqLogRecord));
+        fclose(f);
+        return 1;
+    }
+
+    ReqLogRecord recs[4096];
+    char line[256];
+    size_t n;
+    unsigned long long total = 0;
+    while ((n = fread(recs, sizeof(ReqLogRecord), 4096, f)) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            if (jsonl)
+            {
+                print_json(&recs[i]);
+                continue;
+            }
+            if (recs[i].type == REQLOG_ARGS)
+                continue;
+            reqlog_format(&recs[i], line, sizeof(line));
+            if (with_ts)
+                printf("%llu ", (unsigned long long)recs[i].ts_us);
+            fputs(line, stdout);
+        }
+        total += n;
+    }
+
+    fclose(f);
+    fprintf(stderr, "Decoded %llu records\n", total);
+    return 0;
+}
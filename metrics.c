@@ -0,0 +1,233 @@
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    HdrHistogram hist[METRIC_HIST_COUNT];
+    atomic_ullong counters[METRIC_COUNTER_COUNT];
+} MetricsBlock;
+
+static MetricsBlock *blocks[METRICS_MAX_THREADS];
+static atomic_int block_count = 0;
+static pthread_mutex_t block_reg_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread MetricsBlock *my_block = NULL;
+
+// Threads beyond METRICS_MAX_THREADS share this block (still atomic, just contended)
+static MetricsBlock overflow_block;
+
+static atomic_llong gauges[METRIC_GAUGE_COUNT];
+static int metrics_mode = 0;
+
+static const char *hist_endpoint[METRIC_HIST_COUNT] = {
+    [METRIC_LAT_LEADERBOARD] = "leaderboard",
+    [METRIC_LAT_UPDATE_SCORE] = "update_score",
+    [METRIC_LAT_GET_SCORE] = "get_score",
+    [METRIC_LAT_GET_SCORES] = "get_scores",
+};
+
+static const struct
+{
+    const char *name;
+    const char *help;
+} counter_info[METRIC_COUNTER_COUNT] = {
+    [METRIC_CACHE_HITS] = {"leaderboard_cache_hits_total", "LRU cache lookups that found the player"},
+    [METRIC_CACHE_MISSES] = {"leaderboard_cache_misses_total", "LRU cache lookups that missed"},
+    [METRIC_CACHE_EVICTIONS] = {"leaderboard_cache_evictions_total", "LRU entries evicted to make room"},
+    [METRIC_TOPN_INSERTS] = {"leaderboard_topn_inserts_total", "Updates that entered or moved within the Top-N cache"},
+    [METRIC_TOPN_REJECTS] = {"leaderboard_topn_rejects_total", "Updates whose score did not qualify for the Top-N cache"},
+    [METRIC_POOL_ACQUIRES] = {"leaderboard_pool_acquires_total", "DB connections handed out by the pool"},
+    [METRIC_POOL_WAITS] = {"leaderboard_pool_waits_total", "Pool acquires that blocked waiting for a free connection"},
+    [METRIC_POOL_CONNECTS] = {"leaderboard_pool_connects_total", "DB connections opened by the pool"},
+    [METRIC_POOL_CLOSES] = {"leaderboard_pool_closes_total", "DB connections closed by the pool (idle, over max, or broken)"},
+    [METRIC_WRITES_AVOIDED] = {"leaderboard_writes_avoided_total", "Conditional updates dropped before any write because they changed nothing"},
+};
+
+static const struct
+{
+    const char *name;
+    const char *help;
+} gauge_info[METRIC_GAUGE_COUNT] = {
+    [METRIC_POOL_SIZE] = {"leaderboard_pool_size", "DB connections in the pool"},
+    [METRIC_POOL_IN_USE] = {"leaderboard_pool_in_use", "DB connections currently checked out"},
+    [METRIC_CACHE_ENTRIES] = {"leaderboard_cache_entries", "Entries in the LRU cache"},
+};
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+void metrics_init(int mode)
+{
+    metrics_mode = mode;
+}
+
+static MetricsBlock *block_register(void)
+{
+    MetricsBlock *b = NULL;
+
+    pthread_mutex_lock(&block_reg_lock);
+    int n = atomic_load(&block_count);
+    if (n < METRICS_MAX_THREADS)
+        b = calloc(1, sizeof(MetricsBlock));
+    if (b)
+    {
+        blocks[n] = b;
+        atomic_store(&block_count, n + 1);
+    }
+    pthread_mutex_unlock(&block_reg_lock);
+
+    my_block = b ? b : &overflow_block;
+    return my_block;
+}
+
+static inline MetricsBlock *block_get(void)
+{
+    return my_block ? my_block : block_register();
+}
+
+void metrics_thread_init(void)
+{
+    block_get();
+}
+
+void metrics_record(MetricHist h, uint64_t value)
+{
+    hdr_record(&block_get()->hist[h], value);
+}
+
+void metrics_count(MetricCounter c, uint64_t n)
+{
+    atomic_fetch_add_explicit(&block_get()->counters[c], n, memory_order_relaxed);
+}
+
+void metrics_gauge_set(MetricGauge g, long long value)
+{
+    atomic_store_explicit(&gauges[g], value, memory_order_relaxed);
+}
+
+void metrics_gauge_add(MetricGauge g, long long delta)
+{
+    atomic_fetch_add_explicit(&gauges[g], delta, memory_order_relaxed);
+}
+
+uint64_t metrics_counter_total(MetricCounter c)
+{
+    uint64_t total = atomic_load_explicit(&overflow_block.counters[c], memory_order_relaxed);
+    int n = atomic_load(&block_count);
+    for (int i = 0; i < n; i++)
+        total += atomic_load_explicit(&blocks[i]->counters[c], memory_order_relaxed);
+    return total;
+}
+
+static void hist_total(MetricHist h, HdrSnapshot *s)
+{
+    hdr_snapshot_clear(s);
+    hdr_snapshot_add(s, &overflow_block.hist[h]);
+    int n = atomic_load(&block_count);
+    for (int i = 0; i < n; i++)
+        hdr_snapshot_add(s, &blocks[i]->hist[h]);
+}
+
+void mbuf_printf(MetricsBuf *b, const char *fmt, ...)
+{
+    va_list ap;
+    for (;;)
+    {
+        size_t avail = b->cap - b->len;
+        va_start(ap, fmt);
+        int n = vsnprintf(b->data ? b->data + b->len : NULL, avail, fmt, ap);
+        va_end(ap);
+        if (n < 0)
+            return;
+        if ((size_t)n < avail)
+        {
+            b->len += n;
+            return;
+        }
+
+        size_t cap = b->cap ? b->cap * 2 : 4096;
+        while (cap - b->len <= (size_t)n)
+            cap *= 2;
+        char *p = realloc(b->data, cap);
+        if (!p)
+            return;
+        b->data = p;
+        b->cap = cap;
+    }
+}
+
+void mbuf_free(MetricsBuf *b)
+{
+    free(b->data);
+    b->data = NULL;
+    b->len = b->cap = 0;
+}
+
+// Latencies are recorded in microseconds and exported in seconds
+static void render_summary(MetricsBuf *b, const char *name, const char *labels, const HdrSnapshot *s)
+{
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+    {
+        mbuf_printf(b, "%s{%squantile=\"%g\"} %.6f\n", name, labels, quantiles[i],
+                    hdr_percentile(s, quantiles[i] * 100.0) / 1e6);
+    }
+    mbuf_printf(b, "%s_sum{%.*s} %.6f\n", name, (int)strlen(labels) - 1, labels, s->sum / 1e6);
+    mbuf_printf(b, "%s_count{%.*s} %llu\n", name, (int)strlen(labels) - 1, labels, (unsigned long long)s->total);
+}
+
+void metrics_render(MetricsBuf *b)
+{
+    HdrSnapshot *s = malloc(sizeof(HdrSnapshot));
+    if (!s)
+        return;
+
+    char labels[128];
+
+    mbuf_printf(b, "# HELP leaderboard_request_duration_seconds Server-side request latency\n");
+    mbuf_printf(b, "# TYPE leaderboard_request_duration_seconds summary\n");
+    for (int h = 0; h < METRIC_HIST_COUNT; h++)
+    {
+        if (!hist_endpoint[h])
+            continue;
+        hist_total(h, s);
+        snprintf(labels, sizeof(labels), "endpoint=\"%s\",mode=\"%d\",", hist_endpoint[h], metrics_mode);
+        render_summary(b, "leaderboard_request_duration_seconds", labels, s);
+    }
+
+    mbuf_printf(b, "# HELP leaderboard_request_duration_max_seconds Slowest request seen\n");
+    mbuf_printf(b, "# TYPE leaderboard_request_duration_max_seconds gauge\n");
+    for (int h = 0; h < METRIC_HIST_COUNT; h++)
+    {
+        if (!hist_endpoint[h])
+            continue;
+        hist_total(h, s);
+        mbuf_printf(b, "leaderboard_request_duration_max_seconds{endpoint=\"%s\",mode=\"%d\"} %.6f\n",
+                    hist_endpoint[h], metrics_mode, s->max / 1e6);
+    }
+
+    hist_total(METRIC_LAT_POOL_WAIT, s);
+    snprintf(labels, sizeof(labels), "mode=\"%d\",", metrics_mode);
+    mbuf_printf(b, "# HELP leaderboard_pool_wait_seconds Time spent acquiring a DB connection\n");
+    mbuf_printf(b, "# TYPE leaderboard_pool_wait_seconds summary\n");
+    render_summary(b, "leaderboard_pool_wait_seconds", labels, s);
+
+    for (int c = 0; c < METRIC_COUNTER_COUNT; c++)
+    {
+        mbuf_printf(b, "# HELP %s %s\n# TYPE %s counter\n%s{mode=\"%d\"} %llu\n",
+                    counter_info[c].name, counter_info[c].help, counter_info[c].name,
+                    counter_info[c].name, metrics_mode, (unsigned long long)metrics_counter_total(c));
+    }
+
+    for (int g = 0; g < METRIC_GAUGE_COUNT; g++)
+    {
+        mbuf_printf(b, "# HELP %s %s\n# TYPE %s gauge\n%s{mode=\"%d\"} %lld\n",
+                    gauge_info[g].name, gauge_info[g].help, gauge_info[g].name,
+                    gauge_info[g].name, metrics_mode, (long long)atomic_load(&gauges[g]));
+    }
+
+    free(s);
+}
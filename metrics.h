@@ -0,0 +1,76 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hdr.h"
+
+// Server metrics.
+//
+// Every recording thread lazily gets its own block of histograms and
+// counters and only ever touches that block (relaxed atomics, no locks);
+// GET /metrics sums the blocks and renders Prometheus text format.
+
+#define METRICS_MAX_THREADS 128
+
+typedef enum
+{
+    METRIC_LAT_LEADERBOARD, // request latency, us
+    METRIC_LAT_UPDATE_SCORE,
+    METRIC_LAT_GET_SCORE,
+    METRIC_LAT_GET_SCORES,
+    METRIC_LAT_POOL_WAIT, // time spent in pool_get_connection, us
+    METRIC_HIST_COUNT
+} MetricHist;
+
+typedef enum
+{
+    METRIC_CACHE_HITS,
+    METRIC_CACHE_MISSES,
+    METRIC_CACHE_EVICTIONS,
+    METRIC_TOPN_INSERTS,
+    METRIC_TOPN_REJECTS,
+    METRIC_POOL_ACQUIRES,
+    METRIC_POOL_WAITS, // acquires that had to block for a free connection
+    METRIC_POOL_CONNECTS, // connections opened (startup, growth, replacing broken ones)
+    METRIC_POOL_CLOSES,   // connections closed (idle, over max, or unrecoverable)
+    METRIC_WRITES_AVOIDED, // conditional updates that changed nothing and skipped the write
+    METRIC_COUNTER_COUNT
+} MetricCounter;
+
+typedef enum
+{
+    METRIC_POOL_SIZE,
+    METRIC_POOL_IN_USE,
+    METRIC_CACHE_ENTRIES,
+    METRIC_GAUGE_COUNT
+} MetricGauge;
+
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} MetricsBuf;
+
+void metrics_init(int mode);
+
+// Register the calling thread's block now rather than on its first
+// recording, e.g. before a benchmark starts timing
+void metrics_thread_init(void);
+
+void metrics_record(MetricHist h, uint64_t value);
+void metrics_count(MetricCounter c, uint64_t n);
+void metrics_gauge_set(MetricGauge g, long long value);
+void metrics_gauge_add(MetricGauge g, long long delta);
+
+// Sum of a counter over all threads
+uint64_t metrics_counter_total(MetricCounter c);
+
+void mbuf_printf(MetricsBuf *b, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void mbuf_free(MetricsBuf *b);
+
+// Append all metrics in Prometheus text exposition format
+void metrics_render(MetricsBuf *b);
+
+#endif // METRICS_H
@@ -0,0 +1,602 @@
+#include "repl.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "topn.h"
+
+#define REPL_RING_MASK (REPL_RING_RECORDS - 1)
+#define REPL_SEND_BATCH 4096 // records copied out of the ring per write
+#define REPL_RECV_BATCH 1024
+#define REPL_RETRY_MS 1000
+
+static uint64_t wall_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static int send_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// ---------- Primary ----------
+
+static ReplRecord *ring;
+static uint64_t next_seq = 1;
+static uint64_t epoch;
+static pthread_mutex_t repl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t repl_cond = PTHREAD_COND_INITIALIZER; // new records
+static int listen_fd = -1;
+static atomic_int stopping; // repl_shutdown() was called (either role)
+static atomic_int replicas_connected;
+static atomic_ullong snapshots_sent;
+
+// Must hold repl_lock
+static void publish_locked(int id, int score, uint64_t ts)
+{
+    ReplRecord *r = &ring[next_seq & REPL_RING_MASK];
+    r->seq = next_seq++;
+    r->ts_us = ts;
+    r->id = id;
+    r->score = score;
+    r->type = REPL_UPDATE;
+    r->window = 0;
+}
+
+void repl_publish(int id, int score)
+{
+    if (!ring)
+        return;
+    uint64_t ts = wall_us();
+    pthread_mutex_lock(&repl_lock);
+    publish_locked(id, score, ts);
+    pthread_cond_broadcast(&repl_cond);
+    pthread_mutex_unlock(&repl_lock);
+}
+
+void repl_publish_batch(const Player *recs, int n)
+{
+    if (!ring || n <= 0)
+        return;
+    uint64_t ts = wall_us();
+    pthread_mutex_lock(&repl_lock);
+    for (int i = 0; i < n; i++)
+        publish_locked(recs[i].id, recs[i].score, ts);
+    pthread_cond_broadcast(&repl_cond);
+    pthread_mutex_unlock(&repl_lock);
+}
+
+static ReplRecord control(ReplType type, uint64_t seq)
+{
+    ReplRecord r;
+    memset(&r, 0, sizeof(r));
+    r.type = type;
+    r.seq = seq;
+    r.ts_us = wall_us();
+    return r;
+}
+
+// Copy the LRU and every Top-N window (same lock order as take_snapshot)
+// and send them; *seq is set to the last update the copy reflects
+static int send_snapshot(int fd, uint64_t *seq_out)
+{
+    pthread_mutex_lock(&cache_lock);
+    pthread_mutex_lock(&topn_lock);
+    int nlru = cache_count;
+    int ntopn = 0;
+    for (int w = 0; w < TOPN_WINDOW_COUNT; w++)
+        ntopn += topn_windows[w].count;
+    ReplRecord *recs = malloc(sizeof(ReplRecord) * (nlru + ntopn + 1));
+    if (!recs)
+    {
+        pthread_mutex_unlock(&topn_lock);
+        pthread_mutex_unlock(&cache_lock);
+        return -1;
+    }
+    pthread_mutex_lock(&repl_lock);
+    uint64_t seq = next_seq - 1;
+    pthread_mutex_unlock(&repl_lock);
+
+    int n = 0;
+    for (LRUNode *node = lru_head; node && n < nlru; node = node->next)
+    {
+        recs[n] = control(REPL_SNAP_LRU, seq);
+        recs[n].id = node->id;
+        recs[n].score = node->score;
+        n++;
+    }
+    for (int w = 0; w < TOPN_WINDOW_COUNT; w++)
+    {
+        for (int i = 0; i < topn_windows[w].count; i++)
+        {
+            recs[n] = control(REPL_SNAP_TOPN, seq);
+            recs[n].id = topn_windows[w].players[i].id;
+            recs[n].score = topn_windows[w].players[i].score;
+            recs[n].window = w;
+            n++;
+        }
+    }
+    pthread_mutex_unlock(&topn_lock);
+    pthread_mutex_unlock(&cache_lock);
+
+    recs[n++] = control(REPL_SNAP_END, seq);
+    int rc = send_all(fd, recs, sizeof(ReplRecord) * n);
+    free(recs);
+    if (rc != 0)
+        return -1;
+    atomic_fetch_add(&snapshots_sent, 1);
+    printf("Replication: sent snapshot (%d LRU + %d Top-N entries) at seq %llu\n", nlru, ntopn,
+           (unsigned long long)seq);
+    *seq_out = seq;
+    return 0;
+}
+
+static void *sender_loop(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    ReplRecord *buf = malloc(sizeof(ReplRecord) * REPL_SEND_BATCH);
+    ReplHello hello;
+
+    struct timeval tv = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (!buf || recv_all(fd, &hello, sizeof(hello)) != 0 || memcmp(hello.magic, REPL_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "Replication: bad hello from replica, closing\n");
+        free(buf);
+        close(fd);
+        return NULL;
+    }
+    atomic_fetch_add(&replicas_connected, 1);
+
+    ReplRecord ep = control(REPL_EPOCH, epoch);
+    int ok = send_all(fd, &ep, sizeof(ep)) == 0;
+
+    // Stream from where the replica left off if the ring still has it
+    pthread_mutex_lock(&repl_lock);
+    uint64_t oldest = next_seq > REPL_RING_RECORDS ? next_seq - REPL_RING_RECORDS : 1;
+    int resume = hello.epoch == epoch && hello.next_seq >= oldest && hello.next_seq <= next_seq;
+    pthread_mutex_unlock(&repl_lock);
+
+    uint64_t pos = hello.next_seq;
+    if (ok && !resume)
+    {
+        uint64_t seq = 0;
+        ok = send_snapshot(fd, &seq) == 0;
+        pos = seq + 1;
+    }
+
+    while (ok)
+    {
+        pthread_mutex_lock(&repl_lock);
+        if (pos == next_seq)
+        {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += REPL_HEARTBEAT_MS * 1000000L;
+            if (until.tv_nsec >= 1000000000L)
+            {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&repl_cond, &repl_lock, &until);
+        }
+
+        oldest = next_seq > REPL_RING_RECORDS ? next_seq - REPL_RING_RECORDS : 1;
+        if (pos < oldest)
+        {
+            // Fell a whole ring behind: it reconnects and gets a snapshot
+            pthread_mutex_unlock(&repl_lock);
+            fprintf(stderr, "Replication: replica fell behind the ring, disconnecting\n");
+            break;
+        }
+        // Each write leads with the primary's position, so a replica that
+        // is behind still knows how far
+        int n = 1;
+        while (pos < next_seq && n < REPL_SEND_BATCH)
+            buf[n++] = ring[pos++ & REPL_RING_MASK];
+        buf[0] = control(REPL_HEARTBEAT, next_seq - 1);
+        pthread_mutex_unlock(&repl_lock);
+
+        ok = send_all(fd, buf, sizeof(ReplRecord) * n) == 0;
+    }
+
+    atomic_fetch_sub(&replicas_connected, 1);
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+static void *accept_loop(void *arg)
+{
+    for (;;)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0 && atomic_load(&stopping))
+            return NULL;
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("replication accept");
+            return NULL;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pthread_t t;
+        if (pthread_create(&t, NULL, sender_loop, (void *)(intptr_t)fd) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        pthread_detach(t);
+    }
+}
+
+int repl_primary_start(int port)
+{
+    ring = calloc(REPL_RING_RECORDS, sizeof(ReplRecord));
+    if (!ring)
+        return -1;
+    epoch = (wall_us() << 16) ^ (uint64_t)getpid();
+    if (epoch == 0)
+        epoch = 1;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        perror("replication socket");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    pthread_t t;
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 16) < 0 ||
+        pthread_create(&t, NULL, accept_loop, NULL) != 0)
+    {
+        perror("replication listen");
+        close(listen_fd);
+        listen_fd = -1;
+        free(ring);
+        ring = NULL;
+        return -1;
+    }
+    pthread_detach(t);
+    return 0;
+}
+
+// ---------- Replica ----------
+
+static char primary_host[256];
+static char primary_port[16];
+static uint64_t synced_epoch;
+static atomic_ullong applied_seq;
+static atomic_ullong applied_ts_us; // primary time of the last applied update
+static atomic_ullong primary_seq;   // latest sequence the primary has announced
+static atomic_ullong primary_ts_us; // primary clock when it announced it
+static atomic_int replica_connected;
+static atomic_ullong snapshots_received;
+static atomic_ullong reconnects;
+static pthread_mutex_t apply_lock = PTHREAD_MUTEX_INITIALIZER; // held while a received batch is applied
+
+static int replica_connect(void)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(primary_host, primary_port, &hints, &res) != 0)
+        return -1;
+    int fd = -1;
+    for (struct addrinfo *a = res; a; a = a->ai_next)
+    {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, a->ai_addr, a->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+// Snapshot entries collected until REPL_SNAP_END
+typedef struct
+{
+    Player *lru;
+    int nlru, cap_lru;
+    Player topn[TOPN_WINDOW_COUNT][TOPN_MAX_SIZE];
+    int ntopn[TOPN_WINDOW_COUNT];
+} PendingSnapshot;
+
+static void snapshot_install(PendingSnapshot *s, uint64_t seq)
+{
+    cache_clear();
+    topn_clear();
+    // Oldest first, so the most recently used entry ends up at the head
+    pthread_mutex_lock(&cache_lock);
+    for (int i = s->nlru - 1; i >= 0; i--)
+        cache_update_locked(s->lru[i].id, s->lru[i].score);
+    pthread_mutex_unlock(&cache_lock);
+    int ntopn = 0;
+    for (int w = 0; w < TOPN_WINDOW_COUNT; w++)
+    {
+        topn_load_window(w, s->topn[w], s->ntopn[w]);
+        ntopn += s->ntopn[w];
+        s->ntopn[w] = 0;
+    }
+
+    atomic_store(&applied_seq, seq);
+    atomic_fetch_add(&snapshots_received, 1);
+    printf("Replication: installed snapshot (%d LRU + %d Top-N entries) at seq %llu\n", s->nlru, ntopn,
+           (unsigned long long)seq);
+    s->nlru = 0;
+}
+
+// Apply one connection's stream until it fails; returns when the replica should reconnect
+static void replica_session(int fd)
+{
+    ReplHello hello;
+    memset(&hello, 0, sizeof(hello));
+    memcpy(hello.magic, REPL_MAGIC, 8);
+    hello.epoch = synced_epoch;
+    hello.next_seq = atomic_load(&applied_seq) + 1;
+    if (send_all(fd, &hello, sizeof(hello)) != 0)
+        return;
+
+    ReplRecord *recs = malloc(sizeof(ReplRecord) * REPL_RECV_BATCH);
+    Player *batch = malloc(sizeof(Player) * REPL_RECV_BATCH);
+    time_t *when = malloc(sizeof(time_t) * REPL_RECV_BATCH); // primary clock of each batch entry
+    PendingSnapshot *snap = calloc(1, sizeof(PendingSnapshot));
+    uint64_t epoch_seen = 0;
+    size_t have = 0; // bytes buffered in recs
+    atomic_store(&replica_connected, 1);
+
+    while (recs && batch && when && snap)
+    {
+        ssize_t got = recv(fd, (char *)recs + have, sizeof(ReplRecord) * REPL_RECV_BATCH - have, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        have += got;
+
+        // repl_shutdown() takes apply_lock, so once it returns nothing more is applied
+        pthread_mutex_lock(&apply_lock);
+        if (atomic_load(&stopping))
+        {
+            pthread_mutex_unlock(&apply_lock);
+            break;
+        }
+
+        size_t nrec = have / sizeof(ReplRecord);
+        uint64_t seq = atomic_load(&applied_seq);
+        uint64_t ts = 0;
+        int nbatch = 0, gap = 0;
+        for (size_t i = 0; i < nrec && !gap; i++)
+        {
+            ReplRecord *r = &recs[i];
+            switch (r->type)
+            {
+            case REPL_UPDATE:
+                if (r->seq <= seq)
+                    break;
+                if (r->seq != seq + 1)
+                {
+                    fprintf(stderr, "Replication: gap after seq %llu (got %llu), resyncing\n",
+                            (unsigned long long)seq, (unsigned long long)r->seq);
+                    gap = 1;
+                    break;
+                }
+                batch[nbatch].id = r->id;
+                batch[nbatch].score = r->score;
+                when[nbatch] = (time_t)(r->ts_us / 1000000);
+                nbatch++;
+                seq = r->seq;
+                ts = r->ts_us;
+                break;
+            case REPL_EPOCH:
+                epoch_seen = r->seq;
+                break;
+            case REPL_SNAP_LRU:
+                if (snap->nlru == snap->cap_lru)
+                {
+                    int cap = snap->cap_lru ? snap->cap_lru * 2 : 1024;
+                    Player *p = realloc(snap->lru, sizeof(Player) * cap);
+                    if (!p)
+                    {
+                        gap = 1;
+                        break;
+                    }
+                    snap->lru = p;
+                    snap->cap_lru = cap;
+                }
+                snap->lru[snap->nlru].id = r->id;
+                snap->lru[snap->nlru].score = r->score;
+                snap->nlru++;
+                break;
+            case REPL_SNAP_TOPN:
+                if (r->window < TOPN_WINDOW_COUNT && snap->ntopn[r->window] < TOPN_MAX_SIZE)
+                {
+                    Player *p = &snap->topn[r->window][snap->ntopn[r->window]++];
+                    p->id = r->id;
+                    p->score = r->score;
+                }
+                break;
+            case REPL_SNAP_END:
+                snapshot_install(snap, r->seq);
+                synced_epoch = epoch_seen;
+                seq = r->seq;
+                ts = r->ts_us;
+                break;
+            case REPL_HEARTBEAT:
+                atomic_store(&primary_seq, r->seq);
+                atomic_store(&primary_ts_us, r->ts_us);
+                break;
+            default:
+                gap = 1;
+                break;
+            }
+        }
+
+        if (nbatch > 0)
+        {
+            cache_update_batch(batch, nbatch);
+            // Day/week by when the primary applied the update, not when it arrived
+            pthread_mutex_lock(&topn_lock);
+            for (int i = 0; i < nbatch; i++)
+                topn_update_at_locked(batch[i].id, batch[i].score, when[i]);
+            pthread_mutex_unlock(&topn_lock);
+        }
+        if (ts)
+        {
+            atomic_store(&applied_ts_us, ts);
+            atomic_store(&applied_seq, seq);
+        }
+        pthread_mutex_unlock(&apply_lock);
+        if (gap)
+            break;
+
+        size_t used = nrec * sizeof(ReplRecord);
+        memmove(recs, (char *)recs + used, have - used);
+        have -= used;
+    }
+
+    atomic_store(&replica_connected, 0);
+    if (snap)
+        free(snap->lru);
+    free(snap);
+    free(recs);
+    free(batch);
+    free(when);
+}
+
+static void *replica_loop(void *arg)
+{
+    while (!atomic_load(&stopping))
+    {
+        int fd = replica_connect();
+        if (fd >= 0)
+        {
+            printf("Replication: connected to %s:%s\n", primary_host, primary_port);
+            replica_session(fd);
+            close(fd);
+            fprintf(stderr, "Replication: disconnected from %s:%s\n", primary_host, primary_port);
+        }
+        atomic_fetch_add(&reconnects, 1);
+        struct timespec d = {REPL_RETRY_MS / 1000, (REPL_RETRY_MS % 1000) * 1000000L};
+        nanosleep(&d, NULL);
+    }
+    return NULL;
+}
+
+int repl_replica_start(const char *primary)
+{
+    const char *colon = strrchr(primary, ':');
+    if (!colon || colon == primary || (size_t)(colon - primary) >= sizeof(primary_host) ||
+        strlen(colon + 1) >= sizeof(primary_port) || atoi(colon + 1) <= 0)
+        return -1;
+    memcpy(primary_host, primary, colon - primary);
+    primary_host[colon - primary] = '\0';
+    snprintf(primary_port, sizeof(primary_port), "%s", colon + 1);
+
+    pthread_t t;
+    if (pthread_create(&t, NULL, replica_loop, NULL) != 0)
+        return -1;
+    pthread_detach(t);
+    return 0;
+}
+
+void repl_shutdown(void)
+{
+    pthread_mutex_lock(&apply_lock);
+    atomic_store(&stopping, 1);
+    pthread_mutex_unlock(&apply_lock);
+    if (listen_fd >= 0)
+        shutdown(listen_fd, SHUT_RDWR);
+}
+
+void repl_render_metrics(MetricsBuf *b)
+{
+    if (ring)
+    {
+        pthread_mutex_lock(&repl_lock);
+        uint64_t last = next_seq - 1;
+        pthread_mutex_unlock(&repl_lock);
+        mbuf_printf(b, "# TYPE leaderboard_repl_published_seq gauge\nleaderboard_repl_published_seq %llu\n"
+                       "# TYPE leaderboard_repl_replicas gauge\nleaderboard_repl_replicas %d\n"
+                       "# TYPE leaderboard_repl_snapshots_sent_total counter\nleaderboard_repl_snapshots_sent_total %llu\n",
+                    (unsigned long long)last, atomic_load(&replicas_connected),
+                    (unsigned long long)atomic_load(&snapshots_sent));
+    }
+    if (primary_host[0])
+    {
+        uint64_t applied = atomic_load(&applied_seq);
+        uint64_t latest = atomic_load(&primary_seq);
+        uint64_t lag = latest > applied ? latest - applied : 0;
+        // While behind: how much older the applied state is than the
+        // primary's last heartbeat, both on the primary's clock
+        uint64_t ts = atomic_load(&applied_ts_us);
+        uint64_t primary_ts = atomic_load(&primary_ts_us);
+        double lag_s = lag && ts && primary_ts > ts ? (primary_ts - ts) / 1e6 : 0.0;
+        mbuf_printf(b, "# TYPE leaderboard_repl_connected gauge\nleaderboard_repl_connected %d\n"
+                       "# TYPE leaderboard_repl_applied_seq gauge\nleaderboard_repl_applied_seq %llu\n"
+                       "# TYPE leaderboard_repl_primary_seq gauge\nleaderboard_repl_primary_seq %llu\n"
+                       "# TYPE leaderboard_repl_lag_records gauge\nleaderboard_repl_lag_records %llu\n"
+                       "# TYPE leaderboard_repl_lag_seconds gauge\nleaderboard_repl_lag_seconds %.6f\n"
+                       "# TYPE leaderboard_repl_snapshots_received_total counter\nleaderboard_repl_snapshots_received_total %llu\n"
+                       "# TYPE leaderboard_repl_reconnects_total counter\nleaderboard_repl_reconnects_total %llu\n",
+                    atomic_load(&replica_connected), (unsigned long long)applied, (unsigned long long)latest,
+                    (unsigned long long)lag, lag_s, (unsigned long long)atomic_load(&snapshots_received),
+                    (unsigned long long)atomic_load(&reconnects));
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef REPL_H
+#define REPL_H
+
+#include <stdint.h>
+#include "cache.h"
+#include "metrics.h"
+
+// Replication of score updates to read-only replicas.
+//
+// The primary gives every applied update the next sequence number and
+// keeps the most recent REPL_RING_RECORDS in memory. Each replica holds
+// one TCP connection: it says which sequence it needs next, and the
+// primary streams from there, or first sends a snapshot of its caches
+// (tagged with the sequence it reflects) when that point is no longer in
+// the ring or the primary has restarted since. Every write starts with a
+// heartbeat carrying the primary's latest sequence and clock, and idle
+// connections get one every REPL_HEARTBEAT_MS; replicas compare it with
+// what they have applied to report lag.
+//
+// Two updates of one player racing on the primary may be published in
+// the opposite order to the one the caches saw, as with the DB today.
+
+#define REPL_MAGIC "LBREPL2"
+#define REPL_RING_RECORDS (1 << 18) // power of two
+#define REPL_HEARTBEAT_MS 100
+
+typedef enum
+{
+    REPL_UPDATE = 1,
+    REPL_EPOCH,     // first record on a connection; seq = primary instance id
+    REPL_SNAP_LRU,  // snapshot entries, most recently used first
+    REPL_SNAP_TOPN, // Top-N entries in rank order; window = TopNWindow
+    REPL_SNAP_END,  // seq = last update reflected in the snapshot
+    REPL_HEARTBEAT, // seq = primary's last published update, ts_us = send time
+} ReplType;
+
+// Every message from the primary; fixed size, host byte order
+typedef struct
+{
+    uint64_t seq;
+    uint64_t ts_us; // primary wall clock when published
+    int32_t id;
+    int32_t score;
+    uint32_t type;
+    uint32_t window; // REPL_SNAP_TOPN only, else 0
+} ReplRecord;
+
+// Sent once by the replica after connecting
+typedef struct
+{
+    char magic[8];
+    uint64_t epoch;    // primary instance the replica last synced with, 0 = none
+    uint64_t next_seq; // first update it still needs
+} ReplHello;
+
+// ---- Primary ----
+
+int repl_primary_start(int port);
+
+// Publish applied updates; no-ops unless repl_primary_start() succeeded
+void repl_publish(int id, int score);
+void repl_publish_batch(const Player *recs, int n);
+
+// ---- Replica ----
+
+// Connect to host:port (retrying in the background) and apply the stream
+// to the local LRU and Top-N caches
+int repl_replica_start(const char *primary);
+
+// Stop accepting replicas and stop applying the primary's stream; the
+// caches no longer change through replication once this returns
+void repl_shutdown(void);
+
+// Replication gauges for GET /metrics (either role)
+void repl_render_metrics(MetricsBuf *b);
+
+#endif // REPL_H
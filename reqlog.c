@@ -0,0 +1,260 @@
+#include "reqlog.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define REQLOG_DRAIN_INTERVAL_MS 5
+#define REQLOG_TEXT_LINE 128
+
+typedef struct
+{
+    _Atomic uint32_t head; // next slot to write (producer)
+    char pad0[60];
+    _Atomic uint32_t tail; // next slot to read (drain thread)
+    char pad1[60];
+    ReqLogRecord recs[REQLOG_RING_SIZE];
+} ReqLogRing;
+
+static ReqLogFormat log_fmt = REQLOG_OFF;
+static FILE *log_out = NULL;
+static double log_sample = 1.0;
+
+static ReqLogRing *rings[REQLOG_MAX_THREADS];
+static atomic_int ring_count = 0;
+static pthread_mutex_t ring_reg_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread ReqLogRing *my_ring = NULL;
+static __thread int my_ring_failed = 0;
+static __thread double sample_acc = 0.0;
+
+static atomic_ullong dropped = 0;
+static atomic_int running = 0;
+static pthread_t drain_thread;
+
+int reqlog_format(const ReqLogRecord *rec, char *buf, size_t len)
+{
+    switch (rec->type)
+    {
+    case REQLOG_LEADERBOARD:
+        return snprintf(buf, len, "[LEADERBOARD] mode=%d cache_hit=%d latency=%u us\n",
+                        rec->mode, rec->cache_hit, rec->latency_us);
+    case REQLOG_UPDATE:
+        return snprintf(buf, len, "[UPDATE] mode=%d lru=%d topn=%d db=%d latency=%u us (id=%d score=%d)\n",
+                        rec->mode, !!(rec->flags & REQLOG_WROTE_LRU), !!(rec->flags & REQLOG_WROTE_TOPN),
+                        !!(rec->flags & REQLOG_WROTE_DB), rec->latency_us, rec->id, rec->score);
+    case REQLOG_GET:
+        return snprintf(buf, len, "[GET] mode=%d cache_hit=%d latency=%u us (id=%d score=%d)\n",
+                        rec->mode, rec->cache_hit, rec->latency_us, rec->id, rec->score);
+    case REQLOG_MULTIGET:
+        return snprintf(buf, len, "[MULTIGET] mode=%d ids=%d hits=%d latency=%u us\n",
+                        rec->mode, rec->id, rec->score, rec->latency_us);
+    case REQLOG_ARGS:
+        // Only replay uses them; the text analyzers never saw these lines
+        if (len > 0)
+            buf[0] = '\0';
+        return 0;
+    default:
+        return snprintf(buf, len, "[UNKNOWN] type=%d\n", rec->type);
+    }
+}
+
+static ReqLogRing *ring_register(void)
+{
+    if (my_ring_failed)
+        return NULL;
+
+    pthread_mutex_lock(&ring_reg_lock);
+    int n = atomic_load(&ring_count);
+    ReqLogRing *r = NULL;
+    if (n < REQLOG_MAX_THREADS)
+        r = calloc(1, sizeof(ReqLogRing));
+    if (r)
+    {
+        rings[n] = r;
+        atomic_store(&ring_count, n + 1);
+    }
+    pthread_mutex_unlock(&ring_reg_lock);
+
+    if (!r)
+    {
+        fprintf(stderr, "reqlog: no ring available for thread, its records will be dropped\n");
+        my_ring_failed = 1;
+    }
+    my_ring = r;
+    return r;
+}
+
+int reqlog_sampled(void)
+{
+    if (log_fmt == REQLOG_OFF)
+        return 0;
+    if (log_sample >= 1.0)
+        return 1;
+
+    sample_acc += log_sample;
+    if (sample_acc >= 1.0)
+    {
+        sample_acc -= 1.0;
+        return 1;
+    }
+    return 0;
+}
+
+void reqlog_write(const ReqLogRecord *rec)
+{
+    reqlog_write_args(rec, NULL, 0);
+}
+
+void reqlog_write_args(const ReqLogRecord *rec, const int32_t *args, int nargs)
+{
+    ReqLogRing *r = my_ring ? my_ring : ring_register();
+    if (!r)
+    {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+    if (log_fmt != REQLOG_BINARY || nargs > REQLOG_MAX_ARGS)
+        nargs = 0;
+
+    // The drain thread sees the whole group or none of it (one head store)
+    uint32_t need = 1 + (uint32_t)(nargs + 1) / 2;
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (REQLOG_RING_SIZE - (head - tail) < need)
+    {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    r->recs[head & (REQLOG_RING_SIZE - 1)] = *rec;
+    for (int i = 0; i < nargs; i += 2)
+    {
+        ReqLogRecord *a = &r->recs[(head + 1 + i / 2) & (REQLOG_RING_SIZE - 1)];
+        memset(a, 0, sizeof(*a));
+        a->ts_us = rec->ts_us;
+        a->type = REQLOG_ARGS;
+        a->mode = rec->mode;
+        a->id = args[i];
+        a->score = i + 1 < nargs ? args[i + 1] : 0;
+        a->flags = i + 1 < nargs ? 2 : 1;
+    }
+    atomic_store_explicit(&r->head, head + need, memory_order_release);
+}
+
+unsigned long long reqlog_dropped(void)
+{
+    return atomic_load(&dropped);
+}
+
+// Move everything currently queued to the output in as few writes as possible
+static void drain_once(void)
+{
+    static char textbuf[REQLOG_RING_SIZE * REQLOG_TEXT_LINE];
+    int n = atomic_load(&ring_count);
+
+    for (int i = 0; i < n; i++)
+    {
+        ReqLogRing *r = rings[i];
+        uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+        while (tail != head)
+        {
+            uint32_t idx = tail & (REQLOG_RING_SIZE - 1);
+            uint32_t chunk = head - tail;
+            if (chunk > REQLOG_RING_SIZE - idx)
+                chunk = REQLOG_RING_SIZE - idx; // stop at the wrap point
+
+            if (log_fmt == REQLOG_BINARY)
+            {
+                fwrite(&r->recs[idx], sizeof(ReqLogRecord), chunk, log_out);
+            }
+            else
+            {
+                size_t pos = 0;
+                for (uint32_t k = 0; k < chunk; k++)
+                    pos += reqlog_format(&r->recs[idx + k], textbuf + pos, REQLOG_TEXT_LINE);
+                fwrite(textbuf, 1, pos, log_out);
+            }
+
+            tail += chunk;
+            atomic_store_explicit(&r->tail, tail, memory_order_release);
+        }
+    }
+    fflush(log_out);
+}
+
+static void *drain_loop(void *arg)
+{
+    struct timespec ts = {0, REQLOG_DRAIN_INTERVAL_MS * 1000000L};
+    while (atomic_load(&running))
+    {
+        nanosleep(&ts, NULL);
+        drain_once();
+    }
+    drain_once();
+    return NULL;
+}
+
+int reqlog_init(ReqLogFormat fmt, const char *path, double sample)
+{
+    log_fmt = fmt;
+    log_sample = (sample > 0.0 && sample <= 1.0) ? sample : 1.0;
+    if (fmt == REQLOG_OFF)
+        return 0;
+
+    if (path)
+    {
+        log_out = fopen(path, fmt == REQLOG_BINARY ? "wb" : "w");
+        if (!log_out)
+        {
+            perror("reqlog: fopen");
+            log_fmt = REQLOG_OFF;
+            return -1;
+        }
+    }
+    else if (fmt == REQLOG_BINARY)
+    {
+        fprintf(stderr, "reqlog: binary format needs a log file\n");
+        log_fmt = REQLOG_OFF;
+        return -1;
+    }
+    else
+    {
+        log_out = stdout;
+    }
+
+    if (fmt == REQLOG_BINARY)
+    {
+        ReqLogHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, REQLOG_MAGIC, sizeof(REQLOG_MAGIC));
+        h.record_size = sizeof(ReqLogRecord);
+        fwrite(&h, sizeof(h), 1, log_out);
+    }
+
+    atomic_store(&running, 1);
+    if (pthread_create(&drain_thread, NULL, drain_loop, NULL) != 0)
+    {
+        fprintf(stderr, "reqlog: failed to start drain thread\n");
+        atomic_store(&running, 0);
+        log_fmt = REQLOG_OFF;
+        return -1;
+    }
+    return 0;
+}
+
+void reqlog_shutdown(void)
+{
+    if (!atomic_exchange(&running, 0))
+        return;
+
+    pthread_join(drain_thread, NULL);
+    if (log_out && log_out != stdout)
+        fclose(log_out);
+    log_out = NULL;
+    log_fmt = REQLOG_OFF;
+}
@@ -0,0 +1,92 @@
+#ifndef REQLOG_H
+#define REQLOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Asynchronous request log.
+//
+// Handler threads append fixed-size binary records to a per-thread
+// single-producer/single-consumer ring; a background drain thread
+// batches them to the log file either as the classic text lines
+// ([UPDATE] ... latency=N us) or as raw records that logdecode turns
+// back into the same text.
+
+#define REQLOG_MAGIC "LBLOG01"
+#define REQLOG_RING_SIZE 16384 // records per thread, power of two
+#define REQLOG_MAX_THREADS 128
+
+enum
+{
+    REQLOG_LEADERBOARD = 1,
+    REQLOG_UPDATE = 2,
+    REQLOG_GET = 3,
+    REQLOG_MULTIGET = 4, // id = number of ids requested, score = cache hits
+    REQLOG_ARGS = 5,     // values of the record before it (binary logs only): id, score; flags = how many (1-2)
+};
+
+// Request arguments that do not fit the record (a cas expect=, the ids of
+// a multi-get) follow it as REQLOG_ARGS records, written in one piece so
+// nothing from another thread lands in between
+#define REQLOG_MAX_ARGS 1024
+
+// flags for REQLOG_UPDATE: which stores were written
+#define REQLOG_WROTE_LRU 0x1
+#define REQLOG_WROTE_TOPN 0x2
+#define REQLOG_WROTE_DB 0x4
+// ... and, for conditional updates, the op in bits 4-5 (score is the
+// requested value, not the resulting score)
+#define REQLOG_OP_SHIFT 4
+#define REQLOG_OP_MASK (0x3 << REQLOG_OP_SHIFT)
+#define REQLOG_OP_CAS 3 // UPDATE_CAS; its expect= follows as a REQLOG_ARGS record
+
+// REQLOG_LEADERBOARD records carry the requested depth in id and the
+// window (0 = all, 1 = day, 2 = week) in flags, so a binary log can be
+// replayed (loadgen --replay)
+
+typedef enum
+{
+    REQLOG_OFF = 0,
+    REQLOG_TEXT,
+    REQLOG_BINARY,
+} ReqLogFormat;
+
+typedef struct
+{
+    uint64_t ts_us; // request start (wall clock)
+    uint32_t latency_us;
+    int32_t id;
+    int32_t score;
+    uint8_t type;
+    uint8_t mode;
+    uint8_t cache_hit;
+    uint8_t flags;
+} ReqLogRecord;
+
+// File header for REQLOG_BINARY output
+typedef struct
+{
+    char magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+} ReqLogHeader;
+
+// path may be NULL for stdout (text format only). sample is the fraction
+// of requests to log, in (0, 1].
+int reqlog_init(ReqLogFormat fmt, const char *path, double sample);
+void reqlog_shutdown(void);
+
+// Returns non-zero if the calling thread should log its next request
+int reqlog_sampled(void);
+void reqlog_write(const ReqLogRecord *rec);
+
+// rec followed by REQLOG_ARGS records carrying args[0..nargs); text logs
+// and args beyond REQLOG_MAX_ARGS get rec alone
+void reqlog_write_args(const ReqLogRecord *rec, const int32_t *args, int nargs);
+
+unsigned long long reqlog_dropped(void);
+
+// Format one record as the text line the analyzers expect (with newline)
+int reqlog_format(const ReqLogRecord *rec, char *buf, size_t len);
+
+#endif // REQLOG_H
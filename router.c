@@ -0,0 +1,962 @@
+/*
+Router
+Spreads players over several leaderboard servers (shards) so that no
+single process, lock set or Postgres instance is the limit.
+
+Compile:
+make router
+
+Usage:
+./router [--vnodes N] [--max-id N] [--threads N] [--topn-size N] <port> <shard_url> [<shard_url> ...]
+./router 8080 http://127.0.0.1:9001 http://127.0.0.1:9002
+
+Players are placed on a consistent-hash ring (each shard owns --vnodes
+points, default 64), so adding or removing a shard moves only the players
+between its points and their neighbours.
+
+POST /update_score, GET /get_score
+    forwarded to the shard that owns player_id (keep-alive handle per
+    router thread and shard); the shard's status and body are returned
+GET /leaderboard?top=N[&window=day|week|all]
+    every shard's local top-N is fetched in parallel (curl_multi) and the
+    sorted lists are k-way merged; N is capped at --topn-size (default
+    100), which should match the shards' --topn-size
+GET /shards
+    shards, per-shard request counts and rebalance progress as JSON
+POST /shards?urls=URL,URL,...
+    rebalance onto a new shard list
+
+Rebalancing walks player ids 1..--max-id (default 100000) in batches. For
+each batch it reads the players whose owner changes from their old shard
+(GET /get_scores) and writes them to the new one; only requests for that
+batch's ids wait meanwhile. Ids below the cursor already route to the new
+ring, the rest still to the old one. Copies left on old shards are ignored by
+the leaderboard merge, which only keeps entries from each player's owner.
+Ids outside 1..--max-id switch rings without being copied.
+*/
+
+#define _GNU_SOURCE
+#include <microhttpd.h>
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+#include "cache.h"
+#include "topn.h"
+#include "json.h"
+
+#define DEFAULT_TOP 10
+#define MAX_SHARDS 64
+#define MAX_URL 256
+#define MIGRATE_BATCH 64
+#define FORWARD_TIMEOUT_MS 2000
+
+static int topn_size = TOP_N_SIZE; // deepest leaderboard the shards keep
+
+// ---------- Shards ----------
+//
+// Slots are never reused, so a slot index names the same server for the
+// router's lifetime and can index per-thread handle arrays.
+
+typedef struct
+{
+    char url[MAX_URL];
+    atomic_ullong requests;
+    atomic_ullong errors;
+    atomic_ullong latency_us; // sum over requests
+} Shard;
+
+static Shard shards[MAX_SHARDS];
+static int shard_slots; // slots in use (only grows, under topo_lock)
+
+// Slot for url, adding it if new; -1 if the table is full (must hold topo_lock for writing)
+static int shard_slot(const char *url)
+{
+    for (int i = 0; i < shard_slots; i++)
+    {
+        if (strcmp(shards[i].url, url) == 0)
+            return i;
+    }
+    if (shard_slots == MAX_SHARDS || strlen(url) >= MAX_URL)
+        return -1;
+    snprintf(shards[shard_slots].url, MAX_URL, "%s", url);
+    return shard_slots++;
+}
+
+// ---------- Hash ring ----------
+
+typedef struct
+{
+    uint64_t hash;
+    int slot;
+} RingPoint;
+
+typedef struct
+{
+    int slots[MAX_SHARDS];
+    int n;
+    RingPoint *points;
+    int npoints;
+} Ring;
+
+static int vnodes = 64;
+
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t fnv1a(const char *s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while (*s)
+    {
+        h ^= (unsigned char)*s++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int point_cmp(const void *a, const void *b)
+{
+    const RingPoint *x = a, *y = b;
+    if (x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+    return x->slot - y->slot;
+}
+
+static Ring *ring_build(const int *slots, int n)
+{
+    Ring *r = calloc(1, sizeof(Ring));
+    if (!r)
+        return NULL;
+    r->points = malloc(sizeof(RingPoint) * n * vnodes);
+    if (!r->points)
+    {
+        free(r);
+        return NULL;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        r->slots[i] = slots[i];
+        uint64_t base = fnv1a(shards[slots[i]].url);
+        for (int v = 0; v < vnodes; v++)
+        {
+            r->points[r->npoints].hash = mix64(base + (uint64_t)v * 0x9E3779B97F4A7C15ULL);
+            r->points[r->npoints].slot = slots[i];
+            r->npoints++;
+        }
+    }
+    r->n = n;
+    qsort(r->points, r->npoints, sizeof(RingPoint), point_cmp);
+    return r;
+}
+
+static void ring_free(Ring *r)
+{
+    if (r)
+        free(r->points);
+    free(r);
+}
+
+// First point at or after the player's hash, wrapping around
+static int ring_owner(const Ring *r, int id)
+{
+    uint64_t h = mix64((uint64_t)(uint32_t)id);
+    int lo = 0, hi = r->npoints;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (r->points[mid].hash < h)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return r->points[lo == r->npoints ? 0 : lo].slot;
+}
+
+// ---------- Topology ----------
+//
+// Requests hold topo_lock for reading while they route and forward. The
+// migrator copies each batch without it: it only takes the write lock for
+// a moment to fence the batch's id range (which also waits out forwards
+// already in flight for it) and again to advance the cursor past it.
+// Requests for fenced ids wait on fence_cond; all others go straight
+// through. Writers are preferred so a rebalance is not starved under load.
+
+static pthread_rwlock_t topo_lock;
+static Ring *ring;          // current shard set
+static Ring *old_ring;      // set being migrated away from, NULL when idle
+static int migrate_cursor;  // ids below this already live on `ring`
+static int fence_lo, fence_hi; // ids being copied, [lo, hi); changed under topo_lock (write) and fence_lock
+static pthread_mutex_t fence_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fence_cond = PTHREAD_COND_INITIALIZER; // fence cleared
+static int rebalanced;      // old shards may hold stale copies
+static int max_id = 100000; // id range walked by a rebalance
+static pthread_t migrate_thread;
+
+// Shard serving id right now (must hold topo_lock)
+static int owner_locked(int id)
+{
+    if (old_ring && id >= migrate_cursor)
+        return ring_owner(old_ring, id);
+    return ring_owner(ring, id);
+}
+
+static int fenced(int id)
+{
+    return id >= fence_lo && id < fence_hi;
+}
+
+// Take topo_lock for reading once id is not in the batch being copied
+static void topo_rdlock_id(int id)
+{
+    for (;;)
+    {
+        pthread_rwlock_rdlock(&topo_lock);
+        if (!fenced(id))
+            return;
+        pthread_rwlock_unlock(&topo_lock);
+        pthread_mutex_lock(&fence_lock);
+        while (fenced(id))
+            pthread_cond_wait(&fence_cond, &fence_lock);
+        pthread_mutex_unlock(&fence_lock);
+    }
+}
+
+// Move the fence (and the cursor) with topo_lock held for writing
+static void set_fence(int lo, int hi)
+{
+    pthread_mutex_lock(&fence_lock);
+    fence_lo = lo;
+    fence_hi = hi;
+    pthread_cond_broadcast(&fence_cond);
+    pthread_mutex_unlock(&fence_lock);
+}
+
+// Parse "url,url,..." into slots; returns the count, -1 if malformed (must hold topo_lock for writing)
+static int parse_shard_list(const char *list, int *slots)
+{
+    int n = 0;
+    const char *p = list;
+    while (*p)
+    {
+        const char *end = strchr(p, ',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        char url[MAX_URL];
+        if (len == 0 || len >= MAX_URL || n == MAX_SHARDS)
+            return -1;
+        memcpy(url, p, len);
+        url[len] = '\0';
+        while (len > 0 && url[len - 1] == '/')
+            url[--len] = '\0';
+        int slot = shard_slot(url);
+        if (slot < 0)
+            return -1;
+        for (int i = 0; i < n; i++)
+        {
+            if (slots[i] == slot)
+                return -1;
+        }
+        slots[n++] = slot;
+        p = end ? end + 1 : p + strlen(p);
+    }
+    return n;
+}
+
+// ---------- Forwarding ----------
+
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} Body;
+
+static size_t collect_body(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    Body *b = userdata;
+    size_t n = size * nmemb;
+    if (b->len + n + 1 > b->cap)
+    {
+        size_t cap = b->cap ? b->cap * 2 : 1024;
+        while (cap < b->len + n + 1)
+            cap *= 2;
+        char *p = realloc(b->data, cap);
+        if (!p)
+            return 0;
+        b->data = p;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, ptr, n);
+    b->len += n;
+    b->data[b->len] = '\0';
+    return n;
+}
+
+// Keep-alive handles of the calling thread, one per shard slot
+static __thread CURL *handles[MAX_SHARDS];
+static __thread CURLM *multi;
+
+static CURL *shard_handle(int slot)
+{
+    if (!handles[slot])
+    {
+        handles[slot] = curl_easy_init();
+        if (handles[slot])
+        {
+            curl_easy_setopt(handles[slot], CURLOPT_WRITEFUNCTION, collect_body);
+            curl_easy_setopt(handles[slot], CURLOPT_TIMEOUT_MS, (long)FORWARD_TIMEOUT_MS);
+            curl_easy_setopt(handles[slot], CURLOPT_NOSIGNAL, 1L);
+        }
+    }
+    return handles[slot];
+}
+
+static void point_handle(CURL *curl, const char *url, int post, Body *body)
+{
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, body);
+    if (post)
+    {
+        // Empty body; without POSTFIELDS libcurl would read the body from stdin
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 0L);
+    }
+    else
+    {
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+    }
+}
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void shard_account(int slot, long status, long long start)
+{
+    atomic_fetch_add_explicit(&shards[slot].requests, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shards[slot].latency_us, now_us() - start, memory_order_relaxed);
+    if (status == 0 || status >= 500)
+        atomic_fetch_add_explicit(&shards[slot].errors, 1, memory_order_relaxed);
+}
+
+// One blocking request to a shard; returns the HTTP status, 0 on transport errors
+static long shard_call(CURL *curl, int slot, const char *path, int post, Body *body)
+{
+    char url[MAX_URL + 512];
+    snprintf(url, sizeof(url), "%s%s", shards[slot].url, path);
+    point_handle(curl, url, post, body);
+
+    long long start = now_us();
+    long status = 0;
+    if (curl_easy_perform(curl) == CURLE_OK)
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    shard_account(slot, status, start);
+    return status;
+}
+
+// Next {"id":N,"score":N...} object in a shard response; p advances past it
+static int next_player(const char **p, Player *out)
+{
+    const char *s = strstr(*p, "\"id\":");
+    if (!s)
+        return 0;
+    *p = s + 5;
+    return sscanf(s, "\"id\":%d,\"score\":%d", &out->id, &out->score) == 2;
+}
+
+// ---------- Migration ----------
+
+static int collect_batch(Body *body, Player *out, int max)
+{
+    int n = 0;
+    const char *p = body->data ? body->data : "";
+    Player pl;
+    while (n < max && next_player(&p, &pl))
+    {
+        if (pl.score >= 0)
+            out[n++] = pl;
+    }
+    return n;
+}
+
+// Copy the players of one batch whose owner changes. Runs without
+// topo_lock: the rings cannot change while a rebalance is in progress, and
+// requests for [lo, hi) are held back by the fence.
+static int migrate_batch(CURL *curl, int lo, int hi)
+{
+    int moved = 0;
+    for (int s = 0; s < old_ring->n; s++)
+    {
+        int from = old_ring->slots[s];
+        char path[64 + MIGRATE_BATCH * 12];
+        int len = snprintf(path, sizeof(path), "/get_scores?ids=");
+        int count = 0;
+        for (int id = lo; id < hi; id++)
+        {
+            if (ring_owner(old_ring, id) == from && ring_owner(ring, id) != from)
+            {
+                len += snprintf(path + len, sizeof(path) - len, "%s%d", count ? "," : "", id);
+                count++;
+            }
+        }
+        if (count == 0)
+            continue;
+
+        Body body = {0};
+        if (shard_call(curl, from, path, 0, &body) != 200)
+        {
+            fprintf(stderr, "Rebalance: reading ids %d-%d from %s failed\n", lo, hi - 1, shards[from].url);
+            free(body.data);
+            continue;
+        }
+        Player found[MIGRATE_BATCH];
+        int n = collect_batch(&body, found, MIGRATE_BATCH);
+        free(body.data);
+
+        for (int i = 0; i < n; i++)
+        {
+            int to = ring_owner(ring, found[i].id);
+            char upd[96];
+            snprintf(upd, sizeof(upd), "/update_score?player_id=%d&score=%d", found[i].id, found[i].score);
+            Body ack = {0};
+            if (shard_call(curl, to, upd, 1, &ack) == 200)
+                moved++;
+            else
+                fprintf(stderr, "Rebalance: writing player %d to %s failed\n", found[i].id, shards[to].url);
+            free(ack.data);
+        }
+    }
+    return moved;
+}
+
+static void *migrate_loop(void *arg)
+{
+    CURL *curl = curl_easy_init();
+    if (curl)
+    {
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, collect_body);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)FORWARD_TIMEOUT_MS);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    }
+
+    long long start = now_us();
+    long moved = 0;
+    for (int lo = 1; curl && lo <= max_id; lo += MIGRATE_BATCH)
+    {
+        int hi = lo + MIGRATE_BATCH <= max_id + 1 ? lo + MIGRATE_BATCH : max_id + 1;
+        pthread_rwlock_wrlock(&topo_lock);
+        set_fence(lo, hi);
+        pthread_rwlock_unlock(&topo_lock);
+
+        moved += migrate_batch(curl, lo, hi);
+
+        pthread_rwlock_wrlock(&topo_lock);
+        migrate_cursor = hi;
+        set_fence(0, 0);
+        pthread_rwlock_unlock(&topo_lock);
+    }
+
+    pthread_rwlock_wrlock(&topo_lock);
+    Ring *done = old_ring;
+    old_ring = NULL;
+    pthread_rwlock_unlock(&topo_lock);
+    ring_free(done);
+    if (curl)
+        curl_easy_cleanup(curl);
+    printf("Rebalance finished: %ld players moved in %lld ms\n", moved, (now_us() - start) / 1000);
+    return NULL;
+}
+
+// Switch to a new shard list and start copying; returns 0, or -1 with *err set
+static int rebalance(const char *list, const char **err)
+{
+    int slots[MAX_SHARDS];
+    pthread_rwlock_wrlock(&topo_lock);
+    if (old_ring)
+    {
+        pthread_rwlock_unlock(&topo_lock);
+        *err = "Rebalance already in progress";
+        return -1;
+    }
+    int n = parse_shard_list(list, slots);
+    Ring *next = n > 0 ? ring_build(slots, n) : NULL;
+    if (!next)
+    {
+        pthread_rwlock_unlock(&topo_lock);
+        *err = "Invalid shard list (expected urls=URL,URL,...)";
+        return -1;
+    }
+    old_ring = ring;
+    ring = next;
+    migrate_cursor = 1;
+    rebalanced = 1;
+    if (pthread_create(&migrate_thread, NULL, migrate_loop, NULL) != 0)
+    {
+        // No copy: give up on the old shards' data rather than route to two rings forever
+        ring_free(old_ring);
+        old_ring = NULL;
+        fprintf(stderr, "Warning: rebalance thread not started, switched without copying\n");
+    }
+    else
+    {
+        pthread_detach(migrate_thread);
+    }
+    pthread_rwlock_unlock(&topo_lock);
+    printf("Rebalancing onto %d shards\n", n);
+    return 0;
+}
+
+// ---------- Leaderboard merge ----------
+
+typedef struct
+{
+    int slot;
+    Body body;
+    Player *players;
+    int count;
+    int pos;
+} ShardTop;
+
+// Max-heap of shard indexes by their current head score
+static void heap_sift(int *heap, int n, int i, const ShardTop *tops)
+{
+    for (;;)
+    {
+        int best = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && tops[heap[l]].players[tops[heap[l]].pos].score > tops[heap[best]].players[tops[heap[best]].pos].score)
+            best = l;
+        if (r < n && tops[heap[r]].players[tops[heap[r]].pos].score > tops[heap[best]].players[tops[heap[best]].pos].score)
+            best = r;
+        if (best == i)
+            return;
+        int t = heap[i];
+        heap[i] = heap[best];
+        heap[best] = t;
+        i = best;
+    }
+}
+
+// Fetch every shard's top `fetch` in parallel; returns the number of shards queried (must hold topo_lock)
+static int fetch_tops(ShardTop *tops, int fetch, const char *window)
+{
+    int slots[MAX_SHARDS * 2];
+    int n = 0;
+    for (int i = 0; i < ring->n; i++)
+        slots[n++] = ring->slots[i];
+    for (int i = 0; old_ring && i < old_ring->n; i++)
+    {
+        int dup = 0;
+        for (int j = 0; j < n; j++)
+            dup |= slots[j] == old_ring->slots[i];
+        if (!dup)
+            slots[n++] = old_ring->slots[i];
+    }
+
+    if (!multi)
+        multi = curl_multi_init();
+    char path[96];
+    snprintf(path, sizeof(path), "/leaderboard?top=%d%s%s", fetch, window ? "&window=" : "", window ? window : "");
+    long long start = now_us();
+    for (int i = 0; i < n; i++)
+    {
+        memset(&tops[i], 0, sizeof(tops[i]));
+        tops[i].slot = slots[i];
+        CURL *c = shard_handle(slots[i]);
+        if (!c || !multi)
+            continue;
+        char url[MAX_URL + 96];
+        snprintf(url, sizeof(url), "%s%s", shards[slots[i]].url, path);
+        point_handle(c, url, 0, &tops[i].body);
+        curl_multi_add_handle(multi, c);
+    }
+
+    int running = 1;
+    while (multi && running)
+    {
+        if (curl_multi_perform(multi, &running) != CURLM_OK)
+            break;
+        if (running)
+            curl_multi_wait(multi, NULL, 0, 100, NULL);
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        CURL *c = handles[slots[i]];
+        long status = 0;
+        if (c && multi)
+        {
+            curl_easy_getinfo(c, CURLINFO_RESPONSE_CODE, &status);
+            curl_multi_remove_handle(multi, c);
+        }
+        shard_account(slots[i], status, start);
+        if (status != 200)
+            continue;
+        tops[i].players = malloc(sizeof(Player) * fetch);
+        const char *p = tops[i].body.data ? tops[i].body.data : "";
+        while (tops[i].players && tops[i].count < fetch && next_player(&p, &tops[i].players[tops[i].count]))
+            tops[i].count++;
+    }
+    return n;
+}
+
+// k-way merge of the shard lists, keeping only entries from each player's owner (must hold topo_lock)
+static int merge_tops(ShardTop *tops, int n, Player *out, int top)
+{
+    int heap[MAX_SHARDS * 2];
+    int h = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (tops[i].count > 0)
+            heap[h++] = i;
+    }
+    for (int i = h / 2 - 1; i >= 0; i--)
+        heap_sift(heap, h, i, tops);
+
+    int count = 0;
+    while (h > 0 && count < top)
+    {
+        ShardTop *t = &tops[heap[0]];
+        Player p = t->players[t->pos++];
+        if (owner_locked(p.id) == t->slot)
+            out[count++] = p;
+        if (t->pos == t->count)
+            heap[0] = heap[--h];
+        heap_sift(heap, h, 0, tops);
+    }
+    return count;
+}
+
+// ---------- HTTP Handlers ----------
+
+static enum MHD_Result send_text(struct MHD_Connection *conn_http, unsigned int code, const char *text)
+{
+    struct MHD_Response *res = MHD_create_response_from_buffer(strlen(text), (void *)text, MHD_RESPMEM_PERSISTENT);
+    int ret = MHD_queue_response(conn_http, code, res);
+    MHD_destroy_response(res);
+    return ret;
+}
+
+// Relay a shard's answer (takes ownership of body)
+static enum MHD_Result send_body(struct MHD_Connection *conn_http, unsigned int code, Body *body)
+{
+    if (!body->data)
+        return send_text(conn_http, code, "");
+    struct MHD_Response *res = MHD_create_response_from_buffer(body->len, body->data, MHD_RESPMEM_MUST_FREE);
+    MHD_add_response_header(res, "Content-Type", "application/json");
+    int ret = MHD_queue_response(conn_http, code, res);
+    MHD_destroy_response(res);
+    return ret;
+}
+
+static enum MHD_Result handle_forward(struct MHD_Connection *conn_http, int post)
+{
+    const char *id_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "player_id");
+    if (!id_q)
+        return send_text(conn_http, MHD_HTTP_BAD_REQUEST, "{\"error\":\"missing player_id\"}");
+    int id = atoi(id_q);
+
+    // Rebuild the query from known parameters, so nothing unescaped is passed on
+    char path[160];
+    if (post)
+    {
+        const char *score_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "score");
+        const char *op_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "op");
+        const char *expect_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "expect");
+        if (!score_q)
+            return send_text(conn_http, MHD_HTTP_BAD_REQUEST, "Missing parameters");
+        if (op_q && strcmp(op_q, "set") != 0 && strcmp(op_q, "max") != 0 && strcmp(op_q, "incr") != 0 &&
+            strcmp(op_q, "cas") != 0)
+            return send_text(conn_http, MHD_HTTP_BAD_REQUEST, "Invalid op (expected set, max, incr, or cas with expect=)");
+        int len = snprintf(path, sizeof(path), "/update_score?player_id=%d&score=%d", id, atoi(score_q));
+        if (op_q)
+            len += snprintf(path + len, sizeof(path) - len, "&op=%s", op_q);
+        if (expect_q)
+            snprintf(path + len, sizeof(path) - len, "&expect=%d", atoi(expect_q));
+    }
+    else
+    {
+        snprintf(path, sizeof(path), "/get_score?player_id=%d", id);
+    }
+
+    topo_rdlock_id(id);
+    int slot = owner_locked(id);
+    CURL *curl = shard_handle(slot);
+    Body body = {0};
+    long status = curl ? shard_call(curl, slot, path, post, &body) : 0;
+    pthread_rwlock_unlock(&topo_lock);
+
+    if (status == 0)
+    {
+        free(body.data);
+        return send_text(conn_http, MHD_HTTP_BAD_GATEWAY, "{\"error\":\"shard unavailable\"}");
+    }
+    return send_body(conn_http, (unsigned int)status, &body);
+}
+
+static enum MHD_Result handle_leaderboard(struct MHD_Connection *conn_http)
+{
+    const char *top_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "top");
+    int top = top_q ? atoi(top_q) : DEFAULT_TOP;
+    if (top < 0)
+        top = 0;
+    if (top > topn_size)
+        top = topn_size;
+
+    const char *window = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "window");
+    if (window && strcmp(window, "day") != 0 && strcmp(window, "week") != 0 && strcmp(window, "all") != 0)
+        return send_text(conn_http, MHD_HTTP_BAD_REQUEST, "Invalid window (expected day, week or all)");
+
+    ShardTop tops[MAX_SHARDS * 2];
+    Player merged[TOPN_MAX_SIZE];
+
+    pthread_rwlock_rdlock(&topo_lock);
+    // After a rebalance a shard's list may start with stale copies it no
+    // longer owns; ask for the full depth so enough owned entries remain
+    int fetch = rebalanced ? topn_size : top;
+    int n = fetch_tops(tops, fetch > 0 ? fetch : 1, window);
+    int failed = 0;
+    for (int i = 0; i < n; i++)
+        failed += !tops[i].players;
+    int count = merge_tops(tops, n, merged, top);
+    pthread_rwlock_unlock(&topo_lock);
+
+    for (int i = 0; i < n; i++)
+    {
+        free(tops[i].body.data);
+        free(tops[i].players);
+    }
+    if (failed)
+        return send_text(conn_http, MHD_HTTP_BAD_GATEWAY, "{\"error\":\"shard unavailable\"}");
+
+    size_t cap = JSON_LEADERBOARD_MAX(count);
+    char *json = malloc(cap);
+    int len = json ? json_leaderboard(json, cap, merged, count) : -1;
+    if (len < 0)
+    {
+        free(json);
+        return send_text(conn_http, MHD_HTTP_INTERNAL_SERVER_ERROR, "{\"error\":\"could not build response\"}");
+    }
+    struct MHD_Response *res = MHD_create_response_from_buffer(len, json, MHD_RESPMEM_MUST_FREE);
+    MHD_add_response_header(res, "Content-Type", "application/json");
+    int ret = MHD_queue_response(conn_http, MHD_HTTP_OK, res);
+    MHD_destroy_response(res);
+    return ret;
+}
+
+static void append(char *buf, size_t len, size_t *pos, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+
+static void append(char *buf, size_t len, size_t *pos, const char *fmt, ...)
+{
+    if (*pos >= len)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *pos, len - *pos, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        *pos += n;
+}
+
+static enum MHD_Result handle_shards(struct MHD_Connection *conn_http)
+{
+    char json[16384];
+    size_t pos = 0;
+
+    pthread_rwlock_rdlock(&topo_lock);
+    append(json, sizeof(json), &pos, "{\"shards\":[");
+    for (int i = 0; i < ring->n; i++)
+    {
+        Shard *s = &shards[ring->slots[i]];
+        unsigned long long req = atomic_load(&s->requests);
+        append(json, sizeof(json), &pos,
+               "%s{\"url\":\"%s\",\"requests\":%llu,\"errors\":%llu,\"mean_us\":%.1f}", i ? "," : "", s->url, req,
+               (unsigned long long)atomic_load(&s->errors),
+               req ? (double)atomic_load(&s->latency_us) / req : 0.0);
+    }
+    append(json, sizeof(json), &pos, "],\"vnodes\":%d,\"rebalancing\":%s", vnodes, old_ring ? "true" : "false");
+    if (old_ring)
+        append(json, sizeof(json), &pos, ",\"cursor\":%d,\"max_id\":%d", migrate_cursor, max_id);
+    append(json, sizeof(json), &pos, "}");
+    pthread_rwlock_unlock(&topo_lock);
+
+    if (pos >= sizeof(json))
+        return send_text(conn_http, MHD_HTTP_INTERNAL_SERVER_ERROR, "{\"error\":\"too many shards\"}");
+    struct MHD_Response *res = MHD_create_response_from_buffer(pos, strdup(json), MHD_RESPMEM_MUST_FREE);
+    MHD_add_response_header(res, "Content-Type", "application/json");
+    int ret = MHD_queue_response(conn_http, MHD_HTTP_OK, res);
+    MHD_destroy_response(res);
+    return ret;
+}
+
+static enum MHD_Result handle_request(void *cls, struct MHD_Connection *conn_http,
+                                      const char *url, const char *method,
+                                      const char *ver, const char *upload_data,
+                                      size_t *upload_data_size, void **con_cls)
+{
+    if (strcmp(method, "POST") == 0 && strncmp(url, "/update_score", 13) == 0)
+        return handle_forward(conn_http, 1);
+
+    if (strcmp(method, "GET") == 0 && strcmp(url, "/get_score") == 0)
+        return handle_forward(conn_http, 0);
+
+    if (strcmp(method, "GET") == 0 && strncmp(url, "/leaderboard", 12) == 0)
+        return handle_leaderboard(conn_http);
+
+    if (strcmp(method, "GET") == 0 && strcmp(url, "/shards") == 0)
+        return handle_shards(conn_http);
+
+    if (strcmp(method, "POST") == 0 && strcmp(url, "/shards") == 0)
+    {
+        const char *urls = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "urls");
+        const char *err = "Missing urls";
+        if (!urls || rebalance(urls, &err) != 0)
+            return send_text(conn_http, MHD_HTTP_BAD_REQUEST, err);
+        return send_text(conn_http, MHD_HTTP_OK, "{\"status\":\"rebalancing\"}");
+    }
+
+    return send_text(conn_http, MHD_HTTP_NOT_FOUND, "Not Found");
+}
+
+// ---------- MAIN ----------
+static struct MHD_Daemon *http_daemon;
+
+static void cleanup(int sig)
+{
+    if (http_daemon)
+        MHD_stop_daemon(http_daemon);
+    printf("\nPer-shard requests:\n");
+    for (int i = 0; i < shard_slots; i++)
+    {
+        unsigned long long req = atomic_load(&shards[i].requests);
+        printf("  %-32s %12llu requests %8llu errors %9.1f us mean\n", shards[i].url, req,
+               (unsigned long long)atomic_load(&shards[i].errors),
+               req ? (double)atomic_load(&shards[i].latency_us) / req : 0.0);
+    }
+    printf("Router stopped.\n");
+    exit(0);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--vnodes N] [--max-id N] [--threads N] [--topn-size N] <port> <shard_url> [<shard_url> ...]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    int threads = 10;
+
+    static const struct option long_opts[] = {
+        {"vnodes", required_argument, NULL, 'v'},
+        {"max-id", required_argument, NULL, 'm'},
+        {"threads", required_argument, NULL, 't'},
+        {"topn-size", required_argument, NULL, 'n'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'v':
+            vnodes = atoi(optarg);
+            break;
+        case 'm':
+            max_id = atoi(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'n':
+            topn_size = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (argc - optind < 2 || vnodes <= 0 || max_id < 0 || threads <= 0 || topn_size < 1 ||
+        topn_size > TOPN_MAX_SIZE)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    int port = atoi(argv[optind]);
+
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&topo_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    int slots[MAX_SHARDS];
+    int n = 0;
+    for (int i = optind + 1; i < argc; i++)
+    {
+        char list[MAX_URL];
+        snprintf(list, sizeof(list), "%s", argv[i]);
+        int s;
+        if (parse_shard_list(list, &s) != 1 || n == MAX_SHARDS)
+        {
+            fprintf(stderr, "Bad shard url: %s\n", argv[i]);
+            return 1;
+        }
+        for (int j = 0; j < n; j++)
+        {
+            if (slots[j] == s)
+            {
+                fprintf(stderr, "Duplicate shard url: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        slots[n++] = s;
+    }
+    ring = ring_build(slots, n);
+    if (!ring)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    curl_global_init(CURL_GLOBAL_ALL);
+    signal(SIGINT, cleanup);
+
+    http_daemon = MHD_start_daemon(
+        MHD_USE_SELECT_INTERNALLY,
+        port,
+        NULL, NULL,
+        &handle_request, NULL,
+        MHD_OPTION_THREAD_POOL_SIZE, threads,
+        MHD_OPTION_END);
+    if (!http_daemon)
+    {
+        fprintf(stderr, "Failed to start HTTP server\n");
+        return 1;
+    }
+
+    printf("Router on port %d over %d shards (%d vnodes each)\n", port, n, vnodes);
+    for (int i = 0; i < n; i++)
+        printf("  %s\n", shards[slots[i]].url);
+
+    while (1)
+        pause();
+    return 0;
+}
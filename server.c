@@ -3,10 +3,48 @@ Compile:
 gcc -O2 -Wall server.c -o server -lmicrohttpd -lpq -pthread
 
 Usage:
-./server <port> <mode>
+./server [options] [<port> [<mode>]]
 mode = 0 (DB-only), 1 (LRU Cache + Top-N Cache only), 2 (LRU Cache + DB), 3 (All: LRU Cache + Top-N Cache + DB)
+
+Options:
+--config <path>     read "option = value" lines (long option names) first; the command line overrides them
+--port <port>       HTTP port (default 8080); a positional <port> overrides it
+--mode <mode>       server mode (default 3); a positional <mode> overrides it
+--http-threads <n>  libmicrohttpd worker threads (default 10)
+--conninfo <str>    libpq connection string (default in config.h)
+--cache-size <n>    LRU capacity in entries (default 1000)
+--topn-size <n>     Top-N depth per window (default 100, at most 1000)
+--timezone <tz>     time zone of the day/week Top-N windows and of the DB sessions
+                    (default: the DB's TimeZone in modes 0/2/3, local time in mode 1)
+--udp-port <port>   also accept fire-and-forget score records over UDP
+--log <fmt>         request log format: text (default), binary, off
+--log-file <path>   request log destination (default stdout; required for binary)
+--log-sample <f>    fraction of requests to log, 0 < f <= 1 (default 1)
+--trace-sample <f>  fraction of requests to trace per stage (default 0, off)
+--trace-file <path> write traced requests as Chrome trace-event JSON on shutdown
+--wal-dir <dir>     mode 1: log updates to a write-ahead log and snapshot the caches here
+--durability <lvl>  WAL durability: none, batched (default), sync
+--wal-flush-ms <n>  group-commit interval for none/batched (default 5)
+--snapshot-interval <sec>  seconds between snapshots (default 60)
+--snapshot-file <path>     modes 2/3: warm-start caches from this snapshot and keep it updated
+--preload <n>       modes 2/3 without a usable snapshot: bulk-load the n hottest players
+--preload-conns <n> parallel COPY streams for --preload (default 4)
+--preload-query <q> SELECT returning (player_id, score, hotness bigint); default ranks by last_updated
+--repl-port <port>  stream applied updates to read-only replicas on this TCP port
+--replica-of <host:port>  run as a read-only replica of that primary (forces mode 1)
+--coherence         modes 0/2/3: NOTIFY other servers on this DB of writes and apply theirs
+--coherence-flush-ms <n>  coalescing interval for --coherence notifications (default 10)
+--limiter <alg>     modes 0/2/3: adaptive DB concurrency limit, off (default), aimd, gradient
+--limiter-max <n>   upper bound for the limit, at most --pool-max (default: --pool-max)
+--queue-deadline-ms <n>  longest a request waits for the limiter before a 503 (default 20)
+--pool-min <n>      DB connections opened at startup and kept open (default 4)
+--pool-max <n>      upper bound the pool grows to under load (default 64, at most 256)
+--pool-grow-wait-ms <n>  acquire wait after which the pool opens another connection (default 2)
+--pool-idle-timeout <sec>  close connections above the minimum idle this long (default 60)
+--admin-token <str> /admin/config requires this X-Admin-Token header (default: loopback clients only)
 */
 
+#define _GNU_SOURCE
 #include <microhttpd.h>
 #include <postgresql/libpq-fe.h>
 #include <stdio.h>
@@ -15,739 +53,1281 @@ mode = 0 (DB-only), 1 (LRU Cache + Top-N Cache only), 2 (LRU Cache + DB), 3 (All
 #include <signal.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 #include <pthread.h>
-#include "uthash.h"
+#include <errno.h>
+#include <getopt.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "cache.h"
+#include "topn.h"
+#include "db.h"
+#include "handlers.h"
+#include "reqlog.h"
+#include "metrics.h"
+#include "trace.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "repl.h"
+#include "coherence.h"
+#include "admission.h"
+#include "config.h"
 
 #define MAX_PLAYERS 10000
-#define DEFAULT_PORT 8080
-#define DEFAULT_TOP 10
 
-#define MAX_CACHE_SIZE 1000
-#define POOL_SIZE 64
-#define TOP_N_SIZE 100 // Keep top 100 scores in sorted cache
+// ---------- Top-N Cache Section ----------
+//
+// The caches themselves live in cache.c and topn.c; this loads them from the DB.
 
-typedef struct LRUNode
+// Load one window from the database (replaces its contents)
+void topn_init_window_from_db(TopNWindow w)
 {
-    int id;
-    int score;
-    struct LRUNode *prev, *next;
-    UT_hash_handle hh;
-} LRUNode;
+    Player temp[TOPN_MAX_SIZE];
+    int count = db_get_top(temp, topn_depth, w);
+    topn_load_window(w, temp, count);
+}
 
-typedef struct
+// Initialize Top-N cache from database
+void topn_init_from_db()
 {
-    int id;
-    int score;
-} Player;
+    for (int w = 0; w < TOPN_WINDOW_COUNT; w++)
+        topn_init_window_from_db(w);
 
-// Top-N Cache Structure (sorted array)
-typedef struct
+    printf("Top-N cache initialized with %d players from DB (day %d, week %d)\n",
+           topn_windows[TOPN_ALL].count, topn_windows[TOPN_DAY].count, topn_windows[TOPN_WEEK].count);
+}
+
+// ---------- Snapshot & Durability Section ----------
+//
+// Mode 1 keeps scores only in memory. With --wal-dir every update is also
+// appended to a write-ahead log, and the caches are periodically written
+// to a snapshot; startup restores the snapshot and replays the WAL tail.
+//
+// Modes 2/3 use the same snapshot file (--snapshot-file) for warm restarts:
+// the snapshot records the DB clock when it was taken, and on startup only
+// rows changed since then are re-read from the DB.
+
+#define SNAPSHOT_MAX_DELTA (cache_capacity * 4) // more changed rows than this: start cold
+#define SNAPSHOT_WATERMARK_MARGIN_US 10000000LL  // longest an update may take from now() to its cache write
+
+static int snapshot_enabled = 0;
+static char snapshot_path[4200];
+static int snapshot_interval = 60;
+static pthread_t snapshot_thread;
+
+// Serializes snapshots; set once the shutdown snapshot is taken, since
+// the WAL is closed right after it
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+static int snapshots_closed = 0;
+
+static int write_snapshot(void)
 {
-    Player players[TOP_N_SIZE];
-    int count; // actual number of entries (0 to TOP_N_SIZE)
-} TopNCache;
+    long long start = now_us();
+
+    // New WAL segment first, so the old one is fully covered by this snapshot
+    if (wal_enabled)
+        wal_rotate();
+
+    // Taken before the copy and moved back by a margin. A row's last_updated
+    // is its transaction's now(), and the LRU only sees the new score after
+    // the commit, so an update stamped a little before this point may still
+    // be missing from the copy; a warm start re-reads everything after it.
+    long long watermark = 0;
+    if (mode == 2 || mode == 3)
+    {
+        watermark = db_watermark();
+        if (watermark < 0)
+            return -1;
+        watermark = watermark > SNAPSHOT_WATERMARK_MARGIN_US ? watermark - SNAPSHOT_WATERMARK_MARGIN_US : 0;
+    }
 
-static PGconn *pool[POOL_SIZE];
-static int pool_busy[POOL_SIZE];
-pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t pool_wait = PTHREAD_COND_INITIALIZER;
+    SnapEntry *lru = NULL;
+    SnapEntry topn[TOPN_WINDOW_COUNT * TOPN_MAX_SIZE];
 
-static LRUNode *head = NULL, *tail = NULL;
-static int cache_count = 0;
-static LRUNode *cache_map = NULL;
-pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+    SnapHeader h;
+    memset(&h, 0, sizeof(h));
+
+    pthread_mutex_lock(&cache_lock);
+    pthread_mutex_lock(&topn_lock);
+    lru = malloc(sizeof(SnapEntry) * (cache_count + 1));
+    if (!lru)
+    {
+        pthread_mutex_unlock(&topn_lock);
+        pthread_mutex_unlock(&cache_lock);
+        return -1;
+    }
+    for (LRUNode *n = lru_head; n && h.lru_count < (uint32_t)cache_count; n = n->next)
+    {
+        lru[h.lru_count].id = n->id;
+        lru[h.lru_count].score = n->score;
+        h.lru_count++;
+    }
+    // Every window with its bounds, so day/week survive a restart too
+    int ntopn = 0;
+    for (int w = 0; (mode == 1 || mode == 3) && w < TOPN_WINDOW_COUNT; w++)
+    {
+        const TopNCache *t = &topn_windows[w];
+        for (int i = 0; i < t->count; i++)
+        {
+            topn[ntopn].id = t->players[i].id;
+            topn[ntopn].score = t->players[i].score;
+            ntopn++;
+        }
+        h.window_count[w] = t->count;
+        h.window_start[w] = t->starts_at;
+    }
+    h.topn_count = ntopn;
+    h.lsn = wal_enabled ? wal_last_lsn() : 0;
+    pthread_mutex_unlock(&topn_lock);
+    pthread_mutex_unlock(&cache_lock);
 
-// Top-N Cache
-static TopNCache topn_cache = {{0}, 0};
-pthread_mutex_t topn_lock = PTHREAD_MUTEX_INITIALIZER;
+    h.mode = mode;
+    h.watermark = (uint64_t)watermark;
+    h.created_us = now_us();
+    int rc = snapshot_write(snapshot_path, &h, lru, topn);
+    free(lru);
 
-static int mode = 0; // 0=DB-only, 1=Caches-only, 2=LRU+DB, 3=All
+    if (rc == 0)
+    {
+        if (wal_enabled)
+            wal_truncate_upto(h.lsn);
+        printf("Snapshot written: %u LRU + %u Top-N entries at lsn %llu (%lld us)\n",
+               h.lru_count, h.topn_count, (unsigned long long)h.lsn, now_us() - start);
+    }
+    return rc;
+}
 
-long long now_us()
+int take_snapshot()
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+    pthread_mutex_lock(&snapshot_lock);
+    int rc = snapshots_closed ? -1 : write_snapshot();
+    pthread_mutex_unlock(&snapshot_lock);
+    return rc;
 }
 
-// ---------- DB Section ----------
-
-PGconn *create_new_connection()
+// The last snapshot before shutdown; later take_snapshot() calls do nothing
+static int final_snapshot(void)
 {
-    PGconn *c = PQconnectdb("host=127.0.0.1 port=5432 dbname=leaderboard_db user=leaderboard_user password=leaderboard_pw");
+    pthread_mutex_lock(&snapshot_lock);
+    int rc = snapshots_closed ? -1 : write_snapshot();
+    snapshots_closed = 1;
+    pthread_mutex_unlock(&snapshot_lock);
+    return rc;
+}
 
-    if (!c)
+void *snapshot_loop(void *arg)
+{
+    while (1)
     {
-        fprintf(stderr, "PQconnectdb returned NULL\n");
-        return NULL;
+        sleep(snapshot_interval);
+        take_snapshot();
     }
+    return NULL;
+}
 
-    if (PQstatus(c) != CONNECTION_OK)
-    {
-        fprintf(stderr, "Connection failed: %s\n", PQerrorMessage(c));
-        PQfinish(c);
-        return NULL;
-    }
-    printf("Connected to DB: %s\n", PQdb(c));
-    printf("User: %s\n", PQuser(c));
-    printf("Host: %s\n", PQhost(c));
-    printf("Port: %s\n", PQport(c));
-    return c;
+// Day/week windows are decided by when the update happened, not by when it
+// is replayed; records from older logs carry no time (ts 0) and only reach
+// the all-time window
+static void replay_record(const WalRecord *r, void *arg)
+{
+    cache_update_locked(r->id, r->score);
+    topn_update_at_locked(r->id, r->score, (time_t)r->ts);
 }
 
-void pool_init()
+// Load the first `windows` Top-N windows of a snapshot (must hold topn_lock);
+// version 1 files only have the all-time one
+static void restore_topn_locked(const Snapshot *snap, int windows)
 {
-    for (int i = 0; i < POOL_SIZE; i++)
+    static Player players[TOPN_MAX_SIZE];
+    const SnapEntry *e = snap->topn;
+    for (int w = 0; w < windows && w < SNAPSHOT_WINDOWS; w++)
     {
-        pool[i] = create_new_connection();
-        if (!pool[i])
+        int count = (int)snap->hdr.window_count[w];
+        int keep = count < TOPN_MAX_SIZE ? count : TOPN_MAX_SIZE;
+        for (int i = 0; i < keep; i++)
         {
-            fprintf(stderr, "Failed to initialize DB pool at index %d\n", i);
-            for (int j = 0; j < i; j++)
-            {
-                if (pool[j])
-                    PQfinish(pool[j]);
-                pool[j] = NULL;
-            }
-            exit(1);
+            players[i].id = e[i].id;
+            players[i].score = e[i].score;
         }
-        pool_busy[i] = 0;
+        if (w == TOPN_ALL || snap->hdr.version > 1)
+            topn_restore_window_locked(w, players, keep, (time_t)snap->hdr.window_start[w]);
+        e += count;
     }
 }
 
-PGconn *pool_get_connection()
+static void *snapshot_map_worker(void *arg)
 {
-    pthread_mutex_lock(&pool_lock);
+    Snapshot *snap = arg;
+    if (snapshot_map(snapshot_path, snap) != 0)
+        snap->map = NULL;
+    return NULL;
+}
 
-    while (1)
-    {
-        for (int i = 0; i < POOL_SIZE; i++)
-        {
-            if (!pool_busy[i])
-            {
-                pool_busy[i] = 1;
-                PGconn *c = pool[i];
+// Restore caches from the latest snapshot plus WAL tail, then open the WAL.
+// The snapshot is mapped and verified while WAL segments are validated in
+// parallel; records are then applied in LSN order.
+int durability_init(const char *dir, WalDurability level, int flush_ms)
+{
+    long long start = now_us();
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s/snapshot.bin", dir);
 
-                if (PQstatus(c) != CONNECTION_OK)
-                {
-                    PQreset(c);
-                    if (PQstatus(c) != CONNECTION_OK)
-                    {
-                        fprintf(stderr, "Warning: PQreset failed: %s\n", PQerrorMessage(c));
-                    }
-                }
+    Snapshot snap;
+    memset(&snap, 0, sizeof(snap));
+    pthread_t snap_tid;
+    int snap_threaded = pthread_create(&snap_tid, NULL, snapshot_map_worker, &snap) == 0;
+    if (!snap_threaded)
+        snapshot_map_worker(&snap);
 
-                pthread_mutex_unlock(&pool_lock);
-                return c;
-            }
-        }
-        pthread_cond_wait(&pool_wait, &pool_lock);
-    }
-}
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    WalScan scan;
+    if (wal_scan(dir, ncpu > 0 ? (int)ncpu : 1, &scan) != 0)
+        fprintf(stderr, "WAL scan failed, recovering from snapshot only\n");
 
-void pool_release_connection(PGconn *c)
-{
-    pthread_mutex_lock(&pool_lock);
+    if (snap_threaded)
+        pthread_join(snap_tid, NULL);
 
-    for (int i = 0; i < POOL_SIZE; i++)
+    uint64_t after = 0;
+    pthread_mutex_lock(&cache_lock);
+    pthread_mutex_lock(&topn_lock);
+    if (snap.map)
     {
-        if (pool[i] == c)
-        {
-            pool_busy[i] = 0;
-            break;
-        }
+        // Oldest first, so the most recently used entry ends up at the head
+        for (int i = (int)snap.hdr.lru_count - 1; i >= 0; i--)
+            cache_update_locked(snap.lru[i].id, snap.lru[i].score);
+        restore_topn_locked(&snap, TOPN_WINDOW_COUNT);
+        after = snap.hdr.lsn;
     }
+    size_t replayed = wal_scan_replay(&scan, after, replay_record, NULL);
+    pthread_mutex_unlock(&topn_lock);
+    pthread_mutex_unlock(&cache_lock);
 
-    pthread_cond_signal(&pool_wait);
-    pthread_mutex_unlock(&pool_lock);
+    uint64_t scan_last = scan.last_lsn;
+    uint64_t last = scan_last > after ? scan_last : after;
+    printf("Recovered %u snapshot entries (lsn %llu) + %zu WAL records in %lld us\n",
+           snap.map ? snap.hdr.lru_count : 0, (unsigned long long)after, replayed, now_us() - start);
+
+    wal_scan_free(&scan);
+    snapshot_unmap(&snap);
+
+    // New records must follow the last valid one on disk, not torn bytes
+    if (wal_trim_tail(dir, scan_last, last + 1) != 0 || wal_open(dir, level, flush_ms, last + 1) != 0)
+        return -1;
+    wal_enabled = 1;
+
+    if (pthread_create(&snapshot_thread, NULL, snapshot_loop, NULL) != 0)
+        fprintf(stderr, "Warning: snapshot thread not started, WAL will grow unbounded\n");
+    printf("WAL enabled in %s (durability=%s)\n", dir, wal_durability_name(level));
+    return 0;
 }
 
-void db_update(int id, int score)
+// Modes 2/3: load the LRU (and Top-N for mode 3) from a snapshot written by
+// a previous run, then catch up on rows the DB changed since. Returns 1 if
+// the Top-N cache was restored, 0 otherwise (caller falls back to the DB).
+int warm_start(const char *path)
 {
-    PGconn *c = pool_get_connection();
-    if (!c)
+    long long start = now_us();
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s", path);
+    snapshot_enabled = 1;
+
+    Snapshot snap;
+    if (snapshot_map(snapshot_path, &snap) != 0)
     {
-        fprintf(stderr, "db_update: no connection available\n");
-        return;
+        printf("No usable snapshot at %s, starting cold\n", snapshot_path);
+        return 0;
+    }
+    if (snap.hdr.mode != 2 && snap.hdr.mode != 3)
+    {
+        printf("Snapshot %s was written in mode %u, starting cold\n", snapshot_path, snap.hdr.mode);
+        snapshot_unmap(&snap);
+        return 0;
     }
 
-    char q[256];
-    snprintf(q, sizeof(q),
-             "INSERT INTO leaderboard (player_id, score, last_updated) "
-             "VALUES (%d, %d, now()) "
-             "ON CONFLICT (player_id) DO UPDATE SET score = EXCLUDED.score, last_updated = now();",
-             id, score);
-
-    PGresult *res = PQexec(c, q);
-    if (!res)
+    long long hwm = db_high_water_mark();
+    Player *delta = NULL;
+    int ndelta = 0;
+    if (hwm < 0)
     {
-        fprintf(stderr, "db_update: PQexec returned NULL\n");
+        printf("Cannot read DB high-water mark, ignoring snapshot\n");
+        snapshot_unmap(&snap);
+        return 0;
     }
-    else
+    if ((unsigned long long)hwm > snap.hdr.watermark)
     {
-        if (PQresultStatus(res) != PGRES_COMMAND_OK)
+        delta = malloc(sizeof(Player) * (SNAPSHOT_MAX_DELTA + 1));
+        ndelta = delta ? db_get_changed_since((long long)snap.hdr.watermark, delta, SNAPSHOT_MAX_DELTA + 1) : -1;
+        if (ndelta < 0 || ndelta > SNAPSHOT_MAX_DELTA)
         {
-            fprintf(stderr, "db_update: query failed: %s\n", PQerrorMessage(c));
+            printf("DB changed too much since snapshot (or query failed), starting cold\n");
+            free(delta);
+            snapshot_unmap(&snap);
+            return 0;
         }
-        PQclear(res);
     }
 
-    pool_release_connection(c);
-}
+    int topn_restored = (mode == 3 && snap.hdr.mode == 3);
 
-int db_get_top(Player *arr, int limit)
-{
-    PGconn *c = pool_get_connection();
-    if (!c)
+    pthread_mutex_lock(&cache_lock);
+    pthread_mutex_lock(&topn_lock);
+    for (int i = (int)snap.hdr.lru_count - 1; i >= 0; i--)
+        cache_update_locked(snap.lru[i].id, snap.lru[i].score);
+    // Day/week are reloaded from the DB, which has rows the snapshot lacks
+    if (topn_restored)
+        restore_topn_locked(&snap, 1);
+
+    // Rows changed since the snapshot: refresh cached entries, re-rank Top-N
+    for (int i = 0; i < ndelta; i++)
     {
-        fprintf(stderr, "db_get_top: no connection available\n");
-        return 0;
+        LRUNode *node = cache_find_locked(delta[i].id);
+        if (node)
+            node->score = delta[i].score;
+        if (topn_restored)
+            topn_update_locked(delta[i].id, delta[i].score);
     }
+    pthread_mutex_unlock(&topn_lock);
+    pthread_mutex_unlock(&cache_lock);
 
-    char q[128];
-    snprintf(q, sizeof(q), "SELECT player_id, score FROM leaderboard ORDER BY score DESC LIMIT %d;", limit);
+    printf("Warm start from %s: %u LRU + %u Top-N entries, %d changed rows re-read (%lld us)\n",
+           snapshot_path, snap.hdr.lru_count, topn_restored ? snap.hdr.topn_count : 0, ndelta, now_us() - start);
 
-    PGresult *res = PQexec(c, q);
-    if (!res)
-    {
-        fprintf(stderr, "db_get_top: PQexec returned NULL\n");
-        pool_release_connection(c);
-        return 0;
-    }
+    free(delta);
+    snapshot_unmap(&snap);
+    return topn_restored;
+}
+
+// ---------- Preload Section ----------
+//
+// Without a snapshot, modes 2/3 can bulk-load the hottest players before
+// accepting traffic. The player_id space is split into ranges and each
+// range is streamed over its own pooled connection with binary COPY.
+// The preload query must return (player_id int, score int, hotness bigint);
+// higher hotness means more recently/frequently used.
+
+#define PRELOAD_DEFAULT_QUERY \
+    "SELECT player_id, score, (extract(epoch FROM last_updated) * 1000000)::bigint FROM leaderboard"
 
-    if (PQresultStatus(res) != PGRES_TUPLES_OK)
+typedef struct
+{
+    int id;
+    int score;
+    long long hot;
+} PreloadRow;
+
+typedef struct
+{
+    const char *query;
+    long long lo, hi; // player_id range [lo, hi)
+    int limit;
+    PreloadRow *rows;
+    int count;
+    int failed;
+} PreloadJob;
+
+static uint32_t be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t be64(const unsigned char *p)
+{
+    return ((uint64_t)be32(p) << 32) | be32(p + 4);
+}
+
+// Parse as many complete binary-COPY tuples from buf as possible; returns
+// bytes consumed, or -1 on a malformed stream
+static long preload_parse(PreloadJob *job, const unsigned char *buf, size_t len, int *header_done)
+{
+    static const unsigned char sig[11] = {'P', 'G', 'C', 'O', 'P', 'Y', '\n', 0xff, '\r', '\n', 0};
+    size_t pos = 0;
+
+    if (!*header_done)
     {
-        fprintf(stderr, "db_get_top: query failed: %s\n", PQerrorMessage(c));
-        PQclear(res);
-        pool_release_connection(c);
-        return 0;
+        if (len < 19)
+            return 0;
+        if (memcmp(buf, sig, sizeof(sig)) != 0)
+            return -1;
+        pos = 19 + be32(buf + 15); // signature, flags, header extension length + data
+        if (pos > len)
+            return 0;
+        *header_done = 1;
     }
 
-    int rows = PQntuples(res);
-    for (int i = 0; i < rows; i++)
+    while (pos + 2 <= len)
     {
-        arr[i].id = atoi(PQgetvalue(res, i, 0));
-        arr[i].score = atoi(PQgetvalue(res, i, 1));
+        int16_t nfields = (int16_t)((buf[pos] << 8) | buf[pos + 1]);
+        if (nfields == -1)
+            return len; // trailer
+        if (nfields != 3)
+            return -1;
+
+        // int4, int4, int8: fixed lengths when not NULL
+        size_t need = 2 + (4 + 4) + (4 + 4) + (4 + 8);
+        if (pos + need > len)
+            break;
+        const unsigned char *p = buf + pos + 2;
+        if ((int32_t)be32(p) != 4 || (int32_t)be32(p + 8) != 4 || (int32_t)be32(p + 16) != 8)
+            return -1; // NULLs or unexpected types
+
+        if (job->count < job->limit)
+        {
+            PreloadRow *r = &job->rows[job->count++];
+            r->id = (int32_t)be32(p + 4);
+            r->score = (int32_t)be32(p + 12);
+            r->hot = (long long)be64(p + 20);
+        }
+        pos += need;
     }
-    PQclear(res);
-    pool_release_connection(c);
-    return rows;
+    return pos;
 }
 
-int db_get_score(int id)
+static void *preload_worker(void *arg)
 {
+    PreloadJob *job = arg;
+    job->rows = malloc(sizeof(PreloadRow) * job->limit);
+    if (!job->rows)
+    {
+        job->failed = 1;
+        return NULL;
+    }
+
     PGconn *c = pool_get_connection();
     if (!c)
     {
-        fprintf(stderr, "db_get_score: no connection available\n");
-        return -1;
+        job->failed = 1;
+        return NULL;
     }
-
-    char q[128];
-    snprintf(q, sizeof(q),
-             "SELECT score FROM leaderboard WHERE player_id=%d;", id);
+    char *q = malloc(strlen(job->query) + 512);
+    if (!q)
+    {
+        job->failed = 1;
+        pool_release_connection(c);
+        return NULL;
+    }
+    sprintf(q,
+            "COPY (SELECT p.player_id, p.score, p.hot FROM (%s) AS p(player_id, score, hot) "
+            "WHERE p.player_id >= %lld AND p.player_id < %lld ORDER BY p.hot DESC LIMIT %d) "
+            "TO STDOUT (FORMAT binary);",
+            job->query, job->lo, job->hi, job->limit);
 
     PGresult *res = PQexec(c, q);
-    if (!res)
+    free(q);
+    if (!res || PQresultStatus(res) != PGRES_COPY_OUT)
     {
-        fprintf(stderr, "db_get_score: PQexec returned NULL\n");
+        fprintf(stderr, "preload: COPY failed: %s\n", PQerrorMessage(c));
+        if (res)
+            PQclear(res);
+        job->failed = 1;
         pool_release_connection(c);
-        return -1;
+        return NULL;
     }
+    PQclear(res);
 
-    if (PQresultStatus(res) != PGRES_TUPLES_OK)
+    // Rows may straddle CopyData messages, so keep a carry-over buffer
+    unsigned char *carry = NULL;
+    size_t carry_len = 0, carry_cap = 0;
+    int header_done = 0;
+    char *data;
+    int n;
+    while ((n = PQgetCopyData(c, &data, 0)) > 0)
     {
-        if (PQntuples(res) == 0)
+        if (carry_len + n > carry_cap)
         {
-            PQclear(res);
-            pool_release_connection(c);
-            return -1;
+            carry_cap = (carry_len + n) * 2;
+            unsigned char *p = realloc(carry, carry_cap);
+            if (!p)
+            {
+                job->failed = 1;
+                PQfreemem(data);
+                break;
+            }
+            carry = p;
         }
-        else
+        memcpy(carry + carry_len, data, n);
+        carry_len += n;
+        PQfreemem(data);
+
+        long used = preload_parse(job, carry, carry_len, &header_done);
+        if (used < 0)
         {
-            fprintf(stderr, "db_get_score: query failed: %s\n", PQerrorMessage(c));
-            PQclear(res);
-            pool_release_connection(c);
-            return -1;
+            fprintf(stderr, "preload: malformed COPY stream (query must return int, int, bigint)\n");
+            job->failed = 1;
+            break;
         }
+        memmove(carry, carry + used, carry_len - used);
+        carry_len -= used;
     }
+    free(carry);
 
-    int rows = PQntuples(res);
-    if (rows == 0)
+    // Drain the remaining stream (if we stopped early) and the final result
+    while (n > 0 && (n = PQgetCopyData(c, &data, 0)) > 0)
+        PQfreemem(data);
+    while ((res = PQgetResult(c)) != NULL)
     {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK)
+        {
+            fprintf(stderr, "preload: COPY ended with error: %s\n", PQerrorMessage(c));
+            job->failed = 1;
+        }
         PQclear(res);
-        pool_release_connection(c);
-        return -1;
     }
 
-    int score = atoi(PQgetvalue(res, 0, 0));
-    PQclear(res);
     pool_release_connection(c);
-    return score;
+    return NULL;
 }
 
-// ---------- LRU Cache Section ----------
-
-void lru_remove(LRUNode *node)
-{
-    if (!node)
-        return;
-
-    if (node->prev)
-        node->prev->next = node->next;
-    else
-        head = node->next;
-
-    if (node->next)
-        node->next->prev = node->prev;
-    else
-        tail = node->prev;
-}
-
-void lru_push_front(LRUNode *node)
+static int preload_row_cmp(const void *a, const void *b)
 {
-    node->next = head;
-    node->prev = NULL;
-    if (head)
-        head->prev = node;
-    head = node;
-    if (tail == NULL)
-        tail = node;
+    long long x = ((const PreloadRow *)a)->hot, y = ((const PreloadRow *)b)->hot;
+    return (x < y) - (x > y); // hottest first
 }
 
-void cache_update(int id, int score)
+// Load up to `count` hottest players into the LRU (and Top-N in mode 3)
+// using `conns` parallel COPY streams. Returns rows loaded, -1 on failure.
+int preload_caches(const char *query, int count, int conns)
 {
-    pthread_mutex_lock(&cache_lock);
-
-    LRUNode *node = NULL;
-    HASH_FIND_INT(cache_map, &id, node);
+    long long start = now_us();
+    if (count > cache_capacity)
+        count = cache_capacity;
+    if (conns < 1)
+        conns = 1;
+    int pool_lo, pool_hi;
+    pool_get_bounds(&pool_lo, &pool_hi);
+    if (conns > pool_hi)
+        conns = pool_hi;
+
+    long long lo = db_query_bigint("preload", "SELECT COALESCE(min(player_id), 0) FROM leaderboard;");
+    long long hi = db_query_bigint("preload", "SELECT COALESCE(max(player_id), 0) FROM leaderboard;");
+    if (lo < 0 || hi < 0)
+        return -1;
+    hi++;
+
+    PreloadJob jobs[conns];
+    pthread_t tids[conns];
+    int started[conns];
+    long long span = (hi - lo + conns - 1) / conns;
+    if (span < 1)
+        span = 1;
+    for (int i = 0; i < conns; i++)
+    {
+        memset(&jobs[i], 0, sizeof(jobs[i]));
+        jobs[i].query = query;
+        jobs[i].lo = lo + span * i;
+        jobs[i].hi = (i == conns - 1) ? hi : lo + span * (i + 1);
+        jobs[i].limit = count;
+        started[i] = pthread_create(&tids[i], NULL, preload_worker, &jobs[i]) == 0;
+        if (!started[i])
+        {
+            // No thread: fetch this range on the calling thread
+            preload_worker(&jobs[i]);
+        }
+    }
 
-    if (node)
+    int total = 0, failed = 0;
+    for (int i = 0; i < conns; i++)
     {
-        node->score = score;
-        lru_remove(node);
-        lru_push_front(node);
-        pthread_mutex_unlock(&cache_lock);
-        return;
+        if (started[i])
+            pthread_join(tids[i], NULL);
+        failed |= jobs[i].failed;
+        total += jobs[i].count;
     }
+    long long fetched_us = now_us() - start;
 
-    if (cache_count >= MAX_CACHE_SIZE)
+    PreloadRow *all = failed ? NULL : malloc(sizeof(PreloadRow) * (total ? total : 1));
+    int n = 0;
+    if (all)
     {
-        LRUNode *old_tail = tail;
-        if (old_tail)
+        for (int i = 0; i < conns; i++)
         {
-            HASH_DEL(cache_map, old_tail);
-            lru_remove(old_tail);
-            free(old_tail);
-            cache_count--;
+            memcpy(all + n, jobs[i].rows, sizeof(PreloadRow) * jobs[i].count);
+            n += jobs[i].count;
         }
-    }
+        qsort(all, n, sizeof(PreloadRow), preload_row_cmp);
+        if (n > count)
+            n = count;
 
-    node = (LRUNode *)malloc(sizeof(LRUNode));
-    if (!node)
-    {
+        pthread_mutex_lock(&cache_lock);
+        pthread_mutex_lock(&topn_lock);
+        for (int i = n - 1; i >= 0; i--) // coldest first, hottest ends up most recent
+        {
+            cache_update_locked(all[i].id, all[i].score);
+            if (mode == 3)
+                topn_update_locked(all[i].id, all[i].score);
+        }
+        pthread_mutex_unlock(&topn_lock);
         pthread_mutex_unlock(&cache_lock);
-        return;
     }
-    node->id = id;
-    node->score = score;
-    node->prev = node->next = NULL;
 
-    lru_push_front(node);
-    HASH_ADD_INT(cache_map, id, node);
-    cache_count++;
-
-    pthread_mutex_unlock(&cache_lock);
-}
+    for (int i = 0; i < conns; i++)
+        free(jobs[i].rows);
+    free(all);
 
-int cache_get_score(int id)
-{
-    pthread_mutex_lock(&cache_lock);
-
-    LRUNode *node = NULL;
-    HASH_FIND_INT(cache_map, &id, node);
-
-    if (node)
+    if (failed)
     {
-        int score = node->score;
-        lru_remove(node);
-        lru_push_front(node);
-        pthread_mutex_unlock(&cache_lock);
-        return score;
+        fprintf(stderr, "Preload failed, starting cold\n");
+        return -1;
     }
-
-    pthread_mutex_unlock(&cache_lock);
-    return -1;
+    printf("Preloaded %d players over %d connections in %lld us (fetch %lld us)\n",
+           n, conns, now_us() - start, fetched_us);
+    return n;
 }
 
-// ---------- Top-N Cache Section ----------
-
-// Initialize Top-N cache from database
-void topn_init_from_db()
+// Print the cache hit ratio at a few points after startup so warm and
+// cold starts can be compared
+void *warmup_report_loop(void *arg)
 {
-    pthread_mutex_lock(&topn_lock);
-
-    Player temp[TOP_N_SIZE];
-    int count = db_get_top(temp, TOP_N_SIZE);
-
-    topn_cache.count = count;
-    for (int i = 0; i < count; i++)
+    static const int marks[] = {1, 10, 30, 60};
+    long long started = *(long long *)arg;
+    for (size_t i = 0; i < sizeof(marks) / sizeof(marks[0]); i++)
     {
-        topn_cache.players[i] = temp[i];
+        long long wait = started + marks[i] * 1000000LL - now_us();
+        if (wait > 0)
+            usleep(wait);
+        uint64_t hits = metrics_counter_total(METRIC_CACHE_HITS);
+        uint64_t misses = metrics_counter_total(METRIC_CACHE_MISSES);
+        printf("[WARMUP] t=%ds hits=%llu misses=%llu hit_ratio=%.3f\n", marks[i],
+               (unsigned long long)hits, (unsigned long long)misses,
+               hits + misses ? (double)hits / (hits + misses) : 0.0);
+        fflush(stdout);
     }
-
-    printf("Top-N cache initialized with %d players from DB\n", count);
-    pthread_mutex_unlock(&topn_lock);
+    return NULL;
 }
 
-// Check if score qualifies for top-N (must hold topn_lock before calling)
-int is_topn_score(int score)
+// ---------- UDP Ingest Section ----------
+//
+// Fire-and-forget score events. Each datagram carries one or more packed
+// 8-byte records: int32 player_id, int32 score, both in network byte order.
+// Datagrams are drained UDP_BATCH at a time with recvmmsg() and every batch
+// goes through the cache (and DB, in modes 0/2/3) under one lock/statement.
+
+#define UDP_BATCH 64
+#define UDP_MAX_DGRAM 8192
+#define UDP_REC_SIZE 8
+#define UDP_RCVBUF (8 * 1024 * 1024)
+
+static int udp_fd = -1;
+static pthread_t udp_thread;
+static atomic_int udp_stopping = 0;
+static atomic_ullong udp_packets = 0;   // datagrams received
+static atomic_ullong udp_records = 0;   // records applied
+static atomic_ullong udp_malformed = 0; // datagrams rejected (truncated or bad length)
+static atomic_ullong udp_dropped = 0;   // datagrams dropped by the kernel (SO_RXQ_OVFL)
+
+int udp_init(int port)
 {
-    // If cache not full, any score qualifies
-    if (topn_cache.count < TOP_N_SIZE)
-        return 1;
-
-    // Check if score is higher than lowest in cache
-    return score > topn_cache.players[topn_cache.count - 1].score;
-}
-
-// Update Top-N cache (sorted array, must hold topn_lock)
-void topn_update(int id, int score)
-{
-    pthread_mutex_lock(&topn_lock);
-
-    // Find if player already exists in top-N
-    int existing_idx = -1;
-    for (int i = 0; i < topn_cache.count; i++)
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
     {
-        if (topn_cache.players[i].id == id)
-        {
-            existing_idx = i;
-            break;
-        }
+        perror("udp socket");
+        return -1;
     }
 
-    // If exists, remove old entry
-    if (existing_idx >= 0)
+    int one = 1;
+    int rcvbuf = UDP_RCVBUF;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0)
+        fprintf(stderr, "Warning: SO_RXQ_OVFL unavailable, UDP drops will not be counted\n");
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
     {
-        for (int i = existing_idx; i < topn_cache.count - 1; i++)
-        {
-            topn_cache.players[i] = topn_cache.players[i + 1];
-        }
-        topn_cache.count--;
+        perror("udp bind");
+        close(fd);
+        return -1;
     }
+    return fd;
+}
 
-    // Check if new score qualifies for top-N
-    if (!is_topn_score(score) && existing_idx < 0)
-    {
-        pthread_mutex_unlock(&topn_lock);
+void udp_apply_batch(const Player *recs, int n)
+{
+    if (n == 0)
         return;
-    }
 
-    // Find insertion position
-    int pos = 0;
-    for (pos = 0; pos < topn_cache.count; pos++)
+    if (mode == 1 && wal_enabled)
     {
-        if (score > topn_cache.players[pos].score)
-            break;
-    }
-
-    // Shift elements down
-    if (topn_cache.count < TOP_N_SIZE)
-    {
-        for (int i = topn_cache.count; i > pos; i--)
-        {
-            topn_cache.players[i] = topn_cache.players[i - 1];
-        }
-        topn_cache.count++;
+        if (durable_update_batch(recs, n) != 0)
+            fprintf(stderr, "udp: %d updates were applied but not logged\n", n);
     }
     else
     {
-        // Cache full, shift and discard last
-        for (int i = TOP_N_SIZE - 1; i > pos; i--)
-        {
-            topn_cache.players[i] = topn_cache.players[i - 1];
-        }
+        if (mode == 1 || mode == 2 || mode == 3)
+            cache_update_batch(recs, n);
+        if (mode == 1 || mode == 3)
+            topn_update_batch(recs, n);
     }
+    if (mode == 0 || mode == 2 || mode == 3)
+        db_update_batch(recs, n);
+    repl_publish_batch(recs, n);
 
-    // Insert new entry
-    topn_cache.players[pos].id = id;
-    topn_cache.players[pos].score = score;
-
-    pthread_mutex_unlock(&topn_lock);
+    atomic_fetch_add_explicit(&udp_records, n, memory_order_relaxed);
 }
 
-// Get top N from cache
-int topn_get_top(Player *out, int limit)
+// GET /metrics hook: ingest counters while UDP is enabled
+static void udp_render_metrics(MetricsBuf *b)
 {
-    pthread_mutex_lock(&topn_lock);
-
-    int ret = (topn_cache.count < limit) ? topn_cache.count : limit;
-    if (ret > 0)
-        memcpy(out, topn_cache.players, ret * sizeof(Player));
-
-    pthread_mutex_unlock(&topn_lock);
-    return ret;
+    if (udp_fd < 0)
+        return;
+    mbuf_printf(b, "# TYPE leaderboard_udp_packets_total counter\nleaderboard_udp_packets_total %llu\n"
+                   "# TYPE leaderboard_udp_records_total counter\nleaderboard_udp_records_total %llu\n"
+                   "# TYPE leaderboard_udp_malformed_total counter\nleaderboard_udp_malformed_total %llu\n"
+                   "# TYPE leaderboard_udp_dropped_total counter\nleaderboard_udp_dropped_total %llu\n",
+                (unsigned long long)atomic_load(&udp_packets), (unsigned long long)atomic_load(&udp_records),
+                (unsigned long long)atomic_load(&udp_malformed), (unsigned long long)atomic_load(&udp_dropped));
 }
 
-// ---------- HTTP Handlers ----------
-static enum MHD_Result handle_request(void *cls, struct MHD_Connection *conn_http,
-                                      const char *url, const char *method,
-                                      const char *ver, const char *upload_data,
-                                      size_t *upload_data_size, void **con_cls)
+// GET /metrics hook for everything main() may have started
+static void server_render_metrics(MetricsBuf *b)
 {
-    if (strcmp(method, "GET") == 0 && strncmp(url, "/leaderboard", 12) == 0)
-    {
-        long long start = now_us();
+    udp_render_metrics(b);
+    repl_render_metrics(b);
+    coherence_render_metrics(b);
+}
 
-        const char *top_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "top");
-        int top = top_q ? atoi(top_q) : DEFAULT_TOP;
+void *udp_loop(void *arg)
+{
+    static char bufs[UDP_BATCH][UDP_MAX_DGRAM];
+    static char ctrl[UDP_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+    static Player recs[UDP_BATCH * (UDP_MAX_DGRAM / UDP_REC_SIZE)];
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iovs[UDP_BATCH];
 
-        Player top_players[DEFAULT_TOP];
-        int count = 0;
-        int cache_hit = 0;
+    for (int i = 0; i < UDP_BATCH; i++)
+    {
+        iovs[i].iov_base = bufs[i];
+        iovs[i].iov_len = UDP_MAX_DGRAM;
+    }
 
-        if (mode == 0)
-        {
-            // DB-only
-            count = db_get_top(top_players, top);
-            cache_hit = 0;
-        }
-        else if (mode == 1)
-        {
-            // Caches-only: use Top-N cache
-            count = topn_get_top(top_players, top);
-            cache_hit = 1;
-        }
-        else if (mode == 2)
-        {
-            // LRU Cache + DB: use DB for leaderboard (LRU doesn't guarantee top-N)
-            count = db_get_top(top_players, top);
-            cache_hit = 0;
-        }
-        else if (mode == 3)
+    while (1)
+    {
+        for (int i = 0; i < UDP_BATCH; i++)
         {
-            // All: use Top-N cache
-            count = topn_get_top(top_players, top);
-            cache_hit = 1;
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = ctrl[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
         }
 
-        long long end = now_us();
-        printf("[LEADERBOARD] mode=%d cache_hit=%d latency=%lld us\n",
-               mode, cache_hit, (end - start));
-        fflush(stdout);
-
-        char json[4096];
-        size_t pos = 0;
-        pos += snprintf(json + pos, sizeof(json) - pos, "{\"leaderboard\":[");
-        for (int i = 0; i < count && pos < sizeof(json); i++)
+        // Block for the first datagram, then take whatever else is queued
+        int got = recvmmsg(udp_fd, msgs, UDP_BATCH, MSG_WAITFORONE, NULL);
+        if (atomic_load(&udp_stopping))
+            break;
+        if (got < 0)
         {
-            pos += snprintf(json + pos, sizeof(json) - pos, "{\"id\":%d,\"score\":%d}%s",
-                            top_players[i].id, top_players[i].score, (i == count - 1) ? "" : ",");
+            if (errno == EINTR)
+                continue;
+            if (errno == EBADF)
+                break;
+            perror("recvmmsg");
+            continue;
         }
-        pos += snprintf(json + pos, sizeof(json) - pos, "]}");
-
-        struct MHD_Response *res = MHD_create_response_from_buffer(strlen(json), strdup(json), MHD_RESPMEM_MUST_FREE);
-        MHD_add_response_header(res, "Content-Type", "application/json");
-        int ret = MHD_queue_response(conn_http, MHD_HTTP_OK, res);
-        MHD_destroy_response(res);
-        return ret;
-    }
-
-    if (strcmp(method, "POST") == 0 && strncmp(url, "/update_score", 13) == 0)
-    {
-        long long start = now_us();
 
-        const char *id_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "player_id");
-        const char *score_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "score");
-        if (!id_q || !score_q)
+        int n = 0;
+        for (int i = 0; i < got; i++)
         {
-            const char *err = "Missing parameters";
-            struct MHD_Response *res = MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
-            int ret = MHD_queue_response(conn_http, MHD_HTTP_BAD_REQUEST, res);
-            MHD_destroy_response(res);
-            return ret;
-        }
+            struct msghdr *mh = &msgs[i].msg_hdr;
+            unsigned int len = msgs[i].msg_len;
 
-        int id = atoi(id_q);
-        int score = atoi(score_q);
+            for (struct cmsghdr *cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm))
+            {
+                if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL)
+                {
+                    uint32_t ovfl;
+                    memcpy(&ovfl, CMSG_DATA(cm), sizeof(ovfl));
+                    atomic_store_explicit(&udp_dropped, ovfl, memory_order_relaxed);
+                }
+            }
 
-        int wrote_lru = 0, wrote_topn = 0, wrote_db = 0;
+            if ((mh->msg_flags & MSG_TRUNC) || len == 0 || len % UDP_REC_SIZE != 0)
+            {
+                atomic_fetch_add_explicit(&udp_malformed, 1, memory_order_relaxed);
+                continue;
+            }
 
-        if (mode == 0)
-        {
-            // DB-only
-            db_update(id, score);
-            wrote_db = 1;
-        }
-        else if (mode == 1)
-        {
-            // Caches-only: update both LRU and Top-N caches
-            cache_update(id, score);
-            topn_update(id, score);
-            wrote_lru = 1;
-            wrote_topn = 1;
-        }
-        else if (mode == 2)
-        {
-            // LRU Cache + DB: update LRU and DB
-            cache_update(id, score);
-            db_update(id, score);
-            wrote_lru = 1;
-            wrote_db = 1;
-        }
-        else if (mode == 3)
-        {
-            // All: update LRU, Top-N, and DB
-            cache_update(id, score);
-            topn_update(id, score);
-            db_update(id, score);
-            wrote_lru = 1;
-            wrote_topn = 1;
-            wrote_db = 1;
+            const char *p = bufs[i];
+            for (unsigned int off = 0; off < len; off += UDP_REC_SIZE)
+            {
+                uint32_t id_n, score_n;
+                memcpy(&id_n, p + off, 4);
+                memcpy(&score_n, p + off + 4, 4);
+                recs[n].id = (int)ntohl(id_n);
+                recs[n].score = (int)ntohl(score_n);
+                n++;
+            }
         }
+        atomic_fetch_add_explicit(&udp_packets, got, memory_order_relaxed);
 
-        long long end = now_us();
-        printf("[UPDATE] mode=%d lru=%d topn=%d db=%d latency=%lld us (id=%d score=%d)\n",
-               mode, wrote_lru, wrote_topn, wrote_db, (end - start), id, score);
-        fflush(stdout);
-
-        const char *ok = "{\"status\":\"ok\"}";
-        struct MHD_Response *res = MHD_create_response_from_buffer(strlen(ok), (void *)ok, MHD_RESPMEM_PERSISTENT);
-        int ret = MHD_queue_response(conn_http, MHD_HTTP_OK, res);
-        MHD_destroy_response(res);
-        return ret;
+        udp_apply_batch(recs, n);
     }
+    return NULL;
+}
 
-    if (strcmp(method, "GET") == 0 && strncmp(url, "/get_score", 10) == 0)
+// ---------- MAIN ----------
+static struct MHD_Daemon *http_daemon;
+
+// Runs on the main thread once SIGINT/SIGTERM arrives (see sigwait() in
+// main). Everything that can still change the caches or use a DB
+// connection is stopped first, so the final snapshot is complete and
+// pool_close() never closes a connection in use.
+static void shutdown_server(void)
+{
+    if (http_daemon)
+        MHD_stop_daemon(http_daemon);
+    if (udp_fd >= 0)
     {
-        long long start = now_us();
+        // Wakes recvmmsg(); the loop sees udp_stopping and exits
+        atomic_store(&udp_stopping, 1);
+        shutdown(udp_fd, SHUT_RD);
+        pthread_join(udp_thread, NULL);
+    }
+    repl_shutdown();
+
+    if (wal_enabled || snapshot_enabled)
+        final_snapshot();
+    if (wal_enabled)
+        wal_close();
+    coherence_shutdown();
+    pool_close();
+
+    trace_shutdown();
+    reqlog_shutdown();
+    if (reqlog_dropped())
+        printf("\nRequest log: %llu records dropped (ring full)\n", reqlog_dropped());
+    if (udp_fd >= 0)
+    {
+        printf("\nUDP ingest: packets=%llu records=%llu malformed=%llu dropped=%llu\n",
+               (unsigned long long)atomic_load(&udp_packets), (unsigned long long)atomic_load(&udp_records),
+               (unsigned long long)atomic_load(&udp_malformed), (unsigned long long)atomic_load(&udp_dropped));
+    }
+    if (metrics_counter_total(METRIC_WRITES_AVOIDED))
+        printf("\nConditional updates: %llu writes avoided\n",
+               (unsigned long long)metrics_counter_total(METRIC_WRITES_AVOIDED));
+    printf("\nServer stopped.\n");
+}
 
-        const char *id_q = MHD_lookup_connection_value(conn_http, MHD_GET_ARGUMENT_KIND, "player_id");
-        if (!id_q)
-        {
-            const char *err = "{\"error\":\"missing player_id\"}";
-            struct MHD_Response *res = MHD_create_response_from_buffer(strlen(err), (void *)err, MHD_RESPMEM_PERSISTENT);
-            int ret = MHD_queue_response(conn_http, MHD_HTTP_BAD_REQUEST, res);
-            MHD_destroy_response(res);
-            return ret;
-        }
+// Before any thread that formats local times is started
+static void use_time_zone(const char *tz)
+{
+    setenv("TZ", tz, 1);
+    tzset();
+    printf("Top-N day/week windows use time zone %s\n", tz);
+}
 
-        int id = atoi(id_q);
-        int score = -1;
-        int cache_hit = 0;
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--config PATH] [--port PORT] [--mode MODE] [--http-threads N] [--conninfo STR]\n"
+                    "          [--cache-size N] [--topn-size N] [--udp-port PORT] [--log text|binary|off] [--log-file PATH]\n"
+                    "          [--log-sample FRACTION] [--trace-sample FRACTION] [--trace-file PATH]\n"
+                    "          [--wal-dir DIR] [--durability none|batched|sync] [--wal-flush-ms N]\n"
+                    "          [--snapshot-interval SEC] [--snapshot-file PATH]\n"
+                    "          [--preload N] [--preload-conns N] [--preload-query SQL]\n"
+                    "          [--repl-port PORT] [--replica-of HOST:PORT]\n"
+                    "          [--coherence] [--coherence-flush-ms N]\n"
+                    "          [--limiter off|aimd|gradient] [--limiter-max N] [--queue-deadline-ms N]\n"
+                    "          [--pool-min N] [--pool-max N] [--pool-grow-wait-ms N] [--pool-idle-timeout SEC]\n"
+                    "          [--admin-token STR]"
+                    "          [--timezone TZ] [<port> [<mode>]]\n",
+            prog);
+}
 
-        if (mode == 0)
-        {
-            // DB-only
-            score = db_get_score(id);
-            cache_hit = 0;
-        }
-        else if (mode == 1)
-        {
-            // Caches-only: try LRU cache
-            score = cache_get_score(id);
-            cache_hit = (score >= 0) ? 1 : 0;
-        }
-        else if (mode == 2)
+int main(int argc, char **argv)
+{
+    int port = DEFAULT_PORT;
+    int http_threads = THREAD_POOL_SIZE;
+    const char *conninfo = PG_CONNINFO;
+    int cache_size = MAX_CACHE_SIZE;
+    int topn_size = TOP_N_SIZE;
+    const char *timezone_name = NULL;
+    int udp_port = 0;
+    ReqLogFormat log_fmt = REQLOG_TEXT;
+    const char *log_file = NULL;
+    double log_sample = 1.0;
+    double trace_sample = 0.0;
+    const char *trace_file = NULL;
+    const char *wal_dir = NULL;
+    WalDurability durability = WAL_DURABILITY_BATCHED;
+    int wal_flush_ms = 5;
+    const char *snapshot_file = NULL;
+    int preload_count = 0;
+    int preload_conns = 4;
+    const char *preload_query = PRELOAD_DEFAULT_QUERY;
+    int repl_port = 0;
+    const char *replica_of = NULL;
+    int coherence = 0;
+    int coherence_flush_ms = 10;
+    AdmissionAlgo limiter = ADMISSION_OFF;
+    int limiter_max = 0; // 0: --pool-max
+    int queue_deadline_ms = 20;
+    int pool_min = POOL_MIN_SIZE;
+    int pool_max = POOL_SIZE;
+    int pool_grow_wait_ms = -1;
+    int pool_idle_timeout = 0;
+
+    mode = 3;
+
+    static const struct option long_opts[] = {
+        {"config", required_argument, NULL, 'k'},
+        {"port", required_argument, NULL, 'o'},
+        {"mode", required_argument, NULL, 'e'},
+        {"http-threads", required_argument, NULL, 'H'},
+        {"conninfo", required_argument, NULL, 'U'},
+        {"cache-size", required_argument, NULL, 'z'},
+        {"topn-size", required_argument, NULL, 'Z'},
+        {"timezone", required_argument, NULL, 'y'},
+        {"udp-port", required_argument, NULL, 'u'},
+        {"log", required_argument, NULL, 'l'},
+        {"log-file", required_argument, NULL, 'f'},
+        {"log-sample", required_argument, NULL, 's'},
+        {"trace-sample", required_argument, NULL, 't'},
+        {"trace-file", required_argument, NULL, 'T'},
+        {"wal-dir", required_argument, NULL, 'w'},
+        {"durability", required_argument, NULL, 'd'},
+        {"wal-flush-ms", required_argument, NULL, 'F'},
+        {"snapshot-interval", required_argument, NULL, 'S'},
+        {"snapshot-file", required_argument, NULL, 'P'},
+        {"preload", required_argument, NULL, 'p'},
+        {"preload-conns", required_argument, NULL, 'c'},
+        {"preload-query", required_argument, NULL, 'q'},
+        {"repl-port", required_argument, NULL, 'r'},
+        {"replica-of", required_argument, NULL, 'R'},
+        {"coherence", no_argument, NULL, 'C'},
+        {"coherence-flush-ms", required_argument, NULL, 'N'},
+        {"limiter", required_argument, NULL, 'A'},
+        {"limiter-max", required_argument, NULL, 'X'},
+        {"queue-deadline-ms", required_argument, NULL, 'D'},
+        {"pool-min", required_argument, NULL, 'm'},
+        {"pool-max", required_argument, NULL, 'M'},
+        {"pool-grow-wait-ms", required_argument, NULL, 'g'},
+        {"pool-idle-timeout", required_argument, NULL, 'i'},
+        {"admin-token", required_argument, NULL, 'a'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    // Settings from --config go first so the command line overrides them
+    if (config_apply_file(&argc, &argv) != 0)
+        return 1;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_opts, NULL)) != -1)
+    {
+        switch (opt)
         {
-            // LRU Cache + DB: try LRU first, fallback to DB
-            score = cache_get_score(id);
-            if (score >= 0)
+        case 'k':
+            break; // already read by config_apply_file()
+        case 'o':
+            port = atoi(optarg);
+            break;
+        case 'e':
+            mode = atoi(optarg);
+            break;
+        case 'H':
+            http_threads = atoi(optarg);
+            break;
+        case 'U':
+            conninfo = optarg;
+            break;
+        case 'z':
+            cache_size = atoi(optarg);
+            break;
+        case 'Z':
+            topn_size = atoi(optarg);
+            break;
+        case 'u':
+            udp_port = atoi(optarg);
+            break;
+        case 'l':
+            if (strcmp(optarg, "text") == 0)
+                log_fmt = REQLOG_TEXT;
+            else if (strcmp(optarg, "binary") == 0)
+                log_fmt = REQLOG_BINARY;
+            else if (strcmp(optarg, "off") == 0)
+                log_fmt = REQLOG_OFF;
+            else
             {
-                cache_hit = 1;
+                fprintf(stderr, "Unknown log format: %s\n", optarg);
+                return 1;
             }
-            else
+            break;
+        case 'f':
+            log_file = optarg;
+            break;
+        case 's':
+            log_sample = atof(optarg);
+            if (log_sample <= 0.0 || log_sample > 1.0)
             {
-                score = db_get_score(id);
-                cache_hit = 0;
+                fprintf(stderr, "--log-sample must be in (0, 1]\n");
+                return 1;
             }
-        }
-        else if (mode == 3)
+            break;
+        case 't':
+            trace_sample = atof(optarg);
+            if (trace_sample < 0.0 || trace_sample > 1.0)
+            {
+                fprintf(stderr, "--trace-sample must be in [0, 1]\n");
+                return 1;
+            }
+            break;
+        case 'T':
+            trace_file = optarg;
+            break;
+        case 'w':
+            wal_dir = optarg;
+            break;
+        case 'd':
         {
-            // All: try LRU first, fallback to DB
-            score = cache_get_score(id);
-            if (score >= 0)
+            int ok;
+            durability = wal_parse_durability(optarg, &ok);
+            if (!ok)
             {
-                cache_hit = 1;
+                fprintf(stderr, "Unknown durability level: %s\n", optarg);
+                return 1;
             }
-            else
+            break;
+        }
+        case 'F':
+            wal_flush_ms = atoi(optarg);
+            break;
+        case 'S':
+            snapshot_interval = atoi(optarg) > 0 ? atoi(optarg) : 60;
+            break;
+        case 'P':
+            snapshot_file = optarg;
+            break;
+        case 'p':
+            preload_count = atoi(optarg);
+            break;
+        case 'c':
+            preload_conns = atoi(optarg);
+            break;
+        case 'q':
+            preload_query = optarg;
+            break;
+        case 'r':
+            repl_port = atoi(optarg);
+            break;
+        case 'R':
+            replica_of = optarg;
+            break;
+        case 'C':
+            coherence = 1;
+            break;
+        case 'N':
+            coherence_flush_ms = atoi(optarg);
+            break;
+        case 'A':
+            if (admission_parse(optarg, &limiter) != 0)
+            {
+                fprintf(stderr, "Unknown limiter: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'X':
+            limiter_max = atoi(optarg);
+            break;
+        case 'D':
+            queue_deadline_ms = atoi(optarg);
+            break;
+        case 'm':
+            pool_min = atoi(optarg);
+            break;
+        case 'M':
+            pool_max = atoi(optarg);
+            break;
+        case 'g':
+            pool_grow_wait_ms = atoi(optarg);
+            break;
+        case 'i':
+            pool_idle_timeout = atoi(optarg);
+            break;
+        case 'a':
+            if (*optarg == '\0')
             {
-                score = db_get_score(id);
-                cache_hit = 0;
+                fprintf(stderr, "--admin-token must not be empty\n");
+                return 1;
             }
+            admin_token = optarg;
+            break;
+        case 'y':
+            timezone_name = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
         }
+    }
 
-        long long end = now_us();
-        printf("[GET] mode=%d cache_hit=%d latency=%lld us (id=%d score=%d)\n",
-               mode, cache_hit, (end - start), id, score);
-        fflush(stdout);
-
-        char json[128];
-        snprintf(json, sizeof(json), "{\"id\":%d,\"score\":%d,\"cache_hit\":%d}", id, score, cache_hit);
+    if (optind < argc)
+        port = atoi(argv[optind]);
+    if (optind + 1 < argc)
+        mode = atoi(argv[optind + 1]);
+    if (mode < 0 || mode > 3)
+    {
+        fprintf(stderr, "Unknown mode: %d\n", mode);
+        return 1;
+    }
+    if (http_threads < 1 || cache_size < 1 || topn_size < 1 || topn_size > TOPN_MAX_SIZE)
+    {
+        fprintf(stderr, "--http-threads and --cache-size must be positive, --topn-size between 1 and %d\n",
+                TOPN_MAX_SIZE);
+        return 1;
+    }
+    cache_capacity = cache_size;
+    topn_set_depth(topn_size);
+    db_set_conninfo(conninfo);
 
-        struct MHD_Response *res = MHD_create_response_from_buffer(strlen(json), strdup(json), MHD_RESPMEM_MUST_FREE);
-        MHD_add_response_header(res, "Content-Type", "application/json");
-        int ret = MHD_queue_response(conn_http, MHD_HTTP_OK, res);
-        MHD_destroy_response(res);
-        return ret;
+    // A replica only serves reads from caches fed by the primary's stream
+    if (replica_of)
+    {
+        if (mode != 1)
+            fprintf(stderr, "Warning: --replica-of runs in mode 1, ignoring mode %d\n", mode);
+        if (wal_dir || snapshot_file || preload_count > 0 || udp_port > 0 || repl_port > 0)
+            fprintf(stderr, "Warning: --replica-of ignores --wal-dir, --snapshot-file, --preload, --udp-port and --repl-port\n");
+        mode = 1;
+        read_only = 1;
+        wal_dir = NULL;
+        snapshot_file = NULL;
+        preload_count = 0;
+        udp_port = 0;
+        repl_port = 0;
     }
 
-    const char *nf = "Not Found";
-    struct MHD_Response *res = MHD_create_response_from_buffer(strlen(nf), (void *)nf, MHD_RESPMEM_PERSISTENT);
-    int ret = MHD_queue_response(conn_http, MHD_HTTP_NOT_FOUND, res);
-    MHD_destroy_response(res);
-    return ret;
-}
+    // Blocked before any thread starts so every thread inherits the mask and
+    // only main's sigwait() sees them; a signal during startup waits for it
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
 
-// ---------- MAIN ----------
-static struct MHD_Daemon *http_daemon;
+    long long startup_begin = now_us();
+    printf("Starting server on port %d, mode=%d\n", port, mode);
 
-void cleanup(int sig)
-{
-    for (int i = 0; i < POOL_SIZE; i++)
+    // Day/week windows use localtime_r(); PGTZ makes every DB session (and
+    // so date_trunc() and last_updated) use the same zone
+    if (timezone_name)
     {
-        if (pool[i])
+        setenv("PGTZ", timezone_name, 1);
+        use_time_zone(timezone_name);
+    }
+
+    // Initialize DB pool for modes 0, 2, 3
+    if (mode == 0 || mode == 2 || mode == 3)
+    {
+        if (pool_max < 1 || pool_max > POOL_SLOTS || pool_min < 0 || pool_min > pool_max)
         {
-            PQfinish(pool[i]);
-            pool[i] = NULL;
+            fprintf(stderr, "Pool bounds must satisfy 0 <= --pool-min <= --pool-max <= %d\n", POOL_SLOTS);
+            return 1;
         }
+        pool_configure(pool_min, pool_max, pool_grow_wait_ms, pool_idle_timeout);
+        pool_init();
+
+        // Otherwise follow the DB, before any window is loaded from it
+        char tz[128];
+        if (!timezone_name && db_time_zone(tz, sizeof(tz)) == 0)
+            use_time_zone(tz);
     }
 
-    if (http_daemon)
-        MHD_stop_daemon(http_daemon);
-    printf("\nServer stopped.\n");
-    exit(0);
-}
+    // Keep caches coherent with other servers writing the same DB
+    if (coherence && mode != 1)
+    {
+        if (coherence_start(coherence_flush_ms, mode == 3) != 0)
+        {
+            fprintf(stderr, "Failed to start cache coherence (LISTEN " COHERENCE_CHANNEL ")\n");
+            return 1;
+        }
+        printf("Cache coherence: NOTIFY/LISTEN on %s, flush every %d ms\n", COHERENCE_CHANNEL,
+               coherence_flush_ms > 0 ? coherence_flush_ms : 10);
+    }
+    else if (coherence)
+    {
+        fprintf(stderr, "Warning: --coherence only applies to modes 0, 2 and 3, ignoring\n");
+    }
 
-int main(int argc, char **argv)
-{
-    int port = (argc > 1) ? atoi(argv[1]) : DEFAULT_PORT;
-    mode = (argc > 2) ? atoi(argv[2]) : 3;
+    // Shed DB-bound requests instead of queueing them on the pool without bound
+    if (limiter != ADMISSION_OFF && mode != 1)
+    {
+        // Admitted requests wait for a connection without a deadline, so
+        // there must never be more of them than connections
+        if (limiter_max <= 0)
+            limiter_max = pool_max;
+        else if (limiter_max > pool_max)
+        {
+            fprintf(stderr, "Warning: --limiter-max %d is above --pool-max %d, using %d\n", limiter_max, pool_max,
+                    pool_max);
+            limiter_max = pool_max;
+        }
+        int initial = pool_max / 2 < limiter_max ? pool_max / 2 : limiter_max;
+        admission_init(limiter, initial, limiter_max, queue_deadline_ms);
+        admission_set_pool_size(pool_max);
+        printf("Admission control: %s, limit %d (max %d), queue deadline %d ms\n", admission_name(limiter), initial,
+               limiter_max, queue_deadline_ms);
+    }
+    else if (limiter != ADMISSION_OFF)
+    {
+        fprintf(stderr, "Warning: --limiter only applies to modes 0, 2 and 3, ignoring\n");
+    }
 
-    printf("Starting server on port %d, mode=%d\n", port, mode);
+    // Warm restart of the caches for modes 2 and 3
+    int topn_warm = 0;
+    if (snapshot_file && (mode == 2 || mode == 3))
+    {
+        topn_warm = warm_start(snapshot_file);
+        if (pthread_create(&snapshot_thread, NULL, snapshot_loop, NULL) != 0)
+            fprintf(stderr, "Warning: snapshot thread not started\n");
+    }
+    else if (snapshot_file)
+    {
+        fprintf(stderr, "Warning: --snapshot-file only applies to modes 2 and 3, ignoring\n");
+    }
 
-    // Initialize DB pool for modes 0, 2, 3
-    if (mode == 0 || mode == 2 || mode == 3)
+    // Bulk preload when the snapshot did not warm the LRU
+    if (preload_count > 0 && (mode == 2 || mode == 3))
     {
-        pool_init();
-        printf("DB pool initialized\n");
+        pthread_mutex_lock(&cache_lock);
+        int cached = cache_count;
+        pthread_mutex_unlock(&cache_lock);
+        if (cached == 0)
+            preload_caches(preload_query, preload_count, preload_conns);
     }
 
     // Initialize Top-N cache for modes 1 and 3
     if (mode == 1 || mode == 3)
     {
-        if (mode == 3)
+        if (mode == 3 && topn_warm)
+        {
+            // The snapshot only holds the all-time window
+            topn_init_window_from_db(TOPN_DAY);
+            topn_init_window_from_db(TOPN_WEEK);
+            printf("Top-N cache restored from snapshot\n");
+        }
+        else if (mode == 3)
         {
             // Mode 3: Initialize from DB
             topn_init_from_db();
         }
+        else if (wal_dir)
+        {
+            // Mode 1 with WAL: restore caches from snapshot + WAL tail
+            if (durability_init(wal_dir, durability, wal_flush_ms) != 0)
+            {
+                fprintf(stderr, "Failed to initialize WAL in %s\n", wal_dir);
+                return 1;
+            }
+        }
         else
         {
             // Mode 1: Empty cache (will be populated as updates come)
             printf("Top-N cache initialized (empty, cache-only mode)\n");
         }
     }
+    if (wal_dir && mode != 1)
+        fprintf(stderr, "Warning: --wal-dir only applies to mode 1, ignoring\n");
 
     printf("\n=== Mode Configuration ===\n");
     if (mode == 0)
@@ -760,14 +1340,41 @@ int main(int argc, char **argv)
         printf("Mode 3: LRU Cache + Top-N Cache + DB (All)\n");
     printf("=========================\n\n");
 
-    signal(SIGINT, cleanup);
+    metrics_init(mode);
+    if (trace_init(trace_sample, trace_file) != 0)
+        return 1;
+    if (reqlog_init(log_fmt, log_file, log_sample) != 0)
+        return 1;
+
+    handlers_set_metrics_hook(server_render_metrics);
+
+    // Before serving, so no applied update goes unpublished
+    if (repl_port > 0)
+    {
+        if (repl_primary_start(repl_port) != 0)
+        {
+            fprintf(stderr, "Failed to start replication on port %d\n", repl_port);
+            return 1;
+        }
+        printf("Replication: streaming updates on port %d\n", repl_port);
+    }
+    if (replica_of)
+    {
+        if (repl_replica_start(replica_of) != 0)
+        {
+            fprintf(stderr, "Invalid --replica-of address: %s (expected host:port)\n", replica_of);
+            return 1;
+        }
+        printf("Replication: read-only replica of %s\n", replica_of);
+    }
 
     http_daemon = MHD_start_daemon(
         MHD_USE_SELECT_INTERNALLY,
         port,
         NULL, NULL,
         &handle_request, NULL,
-        MHD_OPTION_THREAD_POOL_SIZE, 10,
+        MHD_OPTION_THREAD_POOL_SIZE, http_threads,
+        MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL,
         MHD_OPTION_END);
     if (!http_daemon)
     {
@@ -775,7 +1382,29 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    while (1)
-        pause();
+    if (udp_port > 0)
+    {
+        udp_fd = udp_init(udp_port);
+        if (udp_fd < 0 || pthread_create(&udp_thread, NULL, udp_loop, NULL) != 0)
+        {
+            fprintf(stderr, "Failed to start UDP ingest on port %d\n", udp_port);
+            return 1;
+        }
+        printf("UDP ingest listening on port %d\n", udp_port);
+    }
+
+    printf("Startup took %lld ms\n", (now_us() - startup_begin) / 1000);
+    if (mode == 2 || mode == 3)
+    {
+        static long long serving_since;
+        pthread_t warmup_thread;
+        serving_since = now_us();
+        if (pthread_create(&warmup_thread, NULL, warmup_report_loop, &serving_since) == 0)
+            pthread_detach(warmup_thread);
+    }
+
+    int sig;
+    sigwait(&stop_signals, &sig);
+    shutdown_server();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,81 @@
+#!/bin/sh
+# Router throughput as the number of shards grows.
+#
+# For each shard count, starts that many local servers and a router in
+# front of them, drives the router with loadgen, and prints one CSV row:
+#   shards,throughput_rps
+# A "direct" row (loadgen against a single server, no router) is printed
+# first as the baseline.
+#
+# Usage: ./shard_scaling.sh [shard counts...]      (default: 1 2 4)
+#
+# Environment:
+#   MODE=1          server mode; 1 (caches only) needs no Postgres, the DB
+#                   modes make every shard share the local database
+#   THREADS=8       loadgen threads
+#   DURATION=10     seconds measured per run (after a 2 s warm-up)
+#   KEYS=100000     player id space
+#   MIX=update=70,get=25,leaderboard=5
+#   BASE_PORT=9100  router port; shards use BASE_PORT+1...
+
+MODE=${MODE:-1}
+THREADS=${THREADS:-8}
+DURATION=${DURATION:-10}
+KEYS=${KEYS:-100000}
+MIX=${MIX:-update=70,get=25,leaderboard=5}
+BASE_PORT=${BASE_PORT:-9100}
+COUNTS=${*:-1 2 4}
+
+PIDS=""
+
+stop_all() {
+    for p in $PIDS; do
+        kill -INT "$p" 2>/dev/null
+    done
+    for p in $PIDS; do
+        wait "$p" 2>/dev/null
+    done
+    PIDS=""
+}
+trap 'stop_all; exit 1' INT TERM
+
+wait_ready() {
+    for _ in $(seq 50); do
+        curl -s -o /dev/null "$1/leaderboard?top=1" && return 0
+        sleep 0.1
+    done
+    echo "No answer from $1" >&2
+    return 1
+}
+
+start_shards() {
+    URLS=""
+    for i in $(seq "$1"); do
+        port=$((BASE_PORT + i))
+        ./server --log off "$port" "$MODE" >/dev/null 2>&1 &
+        PIDS="$PIDS $!"
+        wait_ready "http://127.0.0.1:$port" || return 1
+        URLS="$URLS http://127.0.0.1:$port"
+    done
+}
+
+run_load() {
+    ./loadgen --warmup 2 --duration "$DURATION" --keys "$KEYS" --mix "$MIX" "$1" "$THREADS" 0 2 |
+        sed -n 's/^Throughput: \([0-9.]*\) req\/sec/\1/p'
+}
+
+echo "shards,throughput_rps"
+
+start_shards 1 || { stop_all; exit 1; }
+echo "direct,$(run_load "http://127.0.0.1:$((BASE_PORT + 1))")"
+stop_all
+
+for n in $COUNTS; do
+    start_shards "$n" || { stop_all; exit 1; }
+    # shellcheck disable=SC2086
+    ./router --max-id "$KEYS" "$BASE_PORT" $URLS >/dev/null 2>&1 &
+    PIDS="$PIDS $!"
+    wait_ready "http://127.0.0.1:$BASE_PORT" || { stop_all; exit 1; }
+    echo "$n,$(run_load "http://127.0.0.1:$BASE_PORT")"
+    stop_all
+done
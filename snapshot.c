@@ -0,0 +1,159 @@
+#include "snapshot.h"
+#include "crc32.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAP_HEADER_V1 offsetof(SnapHeader, window_count)
+#define SNAP_WINDOW_FIELDS (sizeof(SnapHeader) - SNAP_HEADER_V1)
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void fsync_dir(const char *path)
+{
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    int dfd = open(dirname(tmp), O_RDONLY | O_DIRECTORY);
+    if (dfd >= 0)
+    {
+        fsync(dfd);
+        close(dfd);
+    }
+}
+
+int snapshot_write(const char *path, const SnapHeader *hdr, const SnapEntry *lru, const SnapEntry *topn)
+{
+    SnapHeader h = *hdr;
+    memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    h.version = SNAPSHOT_VERSION;
+    h.reserved = h.reserved2 = 0;
+    h.topn_count = 0;
+    for (int w = 0; w < SNAPSHOT_WINDOWS; w++)
+        h.topn_count += h.window_count[w];
+    h.crc = crc32c(0, (const char *)&h + SNAP_HEADER_V1, SNAP_WINDOW_FIELDS);
+    h.crc = crc32c(h.crc, lru, sizeof(SnapEntry) * h.lru_count);
+    h.crc = crc32c(h.crc, topn, sizeof(SnapEntry) * h.topn_count);
+
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "snapshot: cannot create %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+
+    if (write_all(fd, &h, sizeof(h)) != 0 ||
+        write_all(fd, lru, sizeof(SnapEntry) * h.lru_count) != 0 ||
+        write_all(fd, topn, sizeof(SnapEntry) * h.topn_count) != 0 ||
+        fsync(fd) != 0)
+    {
+        fprintf(stderr, "snapshot: write to %s failed: %s\n", tmp, strerror(errno));
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+
+    if (rename(tmp, path) != 0)
+    {
+        fprintf(stderr, "snapshot: rename to %s failed: %s\n", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    fsync_dir(path);
+    return 0;
+}
+
+int snapshot_map(const char *path, Snapshot *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < SNAP_HEADER_V1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    const SnapHeader *h = map;
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || h->version < 1 ||
+        h->version > SNAPSHOT_VERSION)
+    {
+        fprintf(stderr, "snapshot: %s has unknown format/version, ignoring\n", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    // Version 1 ends before window_count and only holds the all-time window
+    size_t hdr_len = h->version == 1 ? SNAP_HEADER_V1 : sizeof(SnapHeader);
+    if ((size_t)st.st_size < hdr_len)
+    {
+        fprintf(stderr, "snapshot: %s is truncated, ignoring\n", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    size_t body = (size_t)st.st_size - hdr_len;
+    size_t expect = sizeof(SnapEntry) * ((size_t)h->lru_count + h->topn_count);
+    uint32_t crc = h->version == 1 ? 0 : crc32c(0, (const char *)h + SNAP_HEADER_V1, SNAP_WINDOW_FIELDS);
+    uint32_t windows = 0;
+    for (int w = 0; h->version > 1 && w < SNAPSHOT_WINDOWS; w++)
+        windows += h->window_count[w];
+
+    if (body != expect || (h->version > 1 && windows != h->topn_count) ||
+        crc32c(crc, (const char *)map + hdr_len, body) != h->crc)
+    {
+        fprintf(stderr, "snapshot: %s failed size/checksum validation, ignoring\n", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    memcpy(&out->hdr, h, hdr_len);
+    if (h->version == 1)
+        out->hdr.window_count[0] = h->topn_count;
+    out->lru = (const SnapEntry *)((const char *)map + hdr_len);
+    out->topn = out->lru + h->lru_count;
+    out->map = map;
+    out->map_len = st.st_size;
+    return 0;
+}
+
+void snapshot_unmap(Snapshot *s)
+{
+    if (s->map)
+        munmap(s->map, s->map_len);
+    s->map = NULL;
+    s->lru = s->topn = NULL;
+}
@@ -0,0 +1,61 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compact cache snapshot file.
+//
+// Layout: SnapHeader, then lru_count entries in recency order (most
+// recently used first), then the Top-N windows (all-time, day, week), each
+// window_count[w] entries in rank order. The header carries a CRC-32C of
+// its window fields and everything after it. Version 1 files (a shorter
+// header and only the all-time window) are still read. Files are written to
+// a temporary name, fsynced and renamed into place, so a reader sees
+// either the old or the new snapshot, never a partial one.
+
+#define SNAPSHOT_MAGIC "LBSNAP1"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_WINDOWS 3 // Top-N windows, in TopNWindow order
+
+typedef struct
+{
+    int32_t id;
+    int32_t score;
+} SnapEntry;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t mode;      // server mode that wrote the file
+    uint64_t lsn;       // last WAL record reflected in the snapshot (mode 1)
+    uint64_t watermark; // DB high-water mark when the snapshot was taken (modes 2/3)
+    uint64_t created_us;
+    uint32_t lru_count;
+    uint32_t topn_count; // sum of window_count
+    uint32_t crc;
+    uint32_t reserved;
+    // Version 2 and later
+    uint32_t window_count[SNAPSHOT_WINDOWS];
+    uint32_t reserved2;
+    int64_t window_start[SNAPSHOT_WINDOWS]; // day/week: start of the window the entries belong to
+} SnapHeader;
+
+typedef struct
+{
+    SnapHeader hdr;
+    const SnapEntry *lru;
+    const SnapEntry *topn; // window w starts after the window_count of the ones before it
+    void *map; // mapping backing lru/topn after snapshot_map()
+    size_t map_len;
+} Snapshot;
+
+int snapshot_write(const char *path, const SnapHeader *hdr, const SnapEntry *lru, const SnapEntry *topn);
+
+// Map and verify a snapshot; entries point into the mapping until
+// snapshot_unmap(). Returns 0 on success, -1 if missing or invalid.
+int snapshot_map(const char *path, Snapshot *out);
+void snapshot_unmap(Snapshot *s);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,252 @@
+#include "topn.h"
+
+#include <string.h>
+#include "metrics.h"
+#include "trace.h"
+
+pthread_mutex_t topn_lock = PTHREAD_MUTEX_INITIALIZER;
+TopNCache topn_windows[TOPN_WINDOW_COUNT];
+TopNCache *const topn_cache = &topn_windows[TOPN_ALL];
+int topn_depth = TOP_N_SIZE;
+
+// Start (end = 0) or end of the day/week window containing `now`
+static time_t topn_window_bound(TopNWindow w, time_t now, int end)
+{
+    struct tm tm;
+    localtime_r(&now, &tm);
+    tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    if (w == TOPN_WEEK)
+        tm.tm_mday -= (tm.tm_wday + 6) % 7; // this Monday
+    if (end)
+        tm.tm_mday += w == TOPN_WEEK ? 7 : 1;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+static void topn_window_set(TopNCache *t, TopNWindow w, time_t now)
+{
+    t->starts_at = topn_window_bound(w, now, 0);
+    t->ends_at = topn_window_bound(w, now, 1);
+}
+
+// Start a fresh window once the current one has ended. Every update in the
+// new window goes through topn_update_locked, so an empty window is exact
+// and nothing needs to be rebuilt. Must hold topn_lock.
+static void topn_rotate_locked(TopNWindow w, time_t now)
+{
+    TopNCache *t = &topn_windows[w];
+    if (w == TOPN_ALL || now < t->ends_at)
+        return;
+    t->count = 0;
+    topn_window_set(t, w, now);
+}
+
+// Check if score qualifies for top-N (must hold topn_lock before calling)
+static int is_topn_score(const TopNCache *t, int score)
+{
+    // If cache not full, any score qualifies
+    if (t->count < topn_depth)
+        return 1;
+
+    // Check if score is higher than lowest in cache
+    return score > t->players[t->count - 1].score;
+}
+
+// Update one window's sorted array; returns 1 if the player is in it afterwards
+static int topn_insert(TopNCache *t, int id, int score)
+{
+    // Find if player already exists in top-N
+    int existing_idx = -1;
+    for (int i = 0; i < t->count; i++)
+    {
+        if (t->players[i].id == id)
+        {
+            existing_idx = i;
+            break;
+        }
+    }
+
+    // If exists, remove old entry
+    if (existing_idx >= 0)
+    {
+        for (int i = existing_idx; i < t->count - 1; i++)
+        {
+            t->players[i] = t->players[i + 1];
+        }
+        t->count--;
+    }
+
+    // Check if new score qualifies for top-N
+    if (!is_topn_score(t, score) && existing_idx < 0)
+        return 0;
+
+    // Find insertion position
+    int pos = 0;
+    for (pos = 0; pos < t->count; pos++)
+    {
+        if (score > t->players[pos].score)
+            break;
+    }
+
+    // Shift elements down
+    if (t->count < topn_depth)
+    {
+        for (int i = t->count; i > pos; i--)
+        {
+            t->players[i] = t->players[i - 1];
+        }
+        t->count++;
+    }
+    else
+    {
+        // Cache full, shift and discard last
+        for (int i = topn_depth - 1; i > pos; i--)
+        {
+            t->players[i] = t->players[i - 1];
+        }
+    }
+
+    // Insert new entry
+    t->players[pos].id = id;
+    t->players[pos].score = score;
+    return 1;
+}
+
+void topn_update_at_locked(int id, int score, time_t when)
+{
+    time_t now = time(NULL);
+    for (int w = 0; w < TOPN_WINDOW_COUNT; w++)
+    {
+        TopNCache *t = &topn_windows[w];
+        topn_rotate_locked(w, now);
+        if (w != TOPN_ALL && (when < t->starts_at || when >= t->ends_at))
+            continue;
+        int in = topn_insert(t, id, score);
+        if (w == TOPN_ALL)
+            metrics_count(in ? METRIC_TOPN_INSERTS : METRIC_TOPN_REJECTS, 1);
+    }
+}
+
+void topn_update_locked(int id, int score)
+{
+    topn_update_at_locked(id, score, time(NULL));
+}
+
+void topn_update(int id, int score)
+{
+    uint64_t t0 = trace_start();
+    pthread_mutex_lock(&topn_lock);
+    trace_end(TRACE_TOPN_LOCK_WAIT, t0);
+
+    uint64_t t1 = trace_start();
+    topn_update_locked(id, score);
+    trace_end(TRACE_TOPN_OP, t1);
+    pthread_mutex_unlock(&topn_lock);
+}
+
+void topn_update_batch(const Player *recs, int n)
+{
+    pthread_mutex_lock(&topn_lock);
+    for (int i = 0; i < n; i++)
+        topn_update_locked(recs[i].id, recs[i].score);
+    pthread_mutex_unlock(&topn_lock);
+}
+
+int topn_get_top(Player *out, int limit, TopNWindow w)
+{
+    uint64_t t0 = trace_start();
+    pthread_mutex_lock(&topn_lock);
+    trace_end(TRACE_TOPN_LOCK_WAIT, t0);
+
+    uint64_t t1 = trace_start();
+    topn_rotate_locked(w, time(NULL));
+    const TopNCache *t = &topn_windows[w];
+    int ret = (t->count < limit) ? t->count : limit;
+    if (ret > 0)
+        memcpy(out, t->players, ret * sizeof(Player));
+    trace_end(TRACE_TOPN_OP, t1);
+
+    pthread_mutex_unlock(&topn_lock);
+    return ret;
+}
+
+void topn_load_window(TopNWindow w, const Player *players, int count)
+{
+    pthread_mutex_lock(&topn_lock);
+    if (count > topn_depth)
+        count = topn_depth;
+    TopNCache *t = &topn_windows[w];
+    t->count = count;
+    memcpy(t->players, players, count * sizeof(Player));
+    if (w != TOPN_ALL)
+        topn_window_set(t, w, time(NULL));
+    pthread_mutex_unlock(&topn_lock);
+}
+
+void topn_restore_window_locked(TopNWindow w, const Player *players, int count, time_t starts_at)
+{
+    TopNCache *t = &topn_windows[w];
+    if (w != TOPN_ALL)
+    {
+        topn_window_set(t, w, time(NULL));
+        if (starts_at != t->starts_at)
+            count = 0;
+    }
+    if (count > topn_depth)
+        count = topn_depth;
+    t->count = count;
+    memcpy(t->players, players, count * sizeof(Player));
+}
+
+void topn_clear(void)
+{
+    pthread_mutex_lock(&topn_lock);
+    for (int w = 0; w < TOPN_WINDOW_COUNT; w++)
+    {
+        topn_windows[w].count = 0;
+        topn_windows[w].starts_at = topn_windows[w].ends_at = 0;
+    }
+    pthread_mutex_unlock(&topn_lock);
+}
+
+int topn_get_depth(void)
+{
+    pthread_mutex_lock(&topn_lock);
+    int depth = topn_depth;
+    pthread_mutex_unlock(&topn_lock);
+    return depth;
+}
+
+void topn_set_depth(int depth)
+{
+    if (depth < 1)
+        depth = 1;
+    if (depth > TOPN_MAX_SIZE)
+        depth = TOPN_MAX_SIZE;
+    pthread_mutex_lock(&topn_lock);
+    topn_depth = depth;
+    for (int w = 0; w < TOPN_WINDOW_COUNT; w++)
+    {
+        if (topn_windows[w].count > depth)
+            topn_windows[w].count = depth;
+    }
+    pthread_mutex_unlock(&topn_lock);
+}
+
+void topn_merge_window(TopNWindow w, const Player *players, int count)
+{
+    static Player cached[TOPN_MAX_SIZE]; // only used under topn_lock
+
+    pthread_mutex_lock(&topn_lock);
+    if (count > topn_depth)
+        count = topn_depth;
+    topn_rotate_locked(w, time(NULL));
+    TopNCache *t = &topn_windows[w];
+    int ncached = t->count;
+    memcpy(cached, t->players, ncached * sizeof(Player));
+    t->count = count;
+    memcpy(t->players, players, count * sizeof(Player));
+    for (int i = 0; i < ncached; i++)
+        topn_insert(t, cached[i].id, cached[i].score);
+    pthread_mutex_unlock(&topn_lock);
+}
@@ -0,0 +1,79 @@
+#ifndef TOPN_H
+#define TOPN_H
+
+#include <pthread.h>
+#include <time.h>
+#include "cache.h"
+
+// Top-N leaderboard cache.
+//
+// One sorted array (best score first) per window, all protected by
+// topn_lock. Day and week windows follow the process time zone (TZ); the
+// server sets it to the DB session's TimeZone, which date_trunc() uses.
+
+#define TOP_N_SIZE 100    // default depth: keep the top 100 scores
+#define TOPN_MAX_SIZE 1000 // array capacity; the depth can be resized up to this
+
+typedef enum
+{
+    TOPN_ALL,
+    TOPN_DAY,
+    TOPN_WEEK, // weeks start on Monday, like date_trunc('week', ...)
+    TOPN_WINDOW_COUNT
+} TopNWindow;
+
+// Top-N Cache Structure (sorted array)
+typedef struct
+{
+    Player players[TOPN_MAX_SIZE];
+    int count;      // actual number of entries (0 to topn_depth)
+    time_t starts_at; // day/week: start of the current window
+    time_t ends_at;   // day/week: end of the current window, 0 = not started
+} TopNCache;
+
+extern pthread_mutex_t topn_lock;
+extern TopNCache topn_windows[TOPN_WINDOW_COUNT];
+extern TopNCache *const topn_cache; // the all-time window
+extern int topn_depth; // entries kept per window, at most TOPN_MAX_SIZE
+
+// Update every window in one pass (must hold topn_lock)
+void topn_update_locked(int id, int score);
+
+void topn_update(int id, int score);
+
+// Same for an update applied at `when` (e.g. replayed from the WAL): the
+// day and week windows only take it if it falls in their current window.
+// Must hold topn_lock.
+void topn_update_at_locked(int id, int score, time_t when);
+
+// Apply a batch of updates under a single topn_lock acquisition
+void topn_update_batch(const Player *recs, int n);
+
+// Get top N of a window from cache
+int topn_get_top(Player *out, int limit, TopNWindow w);
+
+// Replace a window's contents with count players in rank order
+void topn_load_window(TopNWindow w, const Player *players, int count);
+
+// Same for entries saved while a day/week window began at starts_at: if
+// that window has ended since, the current one is left empty instead.
+// Must hold topn_lock.
+void topn_restore_window_locked(TopNWindow w, const Player *players, int count, time_t starts_at);
+
+// Empty every window
+void topn_clear(void);
+
+// Current depth, read under topn_lock
+int topn_get_depth(void);
+
+// Change the depth while running. Shrinking drops the lowest entries.
+// Growing only makes room: ranks below the old depth stay empty until
+// filled by topn_merge_window() or by later updates.
+void topn_set_depth(int depth);
+
+// Refill a window after growing: load count players in rank order (e.g.
+// from the DB), then re-apply the entries already cached, which may be
+// newer than the rows read
+void topn_merge_window(TopNWindow w, const Player *players, int count);
+
+#endif // TOPN_H
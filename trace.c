@@ -0,0 +1,309 @@
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_HAVE_TSC 1
+#endif
+
+#define TRACE_MAX_THREADS 128
+
+typedef struct
+{
+    uint64_t ts_ns;
+    uint64_t dur_ns;
+    const char *name; // static request name for TRACE_REQUEST, NULL otherwise
+    uint16_t stage;
+    uint16_t tid;
+} TraceEvent;
+
+typedef struct
+{
+    HdrHistogram hist[TRACE_STAGE_COUNT];
+    int tid;
+} TraceThread;
+
+static const char *stage_names[TRACE_STAGE_COUNT] = {
+    [TRACE_REQUEST] = "request",
+    [TRACE_CACHE_LOCK_WAIT] = "cache_lock_wait",
+    [TRACE_CACHE_OP] = "cache_op",
+    [TRACE_TOPN_LOCK_WAIT] = "topn_lock_wait",
+    [TRACE_TOPN_OP] = "topn_op",
+    [TRACE_POOL_WAIT] = "pool_wait",
+    [TRACE_DB_EXEC] = "db_exec",
+    [TRACE_JSON] = "json_build",
+};
+
+static double trace_sample = 0.0;
+static const char *chrome_out = NULL;
+
+static int use_tsc = 0;
+static double ns_per_tick = 1.0;
+static uint64_t tsc_base = 0;
+static struct timespec mono_base;
+
+static TraceThread *threads[TRACE_MAX_THREADS];
+static atomic_int thread_count = 0;
+static pthread_mutex_t thread_reg_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Exported events; only sampled requests get here, so a mutex is cheap enough
+static TraceEvent *export_events = NULL;
+static size_t export_count = 0;
+static atomic_ullong export_dropped = 0;
+static pthread_mutex_t export_lock = PTHREAD_MUTEX_INITIALIZER;
+
+__thread int trace_active = 0;
+static __thread TraceThread *my_thread = NULL;
+static __thread int my_thread_failed = 0;
+static __thread double sample_acc = 0.0;
+static __thread const char *req_name = NULL;
+static __thread uint64_t req_start = 0;
+static __thread TraceEvent req_events[TRACE_MAX_EVENTS_PER_REQUEST];
+static __thread int req_event_count = 0;
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)(ts.tv_sec - mono_base.tv_sec) * 1000000000ull + ts.tv_nsec - mono_base.tv_nsec;
+}
+
+uint64_t trace_clock_ns(void)
+{
+#ifdef TRACE_HAVE_TSC
+    if (use_tsc)
+        return (uint64_t)((double)(__rdtsc() - tsc_base) * ns_per_tick) + 1;
+#endif
+    return mono_ns() + 1; // never 0, which means "not tracing"
+}
+
+// Only trust the TSC when the CPU says it ticks at a constant rate
+static int tsc_usable(void)
+{
+#ifdef TRACE_HAVE_TSC
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (!f)
+        return 0;
+    char line[4096];
+    int ok = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (strncmp(line, "flags", 5) == 0)
+        {
+            ok = strstr(line, " constant_tsc") && strstr(line, " nonstop_tsc");
+            break;
+        }
+    }
+    fclose(f);
+    return ok;
+#else
+    return 0;
+#endif
+}
+
+static void clock_calibrate(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &mono_base);
+    use_tsc = tsc_usable();
+#ifdef TRACE_HAVE_TSC
+    if (use_tsc)
+    {
+        struct timespec pause = {0, 20 * 1000000L};
+        uint64_t n0 = mono_ns();
+        uint64_t t0 = __rdtsc();
+        nanosleep(&pause, NULL);
+        uint64_t n1 = mono_ns();
+        uint64_t t1 = __rdtsc();
+        ns_per_tick = (double)(n1 - n0) / (double)(t1 - t0);
+        tsc_base = t0 - (uint64_t)((double)n0 / ns_per_tick);
+    }
+#endif
+}
+
+int trace_init(double sample, const char *chrome_path)
+{
+    trace_sample = sample;
+    if (sample <= 0.0)
+        return 0;
+
+    clock_calibrate();
+    printf("Tracing %.4g%% of requests (%s clock%s)\n", sample * 100.0,
+           use_tsc ? "TSC" : "CLOCK_MONOTONIC", use_tsc ? "" : ", no invariant TSC");
+
+    if (chrome_path)
+    {
+        export_events = malloc(sizeof(TraceEvent) * TRACE_MAX_EXPORT_EVENTS);
+        if (!export_events)
+        {
+            fprintf(stderr, "trace: cannot allocate export buffer\n");
+            return -1;
+        }
+        chrome_out = chrome_path;
+    }
+    return 0;
+}
+
+static TraceThread *thread_register(void)
+{
+    if (my_thread_failed)
+        return NULL;
+
+    TraceThread *t = NULL;
+    pthread_mutex_lock(&thread_reg_lock);
+    int n = atomic_load(&thread_count);
+    if (n < TRACE_MAX_THREADS)
+        t = calloc(1, sizeof(TraceThread));
+    if (t)
+    {
+        t->tid = n + 1;
+        threads[n] = t;
+        atomic_store(&thread_count, n + 1);
+    }
+    pthread_mutex_unlock(&thread_reg_lock);
+
+    if (!t)
+        my_thread_failed = 1;
+    my_thread = t;
+    return t;
+}
+
+void trace_begin(const char *name)
+{
+    if (trace_sample <= 0.0)
+        return;
+
+    sample_acc += trace_sample;
+    if (sample_acc < 1.0)
+        return;
+    sample_acc -= 1.0;
+
+    if (!my_thread && !thread_register())
+        return;
+
+    req_name = name;
+    req_event_count = 0;
+    req_start = trace_clock_ns();
+    trace_active = 1;
+}
+
+void trace_end_slow(TraceStage stage, uint64_t start)
+{
+    uint64_t now = trace_clock_ns();
+    uint64_t dur = now > start ? now - start : 0;
+
+    hdr_record(&my_thread->hist[stage], dur);
+
+    if (export_events && req_event_count < TRACE_MAX_EVENTS_PER_REQUEST)
+    {
+        TraceEvent *e = &req_events[req_event_count++];
+        e->ts_ns = start;
+        e->dur_ns = dur;
+        e->name = NULL;
+        e->stage = stage;
+        e->tid = my_thread->tid;
+    }
+}
+
+void trace_finish(void)
+{
+    if (!trace_active)
+        return;
+
+    uint64_t now = trace_clock_ns();
+    uint64_t dur = now > req_start ? now - req_start : 0;
+    hdr_record(&my_thread->hist[TRACE_REQUEST], dur);
+    trace_active = 0;
+
+    if (!export_events)
+        return;
+
+    pthread_mutex_lock(&export_lock);
+    if (export_count + req_event_count + 1 <= TRACE_MAX_EXPORT_EVENTS)
+    {
+        TraceEvent *e = &export_events[export_count++];
+        e->ts_ns = req_start;
+        e->dur_ns = dur;
+        e->name = req_name;
+        e->stage = TRACE_REQUEST;
+        e->tid = my_thread->tid;
+        memcpy(&export_events[export_count], req_events, sizeof(TraceEvent) * req_event_count);
+        export_count += req_event_count;
+    }
+    else
+    {
+        atomic_fetch_add(&export_dropped, 1);
+    }
+    pthread_mutex_unlock(&export_lock);
+}
+
+void trace_render(MetricsBuf *b)
+{
+    if (trace_sample <= 0.0)
+        return;
+
+    HdrSnapshot *s = malloc(sizeof(HdrSnapshot));
+    if (!s)
+        return;
+
+    mbuf_printf(b, "# HELP leaderboard_stage_duration_seconds Per-stage latency of traced requests\n");
+    mbuf_printf(b, "# TYPE leaderboard_stage_duration_seconds summary\n");
+    for (int st = 0; st < TRACE_STAGE_COUNT; st++)
+    {
+        hdr_snapshot_clear(s);
+        int n = atomic_load(&thread_count);
+        for (int i = 0; i < n; i++)
+            hdr_snapshot_add(s, &threads[i]->hist[st]);
+
+        static const double q[] = {0.5, 0.9, 0.99, 0.999};
+        for (size_t i = 0; i < sizeof(q) / sizeof(q[0]); i++)
+        {
+            mbuf_printf(b, "leaderboard_stage_duration_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                        stage_names[st], q[i], hdr_percentile(s, q[i] * 100.0) / 1e9);
+        }
+        mbuf_printf(b, "leaderboard_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n", stage_names[st], s->sum / 1e9);
+        mbuf_printf(b, "leaderboard_stage_duration_seconds_count{stage=\"%s\"} %llu\n", stage_names[st],
+                    (unsigned long long)s->total);
+    }
+    free(s);
+}
+
+static void write_chrome_trace(void)
+{
+    FILE *f = fopen(chrome_out, "w");
+    if (!f)
+    {
+        perror("trace: fopen");
+        return;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    pthread_mutex_lock(&export_lock);
+    for (size_t i = 0; i < export_count; i++)
+    {
+        const TraceEvent *e = &export_events[i];
+        fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}\n",
+                i ? "," : "", e->name ? e->name : stage_names[e->stage], stage_names[e->stage],
+                e->ts_ns / 1000.0, e->dur_ns / 1000.0, e->tid);
+    }
+    size_t n = export_count;
+    pthread_mutex_unlock(&export_lock);
+    fprintf(f, "]}\n");
+    fclose(f);
+
+    printf("Wrote %zu trace events to %s", n, chrome_out);
+    if (atomic_load(&export_dropped))
+        printf(" (%llu requests dropped, buffer full)", (unsigned long long)atomic_load(&export_dropped));
+    printf("\n");
+}
+
+void trace_shutdown(void)
+{
+    if (chrome_out && export_events)
+        write_chrome_trace();
+    chrome_out = NULL;
+}
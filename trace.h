@@ -0,0 +1,63 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "metrics.h"
+
+// Per-stage request tracing.
+//
+// A sampled fraction of requests records a timestamp (TSC-based on x86-64,
+// CLOCK_MONOTONIC elsewhere) around each stage below. Durations go into
+// per-thread, per-stage histograms exported through /metrics and can also
+// be written as Chrome trace-event JSON (chrome://tracing, Perfetto).
+// For requests that are not sampled, trace_start() is a thread-local load
+// and a branch.
+
+typedef enum
+{
+    TRACE_REQUEST, // whole handle_request
+    TRACE_CACHE_LOCK_WAIT,
+    TRACE_CACHE_OP, // work done while holding cache_lock
+    TRACE_TOPN_LOCK_WAIT,
+    TRACE_TOPN_OP,
+    TRACE_POOL_WAIT, // pool_get_connection
+    TRACE_DB_EXEC,   // PQexec / PQexecParams round trip
+    TRACE_JSON,      // response body construction
+    TRACE_STAGE_COUNT
+} TraceStage;
+
+#define TRACE_MAX_EVENTS_PER_REQUEST 32
+#define TRACE_MAX_EXPORT_EVENTS (1 << 20)
+
+// sample: fraction of requests to trace (0 disables). chrome_path may be NULL.
+int trace_init(double sample, const char *chrome_path);
+void trace_shutdown(void);
+
+// Nanoseconds on the trace clock
+uint64_t trace_clock_ns(void);
+
+// Start tracing the calling thread's request if it is sampled; name must
+// be a string literal (it is kept until the trace is written)
+void trace_begin(const char *name);
+void trace_finish(void);
+
+extern __thread int trace_active;
+
+// Returns 0 when the current request is not traced
+static inline uint64_t trace_start(void)
+{
+    return trace_active ? trace_clock_ns() : 0;
+}
+
+void trace_end_slow(TraceStage stage, uint64_t start);
+
+static inline void trace_end(TraceStage stage, uint64_t start)
+{
+    if (start)
+        trace_end_slow(stage, start);
+}
+
+// Append per-stage latency summaries to a /metrics response
+void trace_render(MetricsBuf *b);
+
+#endif // TRACE_H
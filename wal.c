@@ -0,0 +1,629 @@
+#include "wal.h"
+#include "crc32.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WAL_SCAN_CHUNK 65536 // records per validation job
+#define WAL_WRITE_RETRIES 3   // attempts per batch before the log is marked failed
+#define WAL_RETRY_MS 10
+
+static char wal_dir[4096];
+static WalDurability wal_level = WAL_DURABILITY_BATCHED;
+static int wal_flush_ms = 5;
+static int seg_fd = -1;
+static off_t seg_good = 0; // end of the last batch fully written (and synced) to seg_fd
+
+static WalRecord *bufs[2];
+static size_t buf_count[2];
+static int active = 0;
+
+static uint64_t next_lsn = 1;
+static uint64_t durable_lsn = 0;
+
+static pthread_mutex_t wal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER; // wakes the flusher
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;  // batch written / space freed / rotated
+static size_t reserved = 0; // slots promised to callers of wal_reserve()
+static int running = 0;
+static int rotate_req = 0;
+static atomic_int wal_failed = 0; // a batch could not be written; nothing after durable_lsn will be
+static pthread_t flusher;
+
+static uint32_t record_crc(const WalRecord *r)
+{
+    return crc32c(crc32c(0, r, offsetof(WalRecord, crc)), &r->ts, sizeof(r->ts));
+}
+
+// Records from before ts existed left that slot 0 and outside the CRC
+static int record_valid(const WalRecord *r)
+{
+    return r->crc == record_crc(r) || (r->ts == 0 && r->crc == crc32c(0, r, offsetof(WalRecord, crc)));
+}
+
+static void segment_path(char *out, size_t len, const char *dir, uint64_t start_lsn)
+{
+    snprintf(out, len, "%s/wal-%016llx.log", dir, (unsigned long long)start_lsn);
+}
+
+static int segment_open(uint64_t start_lsn)
+{
+    char path[4200];
+    segment_path(path, sizeof(path), wal_dir, start_lsn);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+        fprintf(stderr, "wal: cannot open %s: %s\n", path, strerror(errno));
+    return fd;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Write one batch at seg_good and sync it as the level requires. A short
+// write or failed sync is cut back to seg_good and retried, so the segment
+// never holds a partial batch (which would leave an LSN gap behind it).
+static int write_batch(const WalRecord *recs, size_t n)
+{
+    size_t len = n * sizeof(WalRecord);
+    for (int attempt = 0; attempt < WAL_WRITE_RETRIES; attempt++)
+    {
+        if (attempt > 0)
+        {
+            struct timespec ts = {0, WAL_RETRY_MS * 1000000L};
+            nanosleep(&ts, NULL);
+        }
+        if (write_all(seg_fd, recs, len) != 0)
+            fprintf(stderr, "wal: write failed: %s\n", strerror(errno));
+        else if (wal_level != WAL_DURABILITY_NONE && fdatasync(seg_fd) != 0)
+            fprintf(stderr, "wal: fdatasync failed: %s\n", strerror(errno));
+        else
+        {
+            seg_good += len;
+            return 0;
+        }
+        if (ftruncate(seg_fd, seg_good) != 0)
+        {
+            fprintf(stderr, "wal: cannot truncate the failed batch: %s\n", strerror(errno));
+            break;
+        }
+    }
+    return -1;
+}
+
+static void *flush_loop(void *arg)
+{
+    pthread_mutex_lock(&wal_lock);
+    while (1)
+    {
+        while (buf_count[active] == 0 && running && !rotate_req)
+            pthread_cond_wait(&flush_cond, &wal_lock);
+
+        if (!running && buf_count[active] == 0 && !rotate_req)
+            break;
+
+        // Let a batch accumulate unless updates are waiting on us
+        if (wal_level != WAL_DURABILITY_SYNC && running && !rotate_req &&
+            buf_count[active] < WAL_BUFFER_RECORDS / 2)
+        {
+            pthread_mutex_unlock(&wal_lock);
+            struct timespec ts = {wal_flush_ms / 1000, (wal_flush_ms % 1000) * 1000000L};
+            nanosleep(&ts, NULL);
+            pthread_mutex_lock(&wal_lock);
+        }
+
+        int b = active;
+        active ^= 1;
+        size_t n = buf_count[b];
+        uint64_t last = next_lsn - 1;
+        pthread_mutex_unlock(&wal_lock);
+
+        // Once a batch is lost, later ones are dropped too: writing them
+        // would put a gap in the log and recovery stops at the first gap
+        int ok = !atomic_load(&wal_failed);
+        if (ok && n > 0 && write_batch(bufs[b], n) != 0)
+        {
+            fprintf(stderr, "wal: giving up on LSNs %llu..%llu; later updates will fail\n",
+                    (unsigned long long)(last - n + 1), (unsigned long long)last);
+            atomic_store(&wal_failed, 1);
+            ok = 0;
+        }
+
+        pthread_mutex_lock(&wal_lock);
+        buf_count[b] = 0;
+        if (ok)
+            durable_lsn = last;
+
+        if (rotate_req && ok)
+        {
+            // Everything <= last is in the old segment; the new one starts at last + 1
+            int fd = segment_open(last + 1);
+            if (fd >= 0)
+            {
+                if (wal_level != WAL_DURABILITY_NONE)
+                    fdatasync(seg_fd);
+                close(seg_fd);
+                seg_fd = fd;
+                seg_good = 0;
+            }
+        }
+        rotate_req = 0;
+        pthread_cond_broadcast(&done_cond);
+    }
+    pthread_mutex_unlock(&wal_lock);
+
+    if (wal_level != WAL_DURABILITY_NONE)
+        fdatasync(seg_fd);
+    return NULL;
+}
+
+int wal_open(const char *dir, WalDurability level, int flush_ms, uint64_t first_lsn)
+{
+    snprintf(wal_dir, sizeof(wal_dir), "%s", dir);
+    wal_level = level;
+    wal_flush_ms = flush_ms > 0 ? flush_ms : 1;
+    next_lsn = first_lsn;
+    durable_lsn = first_lsn - 1;
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "wal: cannot create %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    bufs[0] = malloc(sizeof(WalRecord) * WAL_BUFFER_RECORDS);
+    bufs[1] = malloc(sizeof(WalRecord) * WAL_BUFFER_RECORDS);
+    if (!bufs[0] || !bufs[1])
+        return -1;
+
+    seg_fd = segment_open(first_lsn);
+    if (seg_fd < 0)
+        return -1;
+    seg_good = lseek(seg_fd, 0, SEEK_END);
+    atomic_store(&wal_failed, 0);
+
+    running = 1;
+    if (pthread_create(&flusher, NULL, flush_loop, NULL) != 0)
+    {
+        running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void wal_close(void)
+{
+    pthread_mutex_lock(&wal_lock);
+    if (!running)
+    {
+        pthread_mutex_unlock(&wal_lock);
+        return;
+    }
+    running = 0;
+    pthread_cond_signal(&flush_cond);
+    pthread_mutex_unlock(&wal_lock);
+
+    pthread_join(flusher, NULL);
+    close(seg_fd);
+    seg_fd = -1;
+}
+
+void wal_reserve(int n)
+{
+    if (n > WAL_BUFFER_RECORDS)
+        n = WAL_BUFFER_RECORDS;
+    pthread_mutex_lock(&wal_lock);
+    while (buf_count[active] + reserved + n > WAL_BUFFER_RECORDS && running)
+    {
+        pthread_cond_signal(&flush_cond);
+        pthread_cond_wait(&done_cond, &wal_lock);
+    }
+    reserved += n;
+    pthread_mutex_unlock(&wal_lock);
+}
+
+void wal_unreserve(int n)
+{
+    pthread_mutex_lock(&wal_lock);
+    reserved -= (size_t)n < reserved ? (size_t)n : reserved;
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&wal_lock);
+}
+
+uint64_t wal_append(int id, int score)
+{
+    pthread_mutex_lock(&wal_lock);
+    if (reserved > 0)
+        reserved--;
+    else
+    {
+        while (buf_count[active] >= WAL_BUFFER_RECORDS && running)
+        {
+            pthread_cond_signal(&flush_cond);
+            pthread_cond_wait(&done_cond, &wal_lock);
+        }
+    }
+    if (buf_count[active] >= WAL_BUFFER_RECORDS)
+    {
+        // Only possible once wal_close() has stopped the flusher
+        pthread_mutex_unlock(&wal_lock);
+        return 0;
+    }
+
+    WalRecord *r = &bufs[active][buf_count[active]++];
+    r->lsn = next_lsn++;
+    r->id = id;
+    r->score = score;
+    r->ts = (uint32_t)time(NULL);
+    r->crc = record_crc(r);
+    uint64_t lsn = r->lsn;
+
+    if (buf_count[active] == 1 || wal_level == WAL_DURABILITY_SYNC)
+        pthread_cond_signal(&flush_cond);
+    pthread_mutex_unlock(&wal_lock);
+    return lsn;
+}
+
+int wal_wait(uint64_t lsn)
+{
+    if (wal_level != WAL_DURABILITY_SYNC && !atomic_load(&wal_failed))
+        return 0;
+
+    pthread_mutex_lock(&wal_lock);
+    while (durable_lsn < lsn && running && !atomic_load(&wal_failed))
+        pthread_cond_wait(&done_cond, &wal_lock);
+    int rc = durable_lsn < lsn && atomic_load(&wal_failed) ? -1 : 0;
+    pthread_mutex_unlock(&wal_lock);
+    return rc;
+}
+
+uint64_t wal_last_lsn(void)
+{
+    pthread_mutex_lock(&wal_lock);
+    uint64_t lsn = next_lsn - 1;
+    pthread_mutex_unlock(&wal_lock);
+    return lsn;
+}
+
+int wal_rotate(void)
+{
+    pthread_mutex_lock(&wal_lock);
+    if (!running)
+    {
+        pthread_mutex_unlock(&wal_lock);
+        return -1;
+    }
+    rotate_req = 1;
+    pthread_cond_signal(&flush_cond);
+    while (rotate_req && running)
+        pthread_cond_wait(&done_cond, &wal_lock);
+    pthread_mutex_unlock(&wal_lock);
+    return 0;
+}
+
+static int seg_cmp(const void *a, const void *b)
+{
+    uint64_t x = ((const WalSegment *)a)->start_lsn, y = ((const WalSegment *)b)->start_lsn;
+    return (x > y) - (x < y);
+}
+
+// Segment start LSNs in dir, sorted; caller frees *out
+static int list_segments(const char *dir, WalSegment **out)
+{
+    *out = NULL;
+    DIR *d = opendir(dir);
+    if (!d)
+        return 0;
+
+    int n = 0, cap = 0;
+    WalSegment *segs = NULL;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL)
+    {
+        unsigned long long start;
+        char tail[8];
+        if (sscanf(de->d_name, "wal-%16llx.%4s", &start, tail) != 2 || strcmp(tail, "log") != 0)
+            continue;
+        if (n == cap)
+        {
+            cap = cap ? cap * 2 : 16;
+            WalSegment *p = realloc(segs, sizeof(WalSegment) * cap);
+            if (!p)
+                break;
+            segs = p;
+        }
+        memset(&segs[n], 0, sizeof(WalSegment));
+        segs[n++].start_lsn = start;
+    }
+    closedir(d);
+
+    if (n > 1)
+        qsort(segs, n, sizeof(WalSegment), seg_cmp);
+    *out = segs;
+    return n;
+}
+
+void wal_truncate_upto(uint64_t lsn)
+{
+    WalSegment *segs;
+    int n = list_segments(wal_dir, &segs);
+
+    // A segment is covered once the one after it starts at or before lsn + 1
+    for (int i = 0; i + 1 < n; i++)
+    {
+        if (segs[i + 1].start_lsn <= lsn + 1)
+        {
+            char path[4200];
+            segment_path(path, sizeof(path), wal_dir, segs[i].start_lsn);
+            unlink(path);
+        }
+    }
+    free(segs);
+}
+
+// ---- Recovery ----
+
+// Move a segment out of the way without deleting it; list_segments()
+// ignores the new name
+static void segment_set_aside(const char *dir, uint64_t start_lsn)
+{
+    char path[4200], aside[4300];
+    segment_path(path, sizeof(path), dir, start_lsn);
+    snprintf(aside, sizeof(aside), "%s.orphan", path);
+    if (rename(path, aside) != 0)
+        fprintf(stderr, "wal: cannot set aside %s: %s\n", path, strerror(errno));
+    else
+        fprintf(stderr, "wal: set aside %s\n", path);
+}
+
+int wal_trim_tail(const char *dir, uint64_t valid_lsn, uint64_t next_lsn)
+{
+    WalSegment *segs;
+    int n = list_segments(dir, &segs);
+    int rc = 0;
+
+    for (int i = n - 1; i >= 0; i--)
+    {
+        uint64_t start = segs[i].start_lsn;
+        if (start >= next_lsn || valid_lsn + 1 != next_lsn)
+        {
+            // Past the valid end, or the caller's state (a snapshot) is ahead
+            // of the log and already covers everything in it
+            segment_set_aside(dir, start);
+            continue;
+        }
+
+        // The segment holding valid_lsn: cut off torn or unvalidated bytes
+        // so the records appended next follow it without a hole
+        char path[4200];
+        segment_path(path, sizeof(path), dir, start);
+        off_t keep = (off_t)((next_lsn - start) * sizeof(WalRecord));
+        struct stat st;
+        if (stat(path, &st) == 0 && st.st_size > keep && truncate(path, keep) != 0)
+        {
+            fprintf(stderr, "wal: cannot truncate %s: %s\n", path, strerror(errno));
+            rc = -1;
+        }
+        break;
+    }
+    free(segs);
+    return rc;
+}
+
+typedef struct
+{
+    int seg;
+    size_t from, to;
+    size_t first_bad; // == to if the whole chunk is valid
+} ScanJob;
+
+typedef struct
+{
+    WalSegment *segs;
+    ScanJob *jobs;
+    int njobs;
+    atomic_int next;
+} ScanCtx;
+
+static void *scan_worker(void *arg)
+{
+    ScanCtx *ctx = arg;
+    int j;
+    while ((j = atomic_fetch_add(&ctx->next, 1)) < ctx->njobs)
+    {
+        ScanJob *job = &ctx->jobs[j];
+        const WalSegment *s = &ctx->segs[job->seg];
+        job->first_bad = job->to;
+        for (size_t i = job->from; i < job->to; i++)
+        {
+            const WalRecord *r = &s->recs[i];
+            if (r->lsn != s->start_lsn + i || !record_valid(r))
+            {
+                job->first_bad = i;
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+int wal_scan(const char *dir, int threads, WalScan *out)
+{
+    memset(out, 0, sizeof(*out));
+    WalSegment *segs;
+    int n = list_segments(dir, &segs);
+    if (n == 0)
+        return 0;
+
+    int njobs = 0;
+    for (int i = 0; i < n; i++)
+    {
+        char path[4200];
+        segment_path(path, sizeof(path), dir, segs[i].start_lsn);
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            if (fd >= 0)
+                close(fd);
+            continue;
+        }
+        size_t count = (size_t)st.st_size / sizeof(WalRecord);
+        if (count > 0)
+        {
+            void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            if (map != MAP_FAILED)
+            {
+                segs[i].map = map;
+                segs[i].map_len = st.st_size;
+                segs[i].recs = map;
+                segs[i].count = count;
+                njobs += (count + WAL_SCAN_CHUNK - 1) / WAL_SCAN_CHUNK;
+            }
+        }
+        close(fd);
+    }
+
+    ScanCtx ctx = {segs, calloc(njobs ? njobs : 1, sizeof(ScanJob)), njobs, 0};
+    if (!ctx.jobs)
+    {
+        out->segs = segs;
+        out->nsegs = n;
+        wal_scan_free(out);
+        return -1;
+    }
+    int j = 0;
+    for (int i = 0; i < n; i++)
+    {
+        for (size_t from = 0; from < segs[i].count; from += WAL_SCAN_CHUNK)
+        {
+            ctx.jobs[j].seg = i;
+            ctx.jobs[j].from = from;
+            ctx.jobs[j].to = from + WAL_SCAN_CHUNK < segs[i].count ? from + WAL_SCAN_CHUNK : segs[i].count;
+            j++;
+        }
+    }
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > njobs)
+        threads = njobs ? njobs : 1;
+    pthread_t tids[threads];
+    int started = 0;
+    for (int t = 1; t < threads; t++)
+        if (pthread_create(&tids[t], NULL, scan_worker, &ctx) == 0)
+            started++;
+    scan_worker(&ctx);
+    for (int t = 1; t <= started; t++)
+        pthread_join(tids[t], NULL);
+
+    // Each segment is valid up to its first bad record
+    for (j = 0; j < njobs; j++)
+    {
+        WalSegment *s = &segs[ctx.jobs[j].seg];
+        if (ctx.jobs[j].first_bad < ctx.jobs[j].to && ctx.jobs[j].first_bad < s->count)
+            s->count = ctx.jobs[j].first_bad;
+    }
+    free(ctx.jobs);
+
+    // Stop at the first LSN gap; anything after a hole cannot be trusted
+    uint64_t last = 0;
+    int valid = n;
+    for (int i = 0; i < n; i++)
+    {
+        if (i > 0 && segs[i].start_lsn != last + 1)
+        {
+            fprintf(stderr, "wal: gap before segment starting at lsn %llu, ignoring it and later segments\n",
+                    (unsigned long long)segs[i].start_lsn);
+            valid = i;
+            break;
+        }
+        if (segs[i].count > 0)
+            last = segs[i].start_lsn + segs[i].count - 1;
+        else
+            last = segs[i].start_lsn - 1;
+    }
+
+    out->segs = segs;
+    out->nsegs = n;
+    out->last_lsn = last;
+    for (int i = valid; i < n; i++)
+        segs[i].count = 0;
+    return 0;
+}
+
+size_t wal_scan_replay(const WalScan *scan, uint64_t after_lsn, WalReplayFn fn, void *arg)
+{
+    size_t replayed = 0;
+    for (int i = 0; i < scan->nsegs; i++)
+    {
+        const WalSegment *s = &scan->segs[i];
+        for (size_t k = 0; k < s->count; k++)
+        {
+            if (s->recs[k].lsn <= after_lsn)
+                continue;
+            fn(&s->recs[k], arg);
+            replayed++;
+        }
+    }
+    return replayed;
+}
+
+void wal_scan_free(WalScan *scan)
+{
+    for (int i = 0; i < scan->nsegs; i++)
+        if (scan->segs[i].map)
+            munmap(scan->segs[i].map, scan->segs[i].map_len);
+    free(scan->segs);
+    memset(scan, 0, sizeof(*scan));
+}
+
+WalDurability wal_parse_durability(const char *s, int *ok)
+{
+    *ok = 1;
+    if (strcmp(s, "none") == 0)
+        return WAL_DURABILITY_NONE;
+    if (strcmp(s, "batched") == 0)
+        return WAL_DURABILITY_BATCHED;
+    if (strcmp(s, "sync") == 0 || strcmp(s, "per-write") == 0)
+        return WAL_DURABILITY_SYNC;
+    *ok = 0;
+    return WAL_DURABILITY_BATCHED;
+}
+
+const char *wal_durability_name(WalDurability d)
+{
+    switch (d)
+    {
+    case WAL_DURABILITY_NONE:
+        return "none";
+    case WAL_DURABILITY_BATCHED:
+        return "batched";
+    default:
+        return "sync";
+    }
+}
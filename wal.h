@@ -0,0 +1,102 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Append-only write-ahead log of score updates (used by cache-only mode 1).
+//
+// Appenders copy fixed-size records into an in-memory buffer under a
+// short mutex; one flusher thread swaps buffers and writes each batch
+// with a single write() (plus fdatasync(), depending on durability), so
+// concurrent updates share one sync (group commit).
+//
+// The log is split into segment files named wal-<first lsn>.log. A new
+// segment is started whenever a snapshot is taken, and segments entirely
+// covered by a snapshot are deleted.
+
+typedef enum
+{
+    WAL_DURABILITY_NONE,    // written by the flusher, never fsynced (survives process crash only)
+    WAL_DURABILITY_BATCHED, // fsynced every flush interval; updates do not wait
+    WAL_DURABILITY_SYNC,    // each update waits until its record is fsynced
+} WalDurability;
+
+typedef struct
+{
+    uint64_t lsn;
+    int32_t id;
+    int32_t score;
+    uint32_t crc; // CRC-32C of the other fields: lsn, id, score, then ts
+    uint32_t ts;  // when the update was applied, seconds since the epoch (0 in older logs)
+} WalRecord;
+
+#define WAL_BUFFER_RECORDS 65536
+
+int wal_open(const char *dir, WalDurability level, int flush_ms, uint64_t next_lsn);
+void wal_close(void);
+
+// Wait until the active buffer has room for n more records (at most
+// WAL_BUFFER_RECORDS) and hold that room for the caller. Call it before
+// taking cache_lock; each wal_append() then uses one held slot and never
+// blocks. Slots that end up unused go back with wal_unreserve().
+void wal_reserve(int n);
+void wal_unreserve(int n);
+
+// Append one update; returns its LSN. Cheap enough to call under a cache
+// lock once the slot was reserved.
+uint64_t wal_append(int id, int score);
+
+// Block until lsn is as durable as the configured level promises. Returns
+// -1 if the record will never reach the log: a batch that still failed
+// after retries is cut from the segment, durable_lsn stays before it, and
+// every later record is refused the same way (the log stays gap-free).
+int wal_wait(uint64_t lsn);
+
+uint64_t wal_last_lsn(void);
+
+// Flush and start a new segment; blocks until the flusher has switched
+int wal_rotate(void);
+
+// Delete segments whose records are all <= lsn
+void wal_truncate_upto(uint64_t lsn);
+
+// ---- Recovery ----
+
+typedef struct
+{
+    uint64_t start_lsn;
+    const WalRecord *recs;
+    size_t count; // records that passed validation
+    void *map;
+    size_t map_len;
+} WalSegment;
+
+typedef struct
+{
+    WalSegment *segs;
+    int nsegs;
+    uint64_t last_lsn; // last valid, contiguous LSN (0 if none)
+} WalScan;
+
+// Map every segment in dir and validate records with up to `threads`
+// worker threads. Stops at the first torn/invalid record or LSN gap.
+int wal_scan(const char *dir, int threads, WalScan *out);
+
+// Make the log end at valid_lsn before wal_open(dir, ..., next_lsn):
+// truncate the segment holding valid_lsn after its last valid record and
+// rename later segments to *.orphan. If valid_lsn + 1 != next_lsn (the
+// caller restored a snapshot past the log), every segment is set aside.
+int wal_trim_tail(const char *dir, uint64_t valid_lsn, uint64_t next_lsn);
+
+typedef void (*WalReplayFn)(const WalRecord *rec, void *arg);
+
+// Call fn, in LSN order, for every valid record with lsn > after_lsn.
+// Returns the number of records replayed.
+size_t wal_scan_replay(const WalScan *scan, uint64_t after_lsn, WalReplayFn fn, void *arg);
+void wal_scan_free(WalScan *scan);
+
+WalDurability wal_parse_durability(const char *s, int *ok);
+const char *wal_durability_name(WalDurability d);
+
+#endif // WAL_H
@@ -0,0 +1,194 @@
+#include "workload.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// ---------- Random numbers and keys ----------
+
+void zipf_init(Zipf *z, long long keys, double theta)
+{
+    z->keys = keys;
+    z->theta = theta;
+    z->zetan = 0;
+    for (long long i = 1; i <= keys; i++)
+        z->zetan += 1.0 / pow((double)i, theta);
+    z->zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / keys, 1.0 - theta)) / (1.0 - z->zeta2 / z->zetan);
+}
+
+long long zipf_rank(const Zipf *z, uint64_t *rng)
+{
+    double u = rng_double(rng);
+    double uz = u * z->zetan;
+    if (uz < 1.0)
+        return 0;
+    if (uz < z->zeta2)
+        return 1;
+    long long r = (long long)(z->keys * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return r < z->keys ? r : z->keys - 1;
+}
+
+void workload_make_keys(int *out, int n, KeyDist dist, const Zipf *z, uint64_t seed)
+{
+    uint64_t s = seed | 1;
+    for (int i = 0; i < n; i++)
+    {
+        if (dist == KEYS_ZIPFIAN)
+            out[i] = (int)zipf_rank(z, &s) + 1;
+        else
+            out[i] = (int)(rng_next(&s) % z->keys) + 1;
+    }
+}
+
+// ---------- Worker pool ----------
+
+typedef struct
+{
+    WorkloadPool *pool;
+    int index;
+} PoolThread;
+
+static void *pool_thread(void *arg)
+{
+    PoolThread t = *(PoolThread *)arg;
+    free(arg);
+    WorkloadPool *p = t.pool;
+    if (p->thread_init)
+        p->thread_init();
+
+    for (;;)
+    {
+        pthread_barrier_wait(&p->start_barrier);
+        if (atomic_load(&p->quit))
+            break;
+        p->run(p->workers + (size_t)t.index * p->worker_size, t.index);
+        pthread_barrier_wait(&p->end_barrier);
+    }
+    return NULL;
+}
+
+int workload_pool_start(WorkloadPool *p, int nthreads, void *workers, size_t worker_size, WorkloadRunFn run,
+                        void (*thread_init)(void))
+{
+    memset(p, 0, sizeof(*p));
+    p->tids = calloc(nthreads, sizeof(pthread_t));
+    if (!p->tids)
+        return -1;
+    p->workers = workers;
+    p->worker_size = worker_size;
+    p->run = run;
+    p->thread_init = thread_init;
+    pthread_barrier_init(&p->start_barrier, NULL, nthreads + 1);
+    pthread_barrier_init(&p->end_barrier, NULL, nthreads + 1);
+
+    for (int i = 0; i < nthreads; i++)
+    {
+        PoolThread *t = malloc(sizeof(*t));
+        if (!t)
+            return -1;
+        t->pool = p;
+        t->index = i;
+        if (pthread_create(&p->tids[i], NULL, pool_thread, t) != 0)
+        {
+            free(t);
+            return -1;
+        }
+        p->nthreads++;
+    }
+    return 0;
+}
+
+static long long mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long workload_pool_round(WorkloadPool *p, int run_ms)
+{
+    atomic_store(&p->stop, 0);
+    // Start the clock before releasing the workers: on few CPUs they can
+    // finish a fixed number of requests before this thread runs again
+    long long t0 = mono_ns();
+    pthread_barrier_wait(&p->start_barrier);
+    if (run_ms > 0)
+    {
+        struct timespec d = {run_ms / 1000, (run_ms % 1000) * 1000000L};
+        nanosleep(&d, NULL);
+        atomic_store(&p->stop, 1);
+    }
+    pthread_barrier_wait(&p->end_barrier);
+    return mono_ns() - t0;
+}
+
+void workload_pool_stop(WorkloadPool *p)
+{
+    atomic_store(&p->quit, 1);
+    pthread_barrier_wait(&p->start_barrier);
+    for (int i = 0; i < p->nthreads; i++)
+        pthread_join(p->tids[i], NULL);
+    pthread_barrier_destroy(&p->start_barrier);
+    pthread_barrier_destroy(&p->end_barrier);
+    free(p->tids);
+    p->tids = NULL;
+}
+
+// ---------- Command line and results ----------
+
+int workload_parse_opt(WorkloadOpts *o, int opt, const char *arg)
+{
+    switch (opt)
+    {
+    case 'k':
+        o->keys = atoll(arg);
+        return 1;
+    case 'z':
+        o->theta = atof(arg);
+        return 1;
+    case 'o':
+        o->out_path = arg;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int workload_opts_valid(const WorkloadOpts *o)
+{
+    return o->keys >= 2 && o->theta > 0 && o->theta < 1;
+}
+
+FILE *workload_out_open(const WorkloadOpts *o)
+{
+    if (!o->out_path)
+        return stdout;
+    FILE *f = fopen(o->out_path, "w");
+    if (!f)
+        perror("fopen");
+    return f;
+}
+
+void workload_out_close(FILE *f, const WorkloadOpts *o)
+{
+    if (f == stdout)
+        return;
+    fclose(f);
+    fprintf(stderr, "Results written to %s\n", o->out_path);
+}
+
+void workload_json_begin(FILE *f, const WorkloadOpts *o)
+{
+    time_t now = time(NULL);
+    struct tm tm;
+    char ts[32];
+    gmtime_r(&now, &tm);
+    strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    fprintf(f, "{\n  \"timestamp\": \"%s\",\n  \"cpus\": %ld,\n  \"keys\": %lld,\n  \"skew\": %g,\n", ts,
+            sysconf(_SC_NPROCESSORS_ONLN), o->keys, o->theta);
+}
@@ -0,0 +1,132 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Pieces shared by the load tools: the random number and key generators
+// (microbench, harness, loadgen), and the worker pool, command line and
+// JSON result header of the in-process benchmarks (microbench, harness).
+
+#define KEY_STREAM (1 << 16) // keys per worker stream, power of two
+
+// ---------- Random numbers and keys ----------
+
+// xorshift64*; the state must not be 0
+static inline uint64_t rng_next(uint64_t *s)
+{
+    uint64_t x = *s;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *s = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+// Uniform in (0, 1)
+static inline double rng_double(uint64_t *s)
+{
+    return ((rng_next(s) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+// Zipfian ranks (Gray et al., as in YCSB); rank 0 is the hottest
+typedef struct
+{
+    long long keys;
+    double theta;
+    double zetan, zeta2, alpha, eta;
+} Zipf;
+
+// O(keys): computes zeta(keys, theta)
+void zipf_init(Zipf *z, long long keys, double theta);
+
+// Rank in [0, keys)
+long long zipf_rank(const Zipf *z, uint64_t *rng);
+
+typedef enum
+{
+    KEYS_UNIFORM,
+    KEYS_ZIPFIAN,
+} KeyDist;
+
+// Fill out[] with ids in [1, z->keys]; zipfian makes id 1 the hottest.
+// Uniform streams only use z->keys.
+void workload_make_keys(int *out, int n, KeyDist dist, const Zipf *z, uint64_t seed);
+
+// Where worker `index` starts reading its stream, so threads that share
+// keys do not walk them in lockstep
+static inline unsigned workload_stream_start(int index)
+{
+    return (unsigned)index * 7919;
+}
+
+// ---------- Worker pool ----------
+//
+// Workers live for the whole run (so per-thread state such as metrics
+// blocks is set up once, by thread_init) and meet at a barrier before and
+// after every round.
+
+typedef void (*WorkloadRunFn)(void *worker, int index);
+
+typedef struct
+{
+    int nthreads;
+    pthread_t *tids;
+    char *workers;
+    size_t worker_size;
+    WorkloadRunFn run;
+    void (*thread_init)(void);
+    pthread_barrier_t start_barrier, end_barrier;
+    atomic_int stop;
+    atomic_int quit;
+} WorkloadPool;
+
+// Start nthreads threads; thread i calls run(workers + i * worker_size, i)
+// once per round. thread_init (may be NULL) runs first on each thread.
+int workload_pool_start(WorkloadPool *p, int nthreads, void *workers, size_t worker_size, WorkloadRunFn run,
+                        void (*thread_init)(void));
+
+// Run one round. With run_ms > 0 the stop flag is raised after that long;
+// otherwise the round ends when every run() has returned on its own.
+// Returns the round's wall time in ns.
+long long workload_pool_round(WorkloadPool *p, int run_ms);
+
+static inline int workload_pool_stopping(WorkloadPool *p)
+{
+    return atomic_load_explicit(&p->stop, memory_order_relaxed);
+}
+
+// End the last round and join the threads
+void workload_pool_stop(WorkloadPool *p);
+
+// ---------- Command line and results ----------
+
+typedef struct
+{
+    long long keys;
+    double theta;
+    const char *out_path; // NULL = stdout
+} WorkloadOpts;
+
+// getopt_long entries handled by workload_parse_opt()
+#define WORKLOAD_LONG_OPTS                                                                                             \
+    {"keys", required_argument, NULL, 'k'}, {"skew", required_argument, NULL, 'z'},                                    \
+        {"out", required_argument, NULL, 'o'}, {"help", no_argument, NULL, 'h'}
+
+// Apply one of WORKLOAD_LONG_OPTS; returns 0 if opt is not one of them
+int workload_parse_opt(WorkloadOpts *o, int opt, const char *arg);
+
+// keys >= 2 and 0 < theta < 1
+int workload_opts_valid(const WorkloadOpts *o);
+
+// Open o->out_path for the results (stdout if unset); NULL on error
+FILE *workload_out_open(const WorkloadOpts *o);
+void workload_out_close(FILE *f, const WorkloadOpts *o);
+
+// Start the result object with its timestamp, CPU count, keys and skew;
+// the caller adds its own fields and the "results" array
+void workload_json_begin(FILE *f, const WorkloadOpts *o);
+
+#endif // WORKLOAD_H